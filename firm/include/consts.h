@@ -8,6 +8,14 @@
 #define META_CACHE_PREFIX FS_MOUNT_POINT "/cddb"
 #endif
 
+#ifndef PROGRAM_PREFIX
+#define PROGRAM_PREFIX FS_MOUNT_POINT "/prog"
+#endif
+
+#ifndef RESUME_LOG_PATH
+#define RESUME_LOG_PATH FS_MOUNT_POINT "/resume.log"
+#endif
+
 #ifndef FONT_DIR_PREFIX
 #define FONT_DIR_PREFIX FS_MOUNT_POINT "/font"
 #endif
@@ -226,6 +226,12 @@ private:
     void switch_to_req_mode_locked() {
         if(req_mode == cur_mode) return;
 
+        if(req_mode == ESPER_MODE_CD) {
+            // get the drive spinning while the old mode shuts down, so the CD mode has less to wait for
+            auto cd = resources.cdrom;
+            cd->submit(ATAPI::Device::Priority::BACKGROUND, [cd]() { cd->start(true); });
+        }
+
         end_current_mode_locked();
 
         switch(req_mode) {
@@ -21,6 +21,7 @@ private:
     CDPView * rootView;
     CD::Player player;
     CD::CachingMetadataAggregateProvider meta;
+    CD::ProgramStore programs;
     
     Button stopEject;
     Button playPause;
@@ -34,6 +35,17 @@ private:
     bool seek_from_button = false;
     bool lyrics_enabled = true;
     void update_title(const std::shared_ptr<CD::Album> disc, const CD::Track& metadata, const CD::Player::TrackNo trk);
+    void update_view();
+    /// @brief Bring the lyrics and the scrobbler up to the playback position, every loop rather than at the redraw rate
+    void feed_lyrics();
+
+    CD::PlayerEvents::Subscription player_events = CD::PlayerEvents::NO_SUBSCRIPTION;
+    EventBits_t pending_changes = 0;
+    /// @brief Something other than the player changed what's to be shown, e.g. a key was pressed
+    bool view_stale = true;
+    TickType_t last_view_update = 0;
+    /// @brief How often the time is redrawn while playing
+    TickType_t view_tick_interval = pdMS_TO_TICKS(100);
 
     void prev_trk_button();
     void next_trk_button();
@@ -42,4 +54,13 @@ private:
     TickType_t last_digit_time = 0;
     int entered_digits = 0;
     void commit_entered_digits();
+
+    /// @brief Disc whose program was last loaded
+    std::shared_ptr<CD::Album> program_disc = nullptr;
+    bool editing_program = false;
+    bool program_icon_shown = false;
+    std::vector<uint8_t> edited_program = {};
+    void load_program(const std::shared_ptr<CD::Album> disc);
+    void finish_program();
+    void toggle_play_mode();
 };
\ No newline at end of file
@@ -6,16 +6,20 @@
 namespace ATAPI {
     const uint8_t TRK_NUM_LEAD_OUT = 0xAA;
     enum Command: uint8_t {
+        DEVICE_RESET = 0x08,
         EXECUTE_DEVICE_DIAGNOSTIC = 0x90,
         WRITE_PACKET = 0xA0,
-        IDENTIFY_PACKET_DEVICE = 0xA1
+        IDENTIFY_PACKET_DEVICE = 0xA1,
+        STANDBY_IMMEDIATE = 0xE0
     };
     
     enum OperationCodes: uint8_t{
         TEST_UNIT_READY = 0x00,
         REQUEST_SENSE = 0x03,
+        INQUIRY = 0x12,
         START_STOP_UNIT = 0x1B,
         PREVENT_ALLOW_MEDIA_REMOVAL = 0x1E,
+        SEEK = 0x2B,
         READ_SUBCHANNEL = 0x42,
         READ_TOC_PMA_ATIP = 0x43,
         PLAY_AUDIO_MSF = 0x47,
@@ -66,12 +70,29 @@ namespace ATAPI {
     };
 
     enum RequestSenseKey: uint8_t {
-        SENSE_NOT_READY = 0x06
+        SENSE_NO_SENSE = 0x00,
+        SENSE_RECOVERED_ERROR = 0x01,
+        SENSE_NOT_READY = 0x02,
+        SENSE_MEDIUM_ERROR = 0x03,
+        SENSE_HARDWARE_ERROR = 0x04,
+        SENSE_ILLEGAL_REQUEST = 0x05,
+        SENSE_UNIT_ATTENTION = 0x06,
+        SENSE_ABORTED_COMMAND = 0x0B
         // YAGNI
     };
 
     enum RequestSenseAsc: uint8_t {
-        ASC_DEVICE_NOT_READY = 0x29
+        ASC_NONE = 0x00,
+        /// @brief With ASCQ 0x01 the drive is becoming ready, with others it needs to be told to start
+        ASC_NOT_READY = 0x04,
+        ASC_UNRECOVERED_READ_ERROR = 0x11,
+        ASC_INVALID_OPCODE = 0x20,
+        ASC_LBA_OUT_OF_RANGE = 0x21,
+        ASC_INVALID_FIELD_IN_PACKET = 0x24,
+        ASC_MEDIUM_CHANGED = 0x28,
+        ASC_POWER_ON_RESET = 0x29,
+        ASC_NO_MEDIUM = 0x3A,
+        ASC_ILLEGAL_MODE_FOR_TRACK = 0x64
         // YAGNI
     };
 
@@ -133,6 +154,53 @@ namespace ATAPI {
             ReqPktFooter footer;
         };
 
+        struct ATAPI_PKT ReadCD {
+            enum SectorType: uint8_t {
+                SECTOR_ANY = 0,
+                SECTOR_CDDA = 1
+            };
+
+            enum ErrorField: uint8_t {
+                ERRF_NONE = 0,
+                /// @brief 294 bytes of C2 error bits, one per byte of the sector
+                ERRF_C2 = 1,
+                /// @brief Same as `ERRF_C2`, plus a block error byte and a pad byte
+                ERRF_C2_AND_BLOCK = 2
+            };
+
+            enum SubchannelSelect: uint8_t {
+                SUBCH_NONE = 0,
+                SUBCH_RAW_PW = 1,
+                /// @brief 16 bytes of formatted Q subchannel
+                SUBCH_Q = 2,
+                SUBCH_RW = 4
+            };
+
+            uint8_t opcode;
+
+            bool reladr: 1;
+            bool reserved0: 1;
+            SectorType expected_sector_type: 3;
+            uint8_t lun: 3;
+
+            /// @brief Big endian
+            uint32_t lba;
+            /// @brief Big endian, 24-bit
+            uint8_t transfer_length[3];
+
+            bool reserved1: 1;
+            ErrorField error_field: 2;
+            bool edc_ecc: 1;
+            bool user_data: 1;
+            uint8_t header_codes: 2;
+            bool sync: 1;
+
+            SubchannelSelect subchannel: 3;
+            uint8_t reserved2: 5;
+
+            ReqPktFooter footer;
+        };
+
         struct ATAPI_PKT PauseResume {
             uint8_t opcode;
 
@@ -147,6 +215,18 @@ namespace ATAPI {
             ReqPktFooter footer;
         };
 
+        struct ATAPI_PKT Seek {
+            uint8_t opcode;
+
+            uint8_t reserved: 5;
+            uint8_t lun: 3;
+
+            /// @brief Big endian
+            uint32_t lba;
+            uint8_t reserved1[3];
+            ReqPktFooter footer;
+        };
+
         struct ATAPI_PKT StopPlayScan {
             uint8_t opcode;
 
@@ -246,6 +326,17 @@ namespace ATAPI {
             ReqPktFooter footer;
         };
 
+        struct ATAPI_PKT Inquiry {
+            uint8_t opcode;
+            bool evpd: 1;
+            uint8_t reserved0: 4;
+            uint8_t lun: 3;
+            uint8_t page_code;
+            uint8_t reserved1;
+            uint8_t allocation_length;
+            ReqPktFooter footer;
+        };
+
         struct ATAPI_PKT RequestSense {
             uint8_t opcode;
             uint8_t reserved0: 5;
@@ -406,9 +497,12 @@ namespace ATAPI {
                     SubchannelAdr adr: 4;
                     uint8_t track_no;
                     uint8_t reserved0;
-                    char isrc[13];
+                    uint8_t reserved1: 7;
+                    bool tc_val: 1;
+                    char isrc[12];
+                    uint8_t zero;
                     uint8_t aframe;
-                    uint8_t reserved1;
+                    uint8_t reserved2;
                 } isrc_data;
             };
         };
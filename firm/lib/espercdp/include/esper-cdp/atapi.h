@@ -1,7 +1,14 @@
 #pragma once
 #include <esper-core/ide.h>
 #include "types.h"
+#include "wait_profile.h"
+#include "recovery.h"
 #include <vector>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
 namespace ATAPI {
     class Device {
     public:
@@ -21,19 +28,101 @@ namespace ATAPI {
             uint16_t alternate_max_speed;
         };
 
+        /// @brief Delays of the PIO protocol, in microseconds
+        struct PioTimings {
+            /// @brief Before starting to send a packet
+            uint16_t pre_packet_us;
+            /// @brief Between disabling interrupts and issuing the PACKET command
+            uint16_t pre_command_us;
+            /// @brief After the packet, on drives with `busy_ass`
+            uint16_t post_packet_us;
+            /// @brief Between the data words, on drives with `busy_ass`
+            uint16_t word_gap_us;
+        };
+
+        /// @brief Timings that are known to work with the slowest drives around
+        static constexpr PioTimings DEFAULT_PIO_TIMINGS = {
+            .pre_packet_us = 100,
+            .pre_command_us = 100,
+            .post_packet_us = 7000,
+            .word_gap_us = 33
+        };
+
+        /// @brief Counters for one kind of packet command
+        struct CommandStats {
+            uint8_t opcode;
+            /// @brief Time from sending the packet until the whole response was read out
+            WaitHistogram latency;
+            uint64_t bytes_in;
+            /// @brief How many times the response had more data than was asked for and the rest had to be thrown away
+            uint32_t flushes;
+            uint32_t flushed_bytes;
+            /// @brief How many times the drive sent less data than was asked for
+            uint32_t underruns;
+            uint32_t retries;
+            /// @brief How many times the drive raised ERR after the packet
+            uint32_t errors;
+        };
+
+        static const int MAX_TRACKED_OPCODES = 24;
+
         struct Diags {
             bool is_atapi;
             uint16_t self_test_result;
             CapabilitiesMechStatusModePage capas;
             ModeSenseCDAControlModePage cda;
+            /// @brief Per-opcode statistics, in order of first use. Entries never move once added.
+            CommandStats commands[MAX_TRACKED_OPCODES];
+            int command_count;
+        };
+
+        enum class Priority {
+            /// @brief Next step of background work that took the drive away from where the user left it, e.g. the inventory having loaded another disc.
+            /// Goes even before the user's commands, as those expect the drive to be the way they left it.
+            FOLLOW_UP,
+            /// @brief Commands caused by the user, e.g. PLAY or NEXT TRACK
+            USER,
+            /// @brief Periodic status polling and whatever else can wait
+            BACKGROUND
+        };
+
+        /// @brief A command the drive could not be brought to do within the latency ceiling
+        struct ErrorEvent {
+            uint8_t opcode;
+            SenseData sense;
+            /// @brief What the recovery table said to do about the sense at the end, `GIVE_UP` if the drive stopped answering altogether
+            RecoveryAction action;
+            uint32_t elapsed_ms;
         };
 
+        static const uint32_t DEFAULT_LATENCY_CEILING_MS = 10000;
+
         Device(Platform::IDEBus * bus);
 
+        /// @brief Run a job that uses the device on the command queue task.
+        /// @note Jobs of higher priority go first, jobs of the same priority go in the order they were submitted. A running job is never interrupted.
+        /// @param on_done Called on the command queue task once the job is finished
+        /// @returns A future that becomes ready once the job is finished
+        std::shared_future<void> submit(Priority priority, std::function<void()> job, std::function<void()> on_done = nullptr);
+        /// @brief Whether there are jobs of the given priority waiting to run
+        bool has_pending(Priority priority);
+
+        /// @brief Bring the drive up. If it is the same drive as on the previous boot, the stored profile is used instead of probing it all over again.
         void reset();
+        /// @brief Forget the stored drive profile, so that the next `reset()` probes the drive fully
+        void forget_drive_profile();
         bool check_atapi_compatible();
         bool self_test();
-        void wait_ready();
+        /// @brief Wait for the drive to finish whatever it's busy with, e.g. spinning up or changing discs
+        /// @returns Whether it did so within the latency ceiling. An empty drive counts as ready.
+        bool wait_ready();
+        /// @brief Longest `wait_ready()` and `read_toc()` may keep the caller waiting, retries included
+        void set_latency_ceiling(uint32_t ms) { latency_ceiling_ms = ms; }
+        /// @brief Called whenever recovery gives up on a command, on the task that issued it
+        /// @note The device is locked during the call, so the handler must not use it
+        void set_error_handler(std::function<void(const ErrorEvent&)> handler) { error_handler = handler; }
+        /// @brief Sense data that was read out during the last recovery
+        const SenseData& get_last_sense() { return last_sense; }
 
         /// @brief Eject or close the tray
         /// @param open_tray true = open tray, false = close tray
@@ -43,6 +132,9 @@ namespace ATAPI {
         void load_unload(SlotNumber slot);
         /// @brief Sends a device start command to ask the drive to read the disc.
         void start(bool state = true);
+        /// @brief Put the drive into the Standby power mode right away, which shuts down more than just the spindle.
+        /// @note The drive wakes up by itself on the next command that needs the disc.
+        void standby();
         void set_tray_locked(bool lock);
 
         /// @brief Request the player to play audio data
@@ -55,20 +147,68 @@ namespace ATAPI {
         /// @brief Stop the audio playback
         void stop();
         void scan(bool forward, const MSF from);
+        /// @brief Move the head to the sector without playing anything, so that READ SUBCHANNEL reports the position there
+        /// @param lba Address of the sector, 0 being at M00S02F00
+        /// @returns Whether the drive accepted the command
+        bool seek(uint32_t lba);
+
+        /// @brief Size of one sector as returned by `read_cd()`
+        static size_t cdda_sector_size(bool c2, bool subq) { return CDDA_SECTOR_SIZE + (c2 ? CDDA_C2_SIZE : 0) + (subq ? CDDA_SUBQ_SIZE : 0); }
+        static const size_t CDDA_SECTOR_SIZE = 2352;
+        static const size_t CDDA_C2_SIZE = 294;
+        static const size_t CDDA_SUBQ_SIZE = 16;
+        /// @brief Read raw audio sectors off the disc
+        /// @param lba Address of the first sector, 0 being at M00S02F00
+        /// @param out Buffer for `count` sectors of `cdda_sector_size(c2, subq)` bytes: 2352 bytes of audio, then C2 error pointers and formatted Q subchannel if requested
+        /// @returns Whether all of the sectors have been read
+        bool read_cd(uint32_t lba, uint8_t count, uint8_t * out, bool c2 = false, bool subq = false);
 
         /// @brief Check the media status
         MediaTypeCode check_media();
         /// @brief Read the audio CD TOC
         const DiscTOC read_toc();
+        static const size_t CD_TEXT_PACK_SIZE = 18;
+        /// @brief Read the Media Catalog Number (the EAN/UPC barcode) from the Q subchannel
+        /// @returns The 13 digits, or an empty string if the disc has none
+        const std::string read_mcn();
+        /// @brief Read the ISRC of a track from the Q subchannel
+        /// @returns The 12 characters, or an empty string if the track has none
+        /// @note The drive may have to seek through the track to find it
+        const std::string read_isrc(uint8_t track);
+        /// @brief Read the CD-TEXT of the disc, without holding all of it in memory at once
+        /// @param on_pack Called with each `CD_TEXT_PACK_SIZE` byte pack as it comes in
+        /// @returns Whether the drive sent any CD-TEXT
+        bool read_cd_text(std::function<void(const uint8_t * pack)> on_pack);
 
         const DriveInfo * get_info();
         const MechInfo * query_state();
         const AudioStatus * query_position();
         const Quirks& get_quirks() { return quirks; }
+        const PioTimings& get_pio_timings() { return timings; }
+        /// @brief Find the shortest PIO delays the drive still gives consistent responses with, and remember them for the drive's model and firmware
+        /// @note Done automatically by `reset()` the first time a drive is seen
+        void calibrate_pio_timings();
         const Diags * get_diags() { return &_diags; }
+        /// @brief Statistics of how long the drive takes to respond, per wait tag (e.g. "PKT", "TOC", "CDTX")
+        const WaitProfile& get_wait_profile() { return wait_profile; }
+        /// @brief Print the per-opcode statistics into the log, one `key=value` line per opcode for easy parsing
+        void log_command_stats();
+
+        /// @brief Internal use only
+        void process_queue();
 
     private:
+        struct QueuedJob {
+            std::function<void()> job;
+            std::function<void()> on_done;
+            std::shared_ptr<std::promise<void>> promise;
+        };
+
         SemaphoreHandle_t semaphore;
+        SemaphoreHandle_t queue_semaphore;
+        TaskHandle_t queue_task = NULL;
+        /// @brief Pending jobs, one queue per priority
+        std::deque<QueuedJob> queue[3];
         Platform::IDEBus * ide;
         DriveInfo info = { 
             .model = "", .serial = "", .firmware = ""
@@ -77,7 +217,18 @@ namespace ATAPI {
         AudioStatus audio_sts = { 0 };
         int packet_size = 12;
         Quirks quirks;
-        Diags _diags;
+        PioTimings timings = DEFAULT_PIO_TIMINGS;
+        Diags _diags = {};
+
+        /// @brief What is known about the drive and stays the same between boots: quirks, capabilities and the mode pages set up for playback
+        struct DriveProfile;
+        /// @brief Profile of the current drive, nullptr if it has not been probed or stored yet
+        std::shared_ptr<DriveProfile> profile = nullptr;
+        /// @brief Checksum of the model, firmware and serial number, to tell whether the stored profile belongs to this drive
+        uint32_t drive_identity();
+        /// @returns Whether a profile of this very drive has been stored
+        bool load_drive_profile();
+        void save_drive_profile();
 
         union StatusRegister {
             struct __attribute__((packed)) {
@@ -145,20 +296,74 @@ namespace ATAPI {
             uint8_t value;
         };
 
-        const std::vector<uint8_t> read_cd_text_toc_locked();
+        /// @brief How many CD-TEXT packs are read out at once
+        static const size_t CD_TEXT_CHUNK_PACKS = 8;
 
         StatusRegister read_sts_regi();
-        void wait_sts_bit_set(StatusRegister bits);
-        void wait_sts_bit_clr(StatusRegister bits, const char * tag = __func__);
-        bool read_response(void * buf, size_t bufLen, bool flush);
+        WaitProfile wait_profile;
+        /// @brief Opcode of the packet command whose completion is being waited for, if any
+        int wait_opcode = WaitProfile::NO_OPCODE;
+        /// @brief Longest a status wait goes on when the caller has no deadline of its own. The ATA spec gives a drive 31 s to come out of a reset.
+        static const uint32_t STATUS_WAIT_TIMEOUT_MS = 35000;
+        bool wait_sts_bit_set(StatusRegister bits, const char * tag = __func__, int64_t deadline = 0);
+        bool wait_sts_bit_clr(StatusRegister bits, const char * tag = __func__, int64_t deadline = 0);
+        /// @brief Poll the status register until the bits are set (or clear), spinning at first and then backing off exponentially
+        /// @param deadline `esp_timer_get_time()` value to stop waiting at, 0 for `STATUS_WAIT_TIMEOUT_MS` from now
+        /// @returns Whether the bits got where they should before the deadline
+        bool wait_sts(StatusRegister bits, bool set, const char * tag, uint32_t warn_interval_ms, int64_t deadline = 0);
+        /// @param partial The buffer only takes the start of what the drive sends, so data left over after it is no overrun
+        bool read_response(void * buf, size_t bufLen, bool flush, bool partial = false);
         void send_packet(const void * buf, size_t bufLen, bool pad = true);
+        /// @brief Bytes left in the PIO data block currently being transferred
+        size_t pio_remain = 0;
+        size_t pio_next_block(bool ignore_drq);
+
+        /// @brief Statistics of the packet command currently in progress, if any
+        CommandStats * cmd_stats = nullptr;
+        int64_t cmd_start = 0;
+        int64_t cmd_last_activity = 0;
+        CommandStats * stats_for(uint8_t opcode);
+        void begin_command_stats(uint8_t opcode);
+        void end_command_stats();
 
-        void wait_not_busy(const char * tag = __func__);
-        void wait_drq_end();
-        void wait_drq();
+        bool wait_not_busy(const char * tag = __func__, int64_t deadline = 0);
+        bool wait_drq_end(int64_t deadline = 0);
+        bool wait_drq(int64_t deadline = 0);
 
         void init_task_file();
+        void write_task_file();
         void identify();
+        void look_up_quirks();
+
+        /// @brief Use the stored timings for this drive, or calibrate them if there are none
+        void load_pio_timings();
+        const std::string pio_timings_pref_key();
+        /// @brief Raw INQUIRY data, or empty if the drive did not respond properly
+        const std::vector<uint8_t> inquiry();
+        /// @brief Whether the drive returns the same INQUIRY data as the reference a few times in a row with the current timings
+        bool probe_pio_timings(const std::vector<uint8_t>& reference);
+        /// @brief Get the drive out of whatever state a failed probe left it in
+        void recover_after_probe();
+
+        uint32_t latency_ceiling_ms = DEFAULT_LATENCY_CEILING_MS;
+        std::function<void(const ErrorEvent&)> error_handler = nullptr;
+        SenseData last_sense = { 0 };
+        /// @brief Time and resets left for getting one command through
+        struct RecoveryBudget {
+            uint8_t opcode;
+            int64_t started;
+            int64_t deadline;
+            uint8_t resets;
+        };
+        /// @brief Start the clock for getting a command through. Call with the semaphore already held, so that waiting for it doesn't eat into the budget.
+        RecoveryBudget begin_recovery(uint8_t opcode);
+        SenseData request_sense_locked();
+        /// @brief Read out the sense and act on it as the recovery table says, within the budget. The semaphore must be held.
+        /// @returns What was done, `GIVE_UP` if the caller should not try again
+        RecoveryAction recover_locked(RecoveryBudget& budget);
+        /// @brief Give up on the command because the drive did not answer within the budget, telling the error handler. The semaphore must be held.
+        /// @returns `GIVE_UP`, to have it the same way as from `recover_locked()`
+        RecoveryAction give_up_locked(const RecoveryBudget& budget, const char * what);
 
         CapabilitiesMechStatusModePage mode_sense_capabilities();
 
@@ -0,0 +1,62 @@
+#pragma once
+#include "types.h"
+#include <string>
+
+/// Integrity checks of extracted audio: CRC32 as in EAC logs, and AccurateRip checksums that can be compared against the AccurateRip database.
+
+namespace ATAPI {
+    /// @brief Checksums of one track, calculated on the go as the sectors come in
+    class TrackChecksum {
+    public:
+        static const size_t SECTOR_SIZE = 2352;
+        static const size_t SAMPLES_PER_SECTOR = SECTOR_SIZE / 4;
+
+        /// @param sector_count Length of the track in sectors, needed to know where the last track's exclusion starts
+        /// @param is_first_track AccurateRip skips the first 5 sectors (minus one sample) of the first track on the disc
+        /// @param is_last_track AccurateRip skips the last 5 sectors of the last track on the disc
+        TrackChecksum(uint32_t sector_count, bool is_first_track, bool is_last_track);
+
+        /// @brief Feed the next whole sectors of the track
+        void update(const uint8_t * sectors, size_t count);
+        void reset();
+
+        /// @brief Whether all the sectors of the track have been fed in
+        bool is_complete() const { return sectors_done >= sector_count; }
+        uint32_t get_crc32() const { return ~crc; }
+        uint32_t get_accuraterip_v1() const { return ar_v1; }
+        uint32_t get_accuraterip_v2() const { return ar_v2; }
+
+    private:
+        uint32_t sector_count;
+        uint32_t check_from;
+        uint32_t check_to;
+
+        uint32_t sectors_done = 0;
+        /// @brief AccurateRip multiplier of the next sample, 1-based from the start of the track
+        uint32_t multiplier = 1;
+        uint32_t crc = 0xFFFFFFFF;
+        uint32_t ar_v1 = 0;
+        uint32_t ar_v2 = 0;
+    };
+
+    /// @brief Identifies a disc in the AccurateRip database
+    struct AccurateRipDiscId {
+        uint8_t track_count;
+        uint32_t id1;
+        uint32_t id2;
+        /// @brief Same as the FreeDB disc ID
+        uint32_t cddb;
+
+        static AccurateRipDiscId from_toc(const DiscTOC& toc);
+        /// @brief Path of the `dBAR` file with the checksums of this disc on www.accuraterip.com
+        const std::string url_path() const;
+
+        /// @brief Look up the track in a downloaded `dBAR` file.
+        /// @param track_idx 0-based index of the track on the disc
+        /// @returns Highest confidence of a pressing the checksum matches, either as v1 or v2, or 0 if none does
+        int find_confidence(const uint8_t * dbar, size_t len, int track_idx, uint32_t checksum_v1, uint32_t checksum_v2) const;
+    };
+
+    /// @brief Plain CRC32 (IEEE 802.3), slice-by-8 with tables built at compile time. Start with 0xFFFFFFFF and invert the final value.
+    uint32_t crc32_update(uint32_t crc, const uint8_t * data, size_t len);
+}
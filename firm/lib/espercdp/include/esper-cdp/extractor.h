@@ -0,0 +1,97 @@
+#pragma once
+#include <esper-cdp/atapi.h>
+#include <esper-cdp/checksum.h>
+
+/// Digital audio extraction: pulls CDDA sectors off the disc with READ CD ahead of the playback, for playing through the CPU instead of the drive's own outputs.
+
+namespace ATAPI {
+    class CDDAExtractor {
+    public:
+        struct Stats {
+            uint32_t sectors_read;
+            /// @brief Sectors that could not be read even one by one and were replaced with silence
+            uint32_t sectors_lost;
+            /// @brief Sectors that came with C2 errors, and had the affected samples concealed
+            uint32_t sectors_c2;
+            uint32_t retries;
+            /// @brief Times the consumer wanted more data than was in the buffer
+            uint32_t underruns;
+            /// @brief Extraction speed over the last second, in bytes per second of audio. 176400 is 1x.
+            uint32_t bytes_per_second;
+            /// @brief Sectors per READ CD the scheduler settled on
+            uint8_t chunk_sectors;
+        };
+
+        /// @param buffer_sectors Read-ahead buffer size in sectors. Allocated in PSRAM if available.
+        /// @param c2_pointers Ask the drive for C2 error pointers and conceal the bad samples
+        /// @param subchannel_q Ask the drive for the Q subchannel with each sector, to follow the track and index numbers
+        CDDAExtractor(Device * device, size_t buffer_sectors = 256, bool c2_pointers = false, bool subchannel_q = false);
+        ~CDDAExtractor();
+
+        /// @brief Start extracting the given range, throwing away anything buffered from before
+        /// @param first_track Whether the range is the first track of the disc, for the AccurateRip checksum
+        /// @param last_track Whether the range is the last track of the disc, for the AccurateRip checksum
+        void start(const MSF from, const MSF to, bool first_track = false, bool last_track = false);
+        void stop();
+        bool is_running() { return running; }
+        /// @brief Whether the whole range has been extracted and read out by the consumer
+        bool is_finished();
+
+        /// @brief Take out 44.1kHz 16-bit stereo PCM. Never blocks: returns however much was there.
+        size_t read(uint8_t * buf, size_t len);
+        /// @brief Bytes of PCM ready to be read
+        size_t available();
+        /// @brief Disc position of the next sample to be read out
+        const MSF get_position();
+        /// @brief Track and index from the Q subchannel of the last extracted sector, if requested
+        uint8_t get_q_track() { return q_track; }
+        uint8_t get_q_index() { return q_index; }
+        const Stats& get_stats() { return stats; }
+        /// @brief Checksums of what was extracted of the range so far. Comparable to the AccurateRip database once complete, if the range is exactly one track.
+        TrackChecksum get_checksum();
+
+        /// @brief Internal use only
+        void extract_loop();
+
+    private:
+        Device * cdrom;
+        const bool want_c2;
+        const bool want_subq;
+
+        uint8_t * ring = nullptr;
+        size_t ring_size = 0;
+        /// @brief Write and read offsets, in bytes since the start of the extraction
+        volatile uint64_t head = 0;
+        volatile uint64_t tail = 0;
+        /// @brief Guards the buffer and the extraction range
+        SemaphoreHandle_t semaphore;
+        /// @brief Held by the task while it uses the drive and the scratch buffer
+        SemaphoreHandle_t work_semaphore;
+        TaskHandle_t task = NULL;
+
+        uint8_t * scratch = nullptr;
+        volatile bool running = false;
+        /// @brief Bumped on every start/stop so that the task drops a read that was already in flight
+        volatile uint32_t generation = 0;
+        int start_lba = 0;
+        int next_lba = 0;
+        int end_lba = 0;
+        uint8_t chunk = 4;
+        uint8_t last_sample[4] = { 0 };
+        TrackChecksum checksum = TrackChecksum(0, false, false);
+
+        Stats stats = { 0 };
+        int64_t rate_window_start = 0;
+        uint32_t rate_window_bytes = 0;
+        volatile uint8_t q_track = 0;
+        volatile uint8_t q_index = 0;
+
+        /// @brief Read a few sectors, with retries in smaller pieces and silence for what is unreadable. Returns how many sectors went into the buffer.
+        int extract_chunk(uint32_t my_generation);
+        bool read_sectors(int lba, uint8_t count);
+        void conceal_c2(uint8_t * sector);
+        void push(const uint8_t * data, size_t len);
+        /// @brief Count a chunk that went into the buffer towards `Stats::bytes_per_second`
+        void update_rate(size_t len);
+    };
+}
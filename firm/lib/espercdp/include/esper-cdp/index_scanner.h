@@ -0,0 +1,44 @@
+#pragma once
+#include <esper-cdp/atapi.h>
+#include <esper-cdp/metadata.h>
+#include <functional>
+
+/// Finds the pregaps and index points of a disc from its Q subchannel, which the TOC does not tell about.
+
+namespace CD {
+    class IndexScanner {
+    public:
+        IndexScanner(ATAPI::Device * device);
+        ~IndexScanner();
+
+        /// @brief Find the pregap of the next track and the indexes 2 and up within the given track
+        /// @param album Disc that is in the drive
+        /// @param track_idx 0-based index of the track in `album.tracks`
+        /// @param should_stop Checked between probes, return true to give up (e.g. when the user wants to use the drive)
+        /// @param out Found index points get appended here
+        /// @returns Whether the track has been looked through completely
+        /// @note Uses the device directly, so must be run from the device's command queue
+        bool scan_track(const Album& album, int track_idx, std::function<bool()> should_stop, std::vector<IndexPoint>& out);
+
+    private:
+        struct Sample {
+            int frame;
+            uint8_t track;
+            uint8_t index;
+        };
+
+        ATAPI::Device * cdrom;
+        uint8_t * sector = nullptr;
+        /// @brief Whether to read the Q subchannel with READ CD, or seek there and use READ SUBCHANNEL
+        bool use_read_cd = true;
+        /// @brief Whether SEEK + READ SUBCHANNEL works when READ CD doesn't, cleared after the first failure
+        bool use_seek = true;
+        int probes = 0;
+
+        /// @brief Find out the track and index at the frame. In the seek mode the frame that was actually sampled may be off by a bit.
+        bool probe(int frame, Sample& out);
+        /// @brief Find the first frame in [lo; hi] where the position is at or after the given track and index
+        /// @returns -1 if the search was stopped
+        int find_start(int lo, int hi, uint8_t track, uint8_t index, std::function<bool()>& should_stop);
+    };
+}
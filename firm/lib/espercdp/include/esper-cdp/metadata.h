@@ -18,6 +18,15 @@ namespace CD {
         std::string artist;
         std::vector<Lyric> lyrics;
         MSF duration; // Added duration field
+        /// @brief From the Q subchannel, empty if the track has none or it has not been read
+        std::string isrc;
+    };
+
+    /// @brief Where an index starts on the disc, as told by the Q subchannel
+    struct IndexPoint {
+        uint8_t track;
+        uint8_t index;
+        MSF position;
     };
 
     class Album {
@@ -28,8 +37,11 @@ namespace CD {
             lead_out( {.M = 0, .S = 0, .F = 0} ),
             title(""),
             artist(""),
+            mcn(""),
             toc_subchannel({}),
-            toc({})
+            toc({}),
+            index_map({}),
+            index_map_tracks_done(0)
         {}
 
         Album(const ATAPI::DiscTOC& _toc): Album() {
@@ -41,7 +53,6 @@ namespace CD {
                 duration = lead_out;
             }
             toc = _toc.tracks;
-            toc_subchannel = _toc.toc_subchannel;
 
             for (size_t i = 0; i < _toc.tracks.size(); ++i) {
               const auto& track = _toc.tracks[i];
@@ -57,19 +68,29 @@ namespace CD {
                         .title = "",
                         .artist = "",
                         .lyrics = {},
-                        .duration = track_duration // Calculate and set track duration
+                        .duration = track_duration, // Calculate and set track duration
+                        .isrc = ""
                     });
                 }
             }
         }
 
         std::vector<ATAPI::DiscTrack> toc;
+        /// @brief CD-TEXT packs of the disc, as far as `CDTextMetadataProvider` has any use for them. Filled in after the TOC, as it takes long to read.
         std::vector<uint8_t> toc_subchannel;
         std::string title;
         std::string artist;
+        /// @brief Media Catalog Number from the Q subchannel, i.e. the barcode of the release. Empty if the disc has none or it has not been read.
+        std::string mcn;
         std::vector<Track> tracks;
         MSF duration;
         MSF lead_out;
+        /// @brief Starts of the pregaps and of indexes 2 and up, sorted by position. Index 1 of every track is in the TOC and not repeated here.
+        std::vector<IndexPoint> index_map;
+        /// @brief How many tracks, from the first one, have been looked through for `index_map`
+        uint8_t index_map_tracks_done;
+
+        bool is_index_map_complete() const { return !tracks.empty() && index_map_tracks_done >= tracks.size(); }
 
         bool is_metadata_complete() {
             for(auto& track: tracks) {
@@ -81,7 +102,7 @@ namespace CD {
             return (!title.empty() && !artist.empty());
         }
 
-        bool is_metadata_good_for_caching() {
+        bool is_metadata_good_for_caching() const {
             for(auto& track: tracks) {
                 if(track.title.empty()) {
                     return false;
@@ -97,12 +118,15 @@ namespace CD {
         virtual ~MetadataProvider() = default;
         virtual void fetch_album(Album&) {}
         virtual bool cacheable() { return false; }
+        /// @brief Called when more has been learned about the disc after `fetch_album()`, e.g. the index map, so that it can be stored
+        virtual void update_album(const Album&) {}
     };
 
     class CachingMetadataAggregateProvider: public MetadataProvider {
     public:
         CachingMetadataAggregateProvider(const char * cache_path);
         void fetch_album(Album&) override;
+        void update_album(const Album&) override;
         std::vector<MetadataProvider *> providers = {};
         bool cache_enabled = true;
     private:
@@ -142,6 +166,8 @@ namespace CD {
         CDTextMetadataProvider() {}
 
         void fetch_album(Album&) override;
+        /// @brief Whether the pack is one that `fetch_album()` uses, so that the rest need not be kept around
+        static bool is_pack_useful(const uint8_t * pack);
     private:
         uint16_t crc16(const void * data, size_t length);
     };
@@ -0,0 +1,15 @@
+#pragma once
+#include <ArduinoJson.h>
+#include <string>
+#include <vector>
+
+/// Making sense of the releases in a MusicBrainz disc ID lookup. Needs nothing but the JSON, so that it can be tested on the host.
+
+/// @brief Index of the medium in the release that has the given disc ID, or -1
+int MBJsonFindMediumIndex(const JsonObject& info, const std::string& disc_id);
+
+/// @brief When many releases share the disc ID, pick the one whose barcode matches the disc's catalog number, then the one with the most matching ISRCs
+/// @param mcn Catalog number read from the disc, empty if there is none
+/// @param isrcs ISRC of each track read from the disc, empty where there is none
+/// @returns Index of the release, or -1 if they can't be told apart
+int MBJsonPickRelease(const JsonArray& releases, const std::string& mcn, const std::vector<std::string>& isrcs, const std::string& disc_id);
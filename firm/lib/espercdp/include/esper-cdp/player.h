@@ -1,6 +1,13 @@
 #pragma once
 #include <esper-cdp/atapi.h>
 #include <esper-cdp/metadata.h>
+#include <esper-cdp/index_scanner.h>
+#include <esper-cdp/power_manager.h>
+#include <esper-cdp/shuffle_planner.h>
+#include <esper-cdp/transition_scheduler.h>
+#include <esper-cdp/program.h>
+#include <esper-cdp/resume_store.h>
+#include <esper-cdp/player_events.h>
 #include <memory>
 #include <queue>
 #include <set>
@@ -57,20 +64,26 @@ namespace CD {
             NEXT_TRACK,
             PREV_TRACK,
             NEXT_DISC,
-            PREV_DISC
+            PREV_DISC,
+            NEXT_INDEX,
+            PREV_INDEX
         };
 
         enum PlayMode {
             /// @brief Play all tracks and discs in sequence
             PLAYMODE_CONTINUE,
-            /// @brief Shuffle all tracks on the disc
+            /// @brief Shuffle all tracks on all discs whose TOC is known
             PLAYMODE_SHUFFLE,
+            /// @brief Play the tracks programmed for the current disc, in their order
+            PLAYMODE_PROGRAM,
         };
 
         struct Slot {
             bool disc_present;
             bool active;
             std::shared_ptr<Album> disc;
+            /// @brief FreeDB style ID of the disc whose TOC is in `disc`, or 0 if the TOC is not known
+            uint32_t disc_id;
         };
 
         struct TrackNo {
@@ -78,9 +91,15 @@ namespace CD {
             uint8_t index;
         };
 
-        Player(ATAPI::Device * device, MetadataProvider * meta_provider):
+        /// @param resume_log File to keep the resume points of the discs in, or nullptr to forget them on power off
+        Player(ATAPI::Device * device, MetadataProvider * meta_provider, const char * resume_log = nullptr):
             cdrom(device),
-            meta(meta_provider)
+            meta(meta_provider),
+            index_scanner(device),
+            power(device),
+            shuffle(SHUFFLE_TRACKS_PER_DISC),
+            transition(device),
+            resume(resume_log)
         {
             ESP_LOGI("CDP", "CREATE");
             setup_tasks();
@@ -98,17 +117,47 @@ namespace CD {
         const std::vector<Slot>& get_slots() { return slots; }
         const Slot& get_active_slot() { return slots[cur_slot]; }
         int get_active_slot_index() { return cur_slot; }
-        const MSF get_current_absolute_time() { return abs_ts; }
-        const MSF get_current_track_time() { return rel_ts; }
+        /// @brief Current position on the disc. While playing, extrapolated from the last subchannel read, so it's accurate to a frame or so.
+        const MSF get_current_absolute_time();
+        /// @brief Current position in the track, counting down in the pregap. While playing, extrapolated like `get_current_absolute_time()`.
+        const MSF get_current_track_time();
         const TrackNo get_current_track_number() { return cur_track; }
         bool is_processing_metadata() { return !_metaQueue.empty(); }
+        /// @brief Whether the changer is away reading the TOC of another slot right now
+        bool is_taking_inventory() { return inventory_slot >= 0; }
+        /// @brief Last command the drive could not be brought to do in time, valid if `get_drive_error_count()` is not 0
+        const ATAPI::Device::ErrorEvent& get_last_drive_error() { return last_drive_error; }
+        uint32_t get_drive_error_count() { return drive_error_count; }
+        /// @brief How long the drive took to come back after having been let down while idle
+        const SpinUpHistogram& get_spin_up_latency() { return power.get_spin_up_latency(); }
         PlayMode get_play_mode() { return play_mode; }
         void set_play_mode(PlayMode mode);
+        /// @brief Set the program of the disc in the drive
+        /// @param tracks Track numbers in the order to play them, empty to have no program
+        void set_program(const std::vector<uint8_t>& tracks);
+        /// @brief Program of the disc in the drive, empty if there is none
+        const std::vector<uint8_t>& get_program() { return program; }
+        /// @brief Index of the program entry being played, -1 if none
+        int get_program_entry() { return program_entry; }
+
+        static const int STATE_COUNT = (int) State::SEEK_REW + 1;
+        /// @brief Drive status reads per second issued by the poll cycle while in the given state, averaged over the whole uptime
+        float get_poll_rate(State state);
+        void log_poll_stats();
+        /// @brief Number of poll cycles started so far, to tell whether the poll task is still going round
+        uint32_t get_poll_count() { return poll_count; }
+        /// @brief Subscribe here to learn when the getters would return something new
+        PlayerEvents& get_events() { return events; }
 
         void do_command(Command);
         void navigate_to_track(int track);
+        /// @brief Go to an index point of the current disc. Index 1 is always known from the TOC, the rest only once the index scan got to the track.
+        /// @returns Whether the index point is known
+        bool navigate_to_index(uint8_t track, uint8_t index);
 
         void power_down();
+        /// @brief Something happened that suggests the user is about to use the player (e.g. a key was pressed), so get the drive spinning if it was let down
+        void wake_drive();
 
         void poll_state();
 
@@ -116,13 +165,104 @@ namespace CD {
     private:
         ATAPI::Device * cdrom;
         MetadataProvider * meta;
+        IndexScanner index_scanner;
+        PowerManager power;
 
         TaskHandle_t _pollTask;
+        /// @brief Held while the player state is being changed
         SemaphoreHandle_t _cmdSemaphore;
+        /// @brief Held for the whole poll cycle, including the drive status reads
+        SemaphoreHandle_t _pollSemaphore;
+        /// @brief Incremented on every user command, so that the poll cycle can tell its drive status is stale
+        volatile uint32_t command_generation = 0;
+
+        ATAPI::Device::ErrorEvent last_drive_error = { 0 };
+        volatile uint32_t drive_error_count = 0;
+
+        /// @brief Interval value for status that need not be read at all
+        static const TickType_t POLL_NEVER = portMAX_DELAY;
+        struct PollSchedule {
+            TickType_t media;
+            TickType_t mech;
+            TickType_t position;
+        };
+        static const PollSchedule& schedule_for(State state);
+
+        struct PollStats {
+            uint32_t commands;
+            TickType_t ticks;
+        };
+        PollStats poll_stats[STATE_COUNT] = { { 0 } };
+        TickType_t last_poll_tick = 0;
+        TickType_t last_poll_stats_log = 0;
+        volatile uint32_t poll_count = 0;
+
+        PlayerEvents events;
+        State published_sts = State::INIT;
+        TrackNo published_track = { .track = 0, .index = 0 };
+        uint32_t published_slots = 0;
+        /// @brief Tell the subscribers about whatever changed since the last time
+        /// @param fresh_position Whether a position was just read from the drive
+        void publish_changes(bool fresh_position = false);
+
+        bool refresh_requested = true;
+        uint32_t last_poll_generation = 0;
+        TickType_t last_media_poll = 0;
+        TickType_t last_mech_poll = 0;
+        TickType_t last_position_poll = 0;
+        ATAPI::MediaTypeCode last_media_type = ATAPI::MediaTypeCode::MTC_DOOR_CLOSED_UNKNOWN;
+        ATAPI::MechInfo last_mech = { 0 };
+        ATAPI::AudioStatus last_audio = { 0 };
+        /// @brief Whether the drive came up at the last wait for it, in the states that wait for it
+        bool last_ready = false;
+
+        /// @brief Last user command or state change, the inventory and letting the drive down only happen after a while of nothing happening
+        TickType_t last_activity_tick = 0;
+        /// @brief Slot being read by the inventory, -1 if none
+        volatile int inventory_slot = -1;
+        /// @brief Slots whose disc could not be read by the inventory. Not retried until the changer reports the disc changed.
+        std::set<int> inventory_failed = {};
+        /// @brief Read the TOC of the next occupied slot not known yet, then go back to the current one
+        /// @returns Whether there was a slot to read
+        bool take_inventory_step(uint32_t generation);
+        /// @brief Where the reading of one slot by the inventory is at. Each step is a job of its own, so that the user's commands wait for one step at most.
+        struct InventoryWalk {
+            enum class Step { LOAD, READ_TOC, READ_TEXT, READ_IDENTIFIERS, GO_HOME };
+            int slot;
+            int home;
+            uint32_t generation;
+            /// @brief The user wanted something before the slot was read through, so it's neither known nor unreadable
+            bool interrupted;
+            std::shared_ptr<ATAPI::DiscTOC> toc;
+            std::shared_ptr<Album> disc;
+            std::promise<void> done;
+        };
+        /// @brief Do one step of the walk on the drive's task, then queue the next one
+        void run_inventory_step(std::shared_ptr<InventoryWalk> walk, InventoryWalk::Step step);
+        void invalidate_slot(int slot);
+
+        /// @brief Disc ID of the disc the index scan could not be done on, so as not to keep trying
+        uint32_t index_scan_failed_disc = 0;
+        /// @brief Look for the index points of the next track of the current disc not scanned yet
+        /// @returns Whether there was a track to scan
+        bool take_index_scan_step(uint32_t generation);
+
+        static const PowerManager::Thresholds& power_thresholds_for(State state);
+
+        struct PendingMetadata {
+            std::shared_ptr<Album> album;
+            /// @brief Becomes ready once the CD-TEXT and the identifiers are in the album, if they are being read
+            std::shared_future<void> cd_text;
+        };
 
         TaskHandle_t _metaTask;
         SemaphoreHandle_t _metaSemaphore;
-        std::queue<std::shared_ptr<Album>> _metaQueue;
+        std::queue<PendingMetadata> _metaQueue;
+        /// @brief Look up the album's metadata in the background
+        /// @param read_from_disc Read the CD-TEXT, catalog number and ISRCs of the disc in the drive into the album first
+        void queue_metadata(std::shared_ptr<Album> album, bool read_from_disc);
+        /// @brief When the current LOAD state began, to tell how long it took to get the track list
+        TickType_t load_start_tick = 0;
 
         TickType_t softscan_start = 0;
         TickType_t last_softscan_tick = 0;
@@ -130,6 +270,25 @@ namespace CD {
         MSF softscan_hop = { .M = 0, .S = 10, .F = 0 };
         const MSF softscan_hop_default = { .M = 0, .S = 10, .F = 0 };
 
+        /// @brief Monotonic playback clock, anchored on each subchannel position read while playing
+        struct PlaybackClock {
+            bool running;
+            int64_t anchor_us;
+            int abs_anchor;
+            int rel_anchor;
+            /// @brief Position in the pregap, where the track time counts down
+            bool counting_down;
+            /// @brief Absolute frame the clock won't go past: the end of the current track, where the subchannel has to tell what's next
+            int limit;
+            /// @brief Absolute frame shown last before a resync, the clock waits on it rather than going back
+            int floor;
+        };
+        PlaybackClock clock = { 0 };
+        TrackNo last_clock_track = { .track = 0, .index = 0 };
+        bool position_fresh = false;
+        int clock_position();
+        void sync_clock();
+
         MSF abs_ts = { .M = 0, .S = 0, .F = 0 };
         MSF rel_ts = { .M = 0, .S = 0, .F = 0 };
         TrackNo cur_track = { .track = 1, .index = 1 };
@@ -140,7 +299,8 @@ namespace CD {
             Slot { 
                 .disc_present = false,
                 .active = true,
-                .disc = std::make_shared<Album>(Album())
+                .disc = std::make_shared<Album>(Album()),
+                .disc_id = 0
             }
         };
         int next_expected_slot = 0;
@@ -149,13 +309,85 @@ namespace CD {
         bool did_see_actual_playback = false;
         MSF auto_play_start_pos = {.M = 0, .S = 0, .F = 0};
 
-        std::set<int> shuffle_history = {};
+        /// @brief Tracks played off one disc in shuffle before the changer moves on to another
+        static const int SHUFFLE_TRACKS_PER_DISC = 3;
+        ShufflePlanner shuffle;
+        /// @brief Track index to play once the changer brings in the disc the shuffle asked for, -1 if none
+        int shuffle_pending_track = -1;
         PlayMode play_mode = PlayMode::PLAYMODE_CONTINUE;
+        /// @brief Identify the set of discs the shuffle goes over
+        /// @param track_counts Receives the number of tracks in each slot, 0 for slots left out
+        uint32_t shuffle_layout(std::vector<uint8_t>& track_counts);
+        /// @brief Make sure there is a shuffle plan for the discs in the changer with tracks left, resuming the one from before the power cycle if possible
+        void prepare_shuffle();
+        /// @brief Play a track picked by the shuffle, changing discs if needed
+        /// @returns False if the disc is not there anymore
+        bool play_shuffle_entry(const ShufflePlanner::Entry& entry);
+        /// @brief Last track index that can go into one PLAY AUDIO with the given one, because the plan has it followed by the tracks right after it on the disc
+        /// @param ahead How far ahead in the plan the track after the given one is
+        int shuffle_range_last(const ShufflePlanner::Entry& entry, size_t ahead);
+
+        std::vector<uint8_t> program = {};
+        /// @brief Disc the program is for
+        std::shared_ptr<Album> program_album = nullptr;
+        std::vector<PlayRange> program_ranges = {};
+        int program_range = -1;
+        int program_entry = -1;
+        bool has_program() { return program_album == slots[cur_slot].disc && !program_ranges.empty(); }
+        /// @brief Play from the given program entry up to the end of its range
+        bool play_program_entry(int entry);
+        /// @brief Start the next track of the shuffle or the next range of the program after the current one ran out
+        /// @returns False if there is nothing left, or in the continuous mode
+        bool play_next_planned();
+        /// @brief Keep up with the drive playing on from one planned track into the next within the same range
+        void follow_range_crossing();
+        /// @brief Find the range to play after the current one
+        /// @returns False if it can't follow right after, e.g. when nothing is left or it's on another disc
+        bool peek_next_range(MSF& start, MSF& end);
+
+        /// @brief Absolute frames of the range the drive was last told to play
+        int play_range_start = 0;
+        int play_range_end = 0;
+        TransitionScheduler transition;
+        /// @brief Range the armed transition is going to play
+        int transition_range_start = 0;
+        int transition_range_end = 0;
+        /// @brief Queue the PLAY AUDIO of the next shuffled track or programmed range to go out right as the current range ends
+        void schedule_transition();
+        /// @brief The scheduled transition went out, so move on in the shuffle plan or program
+        void take_transition();
+
+        ResumeStore resume;
+        /// @brief PLAY from stop carries on from `resume_point` rather than the first track
+        bool resume_offered = false;
+        MSF resume_point = { .M = 0, .S = 0, .F = 0 };
+        TickType_t last_resume_flush = 0;
+        /// @brief While playing on, the resume points are written out at a track change at most this often, to not lose all of it on a power cut
+        static const TickType_t RESUME_FLUSH_INTERVAL = pdMS_TO_TICKS(5 * 60 * 1000);
+        void flush_resume();
+        /// @brief Offer to resume the disc in the drive, if it was left off somewhere before
+        void offer_resume();
 
         void setup_tasks();
         void start_seeking(bool ffwd);
         bool change_discs(bool forward);
+        bool change_to_slot(int slot);
         void change_tracks(bool ffwd);
+        void change_indexes(bool fwd);
+        /// @brief `navigate_to_track()` for when the command semaphore is already held
+        void go_to_track(int track);
+        /// @brief `navigate_to_index()` for when the command semaphore is already held
+        bool go_to_index(uint8_t track, uint8_t index);
         bool play_next_shuffled_track();
+
+        // Queue a drive command in the user priority without waiting for it to finish
+        void drive_play(const MSF start, const MSF end);
+        /// @brief Play from the start of the track of the current disc with the given index up to the end of the other given one
+        void drive_play_track(int trk_idx, int last_trk_idx = -1);
+        void drive_pause(bool pause);
+        void drive_stop();
+        void drive_scan(bool forward, const MSF from);
+        void drive_eject(bool open);
+        void drive_load_unload(ATAPI::SlotNumber slot);
     };
 }
\ No newline at end of file
@@ -0,0 +1,70 @@
+#pragma once
+#include <esper-cdp/player.h>
+#include <esper-cdp/virtual_drive.h>
+#include <functional>
+#include <map>
+#include <string>
+
+/// Puts a `CD::Player` through its paces against a `VirtualDrive`, to see how quickly it reacts and whether it ever gets stuck.
+
+namespace CD {
+    class PlayerBench {
+    public:
+        /// @param disc Disc to put into every slot, or nullptr for a disc of silent tracks
+        /// @param slot_count Number of changer slots of the virtual drive
+        PlayerBench(std::shared_ptr<const ATAPI::VirtualDisc> disc, uint8_t slot_count = 1);
+        ~PlayerBench();
+
+        /// @brief Time from `do_command()` to the player getting where the command should take it, for the common commands
+        void measure_commands(int rounds);
+        /// @brief Time from the tray going in to the track list being there
+        void measure_load(int rounds);
+        /// @brief Throw random commands and tray movements at the player, looking for the poll loop stalling or the state machine getting stuck.
+        /// The same seed gives the same sequence.
+        void fuzz(uint32_t seed, int steps);
+        /// @brief Print out all that was measured into the log
+        void log_report();
+
+        const std::map<std::string, ATAPI::WaitHistogram>& get_reactions() const { return reactions; }
+        const ATAPI::WaitHistogram& get_load_times() const { return load_times; }
+        uint32_t get_stall_count() const { return stalls; }
+        uint32_t get_wedge_count() const { return wedges; }
+
+        /// @brief How long the poll loop may go without starting a new cycle before it counts as stalled
+        static const int64_t POLL_STALL_US = 10000000;
+        /// @brief How long the player may stay in a state that is meant to pass by itself (e.g. LOAD) before it counts as stuck
+        static const int64_t WEDGE_US = 30000000;
+
+    private:
+        ATAPI::VirtualDrive * drive;
+        ATAPI::Device * device;
+        MetadataProvider meta;
+        Player * player;
+        std::shared_ptr<const ATAPI::VirtualDisc> disc;
+        uint8_t slot_count;
+
+        std::map<std::string, ATAPI::WaitHistogram> reactions = {};
+        ATAPI::WaitHistogram load_times = {};
+        uint32_t stalls = 0;
+        uint32_t wedges = 0;
+        uint32_t fuzz_steps = 0;
+
+        uint32_t last_poll_count = 0;
+        int64_t last_poll_change = 0;
+        bool stalled = false;
+        Player::State last_state = Player::State::INIT;
+        int64_t state_since = 0;
+        bool wedged = false;
+
+        /// @brief Look out for stalls and wedges, called all along while the bench waits
+        void watch();
+        /// @brief Wait for the condition to come true, while watching the player
+        /// @returns Microseconds it took, or -1 on timeout
+        int64_t wait_until(std::function<bool()> condition, uint32_t timeout_ms);
+        int64_t wait_for_state(Player::State state, uint32_t timeout_ms);
+        /// @brief Send the command and note down how long it took to get to the state
+        void react(const char * name, Player::Command cmd, std::function<bool()> done, uint32_t timeout_ms = 10000);
+        /// @brief Get back to a closed tray and a stopped disc, e.g. after fuzzing
+        bool settle();
+    };
+}
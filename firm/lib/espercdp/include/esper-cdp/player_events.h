@@ -0,0 +1,47 @@
+#pragma once
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <atomic>
+
+/// Lets the ones interested in the player's state sleep until it changes, instead of checking on it over and over.
+
+namespace CD {
+    class PlayerEvents {
+    public:
+        enum Event: EventBits_t {
+            /// @brief The player went into another state
+            EVT_STATE = (1 << 0),
+            /// @brief Another track or index is playing, or was picked while stopped
+            EVT_TRACK = (1 << 1),
+            /// @brief A fresh position came from the drive
+            EVT_POSITION = (1 << 2),
+            /// @brief Something was learned about a disc, or the metadata queue emptied or filled
+            EVT_METADATA = (1 << 3),
+            /// @brief Another slot is active, or a slot's disc changed
+            EVT_SLOTS = (1 << 4),
+
+            EVT_ALL = EVT_STATE | EVT_TRACK | EVT_POSITION | EVT_METADATA | EVT_SLOTS
+        };
+
+        static const int MAX_SUBSCRIBERS = 4;
+        typedef int Subscription;
+        static const Subscription NO_SUBSCRIPTION = -1;
+
+        PlayerEvents();
+        ~PlayerEvents();
+
+        /// @returns `NO_SUBSCRIPTION` if all are taken already
+        Subscription subscribe();
+        void unsubscribe(Subscription sub);
+        /// @brief Let every subscriber know of the events. Events not waited for yet pile up into one.
+        void publish(EventBits_t events);
+        /// @brief Sleep until any of the given events happens or the timeout runs out
+        /// @returns The events that happened, which are then cleared. 0 on timeout.
+        EventBits_t wait(Subscription sub, TickType_t timeout, EventBits_t events = EVT_ALL);
+
+    private:
+        // The groups stay for as long as the bus does, so a publisher never sets bits on a deleted one
+        EventGroupHandle_t groups[MAX_SUBSCRIBERS];
+        std::atomic<bool> taken[MAX_SUBSCRIBERS];
+    };
+}
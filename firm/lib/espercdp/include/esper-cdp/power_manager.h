@@ -0,0 +1,75 @@
+#pragma once
+#include <esper-cdp/atapi.h>
+#include <future>
+
+/// Lets the drive rest while the player sits idle, and gets it going again ahead of time when the user is likely to want it.
+
+namespace CD {
+    /// @brief Distribution of how long the drive took to spin up, in buckets of equal width
+    struct SpinUpHistogram {
+        static const int BUCKET_COUNT = 16;
+        /// @brief Width of each bucket in milliseconds. The last one holds everything above.
+        static const uint32_t BUCKET_MS = 250;
+
+        uint32_t buckets[BUCKET_COUNT] = { 0 };
+        uint32_t count = 0;
+        uint64_t total_ms = 0;
+        uint32_t max_ms = 0;
+
+        void add(uint32_t ms);
+        uint32_t average_ms() const { return count == 0 ? 0 : (uint32_t) (total_ms / count); }
+        /// @brief Approximate percentile (0~100) of the recorded spin-ups, as the upper bound of the bucket it falls into
+        uint32_t percentile_ms(int pct) const;
+    };
+
+    class PowerManager {
+    public:
+        enum class Level {
+            /// @brief Spinning, or at least not told otherwise
+            ACTIVE,
+            /// @brief Spindle stopped
+            IDLE,
+            /// @brief Spindle stopped and the drive in Standby
+            STANDBY
+        };
+
+        /// @brief Idle time value for a level that should never be entered
+        static const TickType_t NEVER = portMAX_DELAY;
+        /// @brief How long the player must sit idle before the drive goes down to each level
+        struct Thresholds {
+            TickType_t idle;
+            TickType_t standby;
+        };
+
+        PowerManager(ATAPI::Device * device);
+        ~PowerManager();
+
+        /// @brief Take the drive one level down if it has been idle for long enough
+        /// @param idle_for Time since the last user command or state change
+        /// @returns Whether a command was queued to the drive
+        bool take_step(const Thresholds& thresholds, TickType_t idle_for);
+        /// @brief Spin the drive up in the background if it was let down, so it's ready by the time the user actually asks for something
+        void pre_spin();
+        /// @brief The drive is being used by something that spins it up anyway, e.g. playback or a TOC read
+        /// @param by_user Whether the user is waiting on it, as opposed to a background job, for telling how often a pre-spin was missed
+        void note_active(bool by_user = true);
+
+        Level get_level() const { return level; }
+        const SpinUpHistogram& get_spin_up_latency() const { return spin_up_latency; }
+        /// @brief Print out the statistics into the log
+        void log_summary() const;
+
+    private:
+        ATAPI::Device * cdrom;
+        volatile Level level = Level::ACTIVE;
+        /// @brief Incremented on every `note_active()`, so that a pre-spin overtaken by a real command can be dropped
+        volatile uint32_t activity_generation = 0;
+        std::shared_future<void> pending_spin = {};
+        bool pre_spin_pending = false;
+
+        SpinUpHistogram spin_up_latency = {};
+        uint32_t pre_spins = 0;
+        /// @brief Times the drive was needed while let down without a pre-spin ahead of it
+        uint32_t cold_starts = 0;
+    };
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <esper-cdp/metadata.h>
+#include <string>
+#include <vector>
+
+/// User programmed play lists: the tracks of a disc in the order the user picked them.
+
+namespace CD {
+    /// @brief Stretch of the disc that can be played with a single PLAY AUDIO
+    struct PlayRange {
+        MSF start;
+        MSF end;
+        /// @brief Index of the program entry the range starts with
+        uint8_t first_entry;
+        /// @brief Number of program entries the range covers
+        uint8_t entry_count;
+    };
+
+    /// @brief Turn a program into the fewest ranges to play: tracks that follow one another on the disc go into one range,
+    /// so that the drive plays across their boundaries without being told anything
+    /// @param program Track numbers as on the disc, in the order to play them
+    /// @note Track numbers not on the disc are skipped
+    std::vector<PlayRange> compile_program(const std::vector<uint8_t>& program, const Album& album);
+
+    /// @brief Keeps the programs of each disc in a folder, keyed by the MusicBrainz disc ID
+    class ProgramStore {
+    public:
+        ProgramStore(const char * path);
+
+        /// @returns An empty program if none was saved for the disc
+        std::vector<uint8_t> load(const Album& album);
+        /// @brief Save the program of the disc, or forget it if the program is empty
+        void save(const Album& album, const std::vector<uint8_t>& program);
+
+    private:
+        std::string path;
+        const std::string id_to_path(const std::string& id);
+    };
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <stdint.h>
+
+namespace ATAPI {
+    /// @brief What the drive told about the last failed command in REQUEST SENSE
+    struct SenseData {
+        uint8_t key;
+        uint8_t asc;
+        uint8_t ascq;
+    };
+
+    enum class RecoveryAction {
+        /// @brief Nothing is wrong (anymore)
+        NONE,
+        /// @brief Transient condition that reading the sense has already cleared, try again after a short breather
+        RETRY,
+        /// @brief The drive is busy with itself, try again after a while
+        BACK_OFF,
+        /// @brief The drive got stuck, reset it and try again
+        RESET,
+        /// @brief Trying again won't make it any better
+        GIVE_UP
+    };
+
+    struct RecoveryStep {
+        RecoveryAction action;
+        /// @brief How long to wait before the next try, for `RETRY` and `BACK_OFF`
+        uint32_t delay_ms;
+        const char * description;
+    };
+
+    /// @brief Look up what to do about the sense data in the recovery table
+    const RecoveryStep& recovery_step_for(const SenseData& sense);
+}
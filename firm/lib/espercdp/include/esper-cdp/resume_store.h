@@ -0,0 +1,52 @@
+#pragma once
+#include <esper-cdp/types.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <string>
+#include <vector>
+
+/// Remembers where each disc was left off, so that it can carry on from there when it comes back.
+
+namespace CD {
+    /// @brief Resume points of the recently played discs. Kept in RAM as the disc plays,
+    /// and appended to a log file in flash only when asked to, so that the flash doesn't wear out on every position read.
+    class ResumeStore {
+    public:
+        /// @param path Log file to keep the points in, or nullptr to keep them in RAM only
+        ResumeStore(const char * path);
+        ~ResumeStore();
+
+        /// @brief Update the resume point of a disc, in RAM only
+        void note(uint32_t disc_id, const MSF position);
+        /// @brief Drop the resume point of a disc, e.g. because it was played to the end
+        void forget(uint32_t disc_id);
+        /// @returns Whether there is a resume point for the disc
+        bool find(uint32_t disc_id, MSF& position);
+        /// @brief Write the points changed since the last flush out to the log
+        void flush();
+
+    private:
+        struct Point {
+            uint32_t disc_id;
+            MSF position;
+            /// @brief Counter value at the last use, the least recently used point goes when out of room
+            uint32_t used;
+            /// @brief Forgotten, but the log doesn't know yet
+            bool forgotten;
+            bool dirty;
+        };
+
+        std::string path;
+        SemaphoreHandle_t semaphore;
+        std::vector<Point> points = {};
+        uint32_t use_counter = 0;
+        size_t log_size = 0;
+
+        Point * find_point(uint32_t disc_id);
+        void load();
+        /// @brief Rewrite the log with only the points still in use
+        /// @returns Whether the new log made it to flash
+        bool compact();
+        static void on_shutdown();
+    };
+}
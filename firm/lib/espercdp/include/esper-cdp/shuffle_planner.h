@@ -0,0 +1,58 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+/// Plans the shuffle play order over all tracks of all discs in the changer ahead of time.
+
+namespace CD {
+    class ShufflePlanner {
+    public:
+        struct Entry {
+            uint8_t slot;
+            /// @brief 0-based index of the track in the album's track list
+            uint8_t track;
+        };
+
+        /// @param tracks_per_disc How many tracks to play off a disc before moving on to another one, bounding how often the changer has to swap discs
+        ShufflePlanner(int tracks_per_disc);
+        ~ShufflePlanner();
+
+        /// @brief Make a new play order
+        /// @param track_counts Number of tracks in each slot, 0 for slots to leave out
+        /// @param layout_id Identifies the set of discs the plan is for, e.g. a hash of their disc IDs
+        /// @param seed Random seed. The same counts and seed always give the same order.
+        /// @param first_slot Slot to start from, usually the one already in the drive, or -1 to start anywhere
+        void plan(const std::vector<uint8_t>& track_counts, uint32_t layout_id, uint32_t seed, int first_slot = -1);
+        /// @brief Pick up the plan saved before a power cycle
+        /// @returns Whether there was a plan for the same discs with tracks left to play
+        bool restore(const std::vector<uint8_t>& track_counts, uint32_t layout_id);
+        void clear();
+
+        /// @brief Take the next track of the plan
+        /// @returns False once all tracks of the plan have been played
+        bool next(Entry& out);
+        /// @brief Step back to the track played before the current one
+        bool previous(Entry& out);
+        /// @brief Look at a track coming up without taking it
+        /// @param ahead 0 for the one `next()` would give, 1 for the one after it, etc.
+        bool peek(Entry& out, size_t ahead = 0) const;
+
+        bool is_planned_for(uint32_t layout_id) const { return entries != nullptr && layout == layout_id; }
+        size_t get_length() const { return count; }
+        /// @brief Number of tracks of the plan taken so far
+        size_t get_position() const { return cursor; }
+
+    private:
+        int tracks_per_disc;
+        Entry * entries = nullptr;
+        size_t count = 0;
+        size_t cursor = 0;
+        uint32_t layout = 0;
+        uint32_t seed = 0;
+        int first_slot = -1;
+
+        /// @brief Remember where we are in the plan in the NVS
+        void save();
+    };
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <esper-cdp/atapi.h>
+#include <esp_timer.h>
+
+/// Sends the PLAY AUDIO of the next range right as the current one runs out, instead of after the poll cycle notices it did.
+
+namespace CD {
+    class TransitionScheduler {
+    public:
+        enum class Phase {
+            IDLE,
+            /// @brief Waiting for the time to send the command
+            ARMED,
+            /// @brief Command sent, but not yet acknowledged by the player
+            FIRED
+        };
+
+        TransitionScheduler(ATAPI::Device * device);
+        ~TransitionScheduler();
+
+        /// @brief Send PLAY AUDIO for the given range at the given time
+        /// @param at_us Time to send it at, as in `esp_timer_get_time()`
+        void arm(int64_t at_us, const MSF start, const MSF end);
+        /// @brief Drop the armed command, if it hasn't gone out yet
+        /// @returns Whether the command went out already
+        bool cancel();
+        /// @brief Get back to IDLE after the player took note of the command having gone out
+        void acknowledge();
+        Phase get_phase() const { return phase; }
+
+    private:
+        ATAPI::Device * cdrom;
+        esp_timer_handle_t timer = nullptr;
+        SemaphoreHandle_t semaphore;
+        volatile Phase phase = Phase::IDLE;
+        MSF start = { 0 };
+        MSF end = { 0 };
+
+        static void on_timer(void * arg);
+    };
+}
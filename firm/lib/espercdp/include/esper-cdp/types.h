@@ -78,7 +78,6 @@ namespace ATAPI {
     struct DiscTOC {
         const MSF leadOut;
         const std::vector<DiscTrack> tracks;
-        const std::vector<uint8_t> toc_subchannel;
     };
 
     enum MediaTypeCode: uint8_t {
@@ -0,0 +1,186 @@
+#pragma once
+#include <esper-core/ide.h>
+#include "types.h"
+#include "wait_profile.h"
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+/// A software ATAPI CD-ROM drive sitting behind the IDE bus interface, for exercising `ATAPI::Device` and `CD::Player` without the real hardware.
+
+namespace ATAPI {
+    struct VirtualTrack {
+        uint8_t number;
+        /// @brief Index number and absolute frame of its start, sorted. Index 1 is where the TOC points to.
+        std::vector<std::pair<uint8_t, int>> indexes;
+        bool preemphasis;
+        std::string title;
+        std::string performer;
+        std::string isrc;
+
+        int start_frame() const;
+        int pregap_frame() const { return indexes.front().second; }
+    };
+
+    /// @brief Piece of the disc's audio that comes from one WAV file
+    struct VirtualFile {
+        /// @brief Empty if the file could not be read, then the piece plays as silence
+        std::string path;
+        int start_frame;
+        int frame_count;
+        /// @brief Where the PCM data starts in the file
+        long data_offset;
+    };
+
+    struct VirtualDisc {
+        std::string title;
+        std::string performer;
+        std::string catalog;
+        std::vector<VirtualTrack> tracks;
+        std::vector<VirtualFile> files;
+        int lead_out_frame;
+
+        /// @brief The track that the given absolute frame belongs to, counting the pregap in
+        const VirtualTrack * track_at(int frame) const;
+
+        /// @brief Build a disc from a cue sheet. Track lengths are taken from the WAV files next to the cue sheet.
+        /// @note Files that can't be found are assumed to be one minute long, so the layout stays usable without the audio.
+        static std::shared_ptr<VirtualDisc> from_cue(const char * path);
+        /// @brief Build a disc of silent tracks of the same length, for when only the layout matters
+        static std::shared_ptr<VirtualDisc> silent(int track_count, int track_frames);
+    };
+
+    class VirtualDrive: public Platform::IDEBus {
+    public:
+        using Clock = int64_t (*)();
+
+        /// @brief Simulated mechanism timings, in microseconds
+        struct Latencies {
+            /// @brief Busy time of any command not listed below
+            uint32_t command;
+            uint32_t read_toc;
+            /// @brief READ TOC for the CD-TEXT, which some drives take seconds over
+            uint32_t read_cd_text;
+            uint32_t seek;
+            uint32_t spin_up;
+            uint32_t changer_load;
+        };
+
+        /// @param slot_count Number of changer slots, 1 for a plain drive
+        /// @param clock Time source in microseconds. Pass a virtual clock to run the drive in simulated time.
+        VirtualDrive(uint8_t slot_count = 1, Clock clock = nullptr);
+
+        data16 read(uint8_t reg) override;
+        void write(uint8_t reg, data16 data) override;
+        void reset() override;
+        void read_block(uint8_t reg, void * buf, size_t words) override;
+        void write_block(uint8_t reg, const void * buf, size_t words) override;
+        uint32_t get_transaction_count() override { return access_count; }
+
+        void insert_disc(uint8_t slot, std::shared_ptr<const VirtualDisc> disc);
+        void remove_disc(uint8_t slot);
+        /// @brief Simulate the user pushing the tray in or pulling it out
+        void set_door_open(bool open);
+
+        Latencies latencies = {
+            .command = 2000,
+            .read_toc = 50000,
+            .read_cd_text = 50000,
+            .seek = 150000,
+            .spin_up = 1500000,
+            .changer_load = 3000000
+        };
+        /// @brief Busy time override for specific packet opcodes, in microseconds
+        std::map<uint8_t, uint32_t> command_latency;
+
+        /// @brief Longest silence between two PLAY AUDIO ranges that still counts as a transition from one to the other
+        static const int64_t GAP_WINDOW_US = 10000000;
+        /// @brief Silence between the audio of one PLAY AUDIO range and the next, in microseconds
+        const WaitHistogram& get_play_gaps() { return play_gaps; }
+        /// @brief Frames of audio lost to a PLAY AUDIO that came in before the previous range was over
+        uint32_t get_cut_frames() { return cut_frames; }
+        void reset_play_gaps() { play_gaps = WaitHistogram(); cut_frames = 0; }
+
+    private:
+        enum class Phase {
+            IDLE,
+            RECEIVE_PACKET,
+            DATA_TO_HOST
+        };
+
+        enum class AudioState {
+            NONE,
+            PLAYING,
+            PAUSED,
+            SCANNING,
+            COMPLETED,
+            /// @brief Completed, and the host was told so already. Reads as no status, but the next PLAY AUDIO still follows on from it.
+            REPORTED
+        };
+
+        struct Slot {
+            std::shared_ptr<const VirtualDisc> disc;
+            bool changed;
+        };
+
+        Clock clock;
+        uint32_t access_count = 0;
+
+        uint8_t regs[16] = { 0 };
+        uint8_t error = 0;
+        bool err_flag = false;
+        int64_t busy_until = 0;
+        Phase phase = Phase::IDLE;
+        std::vector<uint8_t> packet = {};
+        size_t packet_expected = 0;
+        std::vector<uint8_t> out = {};
+        size_t out_pos = 0;
+        uint8_t sense_key = 0;
+        uint8_t sense_asc = 0;
+        uint8_t sense_ascq = 0;
+
+        std::vector<Slot> slots;
+        uint8_t current_slot = 0;
+        int pending_slot = -1;
+        int64_t changer_ready_at = 0;
+        bool door_open = false;
+        int64_t spun_up_at = 0;
+        bool spinning = false;
+
+        AudioState audio = AudioState::NONE;
+        int play_pos = 0;
+        int play_end = 0;
+        int64_t play_anchor = 0;
+        bool scan_reverse = false;
+        /// @brief When the audio of the last range stopped coming out
+        int64_t audio_stopped_at = 0;
+        WaitHistogram play_gaps = {};
+        uint32_t cut_frames = 0;
+
+        uint8_t cda_ports[4][2] = { {1, 255}, {2, 255}, {1, 255}, {2, 255} };
+
+        int64_t now();
+        const VirtualDisc * current_disc();
+        bool is_ready();
+        void update_mechanism();
+        int current_frame();
+
+        void execute_command(uint8_t cmd);
+        void execute_packet();
+        void finish(uint32_t latency_us, uint8_t opcode);
+        void fail(uint8_t key, uint8_t asc, uint8_t ascq = 0);
+        /// @brief Fail with no medium or becoming ready, depending on whether there is a disc
+        void fail_not_ready();
+
+        void reply_identify();
+        void reply_read_toc();
+        void reply_cd_text();
+        void reply_subchannel();
+        void reply_read_cd();
+        void reply_mech_status();
+        void reply_mode_sense();
+        void reply_request_sense();
+        void accept_mode_select();
+    };
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <map>
+#include <string>
+
+namespace ATAPI {
+    /// @brief Distribution of how long the drive kept us waiting, in power-of-two buckets
+    struct WaitHistogram {
+        static const int BUCKET_COUNT = 16;
+        /// @brief Upper bound of the first bucket in microseconds, each next one is twice as large. The last one holds everything above.
+        static const uint32_t FIRST_BUCKET_US = 64;
+
+        uint32_t buckets[BUCKET_COUNT] = { 0 };
+        uint32_t count = 0;
+        uint64_t total_us = 0;
+        uint32_t min_us = UINT32_MAX;
+        uint32_t max_us = 0;
+
+        void add(uint32_t us);
+        uint32_t average_us() const { return count == 0 ? 0 : (uint32_t) (total_us / count); }
+        /// @brief Approximate percentile (0~100) of the recorded waits, as the upper bound of the bucket it falls into
+        uint32_t percentile_us(int pct) const;
+        static uint32_t bucket_upper_bound_us(int bucket) { return FIRST_BUCKET_US << bucket; }
+    };
+
+    /// @brief Learns how long the drive takes to process each command, so status waits can sleep instead of hammering the bus
+    class WaitProfile {
+    public:
+        /// @brief Opcode value to use for waits not caused by a packet command
+        static const int NO_OPCODE = -1;
+
+        WaitProfile();
+        ~WaitProfile();
+        WaitProfile(const WaitProfile&) = delete;
+        WaitProfile& operator=(const WaitProfile&) = delete;
+
+        void record(const char * tag, int opcode, uint32_t us);
+        /// @brief Learned typical duration of the command with the given opcode, or 0 if nothing is known yet
+        uint32_t expected_us(int opcode) const;
+
+        /// @brief Copy of the histograms so far, as they keep changing on the drive's task
+        std::map<std::string, WaitHistogram> get_histograms() const;
+        void reset();
+        /// @brief Print out the statistics into the log
+        void log_summary() const;
+
+    private:
+        /// @brief Guards the histograms, which get new tags from the drive's task while the UI may be reading them out
+        SemaphoreHandle_t semaphore;
+        std::map<std::string, WaitHistogram> histograms = {};
+        /// @brief Exponentially weighted moving average of the wait per opcode, in microseconds
+        uint32_t opcode_ewma[256] = { 0 };
+    };
+}
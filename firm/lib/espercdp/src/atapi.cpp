@@ -1,11 +1,31 @@
 #include <esper-cdp/atapi.h>
 #include <esper-cdp/atapi-protocol.h>
+#include <esper-cdp/checksum.h>
+#include <esper-core/prefs.h>
+#include <esp_timer.h>
 #include <cassert>
 #include <algorithm>
 #include <endian.h>
 
 static const char LOG_TAG[] = "ATAPI";
 
+// Version of the stored PIO timings blob, bump when the layout of PioTimings changes
+static const uint8_t PIO_TIMINGS_VERSION = 1;
+// Calibration stops narrowing a delay down once the search range is this small
+static const uint16_t PIO_CALIBRATION_RESOLUTION_US = 4;
+// How many identical INQUIRY responses it takes to call a timing safe
+static const int PIO_PROBE_REPEATS = 8;
+// Version of the stored drive profile, bump when the layout of DriveProfile or the quirks database changes
+static const uint8_t DRIVE_PROFILE_VERSION = 1;
+static const Prefs::Key<std::vector<uint8_t>> PREFS_KEY_DRIVE_PROFILE = { "drv_profile", {} };
+// Shortest pause before going again on a RETRY from the recovery table
+static const uint32_t RETRY_MIN_DELAY_MS = 10;
+
+static void pio_delay(uint32_t us) {
+    if(us >= 1000) delay(us / 1000);
+    else if(us > 0) delayMicroseconds(us);
+}
+
 namespace ATAPI {
     static void ata_str_to_human(char * atastr, size_t len) {
         for(int i = 0; i < len; i += 2) {
@@ -19,6 +39,13 @@ namespace ATAPI {
         }
     }
 
+    static void queueTask(void* pvParameter) {
+        Device* device = static_cast<Device*>(pvParameter);
+        while(true) {
+            device->process_queue();
+        }
+    }
+
     Device::Device(Platform::IDEBus * bus): 
         ide(bus) 
     {
@@ -29,7 +56,67 @@ namespace ATAPI {
         semaphore = xSemaphoreCreateBinary();
         xSemaphoreGive(semaphore);
 
+        queue_semaphore = xSemaphoreCreateMutex();
+
         quirks = {0};
+
+        xTaskCreate(
+            queueTask,
+            "ATAPIQ",
+            8000,
+            this,
+            5,
+            &queue_task
+        );
+    }
+
+    std::shared_future<void> Device::submit(Priority priority, std::function<void()> job, std::function<void()> on_done) {
+        auto promise = std::make_shared<std::promise<void>>();
+        std::shared_future<void> rslt = promise->get_future().share();
+
+        xSemaphoreTake(queue_semaphore, portMAX_DELAY);
+        queue[(int) priority].push_back(QueuedJob {
+            .job = job,
+            .on_done = on_done,
+            .promise = promise
+        });
+        xSemaphoreGive(queue_semaphore);
+
+        xTaskNotifyGive(queue_task);
+        return rslt;
+    }
+
+    bool Device::has_pending(Priority priority) {
+        xSemaphoreTake(queue_semaphore, portMAX_DELAY);
+        bool rslt = !queue[(int) priority].empty();
+        xSemaphoreGive(queue_semaphore);
+        return rslt;
+    }
+
+    void Device::process_queue() {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        while(true) {
+            QueuedJob next;
+            bool found = false;
+
+            xSemaphoreTake(queue_semaphore, portMAX_DELAY);
+            for(auto& q: queue) {
+                if(!q.empty()) {
+                    next = q.front();
+                    q.pop_front();
+                    found = true;
+                    break;
+                }
+            }
+            xSemaphoreGive(queue_semaphore);
+
+            if(!found) break;
+
+            next.job();
+            if(next.on_done) next.on_done();
+            next.promise->set_value();
+        }
     }
 
     void Device::reset() {
@@ -40,14 +127,92 @@ namespace ATAPI {
         ide->write(IDE::Register::Command, {{.low = 0x91, .high = 0xFF}});
         xSemaphoreGive(semaphore);
 
+        int64_t started = esp_timer_get_time();
         _diags.is_atapi = check_atapi_compatible();
-        self_test();
         init_task_file();
         identify();
+        bool known = load_drive_profile();
+        if(!known) {
+            // Full probe of a drive never seen before, or changed since
+            self_test();
+            init_task_file();
+            look_up_quirks();
+        }
+        load_pio_timings();
         query_state();
-        _diags.capas = mode_sense_capabilities();
+        if(!known) {
+            _diags.capas = mode_sense_capabilities();
+            profile = std::make_shared<DriveProfile>();
+            save_drive_profile();
+        }
         set_speed();
-        ESP_LOGI(LOG_TAG, "end of Reset");
+        ESP_LOGI(LOG_TAG, "end of Reset (%s drive) in %lli ms", known ? "known" : "new", (esp_timer_get_time() - started) / 1000);
+    }
+
+    struct __attribute__((packed)) Device::DriveProfile {
+        bool has_cda;
+        Responses::ModeSense cda_header;
+        ModeSenseCDAControlModePage cda;
+        bool has_power;
+        Responses::ModeSense power_header;
+        Responses::ModeSensePowerConditionModePage power;
+    };
+
+    struct __attribute__((packed)) StoredDriveProfile {
+        uint8_t version;
+        uint32_t identity;
+        uint16_t self_test_result;
+        Device::Quirks quirks;
+        CapabilitiesMechStatusModePage capas;
+    };
+
+    uint32_t Device::drive_identity() {
+        const std::string identity = info.model + "/" + info.firmware + "/" + info.serial;
+        return ~crc32_update(0xFFFFFFFF, (const uint8_t *) identity.c_str(), identity.size());
+    }
+
+    bool Device::load_drive_profile() {
+        const std::vector<uint8_t> blob = Prefs::get(PREFS_KEY_DRIVE_PROFILE);
+        if(blob.size() != sizeof(StoredDriveProfile) + sizeof(DriveProfile)) return false;
+
+        StoredDriveProfile stored;
+        memcpy(&stored, blob.data(), sizeof(stored));
+        if(stored.version != DRIVE_PROFILE_VERSION || stored.identity != drive_identity()) {
+            ESP_LOGI(LOG_TAG, "Stored drive profile is of another drive");
+            return false;
+        }
+
+        quirks = stored.quirks;
+        _diags.self_test_result = stored.self_test_result;
+        _diags.capas = stored.capas;
+        profile = std::make_shared<DriveProfile>();
+        memcpy(profile.get(), &blob[sizeof(stored)], sizeof(DriveProfile));
+        if(profile->has_cda) _diags.cda = profile->cda;
+
+        ESP_LOGI(LOG_TAG, "Using the stored drive profile (mode pages: CDA %s, power %s)", profile->has_cda ? "yes" : "no", profile->has_power ? "yes" : "no");
+        return true;
+    }
+
+    void Device::save_drive_profile() {
+        if(profile == nullptr) return;
+
+        const StoredDriveProfile stored = {
+            .version = DRIVE_PROFILE_VERSION,
+            .identity = drive_identity(),
+            .self_test_result = _diags.self_test_result,
+            .quirks = quirks,
+            .capas = _diags.capas
+        };
+
+        std::vector<uint8_t> blob = {};
+        blob.insert(blob.end(), (const uint8_t *) &stored, (const uint8_t *) &stored + sizeof(stored));
+        blob.insert(blob.end(), (const uint8_t *) profile.get(), (const uint8_t *) profile.get() + sizeof(DriveProfile));
+        Prefs::set(PREFS_KEY_DRIVE_PROFILE, blob);
+    }
+
+    void Device::forget_drive_profile() {
+        profile = nullptr;
+        Prefs::set(PREFS_KEY_DRIVE_PROFILE, std::vector<uint8_t>());
     }
 
     const DriveInfo * Device::get_info() { return &info; }
@@ -183,6 +348,11 @@ namespace ATAPI {
 
     void Device::init_task_file() {
         xSemaphoreTake(semaphore, portMAX_DELAY);
+        write_task_file();
+        xSemaphoreGive(semaphore);
+    }
+
+    void Device::write_task_file() {
         ESP_LOGI(LOG_TAG, "init task file");
         ide->write(IDE::Register::Feature, {{ .low = (FeatureRegister {{ .DMA = false, .overlap = false }}).value, .high = 0xFF }});
 
@@ -195,7 +365,6 @@ namespace ATAPI {
 
         wait_not_busy("TSK");
         wait_drq_end();
-        xSemaphoreGive(semaphore);
     }
 
     bool Device::self_test() {
@@ -218,6 +387,7 @@ namespace ATAPI {
         ide->write(IDE::Register::Command, {{ .low = Command::IDENTIFY_PACKET_DEVICE, .high = 0xFF }});
         wait_not_busy("ID");
         wait_drq();
+        pio_remain = 512; // ATA PIO data-in: one 256-word sector, byte count registers carry nothing of use here
         read_response(&rslt, sizeof(Responses::IdentifyPacket), true);
         xSemaphoreGive(semaphore);
 
@@ -235,10 +405,14 @@ namespace ATAPI {
         info.serial = std::string(buf);
 
         packet_size = ((rslt.general_config & 0x1) != 0) ? 16 : 12;
-        
-        quirks = { 0 };
 
+        ESP_LOGI(LOG_TAG, "Drive Model = '%s', SN = '%s', FW = '%s', packet size = %i", info.model.c_str(),  info.serial.c_str(), info.firmware.c_str(), packet_size);
+    }
+
+    void Device::look_up_quirks() {
+        quirks = { 0 };
 
+        // NB: the quirks are stored in the drive profile, so bump DRIVE_PROFILE_VERSION when changing this
         static const std::vector<std::pair<std::string, Quirks>> quirks_db = {
             {"TEAC DV-W58G-A", Quirks {.must_use_softscan = true}},
             {"TEAC DV-W516GDM", Quirks {.must_use_softscan = true}},
@@ -261,8 +435,126 @@ namespace ATAPI {
                 break;
             }
         }
+    }
 
-        ESP_LOGI(LOG_TAG, "Drive Model = '%s', SN = '%s', FW = '%s', packet size = %i", info.model.c_str(),  info.serial.c_str(), info.firmware.c_str(), packet_size);
+    const std::string Device::pio_timings_pref_key() {
+        // NVS keys are limited to 15 characters, so go by a hash of the model and firmware
+        const std::string identity = info.model + "/" + info.firmware;
+        uint32_t hash = ~crc32_update(0xFFFFFFFF, (const uint8_t *) identity.c_str(), identity.size());
+        char key[16] = { 0 };
+        snprintf(key, sizeof(key), "piot_%08x", hash);
+        return std::string(key);
+    }
+
+    void Device::load_pio_timings() {
+        timings = DEFAULT_PIO_TIMINGS;
+
+        const Prefs::Key<std::vector<uint8_t>> key = { pio_timings_pref_key(), {} };
+        const std::vector<uint8_t> blob = Prefs::get(key);
+        if(blob.size() == 1 + sizeof(PioTimings) && blob[0] == PIO_TIMINGS_VERSION) {
+            memcpy(&timings, &blob[1], sizeof(PioTimings));
+            ESP_LOGI(LOG_TAG, "Using stored PIO timings: pre-packet %uus, pre-command %uus, post-packet %uus, word gap %uus", timings.pre_packet_us, timings.pre_command_us, timings.post_packet_us, timings.word_gap_us);
+        } else {
+            ESP_LOGI(LOG_TAG, "New drive, calibrating PIO timings");
+            calibrate_pio_timings();
+        }
+    }
+
+    void Device::calibrate_pio_timings() {
+        timings = DEFAULT_PIO_TIMINGS;
+        const std::vector<uint8_t> reference = inquiry();
+        if(reference.empty() || !probe_pio_timings(reference)) {
+            // Not even the safe timings give a stable response, so there is nothing to go by. Try again next time.
+            ESP_LOGW(LOG_TAG, "Drive does not respond to INQUIRY consistently, keeping the default PIO timings");
+            return;
+        }
+
+        struct Tunable {
+            uint16_t * value;
+            const uint16_t safe;
+        };
+        std::vector<Tunable> tunables = {
+            { &timings.pre_packet_us, DEFAULT_PIO_TIMINGS.pre_packet_us },
+            { &timings.pre_command_us, DEFAULT_PIO_TIMINGS.pre_command_us },
+        };
+        if(quirks.busy_ass) {
+            tunables.push_back({ &timings.post_packet_us, DEFAULT_PIO_TIMINGS.post_packet_us });
+            tunables.push_back({ &timings.word_gap_us, DEFAULT_PIO_TIMINGS.word_gap_us });
+        }
+
+        int64_t started = esp_timer_get_time();
+        for(auto& t: tunables) {
+            // Everything below `lo` is known to fail, `hi` is known to work
+            uint16_t lo = 0;
+            uint16_t hi = t.safe;
+            while(hi - lo > PIO_CALIBRATION_RESOLUTION_US) {
+                uint16_t mid = (lo + hi) / 2;
+                *t.value = mid;
+                if(probe_pio_timings(reference)) {
+                    hi = mid;
+                } else {
+                    lo = mid + 1;
+                    recover_after_probe();
+                }
+            }
+
+            // Leave some margin for a warm drive or a worn out belt, the worst case was only seen for a few dozen commands
+            *t.value = std::min((uint32_t) t.safe, (uint32_t) hi + hi / 4 + PIO_CALIBRATION_RESOLUTION_US);
+        }
+
+        // Check that the combination holds up as well, and fall back to the safe values if it doesn't
+        if(!probe_pio_timings(reference)) {
+            ESP_LOGW(LOG_TAG, "Calibrated PIO timings failed the final check, keeping the default ones");
+            recover_after_probe();
+            timings = DEFAULT_PIO_TIMINGS;
+        }
+
+        ESP_LOGI(LOG_TAG, "Calibrated PIO timings in %lli ms: pre-packet %uus, pre-command %uus, post-packet %uus, word gap %uus", (esp_timer_get_time() - started) / 1000, timings.pre_packet_us, timings.pre_command_us, timings.post_packet_us, timings.word_gap_us);
+
+        std::vector<uint8_t> blob = { PIO_TIMINGS_VERSION };
+        blob.insert(blob.end(), (const uint8_t *) &timings, (const uint8_t *) &timings + sizeof(PioTimings));
+        Prefs::set(Prefs::Key<std::vector<uint8_t>> { pio_timings_pref_key(), {} }, blob);
+    }
+
+    const std::vector<uint8_t> Device::inquiry() {
+        static const uint8_t INQUIRY_LENGTH = 36;
+        const Requests::Inquiry req = {
+            .opcode = OperationCodes::INQUIRY,
+            .allocation_length = INQUIRY_LENGTH
+        };
+
+        std::vector<uint8_t> rslt(INQUIRY_LENGTH, 0);
+
+        xSemaphoreTake(semaphore, portMAX_DELAY);
+        send_packet(&req, sizeof(req), true);
+        bool ok = !read_sts_regi().ERR && read_response(rslt.data(), rslt.size(), false);
+        read_response(nullptr, 0, true);
+        xSemaphoreGive(semaphore);
+
+        if(!ok) rslt.clear();
+        return rslt;
+    }
+
+    bool Device::probe_pio_timings(const std::vector<uint8_t>& reference) {
+        for(int i = 0; i < PIO_PROBE_REPEATS; i++) {
+            if(inquiry() != reference) return false;
+        }
+        return true;
+    }
+
+    void Device::recover_after_probe() {
+        // A packet sent too fast may have been half received, DEVICE RESET gets the drive out of that no matter what
+        const PioTimings tried = timings;
+        timings = DEFAULT_PIO_TIMINGS;
+
+        xSemaphoreTake(semaphore, portMAX_DELAY);
+        ide->write(IDE::Register::Command, {{ .low = Command::DEVICE_RESET, .high = 0xFF }});
+        delay(1);
+        wait_not_busy("RST");
+        xSemaphoreGive(semaphore);
+        init_task_file();
+
+        timings = tried;
     }
 
     void Device::start(bool state) {
@@ -276,6 +568,13 @@ namespace ATAPI {
         xSemaphoreGive(semaphore);
     }
 
+    void Device::standby() {
+        xSemaphoreTake(semaphore, portMAX_DELAY);
+        ide->write(IDE::Register::Command, {{ .low = Command::STANDBY_IMMEDIATE, .high = 0xFF }});
+        wait_not_busy("STBY");
+        xSemaphoreGive(semaphore);
+    }
+
     void Device::eject(bool open) {
         const Requests::StartStopUnit req = {
             .opcode = OperationCodes::START_STOP_UNIT,
@@ -321,6 +620,22 @@ namespace ATAPI {
         xSemaphoreGive(semaphore);
     }
 
+    bool Device::seek(uint32_t lba) {
+        const Requests::Seek req = {
+            .opcode = OperationCodes::SEEK,
+            .lba = htobe32(lba)
+        };
+
+        xSemaphoreTake(semaphore, portMAX_DELAY);
+        send_packet(&req, sizeof(req), true);
+        wait_not_busy("SEEK");
+        bool rslt = !read_sts_regi().ERR;
+        xSemaphoreGive(semaphore);
+
+        if(!rslt) ESP_LOGW(LOG_TAG, "SEEK to LBA %u failed", lba);
+        return rslt;
+    }
+
     void Device::pause(bool pause) {
         const Requests::PauseResume req = {
             .opcode = OperationCodes::PAUSE_RESUME,
@@ -372,6 +687,27 @@ namespace ATAPI {
     }
 
     void Device::mode_select_output_ports() {
+        if(profile != nullptr && profile->has_cda) {
+            // The drive forgets the page on reset, but what to set is known from the last time
+            struct ATAPI_PKT {
+                Requests::ModeSelect a = {
+                    .opcode = OperationCodes::MODE_SELECT,
+                    .set_me_to_true = true,
+                    .parameter_list_length = htobe16(sizeof(Responses::ModeSense) + sizeof(ModeSenseCDAControlModePage))
+                };
+                Responses::ModeSense b;
+                ModeSenseCDAControlModePage c;
+            } tmp;
+            tmp.b = profile->cda_header;
+            tmp.c = profile->cda;
+
+            xSemaphoreTake(semaphore, portMAX_DELAY);
+            send_packet(&tmp, sizeof(tmp), true);
+            xSemaphoreGive(semaphore);
+            _diags.cda = profile->cda;
+            return;
+        }
+
         const Requests::ModeSense msrq = {
             .opcode = OperationCodes::MODE_SENSE,
             .page = ModeSensePageCode::MSPC_CDA_CONTROL,
@@ -447,10 +783,36 @@ namespace ATAPI {
             cdactl2.ports[0].channel, cdactl2.ports[0].volume, cdactl2.ports[1].channel, cdactl2.ports[1].volume, cdactl2.ports[2].channel, cdactl2.ports[2].volume, cdactl2.ports[3].channel, cdactl2.ports[3].volume);
         
         _diags.cda = cdactl2;
+
+        if(profile != nullptr) {
+            profile->has_cda = true;
+            profile->cda_header = mph;
+            profile->cda = cdactl;
+            save_drive_profile();
+        }
     }
 
     void Device::mode_select_power_conditions() {
         // disable standby timers (e.g. some TEAC drives go to sleep during long pause)
+        if(profile != nullptr && profile->has_power) {
+            struct ATAPI_PKT {
+                Requests::ModeSelect a = {
+                    .opcode = OperationCodes::MODE_SELECT,
+                    .set_me_to_true = true,
+                    .parameter_list_length = htobe16(sizeof(Responses::ModeSense) + sizeof(Responses::ModeSensePowerConditionModePage))
+                };
+                Responses::ModeSense b;
+                Responses::ModeSensePowerConditionModePage c;
+            } tmp;
+            tmp.b = profile->power_header;
+            tmp.c = profile->power;
+
+            xSemaphoreTake(semaphore, portMAX_DELAY);
+            send_packet(&tmp, sizeof(tmp), true);
+            xSemaphoreGive(semaphore);
+            return;
+        }
+
         const Requests::ModeSense msrq = {
             .opcode = OperationCodes::MODE_SENSE,
             .page = ModeSensePageCode::MSPC_POWER_CONDITION,
@@ -508,6 +870,13 @@ namespace ATAPI {
         pwrctl2.idle_timer = be16toh(pwrctl.idle_timer);
         pwrctl2.standby_timer = be16toh(pwrctl.standby_timer);
         ESP_LOGI(LOG_TAG, "NEW power status: IDLE[%i: %i] STBY[%i: %i]", pwrctl2.idle, pwrctl2.idle_timer, pwrctl2.standby, pwrctl2.standby_timer);
+
+        if(profile != nullptr) {
+            profile->has_power = true;
+            profile->power_header = mph;
+            profile->power = pwrctl;
+            save_drive_profile();
+        }
     }
 
     void Device::play(const MSF start, const MSF end) {
@@ -538,8 +907,7 @@ namespace ATAPI {
         xSemaphoreGive(semaphore);
     }
 
-    const std::vector<uint8_t> Device::read_cd_text_toc_locked() {
-        // just for fun let's try this
+    bool Device::read_cd_text(std::function<void(const uint8_t * pack)> on_pack) {
         const Requests::ReadTOC req = {
             .opcode = OperationCodes::READ_TOC_PMA_ATIP,
             .msf = true,
@@ -547,6 +915,7 @@ namespace ATAPI {
             .allocation_length = htobe16(0x7FFF) // oughtta be enough!
         };
 
+        xSemaphoreTake(semaphore, portMAX_DELAY);
         send_packet(&req, sizeof(req), true);
         delay(50); // some drives e.g. CD68E seem to be kinda slow on the response, producing invalid output
         wait_not_busy("CDTX");
@@ -561,26 +930,37 @@ namespace ATAPI {
             uint16_t size;
             uint16_t reserved;
         } head;
-        read_response(&head, sizeof(head), false);
-
-        std::vector<uint8_t> rslt = {};
+        bool rslt = false;
 
-        if(head.reserved != 0) {
+        if(!read_response(&head, sizeof(head), false, true) || head.reserved != 0) {
             ESP_LOGW(LOG_TAG, "CD text: expected bytes [2] and [3] to be 0 but they were 0x%04x, probably the device can't read CD Text, bailing out!", head.reserved);
-            read_response(nullptr, 0, true);
         }
         else {
-            head.size = be16toh(head.size);
-            std::vector<uint8_t> buffer(head.size);
-            read_response(&buffer[0], head.size, true);
-            rslt = buffer;
-            // printf("CDTXT: ");
-            // for(size_t i=0;i<head.size; i++) {
-            //     printf("%02x ", buffer[i]);
-            // }
-            // printf("\n");
+            // The size counts the reserved bytes as well, but not itself
+            size_t remain = (be16toh(head.size) - sizeof(head.reserved)) / CD_TEXT_PACK_SIZE;
+            size_t total = 0;
+            uint8_t buffer[CD_TEXT_PACK_SIZE * CD_TEXT_CHUNK_PACKS];
+            int64_t start = esp_timer_get_time();
+
+            while(remain > 0) {
+                size_t count = std::min(remain, (size_t) CD_TEXT_CHUNK_PACKS);
+                if(!read_response(buffer, count * CD_TEXT_PACK_SIZE, false, true)) {
+                    ESP_LOGW(LOG_TAG, "CD text: drive stopped sending after %i packs", total);
+                    break;
+                }
+                for(size_t i = 0; i < count; i++) on_pack(&buffer[i * CD_TEXT_PACK_SIZE]);
+                remain -= count;
+                total += count;
+            }
+
+            int64_t elapsed = std::max((int64_t) 1, esp_timer_get_time() - start);
+            ESP_LOGI(LOG_TAG, "CD text: read %i packs in %lli us (%lli B/s)", total, elapsed, (total * CD_TEXT_PACK_SIZE * 1000000LL) / elapsed);
+            rslt = (total > 0);
         }
 
+        read_response(nullptr, 0, true);
+        xSemaphoreGive(semaphore);
+
         return rslt;
     }
 
@@ -597,7 +977,6 @@ namespace ATAPI {
         Responses::ReadTOCResponseHeader res_hdr;
         bool success = false;
         int attempts = quirks.fucky_toc_reads ? 20 : 2;
-        std::vector<uint8_t> toc_subchannel = {};
         std::vector<DiscTrack> tracks = {};
         MSF leadOut = { .M = 0, .S = 0, .F = 0 };
         Responses::NormalTOCEntry entry;
@@ -605,12 +984,26 @@ namespace ATAPI {
         tracks = {};
 
         xSemaphoreTake(semaphore, portMAX_DELAY);
+        RecoveryBudget budget = begin_recovery(OperationCodes::READ_TOC_PMA_ATIP);
 
+        bool first_attempt = true;
         do {
             tracks.clear();
             send_packet(&req, sizeof(req), true);
+            if(!first_attempt && cmd_stats != nullptr) cmd_stats->retries++;
+            first_attempt = false;
             delay(quirks.fucky_toc_reads ? 1000 : 50); // some drives e.g. CD68E seem to be kinda slow on the response, producing invalid output
-            wait_not_busy("TOC");
+            if(!wait_not_busy("TOC", budget.deadline)) {
+                give_up_locked(budget, "drive stayed busy reading the TOC");
+                break;
+            }
+
+            if(read_sts_regi().ERR) {
+                // Not garbage but a proper refusal, so the sense tells whether another go makes sense at all
+                read_response(nullptr, 0, true);
+                if(recover_locked(budget) == RecoveryAction::GIVE_UP) break;
+                continue;
+            }
 
             read_response(&res_hdr, sizeof(res_hdr), false);
             res_hdr.data_length = be16toh(res_hdr.data_length);
@@ -620,7 +1013,11 @@ namespace ATAPI {
                 ESP_LOGI(LOG_TAG, "TOC reading attempts = %i", attempts);
                 int last_trkno = res_hdr.first_track_no - 1;
                 for(int i = res_hdr.first_track_no; i <= res_hdr.last_track_no + 1; i++) {
-                    if(!quirks.no_drq_in_toc) wait_drq();
+                    if(!quirks.no_drq_in_toc && !wait_drq(budget.deadline)) {
+                        ESP_LOGE(LOG_TAG, "  ^--- entry never came. retry.");
+                        success = false;
+                        break;
+                    }
                     read_response(&entry, sizeof(entry), false);
                     ESP_LOGI(LOG_TAG, " + track %i: %02im%02is%02if, preemph=%i, prot=%i, data=%i, quadro=%i", entry.track_no, entry.address.M, entry.address.S, entry.address.F, entry.pre_emphasis, entry.copy_protected, entry.data_track, entry.quadrophonic);
 
@@ -649,17 +1046,87 @@ namespace ATAPI {
             } else {
                 ESP_LOGE(LOG_TAG, "  ^--- this makes no sense! retry.");
             }
-        } while(!success && (attempts--) > 0);
+        } while(!success && (attempts--) > 0 && esp_timer_get_time() < budget.deadline);
         
         if(!success) tracks.clear();
-        else toc_subchannel = read_cd_text_toc_locked();
 
         xSemaphoreGive(semaphore);
         return DiscTOC {
             .leadOut = leadOut,
-            .tracks = tracks,
-            .toc_subchannel = toc_subchannel
+            .tracks = tracks
+        };
+    }
+
+    const std::string Device::read_mcn() {
+        Responses::ReadSubchannel res = { 0 };
+        const Requests::ReadSubchannel req = {
+            .opcode = OperationCodes::READ_SUBCHANNEL,
+            .subQ = true,
+            .data_format = SubchannelFormat::SUBCH_FMT_UPC_BARCODE,
+            .allocation_length = htobe16(sizeof(res))
         };
+
+        xSemaphoreTake(semaphore, portMAX_DELAY);
+        send_packet(&req, sizeof(req), true);
+        bool ok = !read_sts_regi().ERR && read_response(&res, sizeof(res), false);
+        read_response(nullptr, 0, true);
+        xSemaphoreGive(semaphore);
+
+        if(!ok || res.data_format != SubchannelFormat::SUBCH_FMT_UPC_BARCODE || !res.upc_barcode_data.mc_val) return "";
+        const std::string mcn = std::string(res.upc_barcode_data.upc, strnlen(res.upc_barcode_data.upc, 13));
+        // Some discs have the flag set but nothing in there
+        if(mcn.find_first_not_of('0') == std::string::npos) return "";
+        ESP_LOGI(LOG_TAG, "MCN = %s", mcn.c_str());
+        return mcn;
+    }
+
+    const std::string Device::read_isrc(uint8_t track) {
+        Responses::ReadSubchannel res = { 0 };
+        const Requests::ReadSubchannel req = {
+            .opcode = OperationCodes::READ_SUBCHANNEL,
+            .subQ = true,
+            .data_format = SubchannelFormat::SUBCH_FMT_ISRC,
+            .track_no_for_isrc = track,
+            .allocation_length = htobe16(sizeof(res))
+        };
+
+        xSemaphoreTake(semaphore, portMAX_DELAY);
+        send_packet(&req, sizeof(req), true);
+        bool ok = !read_sts_regi().ERR && read_response(&res, sizeof(res), false);
+        read_response(nullptr, 0, true);
+        xSemaphoreGive(semaphore);
+
+        if(!ok || res.data_format != SubchannelFormat::SUBCH_FMT_ISRC || !res.isrc_data.tc_val) return "";
+        const std::string isrc = std::string(res.isrc_data.isrc, strnlen(res.isrc_data.isrc, sizeof(res.isrc_data.isrc)));
+        ESP_LOGI(LOG_TAG, "ISRC of track %i = %s", track, isrc.c_str());
+        return isrc;
+    }
+
+    bool Device::read_cd(uint32_t lba, uint8_t count, uint8_t * out, bool c2, bool subq) {
+        const Requests::ReadCD req = {
+            .opcode = OperationCodes::READ_CD,
+            .expected_sector_type = Requests::ReadCD::SectorType::SECTOR_CDDA,
+            .lba = htobe32(lba),
+            .transfer_length = { 0, 0, count },
+            .error_field = c2 ? Requests::ReadCD::ErrorField::ERRF_C2 : Requests::ReadCD::ErrorField::ERRF_NONE,
+            .user_data = true,
+            .subchannel = subq ? Requests::ReadCD::SubchannelSelect::SUBCH_Q : Requests::ReadCD::SubchannelSelect::SUBCH_NONE,
+        };
+
+        xSemaphoreTake(semaphore, portMAX_DELAY);
+        send_packet(&req, sizeof(req), true);
+
+        bool rslt = false;
+        if(read_sts_regi().ERR) {
+            ESP_LOGW(LOG_TAG, "READ CD of %i sectors at LBA %u failed", count, lba);
+            read_response(nullptr, 0, true);
+        } else {
+            rslt = read_response(out, cdda_sector_size(c2, subq) * count, false);
+            read_response(nullptr, 0, true);
+        }
+        xSemaphoreGive(semaphore);
+
+        return rslt;
     }
 
     MediaTypeCode Device::check_media() {
@@ -680,67 +1147,99 @@ namespace ATAPI {
     }
 
     void Device::send_packet(const void * buf, size_t bufLen, bool pad) {
-        delayMicroseconds(100); // either just the C68E is too old and slow to keep up with the ESP even over 100kHz i2c... or my pcb layout bites me in the ass again!!
-        // for our use case those occasional delays don't have too much effect but this will limit potential growth for data disc reading if any!
+        begin_command_stats(((const uint8_t*) buf)[0]);
+
+        pio_delay(timings.pre_packet_us); // either just the C68E is too old and slow to keep up with the ESP even over 100kHz i2c... or my pcb layout bites me in the ass again!!
+        // the default is still tuned for the C68E, faster drives get theirs from calibrate_pio_timings()
 
 
         // Need to set nIEN before sending the PACKET command
         ide->write(IDE::Register::DeviceControl, {{ .low = (DeviceControlRegister {{ .nIEN = true }}).value, .high = 0xFF }});
-        delayMicroseconds(100);
+        pio_delay(timings.pre_command_us);
         ide->write(IDE::Register::Command, {{ .low = Command::WRITE_PACKET, .high = 0xFF }});
+        pio_remain = 0;
 
         const uint8_t* data = (const uint8_t*) buf;
-        int i = 0;
-        for(i = 0; i < bufLen; i+=2) {
-            delayMicroseconds(10);
-            ide->write(IDE::Register::Data, {{ .low = data[i], .high = data[i + 1] }});
+        ide->write_block(IDE::Register::Data, data, bufLen / 2);
+        size_t i = bufLen & ~1;
+        if(i < bufLen) {
+            ide->write(IDE::Register::Data, {{ .low = data[i], .high = 0x00 }});
+            i += 2;
         }
 
-        if(pad) {
-            for(; i < packet_size; i+=2) {
-                delayMicroseconds(10);
-                ide->write(IDE::Register::Data, { 0x00, 0x00 });
-            }
+        if(pad && i < packet_size) {
+            static const uint8_t zeroes[16] = { 0 };
+            ide->write_block(IDE::Register::Data, zeroes, (packet_size - i) / 2);
         }
 
         if(quirks.busy_ass) {
-            delay(7);
+            pio_delay(timings.post_packet_us);
         }
+        // Only this wait tells how long the command itself took, so only this one teaches the expected duration
+        wait_opcode = data[0];
         wait_not_busy("PKT");
+        wait_opcode = WaitProfile::NO_OPCODE;
+
+        cmd_last_activity = esp_timer_get_time();
+        if(cmd_stats != nullptr && read_sts_regi().ERR) cmd_stats->errors++;
+    }
+
+    size_t Device::pio_next_block(bool ignore_drq) {
+        StatusRegister sts = read_sts_regi();
+        if(!sts.DRQ) {
+            // Drives that don't assert DRQ properly still get their data pulled one word at a time, like it always was
+            return ignore_drq ? 2 : 0;
+        }
+
+        if(quirks.busy_ass) {
+            // These need a breather between words, so keep checking after each of them
+            pio_delay(timings.word_gap_us);
+            return 2;
+        }
+
+        // ATAPI 5.11: while DRQ is set, the Byte Count registers hold the size of the current data block
+        size_t count = ide->read(IDE::Register::CylinderLow).low | (ide->read(IDE::Register::CylinderHigh).low << 8);
+        if(count == 0) count = 2;
+        return (count + 1) & ~1;
     }
 
-    bool Device::read_response(void * outBuf, size_t bufLen, bool flush) {
+    bool Device::read_response(void * outBuf, size_t bufLen, bool flush, bool partial) {
         if((bufLen == 0 || outBuf == nullptr) && !flush) {
             ESP_LOGE(LOG_TAG, "No buffer provided for response!");
             return false;
         }
 
-        data16 val;
-        StatusRegister sts;
         uint8_t * buf = (uint8_t*)outBuf;
         bool rslt = false;
 
         if(bufLen > 0 && buf != nullptr) {
-            int i = 0;
-            do {
-                val = ide->read(IDE::Register::Data);
-                buf[i++] = val.low;
-                buf[i++] = val.high;
-                delayMicroseconds(10);
-
-                sts = read_sts_regi();
-                delayMicroseconds(10);
-
-                if(quirks.busy_ass) {
-                    delayMicroseconds(33);
+            size_t i = 0;
+            while(i < bufLen) {
+                if(pio_remain == 0) {
+                    pio_remain = pio_next_block(quirks.no_drq_in_toc);
+                    if(pio_remain == 0) break;
                 }
-            } while(bufLen > i && (sts.DRQ || quirks.no_drq_in_toc));
+
+                size_t words = std::min(bufLen - i, pio_remain) / 2;
+                if(words > 0) {
+                    ide->read_block(IDE::Register::Data, &buf[i], words);
+                    i += words * 2;
+                    pio_remain -= words * 2;
+                } else {
+                    // odd sized buffer: the high byte of the last word has nowhere to go
+                    buf[i++] = ide->read(IDE::Register::Data).low;
+                    pio_remain -= 2;
+                }
+            }
+
+            if(cmd_stats != nullptr) cmd_stats->bytes_in += i;
 
             if(bufLen > i) {
-                ESP_LOGV(LOG_TAG, "Data underrun when reading response: wanted %i bytes, DRQ clear after %i bytes", bufLen, i + 1);
+                ESP_LOGV(LOG_TAG, "Data underrun when reading response: wanted %i bytes, DRQ clear after %i bytes", bufLen, i);
+                if(cmd_stats != nullptr) cmd_stats->underruns++;
             }
-            else if(sts.DRQ && !flush) {
-                ESP_LOGV(LOG_TAG, "Buffer overrun when reading response: wanted %i bytes, but DRQ still set", bufLen);
+            else if(pio_remain > 0 && !flush && !partial) {
+                ESP_LOGV(LOG_TAG, "Buffer overrun when reading response: wanted %i bytes, but %i more are pending", bufLen, pio_remain);
             }
             else {
                 rslt = true;
@@ -749,101 +1248,264 @@ namespace ATAPI {
 
         if(flush) {
             int flushed = 0;
-            sts = read_sts_regi();
-            while(sts.DRQ) {
-                val = ide->read(IDE::Register::Data);
-                flushed += 2;
-
-                sts = read_sts_regi();
+            uint8_t scratch[64];
+            while(true) {
+                if(pio_remain == 0) {
+                    pio_remain = pio_next_block(false);
+                    if(pio_remain == 0) break;
+                }
+                size_t words = std::min(sizeof(scratch), pio_remain) / 2;
+                ide->read_block(IDE::Register::Data, scratch, words);
+                flushed += words * 2;
+                pio_remain -= words * 2;
+            }
+            if(flushed > 0) {
+                ESP_LOGD(LOG_TAG, "Flushed %i extra bytes", flushed);
+                if(cmd_stats != nullptr) {
+                    cmd_stats->flushes++;
+                    cmd_stats->flushed_bytes += flushed;
+                    cmd_stats->bytes_in += flushed;
+                }
             }
-            if(flushed > 0) ESP_LOGD(LOG_TAG, "Flushed %i extra bytes", flushed);
             rslt = true;
         }
 
+        cmd_last_activity = esp_timer_get_time();
+        if(flush) end_command_stats();
+
+        return rslt;
+    }
+
+    Device::CommandStats * Device::stats_for(uint8_t opcode) {
+        for(int i = 0; i < _diags.command_count; i++) {
+            if(_diags.commands[i].opcode == opcode) return &_diags.commands[i];
+        }
+        if(_diags.command_count == MAX_TRACKED_OPCODES) return nullptr;
+
+        CommandStats * rslt = &_diags.commands[_diags.command_count];
+        *rslt = CommandStats { .opcode = opcode };
+        // only publish the entry once it's filled in, the UI may be reading the list at the same time
+        _diags.command_count++;
         return rslt;
     }
 
+    void Device::begin_command_stats(uint8_t opcode) {
+        end_command_stats();
+        cmd_stats = stats_for(opcode);
+        cmd_start = esp_timer_get_time();
+        cmd_last_activity = cmd_start;
+    }
+
+    void Device::end_command_stats() {
+        if(cmd_stats == nullptr) return;
+        // commands without a data phase have no flush to end them, so this may be called only as the next command starts
+        cmd_stats->latency.add((uint32_t) (cmd_last_activity - cmd_start));
+        cmd_stats = nullptr;
+    }
+
+    void Device::log_command_stats() {
+        for(int i = 0; i < _diags.command_count; i++) {
+            const CommandStats& c = _diags.commands[i];
+            ESP_LOGI("CMDSTAT", "op=0x%02x n=%u min=%u avg=%u p99=%u max=%u bytes=%llu flushes=%u flushed=%u underruns=%u retries=%u errors=%u",
+                c.opcode, c.latency.count, c.latency.count > 0 ? c.latency.min_us : 0, c.latency.average_us(), c.latency.percentile_us(99), c.latency.max_us,
+                c.bytes_in, c.flushes, c.flushed_bytes, c.underruns, c.retries, c.errors);
+        }
+    }
+
     Device::StatusRegister Device::read_sts_regi() {
         StatusRegister val;
         val.value = ide->read(IDE::Register::Status).low;
         return val;
     }
 
-    void Device::wait_sts_bit_set(StatusRegister bits) {
-        TickType_t start_wait = xTaskGetTickCount();
-        ESP_LOGD(LOG_TAG, "Wait for bit set 0x%02x", bits.value);
-
-        do {
-            if(xTaskGetTickCount() - start_wait >= pdMS_TO_TICKS(10000)) {
-                ESP_LOGW(LOG_TAG, "Still waiting for bit set 0x%02x", bits.value);
-                start_wait = xTaskGetTickCount();
-            }
-        } while ((read_sts_regi().value & bits.value) == 0);
+    bool Device::wait_sts_bit_set(StatusRegister bits, const char * tag, int64_t deadline) {
+        ESP_LOGD(tag, "Wait for bit set 0x%02x", bits.value);
+        return wait_sts(bits, true, tag, 10000, deadline);
     }
 
-    void Device::wait_sts_bit_clr(StatusRegister bits, const char * tag) {
-        TickType_t start_wait = xTaskGetTickCount();
+    bool Device::wait_sts_bit_clr(StatusRegister bits, const char * tag, int64_t deadline) {
         ESP_LOGD(tag, "Wait for bit clear 0x%02x", bits.value);
+        return wait_sts(bits, false, tag, 3000, deadline);
+    }
 
-        do {
-            delay(100);
-            if(xTaskGetTickCount() - start_wait >= pdMS_TO_TICKS(3000)) {
-                ESP_LOGW(tag, "Still waiting for bit clear 0x%02x", bits.value);
-                start_wait = xTaskGetTickCount();
+    bool Device::wait_sts(StatusRegister bits, bool set, const char * tag, uint32_t warn_interval_ms, int64_t deadline) {
+        // Polling the status is a few I2C transactions already, so for this long just poll back to back
+        static const uint32_t SPIN_US = 1000;
+        // Longest sleep between polls, so that a drive which got stuck for a while isn't noticed too late
+        static const uint32_t MAX_SLEEP_US = 50000;
+
+        auto is_done = [this, bits, set]() {
+            bool any = (read_sts_regi().value & bits.value) != 0;
+            return set ? any : !any;
+        };
+
+        int64_t start = esp_timer_get_time();
+        int64_t last_warn = start;
+        if(deadline == 0) deadline = start + STATUS_WAIT_TIMEOUT_MS * 1000LL;
+        uint32_t expected = wait_profile.expected_us(wait_opcode);
+        uint32_t sleep_us = 100;
+        uint32_t sleep_cap = std::max(SPIN_US, std::min(MAX_SLEEP_US, expected / 4));
+
+        if(!is_done()) {
+            if(expected > 2 * SPIN_US) {
+                // The drive is known to be slow at this, no point in asking again before about half the usual time passes
+                delay(std::min((int64_t) expected / 2000, std::max((int64_t) 0, (deadline - start) / 1000)));
+            }
+
+            while(!is_done()) {
+                int64_t now = esp_timer_get_time();
+                if(now >= deadline) {
+                    ESP_LOGE(tag, "Gave up waiting for bit %s 0x%02x after %lli ms", set ? "set" : "clear", bits.value, (now - start) / 1000);
+                    return false;
+                }
+                if(now - last_warn >= warn_interval_ms * 1000LL) {
+                    ESP_LOGW(tag, "Still waiting for bit %s 0x%02x", set ? "set" : "clear", bits.value);
+                    last_warn = now;
+                }
+
+                if(now - start < SPIN_US) continue;
+
+                if(sleep_us < 1000) delayMicroseconds(sleep_us);
+                else delay(sleep_us / 1000);
+                sleep_us = std::min(sleep_us * 2, sleep_cap);
             }
-        } while ((read_sts_regi().value & bits.value) != 0);
+        }
+
+        wait_profile.record(tag, wait_opcode, (uint32_t) (esp_timer_get_time() - start));
+        return true;
     }
 
-    void Device::wait_not_busy(const char * tag) { 
+    bool Device::wait_not_busy(const char * tag, int64_t deadline) { 
         ESP_LOGV(tag, "Waiting for drive to stop being busy...");
-        wait_sts_bit_clr({{.BSY = true}}, tag); 
+        return wait_sts_bit_clr({{.BSY = true}}, tag, deadline); 
     }
-    void Device::wait_drq_end() { wait_sts_bit_clr({{.DRQ = true}}); }
-    void Device::wait_drq() { wait_sts_bit_set({{.DRQ = true}}); }
+    bool Device::wait_drq_end(int64_t deadline) { return wait_sts_bit_clr({{.DRQ = true}}, "DRQE", deadline); }
+    bool Device::wait_drq(int64_t deadline) { return wait_sts_bit_set({{.DRQ = true}}, "DRQ", deadline); }
 
-    void Device::wait_ready() {
+    bool Device::wait_ready() {
         ESP_LOGI(LOG_TAG, "Waiting for drive to become ready...");
         xSemaphoreTake(semaphore, portMAX_DELAY);
-        wait_sts_bit_set({{.DRDY = true}}); 
+        RecoveryBudget budget = begin_recovery(OperationCodes::REQUEST_SENSE);
+
+        RecoveryAction action = RecoveryAction::GIVE_UP;
+        if(!wait_sts_bit_set({{.DRDY = true}}, "DRDY", budget.deadline)) {
+            give_up_locked(budget, "drive never got ready");
+        } else do {
+            action = recover_locked(budget);
+            if(action != RecoveryAction::NONE && cmd_stats != nullptr) cmd_stats->retries++;
+        } while(action != RecoveryAction::NONE && action != RecoveryAction::GIVE_UP);
+        ESP_LOGI(LOG_TAG, "Request sense ready with SK=0x%02x, ASC=0x%02x, ASCQ=0x%02x", last_sense.key, last_sense.asc, last_sense.ascq);
+        xSemaphoreGive(semaphore);
 
-        const Requests::RequestSense req = {
-            .opcode = OperationCodes::REQUEST_SENSE,
-            .allocation_length = 0xFF
-        };
-        Responses::RequestSense res = { 0 };
-        TickType_t start_wait = xTaskGetTickCount();
-        do {
-            if(xTaskGetTickCount() - start_wait >= pdMS_TO_TICKS(10000)) {
-                ESP_LOGW(LOG_TAG, "Device still not ready!");
-                start_wait = xTaskGetTickCount();
-            }
-            send_packet(&req, sizeof(req), true);
-            read_response(&res, sizeof(res), true);
-        } while(res.sense_key == RequestSenseKey::SENSE_NOT_READY /*&& res.additional_sense_code == RequestSenseAsc::ASC_DEVICE_NOT_READY*/);
-        ESP_LOGI(LOG_TAG, "Request sense ready with SK=0x%02x, ASC=0x%02x", res.sense_key, res.additional_sense_code);
-        xSemaphoreGive(semaphore);
-
-        // const uint8_t req2 = OperationCodes::TEST_UNIT_READY;
-        // send_packet(&req2, sizeof(req2), true);
-        // StatusRegister sr = read_sts_regi();
-        // while(sr.ERR || sr.BSY) {
-        //     if(xTaskGetTickCount() - start_wait >= pdMS_TO_TICKS(10000)) {
-        //         ESP_LOGW(LOG_TAG, "Waiting for TEST_UNIT_READY to stop raising ERR and/or BSY");
-        //         start_wait = xTaskGetTickCount();
-        //     }
-        //     send_packet(&req2, sizeof(req2), true);
-        //     sr = read_sts_regi();
-        // }
+        // Nothing to read is a perfectly fine state to be ready in
+        bool no_medium = (last_sense.key == SENSE_NOT_READY && last_sense.asc == ASC_NO_MEDIUM);
+        if(action == RecoveryAction::GIVE_UP && !no_medium) {
+            ESP_LOGW(LOG_TAG, "Device still not ready!");
+            return false;
+        }
 
         query_state();
         while(mech_sts.is_in_motion) {
-            if(xTaskGetTickCount() - start_wait >= pdMS_TO_TICKS(10000)) {
-                ESP_LOGW(LOG_TAG, "Waiting for changer!");
-                start_wait = xTaskGetTickCount();
+            if(esp_timer_get_time() >= budget.deadline) {
+                ESP_LOGW(LOG_TAG, "Changer still in motion!");
+                return false;
             }
+            delay(100);
             query_state();
         }
 
         ESP_LOGI(LOG_TAG, "The device appears to be ready");
+        return true;
+    }
+
+    Device::RecoveryBudget Device::begin_recovery(uint8_t opcode) {
+        int64_t now = esp_timer_get_time();
+        return RecoveryBudget {
+            .opcode = opcode,
+            .started = now,
+            .deadline = now + (int64_t) latency_ceiling_ms * 1000,
+            .resets = 1
+        };
+    }
+
+    SenseData Device::request_sense_locked() {
+        const Requests::RequestSense req = {
+            .opcode = OperationCodes::REQUEST_SENSE,
+            .allocation_length = 0xFF
+        };
+        Responses::RequestSense res = { 0 };
+        send_packet(&req, sizeof(req), true);
+        read_response(&res, sizeof(res), true);
+        return SenseData {
+            .key = res.sense_key,
+            .asc = res.additional_sense_code,
+            .ascq = res.additional_sense_code_qualifier
+        };
+    }
+
+    RecoveryAction Device::recover_locked(RecoveryBudget& budget) {
+        last_sense = request_sense_locked();
+        const RecoveryStep& step = recovery_step_for(last_sense);
+        RecoveryAction action = step.action;
+
+        int64_t now = esp_timer_get_time();
+        if(action != RecoveryAction::NONE && now >= budget.deadline) action = RecoveryAction::GIVE_UP;
+        if(action == RecoveryAction::RESET && budget.resets == 0) action = RecoveryAction::GIVE_UP;
+
+        switch(action) {
+            case RecoveryAction::NONE:
+                break;
+
+            case RecoveryAction::RETRY:
+                // Even a drive that says to just go again shouldn't get REQUEST SENSE back to back until the deadline, that's the bus and a CPU busy for nothing
+                delay(std::max(step.delay_ms, RETRY_MIN_DELAY_MS));
+                break;
+
+            case RecoveryAction::BACK_OFF:
+                delay(std::min((int64_t) step.delay_ms, (budget.deadline - now) / 1000 + 1));
+                break;
+
+            case RecoveryAction::RESET:
+                ESP_LOGW(LOG_TAG, "Resetting the drive after %s", step.description);
+                budget.resets--;
+                ide->write(IDE::Register::Command, {{ .low = Command::DEVICE_RESET, .high = 0xFF }});
+                delay(1);
+                if(!wait_not_busy("RST", budget.deadline)) {
+                    return give_up_locked(budget, "drive stayed busy after reset");
+                }
+                write_task_file();
+                break;
+
+            case RecoveryAction::GIVE_UP:
+                {
+                    const ErrorEvent evt = {
+                        .opcode = budget.opcode,
+                        .sense = last_sense,
+                        .action = step.action,
+                        .elapsed_ms = (uint32_t) ((now - budget.started) / 1000)
+                    };
+                    ESP_LOGW(LOG_TAG, "Giving up on opcode 0x%02x after %u ms: %s (SK=0x%02x, ASC=0x%02x, ASCQ=0x%02x)", evt.opcode, evt.elapsed_ms, step.description, last_sense.key, last_sense.asc, last_sense.ascq);
+                    // An empty drive is not a failure, the player learns about it from the media status anyway
+                    bool no_medium = (last_sense.key == SENSE_NOT_READY && last_sense.asc == ASC_NO_MEDIUM);
+                    if(error_handler && !no_medium) error_handler(evt);
+                }
+                break;
+        }
+
+        return action;
+    }
+
+    RecoveryAction Device::give_up_locked(const RecoveryBudget& budget, const char * what) {
+        // nothing was read out, so whatever is left from before doesn't apply
+        last_sense = { 0 };
+        const ErrorEvent evt = {
+            .opcode = budget.opcode,
+            .sense = { 0 },
+            .action = RecoveryAction::GIVE_UP,
+            .elapsed_ms = (uint32_t) ((esp_timer_get_time() - budget.started) / 1000)
+        };
+        ESP_LOGW(LOG_TAG, "Giving up on opcode 0x%02x after %u ms: %s", evt.opcode, evt.elapsed_ms, what);
+        if(error_handler) error_handler(evt);
+        return RecoveryAction::GIVE_UP;
     }
 }
\ No newline at end of file
@@ -0,0 +1,148 @@
+#include <esper-cdp/checksum.h>
+#include <esp_log.h>
+#include <string.h>
+#include <algorithm>
+
+static const char LOG_TAG[] = "CKSUM";
+
+// Samples excluded by AccurateRip at the start of the first track and the end of the last one
+static const uint32_t AR_EXCLUDED_SAMPLES = 5 * ATAPI::TrackChecksum::SAMPLES_PER_SECTOR;
+// Sector address of M00S02F00
+static const int LBA_OFFSET = 2 * MSF::FRAMES_IN_SECOND;
+
+namespace ATAPI {
+    struct CrcTables {
+        uint32_t t[8][256];
+    };
+
+    // Built by the compiler, so that they are there before any task can get to them
+    static constexpr CrcTables make_crc_tables() {
+        CrcTables rslt = {};
+        for(uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for(int j = 0; j < 8; j++) c = (c & 1) ? ((c >> 1) ^ 0xEDB88320) : (c >> 1);
+            rslt.t[0][i] = c;
+        }
+        for(int t = 1; t < 8; t++) {
+            for(int i = 0; i < 256; i++) {
+                rslt.t[t][i] = (rslt.t[t - 1][i] >> 8) ^ rslt.t[0][rslt.t[t - 1][i] & 0xFF];
+            }
+        }
+        return rslt;
+    }
+
+    static constexpr CrcTables crc_tables = make_crc_tables();
+
+    uint32_t crc32_update(uint32_t crc, const uint8_t * data, size_t len) {
+        while(len >= 8) {
+            uint32_t lo, hi;
+            memcpy(&lo, data, 4);
+            memcpy(&hi, data + 4, 4);
+            lo ^= crc;
+            crc = crc_tables.t[7][lo & 0xFF] ^ crc_tables.t[6][(lo >> 8) & 0xFF] ^ crc_tables.t[5][(lo >> 16) & 0xFF] ^ crc_tables.t[4][lo >> 24] ^
+                  crc_tables.t[3][hi & 0xFF] ^ crc_tables.t[2][(hi >> 8) & 0xFF] ^ crc_tables.t[1][(hi >> 16) & 0xFF] ^ crc_tables.t[0][hi >> 24];
+            data += 8;
+            len -= 8;
+        }
+        while(len--) crc = (crc >> 8) ^ crc_tables.t[0][(crc ^ *data++) & 0xFF];
+
+        return crc;
+    }
+
+    TrackChecksum::TrackChecksum(uint32_t sectors, bool is_first_track, bool is_last_track):
+        sector_count(sectors)
+    {
+        uint32_t total = sectors * SAMPLES_PER_SECTOR;
+        check_from = is_first_track ? AR_EXCLUDED_SAMPLES : 0;
+        check_to = (is_last_track && total > AR_EXCLUDED_SAMPLES) ? (total - AR_EXCLUDED_SAMPLES) : total;
+    }
+
+    void TrackChecksum::reset() {
+        sectors_done = 0;
+        multiplier = 1;
+        crc = 0xFFFFFFFF;
+        ar_v1 = 0;
+        ar_v2 = 0;
+    }
+
+    void TrackChecksum::update(const uint8_t * sectors, size_t count) {
+        if(sectors_done + count > sector_count) {
+            ESP_LOGW(LOG_TAG, "Track is %u sectors long, ignoring %u extra", sector_count, sectors_done + count - sector_count);
+            count = sector_count - sectors_done;
+        }
+
+        crc = crc32_update(crc, sectors, count * SECTOR_SIZE);
+
+        const size_t samples = count * SAMPLES_PER_SECTOR;
+        for(size_t i = 0; i < samples; i++, multiplier++) {
+            if(multiplier < check_from || multiplier > check_to) continue;
+
+            // Left channel in the lower half, as it is stored on the disc
+            const uint8_t * s = &sectors[i * 4];
+            uint32_t value = s[0] | (s[1] << 8) | (s[2] << 16) | ((uint32_t) s[3] << 24);
+
+            uint64_t product = (uint64_t) value * multiplier;
+            ar_v1 += (uint32_t) product;
+            ar_v2 += (uint32_t) product + (uint32_t) (product >> 32);
+        }
+
+        sectors_done += count;
+    }
+
+    AccurateRipDiscId AccurateRipDiscId::from_toc(const DiscTOC& toc) {
+        AccurateRipDiscId rslt = { 0 };
+        rslt.track_count = toc.tracks.size();
+
+        uint32_t digit_sum = 0;
+        for(int i = 0; i < toc.tracks.size(); i++) {
+            uint32_t lba = MSF_TO_FRAMES(toc.tracks[i].position) - LBA_OFFSET;
+            rslt.id1 += lba;
+            rslt.id2 += std::max(lba, (uint32_t) 1) * (i + 1);
+
+            for(uint32_t sec = MSF_TO_FRAMES(toc.tracks[i].position) / MSF::FRAMES_IN_SECOND; sec > 0; sec /= 10) digit_sum += sec % 10;
+        }
+
+        uint32_t lead_out = MSF_TO_FRAMES(toc.leadOut) - LBA_OFFSET;
+        rslt.id1 += lead_out;
+        rslt.id2 += lead_out * (rslt.track_count + 1);
+
+        if(!toc.tracks.empty()) {
+            uint32_t length = MSF_TO_FRAMES(toc.leadOut) / MSF::FRAMES_IN_SECOND - MSF_TO_FRAMES(toc.tracks.front().position) / MSF::FRAMES_IN_SECOND;
+            rslt.cddb = ((digit_sum % 255) << 24) | (length << 8) | rslt.track_count;
+        }
+
+        return rslt;
+    }
+
+    const std::string AccurateRipDiscId::url_path() const {
+        char temp[64] = { 0 };
+        snprintf(temp, sizeof(temp), "/accuraterip/%x/%x/%x/dBAR-%03u-%08x-%08x-%08x.bin", id1 & 0xF, (id1 >> 4) & 0xF, (id1 >> 8) & 0xF, track_count, id1, id2, cddb);
+        return std::string(temp);
+    }
+
+    int AccurateRipDiscId::find_confidence(const uint8_t * dbar, size_t len, int track_idx, uint32_t checksum_v1, uint32_t checksum_v2) const {
+        // The file is a list of pressings, each with a 13 byte header and then 9 bytes per track, all little endian
+        auto le32 = [](const uint8_t * p) { return (uint32_t) (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24)); };
+
+        int best = 0;
+        size_t pos = 0;
+        while(pos + 13 <= len) {
+            uint8_t count = dbar[pos];
+            size_t chunk_len = 13 + count * 9;
+            if(pos + chunk_len > len) {
+                ESP_LOGW(LOG_TAG, "Truncated dBAR at %u", pos);
+                break;
+            }
+
+            if(count == track_count && le32(&dbar[pos + 1]) == id1 && le32(&dbar[pos + 5]) == id2 && le32(&dbar[pos + 9]) == cddb && track_idx < count) {
+                const uint8_t * trk = &dbar[pos + 13 + track_idx * 9];
+                uint32_t expected = le32(&trk[1]);
+                if(expected == checksum_v1 || expected == checksum_v2) best = std::max(best, (int) trk[0]);
+            }
+
+            pos += chunk_len;
+        }
+
+        return best;
+    }
+}
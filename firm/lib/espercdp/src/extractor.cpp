@@ -0,0 +1,262 @@
+#include <esper-cdp/extractor.h>
+#include <esper-cdp/atapi-protocol.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <algorithm>
+
+static const char LOG_TAG[] = "CDDAX";
+
+// Largest READ CD issued at once. Bigger requests cost less overhead per sector, but take longer to redo when they fail.
+static const uint8_t MAX_CHUNK_SECTORS = 16;
+// How many times a single sector is retried before being replaced with silence
+static const int SECTOR_RETRY_LIMIT = 3;
+// The LBA of M00S02F00
+static const int LBA_OFFSET = 2 * MSF::FRAMES_IN_SECOND;
+
+static uint8_t bcd_to_int(uint8_t bcd) { return (bcd >> 4) * 10 + (bcd & 0xF); }
+
+static void * alloc_prefer_psram(size_t size) {
+    void * rslt = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    if(rslt == nullptr) {
+        ESP_LOGW(LOG_TAG, "No PSRAM for %i bytes, trying internal RAM", size);
+        rslt = malloc(size);
+    }
+    return rslt;
+}
+
+namespace ATAPI {
+    static void extractTask(void* pvParameter) {
+        CDDAExtractor* extractor = static_cast<CDDAExtractor*>(pvParameter);
+        while(true) {
+            extractor->extract_loop();
+        }
+    }
+
+    CDDAExtractor::CDDAExtractor(Device * device, size_t buffer_sectors, bool c2_pointers, bool subchannel_q):
+        cdrom(device),
+        want_c2(c2_pointers),
+        want_subq(subchannel_q)
+    {
+        semaphore = xSemaphoreCreateMutex();
+        work_semaphore = xSemaphoreCreateBinary();
+        xSemaphoreGive(work_semaphore);
+
+        ring_size = buffer_sectors * Device::CDDA_SECTOR_SIZE;
+        ring = (uint8_t *) alloc_prefer_psram(ring_size);
+        scratch = (uint8_t *) alloc_prefer_psram(MAX_CHUNK_SECTORS * Device::cdda_sector_size(want_c2, want_subq));
+        if(ring == nullptr || scratch == nullptr) {
+            ESP_LOGE(LOG_TAG, "Could not allocate buffers, extraction will not work");
+            ring_size = 0;
+            return;
+        }
+
+        xTaskCreate(
+            extractTask,
+            "CDDAX",
+            4096,
+            this,
+            4,
+            &task
+        );
+    }
+
+    CDDAExtractor::~CDDAExtractor() {
+        stop();
+        if(task != NULL) {
+            // Wait out the read in progress, it writes into the scratch buffer
+            xSemaphoreTake(work_semaphore, portMAX_DELAY);
+            vTaskDelete(task);
+            task = NULL;
+        }
+        vSemaphoreDelete(work_semaphore);
+        vSemaphoreDelete(semaphore);
+        if(ring != nullptr) free(ring);
+        if(scratch != nullptr) free(scratch);
+    }
+
+    void CDDAExtractor::start(const MSF from, const MSF to, bool first_track, bool last_track) {
+        xSemaphoreTake(semaphore, portMAX_DELAY);
+        generation++;
+        head = 0;
+        tail = 0;
+        start_lba = MSF_TO_FRAMES(from) - LBA_OFFSET;
+        next_lba = start_lba;
+        end_lba = MSF_TO_FRAMES(to) - LBA_OFFSET;
+        memset(last_sample, 0, sizeof(last_sample));
+        rate_window_start = esp_timer_get_time();
+        rate_window_bytes = 0;
+        checksum = TrackChecksum(std::max(0, end_lba - start_lba), first_track, last_track);
+        running = (ring_size > 0);
+        xSemaphoreGive(semaphore);
+
+        ESP_LOGI(LOG_TAG, "Start extraction of LBA %i ~ %i", start_lba, end_lba);
+        if(task != NULL) xTaskNotifyGive(task);
+    }
+
+    void CDDAExtractor::stop() {
+        xSemaphoreTake(semaphore, portMAX_DELAY);
+        generation++;
+        running = false;
+        head = 0;
+        tail = 0;
+        xSemaphoreGive(semaphore);
+    }
+
+    bool CDDAExtractor::is_finished() {
+        return running && next_lba >= end_lba && available() == 0;
+    }
+
+    TrackChecksum CDDAExtractor::get_checksum() {
+        xSemaphoreTake(semaphore, portMAX_DELAY);
+        TrackChecksum rslt = checksum;
+        xSemaphoreGive(semaphore);
+        return rslt;
+    }
+
+    size_t CDDAExtractor::available() {
+        return (size_t) (head - tail);
+    }
+
+    const MSF CDDAExtractor::get_position() {
+        return FRAMES_TO_MSF(start_lba + LBA_OFFSET + (int) (tail / Device::CDDA_SECTOR_SIZE));
+    }
+
+    size_t CDDAExtractor::read(uint8_t * buf, size_t len) {
+        xSemaphoreTake(semaphore, portMAX_DELAY);
+        size_t count = std::min(len, (size_t) (head - tail));
+        size_t ofs = tail % ring_size;
+        size_t first = std::min(count, ring_size - ofs);
+        memcpy(buf, &ring[ofs], first);
+        if(count > first) memcpy(&buf[first], ring, count - first);
+        tail += count;
+
+        if(count < len && running && next_lba < end_lba) stats.underruns++;
+        xSemaphoreGive(semaphore);
+
+        return count;
+    }
+
+    void CDDAExtractor::extract_loop() {
+        if(!running || next_lba >= end_lba) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            return;
+        }
+
+        if(ring_size - available() < chunk * Device::CDDA_SECTOR_SIZE) {
+            // Read-ahead buffer is full, let the consumer catch up
+            vTaskDelay(pdMS_TO_TICKS(10));
+            return;
+        }
+
+        xSemaphoreTake(work_semaphore, portMAX_DELAY);
+        extract_chunk(generation);
+        xSemaphoreGive(work_semaphore);
+
+        if(running && next_lba >= end_lba) {
+            ESP_LOGI(LOG_TAG, "Extraction done: %u sectors, %u lost, %u with C2 errors, %u retries, %u underruns", stats.sectors_read, stats.sectors_lost, stats.sectors_c2, stats.retries, stats.underruns);
+            const TrackChecksum sums = get_checksum();
+            ESP_LOGI(LOG_TAG, "CRC32 %08X, AccurateRip v1 %08X, v2 %08X", sums.get_crc32(), sums.get_accuraterip_v1(), sums.get_accuraterip_v2());
+        }
+    }
+
+    int CDDAExtractor::extract_chunk(uint32_t my_generation) {
+        const size_t sector_size = Device::cdda_sector_size(want_c2, want_subq);
+        int lba = next_lba;
+        uint8_t count = std::min((int) chunk, end_lba - lba);
+        int failures = 0;
+
+        while(!read_sectors(lba, count)) {
+            if(generation != my_generation) return 0;
+            stats.retries++;
+
+            if(count > 1) {
+                // Maybe just one sector in there is bad, narrow it down
+                count /= 2;
+                chunk = count;
+                continue;
+            }
+
+            if(++failures >= SECTOR_RETRY_LIMIT) {
+                ESP_LOGW(LOG_TAG, "Giving up on LBA %i, replacing with silence", lba);
+                memset(scratch, 0, sector_size);
+                stats.sectors_lost++;
+                break;
+            }
+        }
+
+        for(int i = 0; i < count; i++) {
+            uint8_t * sector = &scratch[i * sector_size];
+            if(want_c2 && failures < SECTOR_RETRY_LIMIT) conceal_c2(sector);
+            if(want_subq) {
+                const uint8_t * q = &sector[Device::CDDA_SECTOR_SIZE + (want_c2 ? Device::CDDA_C2_SIZE : 0)];
+                if((q[0] & 0xF) == SUBCH_ADR_CUR_POS_DATA) {
+                    q_track = bcd_to_int(q[1]);
+                    q_index = bcd_to_int(q[2]);
+                }
+            }
+        }
+
+        xSemaphoreTake(semaphore, portMAX_DELAY);
+        if(generation == my_generation) {
+            for(int i = 0; i < count; i++) {
+                push(&scratch[i * sector_size], Device::CDDA_SECTOR_SIZE);
+                // the C2 pointers and the subchannel follow each sector in the scratch buffer, so one at a time
+                checksum.update(&scratch[i * sector_size], 1);
+            }
+            next_lba = lba + count;
+            stats.sectors_read += count;
+            update_rate(count * Device::CDDA_SECTOR_SIZE);
+        }
+        xSemaphoreGive(semaphore);
+
+        if(failures == 0 && chunk < MAX_CHUNK_SECTORS) chunk++;
+        stats.chunk_sectors = chunk;
+        return count;
+    }
+
+    bool CDDAExtractor::read_sectors(int lba, uint8_t count) {
+        bool rslt = false;
+        // Go through the command queue, so that the user's commands still have the way over the extraction
+        cdrom->submit(Device::Priority::BACKGROUND, [this, lba, count, &rslt]() {
+            rslt = cdrom->read_cd(lba, count, scratch, want_c2, want_subq);
+        }).wait();
+        return rslt;
+    }
+
+    void CDDAExtractor::conceal_c2(uint8_t * sector) {
+        const uint8_t * c2 = &sector[Device::CDDA_SECTOR_SIZE];
+        bool any = false;
+
+        // One C2 bit per byte of audio, MSB first. Bad samples are replaced with the previous good one, which is about the best that can be done without looking ahead.
+        for(size_t s = 0; s < Device::CDDA_SECTOR_SIZE; s += 4) {
+            uint8_t flags = c2[s / 8] >> (4 - (s % 8)) & 0xF;
+            if(flags != 0) {
+                memcpy(&sector[s], last_sample, 4);
+                any = true;
+            } else {
+                memcpy(last_sample, &sector[s], 4);
+            }
+        }
+
+        if(any) stats.sectors_c2++;
+    }
+
+    void CDDAExtractor::push(const uint8_t * data, size_t len) {
+        size_t ofs = head % ring_size;
+        size_t first = std::min(len, ring_size - ofs);
+        memcpy(&ring[ofs], data, first);
+        if(len > first) memcpy(ring, &data[first], len - first);
+        head += len;
+    }
+
+    void CDDAExtractor::update_rate(size_t len) {
+        // Whole chunks only, a window that ends halfway into one would count sectors that took no time to read
+        int64_t now = esp_timer_get_time();
+        rate_window_bytes += len;
+        if(now - rate_window_start >= 1000000) {
+            stats.bytes_per_second = (uint32_t) (rate_window_bytes * 1000000LL / (now - rate_window_start));
+            rate_window_start = now;
+            rate_window_bytes = 0;
+        }
+    }
+}
@@ -0,0 +1,143 @@
+#include <esper-cdp/index_scanner.h>
+#include <esper-cdp/atapi-protocol.h>
+#include <esp_heap_caps.h>
+
+static const char LOG_TAG[] = "IDXSCAN";
+
+// The LBA of M00S02F00
+static const int LBA_OFFSET = 2 * MSF::FRAMES_IN_SECOND;
+// How far off the seek may land for the sample to still count
+static const int SEEK_TOLERANCE = MSF::FRAMES_IN_SECOND / 2;
+// Binary search over a whole disc takes 19 steps, anything more means the drive is returning nonsense
+static const int SEARCH_STEP_LIMIT = 24;
+
+static uint8_t bcd_to_int(uint8_t bcd) { return (bcd >> 4) * 10 + (bcd & 0xF); }
+
+namespace CD {
+    IndexScanner::IndexScanner(ATAPI::Device * device):
+        cdrom(device)
+    {
+        const size_t size = ATAPI::Device::cdda_sector_size(false, true);
+        sector = (uint8_t *) heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+        if(sector == nullptr) sector = (uint8_t *) malloc(size);
+    }
+
+    IndexScanner::~IndexScanner() {
+        if(sector != nullptr) free(sector);
+    }
+
+    bool IndexScanner::probe(int frame, Sample& out) {
+        probes++;
+
+        if(use_read_cd && sector != nullptr) {
+            if(cdrom->read_cd(frame - LBA_OFFSET, 1, sector, false, true)) {
+                const uint8_t * q = &sector[ATAPI::Device::CDDA_SECTOR_SIZE];
+                if((q[0] & 0xF) == ATAPI::SUBCH_ADR_CUR_POS_DATA) {
+                    out.frame = frame;
+                    out.track = bcd_to_int(q[1]);
+                    out.index = bcd_to_int(q[2]);
+                    return true;
+                }
+                // Some sectors carry the catalog number or ISRC instead, the neighbour will do just as well
+                return probe(frame + 1, out);
+            }
+
+            ESP_LOGW(LOG_TAG, "Drive can't read the Q subchannel with READ CD, seeking instead");
+            use_read_cd = false;
+        }
+
+        if(!use_seek) return false;
+
+        // Move the head there without playing anything, and look where it landed.
+        // Seeking with PLAY AUDIO + PAUSE would be heard on the output while the player is supposedly stopped.
+        if(!cdrom->seek(frame - LBA_OFFSET)) {
+            ESP_LOGW(LOG_TAG, "Drive can't seek either, no index scanning on it");
+            use_seek = false;
+            return false;
+        }
+        const ATAPI::AudioStatus * sts = cdrom->query_position();
+        int sampled = MSF_TO_FRAMES(sts->position_in_disc);
+        if(abs(sampled - frame) > SEEK_TOLERANCE) {
+            // Not every drive reports the head position outside of audio play, so don't try again on this one
+            ESP_LOGW(LOG_TAG, "Wanted to sample %i but the drive says %i after seeking, no index scanning on it", frame, sampled);
+            use_seek = false;
+            return false;
+        }
+
+        out.frame = sampled;
+        out.track = sts->track;
+        out.index = sts->index;
+        return true;
+    }
+
+    int IndexScanner::find_start(int lo, int hi, uint8_t track, uint8_t index, std::function<bool()>& should_stop) {
+        // Invariant: everything before `lo` is before the point, `hi` is at or after it
+        Sample s;
+        for(int step = 0; lo < hi && step < SEARCH_STEP_LIMIT; step++) {
+            if(should_stop()) return -1;
+
+            int mid = lo + (hi - lo) / 2;
+            if(!probe(mid, s)) return -1;
+
+            bool at_or_after = s.track > track || (s.track == track && s.index >= index);
+            if(at_or_after) hi = std::min(hi, s.frame);
+            else lo = std::max(mid, s.frame) + 1;
+        }
+        return hi;
+    }
+
+    bool IndexScanner::scan_track(const Album& album, int track_idx, std::function<bool()> should_stop, std::vector<IndexPoint>& out) {
+        probes = 0;
+        bool rslt = false;
+        const Track& trk = album.tracks[track_idx];
+        const uint8_t number = trk.disc_position.number;
+        const int start = MSF_TO_FRAMES(trk.disc_position.position);
+        int end = MSF_TO_FRAMES(album.duration);
+        if(track_idx + 1 < album.tracks.size()) end = MSF_TO_FRAMES(album.tracks[track_idx + 1].disc_position.position);
+
+        do {
+            if(track_idx == 0 && start > LBA_OFFSET) {
+                // Anything before the first track is its pregap, and maybe audio hidden in there
+                out.push_back(IndexPoint { .track = number, .index = 0, .position = FRAMES_TO_MSF(LBA_OFFSET) });
+            }
+
+            Sample last;
+            if(should_stop() || !probe(end - 1, last)) break;
+
+            if(track_idx + 1 < album.tracks.size() && last.track != number) {
+                // The end of the track is already the pregap of the next one
+                const uint8_t next = album.tracks[track_idx + 1].disc_position.number;
+                int pregap = find_start(start, end - 1, next, 0, should_stop);
+                if(pregap < 0) break;
+                out.push_back(IndexPoint { .track = next, .index = 0, .position = FRAMES_TO_MSF(pregap) });
+
+                end = pregap;
+                if(end - 1 <= start) {
+                    rslt = true;
+                    break;
+                }
+                if(should_stop() || !probe(end - 1, last)) break;
+            }
+
+            if(last.track == number && last.index > 1) {
+                bool stopped = false;
+                int from = start;
+                for(uint8_t idx = 2; idx <= last.index; idx++) {
+                    int pos = find_start(from, end - 1, number, idx, should_stop);
+                    if(pos < 0) {
+                        stopped = true;
+                        break;
+                    }
+                    out.push_back(IndexPoint { .track = number, .index = idx, .position = FRAMES_TO_MSF(pos) });
+                    from = pos;
+                }
+                if(stopped) break;
+            }
+
+            rslt = true;
+        } while(0);
+
+        ESP_LOGI(LOG_TAG, "Track %i: %s after %i probes", number, rslt ? "done" : "interrupted", probes);
+        return rslt;
+    }
+}
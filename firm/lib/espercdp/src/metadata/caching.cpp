@@ -33,7 +33,9 @@ struct __attribute__((packed)) CacheDataFileHeader {
 
 enum CacheDataFileEntryKind: uint8_t {
     CACHE_ENTRY_TITLE = 0,
-    CACHE_ENTRY_ARTIST
+    CACHE_ENTRY_ARTIST,
+    /// Whole disc only. Space separated `track.index=frame` items.
+    CACHE_ENTRY_INDEX_MAP
 };
 
 struct __attribute__((packed)) CacheDataFileEntryHeader {
@@ -68,6 +70,39 @@ void _entry_to_vec(std::vector<uint8_t>& v, const std::string& artist, const std
     }
 }
 
+void _index_map_to_vec(std::vector<uint8_t>& v, const CD::Album& album, uint8_t* entry_counter) {
+    if(!album.is_index_map_complete()) return;
+
+    CacheDataFileEntryHeader hdr = { .kind = CACHE_ENTRY_INDEX_MAP, .track_no = 0 };
+    uint8_t * tmp = (uint8_t*) &hdr;
+    v.insert(v.end(), tmp, tmp + sizeof(hdr));
+
+    char item[24];
+    std::string str = "";
+    for(auto& point: album.index_map) {
+        snprintf(item, sizeof(item), "%s%u.%u=%u", str.empty() ? "" : " ", point.track, point.index, MSF_TO_FRAMES(point.position));
+        str += item;
+    }
+    std::copy(str.begin(), str.end(), std::back_inserter(v));
+    v.push_back(0);
+    *entry_counter += 1;
+}
+
+bool _index_map_from_str(CD::Album& album, const char * str) {
+    std::vector<CD::IndexPoint> map = {};
+    unsigned int track, index, frame;
+    int consumed = 0;
+    while(sscanf(str, " %u.%u=%u%n", &track, &index, &frame, &consumed) == 3) {
+        map.push_back(CD::IndexPoint { .track = (uint8_t) track, .index = (uint8_t) index, .position = FRAMES_TO_MSF(frame) });
+        str += consumed;
+    }
+    if(*str != 0 && *str != ' ') return false;
+
+    album.index_map = map;
+    album.index_map_tracks_done = album.tracks.size();
+    return true;
+}
+
 namespace CD {
     CachingMetadataAggregateProvider::CachingMetadataAggregateProvider(const char * cache_path) {
         path = (cache_path == nullptr ? "" : std::string(cache_path));
@@ -105,6 +140,14 @@ namespace CD {
         }
     }
 
+    void CachingMetadataAggregateProvider::update_album(const Album& album) {
+        // Only add to what the cacheable providers found, rather than caching whatever came from CD-TEXT afterwards
+        std::string id = MusicBrainzMetadataProvider::generate_id(album);
+        struct stat st;
+        if(!album.is_metadata_good_for_caching() || stat(id_to_path(id).c_str(), &st) != 0) return;
+        save_to_cache(album, id);
+    }
+
     bool CachingMetadataAggregateProvider::populate_from_cache(Album& album, const std::string id) {
         auto path = id_to_path(id);
 
@@ -182,6 +225,13 @@ namespace CD {
                     }
                     break;
                 
+                case CACHE_ENTRY_INDEX_MAP:
+                    if(!_index_map_from_str(album, val)) {
+                        ESP_LOGE(LOG_TAG, "%s: malformed index map", path.c_str());
+                        goto kill_file;
+                    }
+                    break;
+
                 default:
                     ESP_LOGE(LOG_TAG, "%s: malformed or unknown entry type %i", path.c_str(), cur_data->kind);
                     goto kill_file;
@@ -219,6 +269,7 @@ namespace CD {
         for(auto& t: album.tracks) {
             _entry_to_vec(v, t.artist, t.title, t.disc_position.number, &hdr.entry_count);
         }
+        _index_map_to_vec(v, album, &hdr.entry_count);
 
         hdr.raw_size = v.size();
         ESP_LOGI(LOG_TAG, "Size before compression = %lu", hdr.raw_size);
@@ -44,6 +44,11 @@ namespace CD {
         return crc;
     }
 
+    bool CDTextMetadataProvider::is_pack_useful(const uint8_t * pack) {
+        const CDTextPack * p = (const CDTextPack *) pack;
+        return (p->kind == CDTextPack::Kind::TITLE || p->kind == CDTextPack::Kind::ARTIST) && p->block_no == 0 && !p->wide_char;
+    }
+
     void CDTextMetadataProvider::fetch_album(Album& album) {
         if(album.tracks.size() == 0) return; // probably not a CDA!
         
@@ -58,18 +63,19 @@ namespace CD {
         std::vector<std::string> tmp_artists(album.tracks.size() + 1);
         std::vector<std::string> tmp_titles(album.tracks.size() + 1);
 
-        uint8_t last_seq_no = 0xFF;
+        int last_seq_no = -1;
         int cur_trk_no_artist = 0;
         int cur_trk_no_title = 0;
 
         for(int pos = 0; pos < raw_data.size(); pos += sizeof(CDTextPack)) {
             cur = (CDTextPack*) &raw_data[pos];
 
-            last_seq_no++;
-            if(cur->sequence_no != last_seq_no) {
-                ESP_LOGE(LOG_TAG, "Seq no jump from %i to %i at pos=%i, bail out!", last_seq_no, cur->sequence_no, pos);
+            // Only the useful packs are kept, so there are gaps, but the order must still hold
+            if(cur->sequence_no <= last_seq_no) {
+                ESP_LOGE(LOG_TAG, "Seq no went back from %i to %i at pos=%i, bail out!", last_seq_no, cur->sequence_no, pos);
                 break;
             }
+            last_seq_no = cur->sequence_no;
 
             if(cur->block_no != 0) continue; // maybe one day
             if(cur->wide_char) continue; // maybe one day
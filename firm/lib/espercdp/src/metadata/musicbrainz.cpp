@@ -1,5 +1,6 @@
 #include <esper-cdp/metadata.h>
 #include <esper-cdp/utils.h>
+#include <esper-cdp/musicbrainz_json.h>
 #include <mbedtls/sha1.h>
 #include <cstring>
 #include <esp32-hal-log.h>
@@ -38,7 +39,9 @@ namespace CD {
         WiFiClient client;
         HTTPClient http;
         const std::string host = "http://musicbrainz.org/ws/2/discid/";
-        const std::string query = "?inc=recordings+artist-credits&fmt=json";
+        // The ISRCs of the recordings only help if there's anything to compare them to
+        const bool have_isrcs = std::any_of(album.tracks.cbegin(), album.tracks.cend(), [](const Track& t) { return !t.isrc.empty(); });
+        const std::string query = have_isrcs ? "?inc=recordings+artist-credits+isrcs&fmt=json" : "?inc=recordings+artist-credits&fmt=json";
 
         std::string url = host + disc_id + query;
 
@@ -54,10 +57,18 @@ namespace CD {
             } else {
                 if(response["releases"].is<JsonArray>()) {
                     auto releases = response["releases"].as<JsonArray>();
-                    if(releases.size() != 1) {
+                    int release_idx = -1;
+                    if(releases.size() == 1) release_idx = 0;
+                    else if(releases.size() > 1) {
+                        std::vector<std::string> isrcs = {};
+                        for(auto& trk: album.tracks) isrcs.push_back(trk.isrc);
+                        release_idx = MBJsonPickRelease(releases, album.mcn, isrcs, disc_id);
+                    }
+
+                    if(release_idx < 0) {
                         ESP_LOGW(LOG_TAG, "%i releases found, can't proceed", releases.size());
                     } else {
-                        auto info = releases[0].as<JsonObject>();
+                        auto info = releases[release_idx].as<JsonObject>();
                         if(album.title.empty() && info["title"].is<JsonString>()) {
                             album.title = info["title"].as<std::string>();
                         }
@@ -65,20 +76,7 @@ namespace CD {
 
                         // now on to find which CD of the release this is
                         if(info["media"].is<JsonArray>()) {
-                            auto media = info["media"].as<JsonArray>();
-                            int mediaIdx = -1;
-                            for(int i = 0; i < media.size(); i++) {
-                                if(media[i]["discs"].is<JsonArray>()) {
-                                    for(auto disc: media[i]["discs"].as<JsonArray>()) {
-                                        if(disc["id"].is<JsonString>()) {
-                                            if(disc_id == disc["id"].as<std::string>()) {
-                                                mediaIdx = i;
-                                                break;
-                                            }
-                                        }
-                                    }
-                                }
-                            }
+                            int mediaIdx = MBJsonFindMediumIndex(info, disc_id);
 
                             if(mediaIdx != -1 && info["media"][mediaIdx]["tracks"].is<JsonArray>()) {
                                 auto tracks = info["media"][mediaIdx]["tracks"].as<JsonArray>();
@@ -0,0 +1,81 @@
+#include <esper-cdp/musicbrainz_json.h>
+#include <esp32-hal-log.h>
+#include <algorithm>
+
+static const char LOG_TAG[] = "MBRAINZ";
+
+int MBJsonFindMediumIndex(const JsonObject& info, const std::string& disc_id) {
+    if(!info["media"].is<JsonArray>()) return -1;
+
+    auto media = info["media"].as<JsonArray>();
+    for(int i = 0; i < media.size(); i++) {
+        if(media[i]["discs"].is<JsonArray>()) {
+            for(auto disc: media[i]["discs"].as<JsonArray>()) {
+                if(disc["id"].is<JsonString>() && disc_id == disc["id"].as<std::string>()) {
+                    return i;
+                }
+            }
+        }
+    }
+    return -1;
+}
+
+// Barcodes come as 12 digit UPC or 13 digit EAN, the MCN is always the latter
+static const std::string normalize_barcode(const std::string& code) {
+    size_t start = code.find_first_not_of('0');
+    return (start == std::string::npos) ? "" : code.substr(start);
+}
+
+int MBJsonPickRelease(const JsonArray& releases, const std::string& disc_mcn, const std::vector<std::string>& isrcs, const std::string& disc_id) {
+    std::vector<int> candidates = {};
+
+    const std::string mcn = normalize_barcode(disc_mcn);
+    if(!mcn.empty()) {
+        for(int i = 0; i < releases.size(); i++) {
+            if(releases[i]["barcode"].is<JsonString>() && normalize_barcode(releases[i]["barcode"].as<std::string>()) == mcn) {
+                candidates.push_back(i);
+            }
+        }
+        ESP_LOGI(LOG_TAG, "%i releases have the barcode %s", candidates.size(), disc_mcn.c_str());
+        if(candidates.size() == 1) return candidates[0];
+    }
+
+    if(candidates.empty()) {
+        for(int i = 0; i < releases.size(); i++) candidates.push_back(i);
+    }
+
+    int best = -1;
+    int best_score = 0;
+    bool tie = false;
+    for(int i: candidates) {
+        auto info = releases[i].as<JsonObject>();
+        int medium = MBJsonFindMediumIndex(info, disc_id);
+        if(medium < 0 || !info["media"][medium]["tracks"].is<JsonArray>()) continue;
+
+        auto tracks = info["media"][medium]["tracks"].as<JsonArray>();
+        int score = 0;
+        for(int t = 0; t < std::min(tracks.size(), isrcs.size()); t++) {
+            if(isrcs[t].empty() || !tracks[t]["recording"]["isrcs"].is<JsonArray>()) continue;
+            for(auto isrc: tracks[t]["recording"]["isrcs"].as<JsonArray>()) {
+                if(isrc.as<std::string>() == isrcs[t]) {
+                    score++;
+                    break;
+                }
+            }
+        }
+
+        if(score > best_score) {
+            best = i;
+            best_score = score;
+            tie = false;
+        } else if(score == best_score && score > 0) {
+            tie = true;
+        }
+    }
+
+    if(best >= 0 && !tie) {
+        ESP_LOGI(LOG_TAG, "Release %i matches %i ISRCs", best, best_score);
+        return best;
+    }
+    return -1;
+}
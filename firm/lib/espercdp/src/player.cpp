@@ -1,8 +1,39 @@
 #include <esper-cdp/player.h>
+#include <esper-cdp/checksum.h>
+#include <esper-cdp/atapi-protocol.h>
+#include <esp_timer.h>
 const uint8_t TRK_NUM_LEAD_OUT = 0xAA;
 static char LOG_TAG[] = "CDP";
 
+// Longest the playback clock runs on its own without hearing from the drive
+static const int CLOCK_MAX_EXTRAPOLATION = 2 * MSF::FRAMES_IN_SECOND;
+// Difference between the clock and the drive above which the clock just jumps instead of easing in
+static const int CLOCK_RESYNC_THRESHOLD = MSF::FRAMES_IN_SECOND;
+// How long the player must sit stopped before the changer goes to read the other slots
+static const TickType_t INVENTORY_IDLE_DELAY = pdMS_TO_TICKS(30000);
+// Longest a changer may take to bring a disc into the play position
+static const TickType_t INVENTORY_LOAD_TIMEOUT = pdMS_TO_TICKS(20000);
+// How long the player must sit stopped before the disc gets scanned for index points
+static const TickType_t INDEX_SCAN_IDLE_DELAY = pdMS_TO_TICKS(10000);
+// How close to the end of the range the PLAY AUDIO of the next shuffled track gets scheduled. Must be over the position poll interval in PLAY.
+static const int64_t TRANSITION_HORIZON_US = 1500000;
+// Frames of the current range to give up, so that the next PLAY AUDIO surely lands before the drive stops even if it has to wait for a job in the queue
+static const int TRANSITION_LEAD_FRAMES = 3;
+// Stop looking for ISRCs after this many tracks in a row without one, most discs have none at all and each look may take the drive a while
+static const int ISRC_MISSES_TO_GIVE_UP = 2;
+
 namespace CD {
+    // Catalog number and ISRCs, for telling apart releases that share the disc ID
+    static void read_identifiers(ATAPI::Device * dev, Album& album) {
+        album.mcn = dev->read_mcn();
+        int misses = 0;
+        for(auto& trk: album.tracks) {
+            trk.isrc = dev->read_isrc(trk.disc_position.number);
+            if(!trk.isrc.empty()) misses = 0;
+            else if(++misses >= ISRC_MISSES_TO_GIVE_UP) break;
+        }
+    }
+
     static void pollTask(void* pvParameter) {
         Player* player = static_cast<Player*>(pvParameter);
         while(true) {
@@ -23,9 +54,19 @@ namespace CD {
         _cmdSemaphore = xSemaphoreCreateBinary();
         xSemaphoreGive(_cmdSemaphore);
 
+        _pollSemaphore = xSemaphoreCreateBinary();
+        xSemaphoreGive(_pollSemaphore);
+
         _metaSemaphore = xSemaphoreCreateBinary();
         xSemaphoreGive(_metaSemaphore);
 
+        cdrom->set_error_handler([this](const ATAPI::Device::ErrorEvent& evt) {
+            last_drive_error = evt;
+            drive_error_count++;
+            // Whatever the drive was up to, it's worth a fresh look
+            refresh_requested = true;
+        });
+
         xTaskCreate(
             pollTask,
             "CDPoll",
@@ -48,10 +89,12 @@ namespace CD {
     void Player::teardown_tasks() {
         if(_pollTask != NULL) {
             ESP_LOGI(LOG_TAG, "Deleting poll task");
+            xSemaphoreTake(_pollSemaphore, portMAX_DELAY);
             xSemaphoreTake(_cmdSemaphore, portMAX_DELAY);
             vTaskDelete(_pollTask);
             _pollTask = NULL;
         }
+        cdrom->set_error_handler(nullptr);
         if(_metaTask != NULL) {
             ESP_LOGI(LOG_TAG, "Deleting metadata task");
             xSemaphoreTake(_metaSemaphore, portMAX_DELAY);
@@ -66,35 +109,271 @@ namespace CD {
             vSemaphoreDelete(_cmdSemaphore);
             _cmdSemaphore = NULL;
         }
+        if(_pollSemaphore != NULL) {
+            vSemaphoreDelete(_pollSemaphore);
+            _pollSemaphore = NULL;
+        }
     }
 
     void Player::process_metadata_queue() {
+        PendingMetadata next;
         if(xSemaphoreTake(_metaSemaphore, portMAX_DELAY)) {
-            if(!_metaQueue.empty()) {
-                std::shared_ptr<Album> album_ptr = _metaQueue.front();
+            if(!_metaQueue.empty()) next = _metaQueue.front();
+            xSemaphoreGive(_metaSemaphore);
+        }
+        if(next.album == nullptr) return;
 
-                meta->fetch_album(*album_ptr);
-                _metaQueue.pop();
-            }
+        // The CD-TEXT is read after the TOC, so the providers have to wait for it
+        if(next.cd_text.valid()) next.cd_text.wait();
+
+        if(xSemaphoreTake(_metaSemaphore, portMAX_DELAY)) {
+            meta->fetch_album(*next.album);
+            _metaQueue.pop();
             xSemaphoreGive(_metaSemaphore);
         }
+        events.publish(PlayerEvents::EVT_METADATA);
+    }
+
+    void Player::queue_metadata(std::shared_ptr<Album> album, bool read_from_disc) {
+        std::shared_future<void> cd_text;
+        if(read_from_disc) {
+            // Lower priority than the status polling, the track list is there already and this can take a few seconds
+            ATAPI::Device * dev = cdrom;
+            cd_text = cdrom->submit(ATAPI::Device::Priority::BACKGROUND, [dev, album]() {
+                std::vector<uint8_t> packs = {};
+                dev->read_cd_text([&packs](const uint8_t * pack) {
+                    if(CDTextMetadataProvider::is_pack_useful(pack)) packs.insert(packs.end(), pack, pack + ATAPI::Device::CD_TEXT_PACK_SIZE);
+                });
+                album->toc_subchannel = packs;
+                read_identifiers(dev, *album);
+            });
+        }
+
+        // NB: std::queue is not thread safe, can this lead to a problem? realistically we shouldn't have more than one in the pipeline anyway...
+        xSemaphoreTake(_metaSemaphore, portMAX_DELAY);
+        _metaQueue.push(PendingMetadata {
+            .album = album,
+            .cd_text = cd_text
+        });
+        xSemaphoreGive(_metaSemaphore); // let the background task go
+        events.publish(PlayerEvents::EVT_METADATA);
+    }
+
+    const Player::PollSchedule& Player::schedule_for(State state) {
+        // How often to check the media type, mechanism status and playback position
+        static const PollSchedule schedule_busy = { .media = 0, .mech = 0, .position = POLL_NEVER };
+        static const PollSchedule schedule_open = { .media = pdMS_TO_TICKS(250), .mech = pdMS_TO_TICKS(250), .position = POLL_NEVER };
+        static const PollSchedule schedule_idle = { .media = pdMS_TO_TICKS(1000), .mech = pdMS_TO_TICKS(1000), .position = POLL_NEVER };
+        // position still needed to notice playback started with the drive's own buttons
+        static const PollSchedule schedule_stop = { .media = pdMS_TO_TICKS(1000), .mech = pdMS_TO_TICKS(1000), .position = pdMS_TO_TICKS(500) };
+        // position in between reads is taken care of by the playback clock
+        static const PollSchedule schedule_play = { .media = pdMS_TO_TICKS(500), .mech = pdMS_TO_TICKS(500), .position = pdMS_TO_TICKS(500) };
+        static const PollSchedule schedule_pause = { .media = pdMS_TO_TICKS(1000), .mech = pdMS_TO_TICKS(1000), .position = pdMS_TO_TICKS(1000) };
+        static const PollSchedule schedule_seek = { .media = pdMS_TO_TICKS(500), .mech = pdMS_TO_TICKS(500), .position = 0 };
+
+        switch(state) {
+            case State::OPEN: return schedule_open;
+            case State::NO_DISC:
+            case State::BAD_DISC:
+                return schedule_idle;
+            case State::STOP: return schedule_stop;
+            case State::PLAY: return schedule_play;
+            case State::PAUSE: return schedule_pause;
+            case State::SEEK_FF:
+            case State::SEEK_REW:
+                return schedule_seek;
+            default: return schedule_busy;
+        }
+    }
+
+    const PowerManager::Thresholds& Player::power_thresholds_for(State state) {
+        // Resuming from pause restarts the playback from scratch anyway, so the drive can stop there as well, just not as eagerly
+        static const PowerManager::Thresholds thresholds_stop = { .idle = pdMS_TO_TICKS(60000), .standby = pdMS_TO_TICKS(600000) };
+        static const PowerManager::Thresholds thresholds_pause = { .idle = pdMS_TO_TICKS(300000), .standby = pdMS_TO_TICKS(1800000) };
+        // some drives keep spinning a disc they could not read, retrying
+        static const PowerManager::Thresholds thresholds_bad_disc = { .idle = pdMS_TO_TICKS(30000), .standby = PowerManager::NEVER };
+        static const PowerManager::Thresholds thresholds_never = { .idle = PowerManager::NEVER, .standby = PowerManager::NEVER };
+
+        switch(state) {
+            case State::STOP: return thresholds_stop;
+            case State::PAUSE: return thresholds_pause;
+            case State::BAD_DISC: return thresholds_bad_disc;
+            default: return thresholds_never;
+        }
+    }
+
+    float Player::get_poll_rate(State state) {
+        const PollStats& stat = poll_stats[(int) state];
+        if(stat.ticks == 0) return 0;
+        return stat.commands * 1000.0f / pdTICKS_TO_MS(stat.ticks);
+    }
+
+    void Player::log_poll_stats() {
+        for(int i = 0; i < STATE_COUNT; i++) {
+            if(poll_stats[i].ticks == 0) continue;
+            ESP_LOGI(LOG_TAG, "Poll: %s for %u s, %u commands, %.1f cmd/s", PlayerStateString((State) i), pdTICKS_TO_MS(poll_stats[i].ticks) / 1000, poll_stats[i].commands, get_poll_rate((State) i));
+        }
+        power.log_summary();
+    }
+
+    int Player::clock_position() {
+        int elapsed = (int) ((esp_timer_get_time() - clock.anchor_us) * MSF::FRAMES_IN_SECOND / 1000000);
+        elapsed = std::min(elapsed, CLOCK_MAX_EXTRAPOLATION);
+        return std::max(clock.floor, std::min(clock.abs_anchor + elapsed, clock.limit - 1));
+    }
+
+    void Player::sync_clock() {
+        int sample = MSF_TO_FRAMES(abs_ts);
+        bool same_track = clock.running && cur_track.track == last_clock_track.track && cur_track.index == last_clock_track.index;
+        int predicted = clock.running ? clock_position() : sample;
+
+        auto const& tracks = get_active_slot().disc->tracks;
+        int limit = MSF_TO_FRAMES(get_active_slot().disc->duration);
+        if(cur_track.track >= 1 && cur_track.track < tracks.size()) {
+            limit = MSF_TO_FRAMES(tracks[cur_track.track].disc_position.position);
+        }
+
+        clock = PlaybackClock {
+            .running = true,
+            .anchor_us = esp_timer_get_time(),
+            .abs_anchor = sample,
+            .rel_anchor = MSF_TO_FRAMES(rel_ts),
+            .counting_down = (cur_track.index == 0),
+            .limit = std::max(limit, sample + 1),
+            // Running slightly ahead of the drive: hold still until it catches up, so that the time never goes backwards.
+            // Anything further off than that is a real jump, e.g. the drive skipped.
+            .floor = (same_track && predicted > sample && predicted - sample <= CLOCK_RESYNC_THRESHOLD) ? predicted : 0
+        };
+        last_clock_track = cur_track;
+    }
+
+    const MSF Player::get_current_absolute_time() {
+        if(!clock.running) return abs_ts;
+        return FRAMES_TO_MSF(clock_position());
+    }
+
+    const MSF Player::get_current_track_time() {
+        if(!clock.running) return rel_ts;
+        int moved = clock_position() - clock.abs_anchor;
+        return FRAMES_TO_MSF(clock.counting_down ? std::max(0, clock.rel_anchor - moved) : (clock.rel_anchor + moved));
     }
 
     void Player::poll_state() {
+        xSemaphoreTake(_pollSemaphore, portMAX_DELAY);
+        poll_count++;
         State oldSts = sts;
         int delay = 0;
+
+        TickType_t now = xTaskGetTickCount();
+        poll_stats[(int) sts].ticks += now - last_poll_tick;
+        last_poll_tick = now;
+
+        // Walk through the changer while nobody is using it, so that switching discs later doesn't need to read the TOC
+        if(sts == State::STOP && slots.size() > 1 && now - last_activity_tick >= INVENTORY_IDLE_DELAY) {
+            if(take_inventory_step(command_generation)) {
+                xSemaphoreTake(_cmdSemaphore, portMAX_DELAY);
+                power.note_active(false);
+                xSemaphoreGive(_cmdSemaphore);
+                xSemaphoreGive(_pollSemaphore);
+                return;
+            }
+        }
+
+        // Same for the pregaps and indexes, one track at a time. Wait for the metadata, which may have brought the index map from the cache.
+        if(sts == State::STOP && now - last_activity_tick >= INDEX_SCAN_IDLE_DELAY && !is_processing_metadata()) {
+            if(take_index_scan_step(command_generation)) {
+                xSemaphoreTake(_cmdSemaphore, portMAX_DELAY);
+                power.note_active(false);
+                xSemaphoreGive(_cmdSemaphore);
+                xSemaphoreGive(_pollSemaphore);
+                return;
+            }
+        }
+
+        // Nothing left to do in the background either, so the drive may rest
         xSemaphoreTake(_cmdSemaphore, portMAX_DELAY);
+        power.take_step(power_thresholds_for(sts), xTaskGetTickCount() - last_activity_tick);
+        xSemaphoreGive(_cmdSemaphore);
+
+        // Read out the drive status first, without blocking `do_command()` meanwhile.
+        // Each read is queued separately in the background, so a user command can get to the drive in between.
+        uint32_t generation = command_generation;
+        std::shared_future<void> done;
+        if(sts != State::INIT) {
+            // Right after a user command or a state change everything is stale, otherwise only read what's due in this state
+            bool force = refresh_requested || generation != last_poll_generation;
+            refresh_requested = false;
+            last_poll_generation = generation;
+
+            const PollSchedule& schedule = schedule_for(sts);
+            auto is_due = [now, force](TickType_t interval, TickType_t last) {
+                return interval != POLL_NEVER && (force || now - last >= interval);
+            };
+
+            if(is_due(schedule.media, last_media_poll)) {
+                done = cdrom->submit(ATAPI::Device::Priority::BACKGROUND, [this]() { last_media_type = cdrom->check_media(); });
+                last_media_poll = now;
+                poll_stats[(int) sts].commands++;
+            }
+            if(is_due(schedule.mech, last_mech_poll)) {
+                done = cdrom->submit(ATAPI::Device::Priority::BACKGROUND, [this]() { last_mech = *cdrom->query_state(); });
+                last_mech_poll = now;
+                poll_stats[(int) sts].commands++;
+            }
+            position_fresh = is_due(schedule.position, last_position_poll);
+            if(position_fresh) {
+                done = cdrom->submit(ATAPI::Device::Priority::BACKGROUND, [this]() { last_audio = *cdrom->query_position(); });
+                last_position_poll = now;
+                poll_stats[(int) sts].commands++;
+            }
+        }
+
+        // Waiting for the drive to come up may take as long as the latency ceiling, so it's queued like the status reads instead of holding up the commands
+        if(sts == State::INIT || sts == State::CLOSE || sts == State::CHANGE_DISC) {
+            const bool initial = (sts == State::INIT);
+            const bool start = (sts != State::CHANGE_DISC);
+            done = cdrom->submit(ATAPI::Device::Priority::BACKGROUND, [this, initial, start]() {
+                if(start) cdrom->start();
+                last_ready = cdrom->wait_ready();
+                if(initial && last_ready) {
+                    vTaskDelay(pdMS_TO_TICKS(500));
+                    cdrom->eject(false); // <- close aka start unit, otherwise any disc is BAD_DISC on some drives
+                }
+            });
+            poll_stats[(int) sts].commands++;
+        }
+
+        if(!done.valid()) {
+            // Nothing new to act upon
+            xSemaphoreGive(_pollSemaphore);
+            return;
+        }
+        done.wait();
+
+        if(now - last_poll_stats_log >= pdMS_TO_TICKS(60000)) {
+            log_poll_stats();
+            last_poll_stats_log = now;
+        }
+
+        xSemaphoreTake(_cmdSemaphore, portMAX_DELAY);
+
+        if(generation != command_generation) {
+            // A user command came in while polling, so the status might be from before it took effect. Better luck next time.
+            xSemaphoreGive(_cmdSemaphore);
+            xSemaphoreGive(_pollSemaphore);
+            return;
+        }
 
+        ATAPI::MediaTypeCode media_type = last_media_type;
         if(sts == State::INIT) {
-            cdrom->start();
-            cdrom->wait_ready();
-            vTaskDelay(pdMS_TO_TICKS(500));
-            cdrom->eject(false); // <- close aka start unit, otherwise any disc is BAD_DISC on some drives
-            sts = State::LOAD;
+            if(last_ready) {
+                sts = State::LOAD;
+            } else {
+                delay = 1000;
+            }
         }
         else {
-            ATAPI::MediaTypeCode media_type = cdrom->check_media();
-            const ATAPI::MechInfo* mech = cdrom->query_state();
+            const ATAPI::MechInfo* mech = &last_mech;
             // Initial memory allocation for the slot statuses, even if it's just one
             if(mech->slot_count > slots.size()) {
                 for(int i = slots.size(); i < mech->slot_count; i++) {
@@ -102,6 +381,7 @@ namespace CD {
                         .disc_present = mech->changer_slots[i].disc_in,
                         .active = (mech->current_disc == i),
                         .disc = std::make_shared<Album>(Album()),
+                        .disc_id = 0
                     });
                 }
             }
@@ -113,6 +393,10 @@ namespace CD {
                 for(int i = 0; i < slots.size(); i++) {
                     slots[i].active = mech->current_disc == i;
                     if(slots[i].active) cur_slot = i; // why? because who knows what's actually in `mech->current_disc`
+                    if(i != cur_slot && (mech->changer_slots[i].disc_changed || (slots[i].disc_present && !mech->changer_slots[i].disc_in))) {
+                        // Whatever the inventory knew about this slot is no longer true
+                        invalidate_slot(i);
+                    }
                     slots[i].disc_present = mech->changer_slots[i].disc_in;
                 }
             } 
@@ -126,7 +410,7 @@ namespace CD {
             // changing to this from if(media_type == ATAPI::MediaTypeCode::MTC_DOOR_OPEN && sts != State::CLOSE) {
             // broke the changer support, why?
             if((media_type == ATAPI::MediaTypeCode::MTC_DOOR_OPEN || mech->is_door_open) && sts != State::CLOSE) {
-                slots[cur_slot].disc = std::make_shared<Album>();
+                invalidate_slot(cur_slot);
                 sts = State::OPEN;
             }
 
@@ -150,9 +434,10 @@ namespace CD {
                     cur_track.index = 1;
                     abs_ts = { .M = 0, .S = 0, .F = 0 };
                     rel_ts = { .M = 0, .S = 0, .F = 0 };
-                    cdrom->start();
-                    cdrom->wait_ready();
-                    if((media_type != ATAPI::MediaTypeCode::MTC_DOOR_CLOSED_UNKNOWN && media_type != ATAPI::MediaTypeCode::MTC_DOOR_CLOSED_UNKNOWN_ALT) || (cdrom->get_quirks().no_media_codes && media_type == ATAPI::MediaTypeCode::MTC_DOOR_CLOSED_UNKNOWN)) {
+                    if(!last_ready) {
+                        delay = 1000;
+                    }
+                    else if((media_type != ATAPI::MediaTypeCode::MTC_DOOR_CLOSED_UNKNOWN && media_type != ATAPI::MediaTypeCode::MTC_DOOR_CLOSED_UNKNOWN_ALT) || (cdrom->get_quirks().no_media_codes && media_type == ATAPI::MediaTypeCode::MTC_DOOR_CLOSED_UNKNOWN)) {
                         sts = (media_type != ATAPI::MediaTypeCode::MTC_DOOR_OPEN) ? State::LOAD : State::OPEN;
                     } else {
                         delay = 2000; //<- some drives cannot load while processing other commands
@@ -163,32 +448,47 @@ namespace CD {
                     // Load state: either just inited, or just closed the tray / changed CDs
                     if(ATAPI::MediaTypeCodeIsAudioCD(media_type) || cdrom->get_quirks().no_media_codes) {
                         // We got an audio CD probably
-                        if(cdrom->get_quirks().no_media_codes) vTaskDelay(pdMS_TO_TICKS(2000));
-                        auto toc = cdrom->read_toc();
-                        if(toc.tracks.empty()) {
-                            // The CD is not really useful as we cannot seem to read or play it
-                            ESP_LOGE(LOG_TAG, "Empty TOC!");
-                            sts = State::BAD_DISC;
-                            slots[cur_slot].disc = std::make_shared<Album>();
-                            want_auto_play = false;
+                        if(slots.size() > 1 && slots[cur_slot].disc_id != 0) {
+                            // Read by the inventory or played before, and the changer hasn't reported it changed since
+                            ESP_LOGI(LOG_TAG, "Slot %i: using the known TOC of disc %08x", cur_slot, slots[cur_slot].disc_id);
+                            auto album = slots[cur_slot].disc;
+                            if(album->toc_subchannel.empty() && !album->is_metadata_complete()) queue_metadata(album, true);
                         } else {
-                            slots[cur_slot].disc = std::make_shared<Album>(toc);
-                            
-                            // NB: std::queue is not thread safe, can this lead to a problem? realistically we shouldn't have more than one in the pipeline anyway...
-                            xSemaphoreTake(_metaSemaphore, portMAX_DELAY);
-                            _metaQueue.push(slots[cur_slot].disc);
-                            xSemaphoreGive(_metaSemaphore); // let the background task go
+                            if(cdrom->get_quirks().no_media_codes) vTaskDelay(pdMS_TO_TICKS(2000));
+                            auto toc = cdrom->read_toc();
+                            if(toc.tracks.empty()) {
+                                // The CD is not really useful as we cannot seem to read or play it
+                                ESP_LOGE(LOG_TAG, "Empty TOC!");
+                                sts = State::BAD_DISC;
+                                invalidate_slot(cur_slot);
+                                want_auto_play = false;
+                                shuffle_pending_track = -1;
+                            } else {
+                                slots[cur_slot].disc = std::make_shared<Album>(toc);
+                                slots[cur_slot].disc_id = ATAPI::AccurateRipDiscId::from_toc(toc).cddb;
+                                queue_metadata(slots[cur_slot].disc, true);
+                            }
+                        }
 
+                        if(sts == State::LOAD) {
+                            ESP_LOGI(LOG_TAG, "Track list ready %u ms after load start", pdTICKS_TO_MS(xTaskGetTickCount() - load_start_tick));
                             cur_track.track = 1;
                             cur_track.index = 1;
+                            offer_resume();
                             if(want_auto_play) {
                                 want_auto_play = false;
                                 sts = State::PLAY;
-                                if(auto_play_start_pos.M == 0 && auto_play_start_pos.S == 0 && auto_play_start_pos.F == 0) {
-                                    auto_play_start_pos = slots[cur_slot].disc->tracks.front().disc_position.position;
+                                if(shuffle_pending_track >= 0 && shuffle_pending_track < slots[cur_slot].disc->tracks.size()) {
+                                    drive_play_track(shuffle_pending_track);
+                                } else {
+                                    if(auto_play_start_pos.M == 0 && auto_play_start_pos.S == 0 && auto_play_start_pos.F == 0) {
+                                        auto_play_start_pos = slots[cur_slot].disc->tracks.front().disc_position.position;
+                                    }
+                                    drive_play(auto_play_start_pos, slots[cur_slot].disc->duration);
                                 }
-                                cdrom->play(auto_play_start_pos, slots[cur_slot].disc->duration);
                                 auto_play_start_pos = { .M = 0, .S = 0, .F = 0 };
+                                shuffle_pending_track = -1;
+                                resume_offered = false;
                             } else {
                                 sts = State::STOP;
                             }
@@ -199,14 +499,14 @@ namespace CD {
                         if(sts == State::BAD_DISC) {
                             ESP_LOGE(LOG_TAG, "Bad media code %i", media_type);
                         }
-                        slots[cur_slot].disc = std::make_shared<Album>();
+                        invalidate_slot(cur_slot);
                         want_auto_play = false;
+                        shuffle_pending_track = -1;
                     }
                 break;
 
                 case State::CHANGE_DISC:
-                    cdrom->wait_ready();
-                    if(next_expected_slot == mech->current_disc) {
+                    if(last_ready && next_expected_slot == mech->current_disc) {
                         sts = State::LOAD;
                     }
                     delay = 1000;
@@ -230,7 +530,7 @@ namespace CD {
                     {
                         abs_ts = { .M = 0, .S = 0, .F = 0 };
                         rel_ts = { .M = 0, .S = 0, .F = 0 };
-                        const ATAPI::AudioStatus* audio = cdrom->query_position();
+                        const ATAPI::AudioStatus* audio = &last_audio;
                         if(audio->state == ATAPI::AudioStatus::PlayState::Playing) {
                             // we are playing for some other reason, maybe front panel button!
                             sts = State::PLAY;
@@ -240,13 +540,31 @@ namespace CD {
 
                 case State::PLAY:
                     {
-                        const ATAPI::AudioStatus* audio = cdrom->query_position();
+                        const ATAPI::AudioStatus* audio = &last_audio;
+                        // The status may have been read just before the scheduled PLAY went out, so it doesn't tell much
+                        bool just_transitioned = (transition.get_phase() == TransitionScheduler::Phase::FIRED);
+                        if(just_transitioned) {
+                            transition.acknowledge();
+                            take_transition();
+                            refresh_requested = true;
+                        }
                         if (audio->track != TRK_NUM_LEAD_OUT) {
                             did_see_actual_playback = true;
                         }
-                        if(audio->state == ATAPI::AudioStatus::PlayState::Stopped || audio->track == TRK_NUM_LEAD_OUT) {
-                            if((play_mode != PlayMode::PLAYMODE_SHUFFLE || !play_next_shuffled_track()) && did_see_actual_playback) {
+                        if(just_transitioned) {
+                            // see you next poll
+                        }
+                        else if(audio->state == ATAPI::AudioStatus::PlayState::Stopped || audio->track == TRK_NUM_LEAD_OUT) {
+                            if(transition.cancel()) {
+                                // the scheduled PLAY went out while this status was being read, so the next range is already playing
+                                take_transition();
+                            }
+                            // the range ended before the scheduled PLAY could go out, so it's up to us now
+                            else if(!play_next_planned() && did_see_actual_playback) {
                                 ESP_LOGW(LOG_TAG, "End of Disc?");
+                                // played to the end, so next time it starts over
+                                resume.forget(slots[cur_slot].disc_id);
+                                flush_resume();
                                 bool was_door_open_chgr = false;
                                 if (slots.size() > 1) {
                                     // check if was door open during play
@@ -259,7 +577,8 @@ namespace CD {
                                         want_auto_play = true;
                                     }
                                 }
-                                if(!was_door_open_chgr && (slots.size() == 1 || !change_discs(true))) {
+                                // the shuffle went over all the discs already and the program is for this disc only, so it's over rather than on to the next one
+                                if(!was_door_open_chgr && (slots.size() == 1 || play_mode != PlayMode::PLAYMODE_CONTINUE || !change_discs(true))) {
                                     cur_track.track = 1;
                                     cur_track.index = 1;
                                     abs_ts = { .M = 0, .S = 0, .F = 0 };
@@ -271,11 +590,20 @@ namespace CD {
                         else if(audio->state == ATAPI::AudioStatus::PlayState::Paused) {
                             sts = State::PAUSE;
                         }  
-                        else {
+                        else if(position_fresh) {
+                            bool track_changed = (cur_track.track != audio->track);
                             cur_track.track = audio->track;
                             cur_track.index = audio->index;
                             abs_ts = audio->position_in_disc;
                             rel_ts = audio->position_in_track;
+                            sync_clock();
+                            if(play_mode != PlayMode::PLAYMODE_CONTINUE) {
+                                follow_range_crossing();
+                                schedule_transition();
+                            } else {
+                                resume.note(slots[cur_slot].disc_id, abs_ts);
+                                if(track_changed && xTaskGetTickCount() - last_resume_flush >= RESUME_FLUSH_INTERVAL) flush_resume();
+                            }
                         }
                     }
                     
@@ -283,7 +611,10 @@ namespace CD {
 
                 case State::PAUSE:
                     {
-                        const ATAPI::AudioStatus* audio = cdrom->query_position();
+                        const ATAPI::AudioStatus* audio = &last_audio;
+                        // Once the power manager lets the spindle down, the drive forgets where it was paused,
+                        // so keep the position from before that to play on from
+                        if(audio->state != ATAPI::AudioStatus::PlayState::Paused) break;
                         cur_track.track = audio->track;
                         cur_track.index = audio->index;
                         abs_ts = audio->position_in_disc;
@@ -293,7 +624,7 @@ namespace CD {
                 case State::SEEK_FF:
                 case State::SEEK_REW:
                     {
-                        const ATAPI::AudioStatus* audio = cdrom->query_position();
+                        const ATAPI::AudioStatus* audio = &last_audio;
                         cur_track.track = audio->track;
                         cur_track.index = audio->index;
                         abs_ts = audio->position_in_disc;
@@ -307,7 +638,7 @@ namespace CD {
                                     softscan_hop = softscan_hop + MSF { .M = 0, .S = 5, .F = 0 };
                                 }
                                 MSF ss = (sts == State::SEEK_FF) ? (abs_ts + softscan_hop) : (abs_ts - softscan_hop);
-                                cdrom->play(ss, slots[cur_slot].disc->duration);
+                                drive_play(ss, slots[cur_slot].disc->duration);
                                 last_softscan_tick = now;
                             }
                         }
@@ -316,7 +647,18 @@ namespace CD {
             }
         }
 
+        // Whatever was read before is of little use in the new state
+        if(sts != oldSts) {
+            refresh_requested = true;
+            last_activity_tick = now;
+            power.note_active(false);
+            if(sts == State::LOAD) load_start_tick = now;
+        }
+        if(sts != State::PLAY) clock.running = false;
+        publish_changes(position_fresh);
+
         xSemaphoreGive(_cmdSemaphore);
+        xSemaphoreGive(_pollSemaphore);
         if(sts != oldSts) {
             ESP_LOGI(LOG_TAG, "State change from %s to %s", PlayerStateString(oldSts), PlayerStateString(sts));
         }
@@ -327,6 +669,19 @@ namespace CD {
 
     void Player::do_command(Command cmd) {
         xSemaphoreTake(_cmdSemaphore, portMAX_DELAY);
+        command_generation++;
+        refresh_requested = true;
+        last_activity_tick = xTaskGetTickCount();
+        power.note_active();
+        // whatever the user wants comes instead of the scheduled next track
+        if(transition.cancel()) take_transition();
+        // the positions below are used to resume/seek from, so make them as fresh as they can be
+        abs_ts = get_current_absolute_time();
+        rel_ts = get_current_track_time();
+        clock.running = false;
+        if((sts == State::PLAY || sts == State::PAUSE) && play_mode == PlayMode::PLAYMODE_CONTINUE) {
+            resume.note(slots[cur_slot].disc_id, abs_ts);
+        }
 
         if(sts != State::INIT && sts != State::CHANGE_DISC && sts != State::LOAD) {
             // Open/Close works in any state
@@ -340,11 +695,11 @@ namespace CD {
 
             if(cmd == Command::CLOSE) {
                 sts = State::CLOSE;
-                cdrom->eject(false);
+                drive_eject(false);
             } 
             else if(cmd == Command::OPEN) {
                 sts = State::OPEN;
-                cdrom->eject(true);
+                drive_eject(true);
             }
         }
 
@@ -371,7 +726,7 @@ namespace CD {
                     case Command::PLAY:
                         want_auto_play = true;
                         sts = State::CLOSE;
-                        cdrom->eject(false);
+                        drive_eject(false);
                     break;
 
                     default:
@@ -395,24 +750,40 @@ namespace CD {
                         {
                             did_see_actual_playback = false;
                             if(play_mode == PlayMode::PLAYMODE_SHUFFLE && cur_track.track == 1) {
+                                prepare_shuffle();
                                 play_next_shuffled_track();
-                                shuffle_history.clear(); // don't keep 1.1 always in history
+                            } else if(play_mode == PlayMode::PLAYMODE_PROGRAM && has_program()) {
+                                play_program_entry(0);
+                            } else if(play_mode == PlayMode::PLAYMODE_CONTINUE && resume_offered && cur_track.track == 1) {
+                                ESP_LOGI(LOG_TAG, "Resuming disc %08x at %02i:%02i:%02i", slots[cur_slot].disc_id, resume_point.M, resume_point.S, resume_point.F);
+                                drive_play(resume_point, slots[cur_slot].disc->duration);
+                                sts = State::PLAY;
                             } else {
                                 auto album = slots[cur_slot].disc;
                                 if(!album->tracks.empty()) {
                                     int desired_track_idx = (album->tracks.size() >= cur_track.track ? (cur_track.track - 1) : 0);
-                                    cdrom->play(album->tracks[desired_track_idx].disc_position.position, album->duration);
+                                    drive_play(album->tracks[desired_track_idx].disc_position.position, album->duration);
                                     sts = State::PLAY;
                                 }
                             }
                         }
                     break;
 
+                    case Command::STOP:
+                        // STOP once more drops the resume point, like on any other CD player
+                        if(resume_offered) {
+                            resume_offered = false;
+                            resume.forget(slots[cur_slot].disc_id);
+                        }
+                    break;
+
                     case Command::NEXT_TRACK:
+                        resume_offered = false;
                         change_tracks(true);
                     break;
 
                     case Command::PREV_TRACK:
+                        resume_offered = false;
                         change_tracks(false);
                     break;
                     
@@ -433,7 +804,7 @@ namespace CD {
                 switch(cmd) {
                     case Command::PAUSE:
                         sts = State::PAUSE;
-                        cdrom->pause(true);
+                        drive_pause(true);
                     break;
 
                     case Command::SEEK_FF:
@@ -448,7 +819,8 @@ namespace CD {
                         cur_track.track = 1;
                         cur_track.index = 1;
                         sts = State::STOP;
-                        cdrom->stop();
+                        drive_stop();
+                        offer_resume();
                     break;
 
                     case Command::NEXT_TRACK:
@@ -467,6 +839,14 @@ namespace CD {
                         change_discs(false);
                     break;
 
+                    case Command::NEXT_INDEX:
+                        change_indexes(true);
+                    break;
+
+                    case Command::PREV_INDEX:
+                        change_indexes(false);
+                    break;
+
                     default:
                     break;
                 }
@@ -477,7 +857,7 @@ namespace CD {
                     case Command::PLAY:
                     case Command::PAUSE:
                         sts = State::PLAY;
-                        cdrom->play(abs_ts, get_active_slot().disc->duration); // <- unpausing after using FF/REW makes the drive continue with SCAN instead of PLAY, so this is more reliable in theory
+                        drive_play(abs_ts, get_active_slot().disc->duration); // <- unpausing after using FF/REW makes the drive continue with SCAN instead of PLAY, so this is more reliable in theory
                     break;
 
                     case Command::SEEK_FF:
@@ -492,7 +872,8 @@ namespace CD {
                         sts = State::STOP;
                         cur_track.track = 1;
                         cur_track.index = 1;
-                        cdrom->stop();
+                        drive_stop();
+                        offer_resume();
                     break;
 
                     case Command::NEXT_TRACK:
@@ -511,6 +892,14 @@ namespace CD {
                         change_discs(false);
                     break;
 
+                    case Command::NEXT_INDEX:
+                        change_indexes(true);
+                    break;
+
+                    case Command::PREV_INDEX:
+                        change_indexes(false);
+                    break;
+
                     default:
                     break;
                 }
@@ -520,23 +909,23 @@ namespace CD {
             case State::SEEK_REW:
                 if(cmd == Command::END_SEEK || (cmd == Command::SEEK_FF && sts == State::SEEK_FF) || (cmd == Command::SEEK_REW && sts == State::SEEK_REW)) {
                     if(pre_seek_sts == State::PLAY) {
-                        cdrom->play(abs_ts, get_active_slot().disc->duration);
+                        drive_play(abs_ts, get_active_slot().disc->duration);
                         sts = State::PLAY;
                     }
                     else {
-                        cdrom->pause(true);
+                        drive_pause(true);
                         sts = State::PAUSE;
                     }
                 }
                 else if(cmd == Command::PLAY) {
-                    cdrom->play(abs_ts, get_active_slot().disc->duration);
+                    drive_play(abs_ts, get_active_slot().disc->duration);
                     sts = State::PLAY;
                 }
                 else if(cmd == Command::STOP) {
                     sts = State::STOP;
                     cur_track.track = 1;
                     cur_track.index = 1;
-                    cdrom->stop();
+                    drive_stop();
                 }
                 else if(cmd == Command::SEEK_FF) {
                     sts = pre_seek_sts;
@@ -549,24 +938,113 @@ namespace CD {
             break;
         }
 
+        // the resume points only go to flash when playback is put aside, not on every position read
+        if(cmd == Command::STOP || cmd == Command::PAUSE || cmd == Command::OPEN || cmd == Command::NEXT_DISC || cmd == Command::PREV_DISC) {
+            flush_resume();
+        }
+
+        publish_changes();
         xSemaphoreGive(_cmdSemaphore);
     }
 
     void Player::navigate_to_track(int track) {
+        xSemaphoreTake(_cmdSemaphore, portMAX_DELAY);
+        last_activity_tick = xTaskGetTickCount();
+        power.note_active();
+        if(transition.cancel()) take_transition();
+        go_to_track(track);
+        publish_changes();
+        xSemaphoreGive(_cmdSemaphore);
+    }
+
+    bool Player::navigate_to_index(uint8_t track, uint8_t index) {
+        xSemaphoreTake(_cmdSemaphore, portMAX_DELAY);
+        last_activity_tick = xTaskGetTickCount();
+        power.note_active();
+        if(transition.cancel()) take_transition();
+        bool found = go_to_index(track, index);
+        publish_changes();
+        xSemaphoreGive(_cmdSemaphore);
+        return found;
+    }
+
+    void Player::go_to_track(int track) {
+        command_generation++;
+        clock.running = false;
         auto album = slots[cur_slot].disc;
         if(track >= 1 && track <= album->tracks.size()) {
             if(sts != State::STOP) {
-                cdrom->play(album->tracks[track - 1].disc_position.position, album->duration);
+                drive_play(album->tracks[track - 1].disc_position.position, album->duration);
                 if(sts == State::PAUSE) {
-                    cdrom->pause(true);
+                    drive_pause(true);
                 }
             }
             else {
                 cur_track.track = track;
+                resume_offered = false;
+                publish_changes();
             }
         }
     }
 
+    bool Player::go_to_index(uint8_t track, uint8_t index) {
+        auto album = slots[cur_slot].disc;
+        if(track < 1 || track > album->tracks.size()) return false;
+
+        MSF position = album->tracks[track - 1].disc_position.position;
+        if(index != 1) {
+            auto point = std::find_if(album->index_map.cbegin(), album->index_map.cend(), [track, index](const IndexPoint& x) { return x.track == track && x.index == index; });
+            if(point == album->index_map.cend()) return false;
+            position = point->position;
+        }
+
+        command_generation++;
+        clock.running = false;
+        if(sts != State::STOP) {
+            drive_play(position, album->duration);
+            if(sts == State::PAUSE) {
+                drive_pause(true);
+            }
+        }
+        else {
+            cur_track.track = track;
+        }
+        return true;
+    }
+
+    void Player::change_indexes(bool fwd) {
+        auto album = slots[cur_slot].disc;
+        if(album->tracks.empty()) return;
+
+        // Index 1 of every track is in the TOC, the map has the others
+        std::vector<IndexPoint> points = album->index_map;
+        for(auto& trk: album->tracks) {
+            points.push_back(IndexPoint { .track = trk.disc_position.number, .index = 1, .position = trk.disc_position.position });
+        }
+        std::sort(points.begin(), points.end(), [](const IndexPoint& a, const IndexPoint& b) { return MSF_TO_FRAMES(a.position) < MSF_TO_FRAMES(b.position); });
+
+        int now = MSF_TO_FRAMES(get_current_absolute_time());
+        const IndexPoint * target = nullptr;
+        if(fwd) {
+            for(auto& point: points) {
+                if(MSF_TO_FRAMES(point.position) > now) {
+                    target = &point;
+                    break;
+                }
+            }
+        } else {
+            // Like with the tracks: within the first 2 seconds go to the previous index, otherwise to the start of the current one
+            int cutoff = now - 2 * MSF::FRAMES_IN_SECOND;
+            for(auto& point: points) {
+                if(MSF_TO_FRAMES(point.position) > cutoff) break;
+                target = &point;
+            }
+            if(target == nullptr) target = &points.front();
+        }
+
+        if(target != nullptr) go_to_index(target->track, target->index);
+    }
+
     void Player::change_tracks(bool fwd) {
         auto album = slots[cur_slot].disc;
         if(!album->tracks.empty()) {
@@ -574,6 +1052,10 @@ namespace CD {
             if(fwd) {
                 if(play_mode == PlayMode::PLAYMODE_SHUFFLE && sts != Player::State::STOP) {
                     play_next_shuffled_track();
+                    return;
+                } else if(play_mode == PlayMode::PLAYMODE_PROGRAM && sts != State::STOP && has_program()) {
+                    if(program_entry + 1 < program.size()) play_program_entry(program_entry + 1);
+                    return;
                 } else {
                     next_trk_no = std::min((int) album->tracks.size(), (int) cur_track.track + 1);
 
@@ -585,18 +1067,33 @@ namespace CD {
                     // if stopped or within the first 2 seconds of a song
                     // go back one track
                     if(play_mode == PlayMode::PLAYMODE_SHUFFLE && sts != State::STOP) {
-                        if(shuffle_history.empty()) return;
-                        next_trk_no = *shuffle_history.rbegin();
-                        shuffle_history.erase(next_trk_no);
+                        ShufflePlanner::Entry prev;
+                        if(shuffle.previous(prev)) play_shuffle_entry(prev);
+                        return;
+                    } else if(play_mode == PlayMode::PLAYMODE_PROGRAM && sts != State::STOP && has_program()) {
+                        if(program_entry > 0) play_program_entry(program_entry - 1);
+                        return;
                     } else {
                         next_trk_no = ((cur_track.track >= 2) ? (cur_track.track - 1) : 1); 
                     }
+                } else if(play_mode == PlayMode::PLAYMODE_PROGRAM && has_program() && program_entry >= 0) {
+                    // go to start of current track, and on through the rest of its range
+                    play_program_entry(program_entry);
+                    if(sts == State::PAUSE) drive_pause(true);
+                    return;
+                } else if(play_mode == PlayMode::PLAYMODE_SHUFFLE && cur_track.track >= 1 && cur_track.track <= album->tracks.size()) {
+                    // go to start of current track, but only play up to its end as usual in shuffle
+                    command_generation++;
+                    clock.running = false;
+                    drive_play_track(cur_track.track - 1);
+                    if(sts == State::PAUSE) drive_pause(true);
+                    return;
                 } else {
                     next_trk_no = cur_track.track; // go to start of current track
                 }
             }
 
-            navigate_to_track(next_trk_no);
+            go_to_track(next_trk_no);
         }
     }
 
@@ -604,11 +1101,11 @@ namespace CD {
         pre_seek_sts = sts;
         if(!cdrom->get_quirks().must_use_softscan) {
             sts = forward ? State::SEEK_FF : State::SEEK_REW;
-            cdrom->scan(forward, abs_ts);
+            drive_scan(forward, abs_ts);
         } else {
             softscan_start = xTaskGetTickCount();
             softscan_hop = softscan_hop_default;
-            if(sts == State::PAUSE) cdrom->pause(false);
+            if(sts == State::PAUSE) drive_pause(false);
             sts = forward ? State::SEEK_FF : State::SEEK_REW;
         }
     }
@@ -624,13 +1121,19 @@ namespace CD {
             i = forward ? ((i + 1) % slots.size()) : (i == 0 ? (slots.size()-1) : (i - 1));
 
         if(i == cur_slot) return false;
-        
-        next_expected_slot = i;
+
+        return change_to_slot(i);
+    }
+
+    bool Player::change_to_slot(int slot) {
+        if(slot == cur_slot || slot < 0 || slot >= slots.size() || !slots[slot].disc_present) return false;
+
+        next_expected_slot = slot;
 
         State old_sts = sts;
         sts = State::CHANGE_DISC;
         if(old_sts == State::PLAY || old_sts == State::PAUSE) {
-            cdrom->stop();
+            drive_stop();
         }
 
         ESP_LOGI(LOG_TAG, "Change slot %i -> %i", cur_slot, next_expected_slot);
@@ -639,7 +1142,7 @@ namespace CD {
             want_auto_play = true;
         }
 
-        cdrom->load_unload(next_expected_slot);
+        drive_load_unload(next_expected_slot);
         cur_track.track = 1;
         cur_track.index = 1;
         abs_ts = { .M = 0, .S = 0, .F = 0 };
@@ -647,46 +1150,478 @@ namespace CD {
         return true;
     }
 
+    void Player::invalidate_slot(int slot) {
+        slots[slot].disc = std::make_shared<Album>();
+        slots[slot].disc_id = 0;
+        inventory_failed.erase(slot);
+    }
+
+    bool Player::take_inventory_step(uint32_t generation) {
+        int slot = -1;
+        for(int i = 0; i < slots.size(); i++) {
+            if(i != cur_slot && slots[i].disc_present && slots[i].disc_id == 0 && inventory_failed.find(i) == inventory_failed.end()) {
+                slot = i;
+                break;
+            }
+        }
+        if(slot < 0) return false;
+
+        ESP_LOGI(LOG_TAG, "Inventory: reading slot %i", slot);
+        inventory_slot = slot;
+
+        auto walk = std::make_shared<InventoryWalk>();
+        walk->slot = slot;
+        walk->home = cur_slot;
+        walk->generation = generation;
+        walk->interrupted = false;
+        std::future<void> done = walk->done.get_future();
+        // Only the first step waits for the drive to have nothing else to do, the rest follow up on it
+        cdrom->submit(ATAPI::Device::Priority::BACKGROUND, [this, walk]() { run_inventory_step(walk, InventoryWalk::Step::LOAD); });
+        done.wait();
+
+        xSemaphoreTake(_cmdSemaphore, portMAX_DELAY);
+        if(walk->disc != nullptr) {
+            slots[slot].disc = walk->disc;
+            slots[slot].disc_id = ATAPI::AccurateRipDiscId::from_toc(*walk->toc).cddb;
+            ESP_LOGI(LOG_TAG, "Inventory: slot %i has disc %08x with %i tracks", slot, slots[slot].disc_id, slots[slot].disc->tracks.size());
+            queue_metadata(slots[slot].disc, false);
+        } else if(!walk->interrupted) {
+            ESP_LOGW(LOG_TAG, "Inventory: slot %i is unreadable", slot);
+            inventory_failed.insert(slot);
+        }
+        inventory_slot = -1;
+        // The changer went away and came back, so don't trust anything read before
+        refresh_requested = true;
+        xSemaphoreGive(_cmdSemaphore);
+
+        return true;
+    }
+
+    void Player::run_inventory_step(std::shared_ptr<InventoryWalk> walk, InventoryWalk::Step step) {
+        using Step = InventoryWalk::Step;
+        ATAPI::Device * dev = cdrom;
+        auto load = [dev](int target) {
+            dev->load_unload(target);
+            TickType_t start = xTaskGetTickCount();
+            while(dev->query_state()->current_disc != target) {
+                if(xTaskGetTickCount() - start >= INVENTORY_LOAD_TIMEOUT) return false;
+                vTaskDelay(pdMS_TO_TICKS(500));
+            }
+            return dev->wait_ready();
+        };
+
+        if(step == Step::LOAD && command_generation != walk->generation) {
+            // the user got there before the changer even left
+            walk->interrupted = true;
+            walk->done.set_value();
+            return;
+        }
+
+        Step next = Step::GO_HOME;
+        switch(step) {
+            case Step::LOAD:
+                if(load(walk->slot) && ATAPI::MediaTypeCodeIsAudioCD(dev->check_media())) next = Step::READ_TOC;
+                break;
+
+            case Step::READ_TOC:
+                walk->toc = std::make_shared<ATAPI::DiscTOC>(dev->read_toc());
+                if(!walk->toc->tracks.empty()) {
+                    walk->disc = std::make_shared<Album>(*walk->toc);
+                    next = Step::READ_TEXT;
+                }
+                break;
+
+            case Step::READ_TEXT:
+                {
+                    // The disc is not going to be in the drive later on, so this is the only chance
+                    std::vector<uint8_t>& cd_text = walk->disc->toc_subchannel;
+                    dev->read_cd_text([&cd_text](const uint8_t * pack) {
+                        if(CDTextMetadataProvider::is_pack_useful(pack)) cd_text.insert(cd_text.end(), pack, pack + ATAPI::Device::CD_TEXT_PACK_SIZE);
+                    });
+                    next = Step::READ_IDENTIFIERS;
+                }
+                break;
+
+            case Step::READ_IDENTIFIERS:
+                read_identifiers(dev, *walk->disc);
+                break;
+
+            case Step::GO_HOME:
+                if(!load(walk->home)) ESP_LOGE(LOG_TAG, "Inventory: could not go back to slot %i", walk->home);
+                walk->done.set_value();
+                return;
+        }
+
+        // The user wanting something in the meantime is a good reason to leave the rest and go right back
+        if(next != Step::GO_HOME && (command_generation != walk->generation || dev->has_pending(ATAPI::Device::Priority::USER))) {
+            ESP_LOGI(LOG_TAG, "Inventory: interrupted, going back to slot %i", walk->home);
+            walk->interrupted = true;
+            // half read, so it gets read again from the start next time
+            walk->disc = nullptr;
+            next = Step::GO_HOME;
+        }
+        // Queued from within this job, so that the queue can't hand the drive to the user's commands with the wrong disc in it
+        dev->submit(ATAPI::Device::Priority::FOLLOW_UP, [this, walk, next]() { run_inventory_step(walk, next); });
+    }
+
+    bool Player::take_index_scan_step(uint32_t generation) {
+        auto album = slots[cur_slot].disc;
+        const uint32_t disc_id = slots[cur_slot].disc_id;
+        if(album->tracks.empty() || album->is_index_map_complete() || (disc_id != 0 && disc_id == index_scan_failed_disc)) return false;
+
+        const int track_idx = album->index_map_tracks_done;
+        std::vector<IndexPoint> found = {};
+        bool done = false;
+        IndexScanner * scanner = &index_scanner;
+        volatile uint32_t * current_generation = &command_generation;
+        cdrom->submit(ATAPI::Device::Priority::BACKGROUND, [scanner, album, track_idx, generation, current_generation, &found, &done]() {
+            // Drop it as soon as the user wants something, the track gets scanned again from the start next time
+            done = scanner->scan_track(*album, track_idx, [generation, current_generation]() { return *current_generation != generation; }, found);
+        }).wait();
+
+        bool complete = false;
+        xSemaphoreTake(_cmdSemaphore, portMAX_DELAY);
+        if(slots[cur_slot].disc == album) {
+            if(done) {
+                album->index_map.insert(album->index_map.end(), found.begin(), found.end());
+                std::sort(album->index_map.begin(), album->index_map.end(), [](const IndexPoint& a, const IndexPoint& b) { return MSF_TO_FRAMES(a.position) < MSF_TO_FRAMES(b.position); });
+                album->index_map_tracks_done++;
+                complete = album->is_index_map_complete();
+            } else if(command_generation == generation) {
+                ESP_LOGW(LOG_TAG, "Index scan: drive could not tell the position in track %i, giving up on this disc", track_idx + 1);
+                index_scan_failed_disc = disc_id;
+            }
+        }
+        xSemaphoreGive(_cmdSemaphore);
+
+        if(complete) {
+            ESP_LOGI(LOG_TAG, "Index scan: disc %08x has %i index points besides the TOC", disc_id, album->index_map.size());
+            // Not through the queue, as that would fetch the metadata all over again
+            xSemaphoreTake(_metaSemaphore, portMAX_DELAY);
+            meta->update_album(*album);
+            xSemaphoreGive(_metaSemaphore);
+            events.publish(PlayerEvents::EVT_METADATA);
+        }
+
+        return true;
+    }
+
     void Player::set_play_mode(PlayMode new_mode) {
-        if(new_mode == play_mode) return;
+        // The shuffle plan and the play range are read by the poll task all along, so they change only under the lock
+        xSemaphoreTake(_cmdSemaphore, portMAX_DELAY);
+        if(new_mode == play_mode) {
+            xSemaphoreGive(_cmdSemaphore);
+            return;
+        }
+        flush_resume();
+        command_generation++;
+        if(transition.cancel()) take_transition();
+        abs_ts = get_current_absolute_time();
+        clock.running = false;
         if(new_mode == PlayMode::PLAYMODE_SHUFFLE) {
-            shuffle_history.clear();
+            prepare_shuffle();
         }
         if(sts == State::PLAY || sts == State::PAUSE) {
-            if(new_mode == PlayMode::PLAYMODE_CONTINUE && play_mode == PlayMode::PLAYMODE_SHUFFLE) {
-                // from shuffle to continue: enqueue the whole disc instead of the active track
-                cdrom->play(abs_ts, slots[cur_slot].disc->duration);
-                if(sts == State::PAUSE) cdrom->pause(true);
-                shuffle_history.clear();
+            if(new_mode == PlayMode::PLAYMODE_PROGRAM && has_program()) {
+                // to program: start it from the top
+                bool paused = (sts == State::PAUSE);
+                play_program_entry(0);
+                if(paused) {
+                    drive_pause(true);
+                    sts = State::PAUSE;
+                }
+            }
+            else if(new_mode == PlayMode::PLAYMODE_CONTINUE && play_mode != PlayMode::PLAYMODE_CONTINUE) {
+                // from shuffle or program to continue: enqueue the whole disc instead of the active track or range
+                drive_play(abs_ts, slots[cur_slot].disc->duration);
+                if(sts == State::PAUSE) drive_pause(true);
             }
             else if(new_mode == PlayMode::PLAYMODE_SHUFFLE) {
                 // from other to shuffle: reenqueue the current track only to receive EOP events properly
-                cdrom->play(abs_ts, (cur_track.track == get_active_slot().disc->tracks.size()) ? get_active_slot().disc->duration : get_active_slot().disc->tracks[cur_track.track].disc_position.position);
-                if(sts == State::PAUSE) cdrom->pause(true);
+                drive_play(abs_ts, (cur_track.track == get_active_slot().disc->tracks.size()) ? get_active_slot().disc->duration : get_active_slot().disc->tracks[cur_track.track].disc_position.position);
+                if(sts == State::PAUSE) drive_pause(true);
             }
         }
         play_mode = new_mode;
+        xSemaphoreGive(_cmdSemaphore);
+    }
+
+    uint32_t Player::shuffle_layout(std::vector<uint8_t>& track_counts) {
+        uint32_t crc = 0xFFFFFFFF;
+        track_counts.assign(slots.size(), 0);
+        for(int i = 0; i < slots.size(); i++) {
+            // Discs whose TOC is not known yet are left out, the inventory gets to them while stopped
+            if(!slots[i].disc_present || slots[i].disc_id == 0) continue;
+            track_counts[i] = (uint8_t) std::min(slots[i].disc->tracks.size(), (size_t) UINT8_MAX);
+            const uint8_t slot = i;
+            crc = ATAPI::crc32_update(crc, &slot, sizeof(slot));
+            crc = ATAPI::crc32_update(crc, (const uint8_t *) &slots[i].disc_id, sizeof(slots[i].disc_id));
+        }
+        return ~crc;
+    }
+
+    void Player::prepare_shuffle() {
+        std::vector<uint8_t> counts = {};
+        const uint32_t layout = shuffle_layout(counts);
+        if(shuffle.is_planned_for(layout) && shuffle.get_position() < shuffle.get_length()) return;
+        if(!shuffle.restore(counts, layout)) {
+            shuffle.plan(counts, layout, esp_random(), cur_slot);
+        }
     }
 
     bool Player::play_next_shuffled_track() {
-        shuffle_history.insert(cur_track.track);
+        // The discs were changed since the plan was made, so it's no good anymore
+        std::vector<uint8_t> counts = {};
+        if(!shuffle.is_planned_for(shuffle_layout(counts))) prepare_shuffle();
 
-        auto const tracklist = get_active_slot().disc->tracks;
-        int playable_track_count = std::count_if(tracklist.cbegin(), tracklist.cend(), [this](const CD::Track& t) {
-            return shuffle_history.find(t.disc_position.number) == shuffle_history.end();
-        });
-        if(playable_track_count == 0) return false;
-        int trk_idx = esp_random() % tracklist.size();
-        while(shuffle_history.find(tracklist[trk_idx].disc_position.number) != shuffle_history.end()) {
-            trk_idx = esp_random() % tracklist.size();
-        }
-       
-        cdrom->play(tracklist[trk_idx].disc_position.position, (trk_idx == (tracklist.size() - 1)) ? get_active_slot().disc->duration : tracklist[trk_idx + 1].disc_position.position);
-        sts = State::PLAY;
+        ShufflePlanner::Entry next;
+        while(shuffle.next(next)) {
+            if(play_shuffle_entry(next)) return true;
+        }
+        return false;
+    }
+
+    int Player::shuffle_range_last(const ShufflePlanner::Entry& entry, size_t ahead) {
+        // Tracks planned one after another the way they are on the disc need no new PLAY AUDIO in between, so there's no gap at all
+        int last = entry.track;
+        ShufflePlanner::Entry next;
+        while(shuffle.peek(next, ahead) && next.slot == entry.slot && next.track == last + 1 && next.track < get_active_slot().disc->tracks.size()) {
+            last++;
+            ahead++;
+        }
+        return last;
+    }
+
+    bool Player::play_next_planned() {
+        switch(play_mode) {
+            case PlayMode::PLAYMODE_SHUFFLE:
+                return play_next_shuffled_track();
+            case PlayMode::PLAYMODE_PROGRAM:
+                if(!has_program() || program_range < 0 || program_range + 1 >= program_ranges.size()) return false;
+                return play_program_entry(program_ranges[program_range + 1].first_entry);
+            default:
+                return false;
+        }
+    }
+
+    void Player::follow_range_crossing() {
+        auto const& tracks = get_active_slot().disc->tracks;
+        if(play_mode == PlayMode::PLAYMODE_SHUFFLE) {
+            // Planned next, but already in the range being played: the drive just carries on into it
+            ShufflePlanner::Entry next;
+            if(!shuffle.peek(next) || next.slot != cur_slot || next.track >= tracks.size() || cur_track.track != next.track + 1) return;
+            int start = MSF_TO_FRAMES(tracks[next.track].disc_position.position);
+            if(start > play_range_start && start < play_range_end) {
+                shuffle.next(next);
+            }
+        }
+        else if(play_mode == PlayMode::PLAYMODE_PROGRAM && has_program() && program_range >= 0) {
+            const PlayRange& range = program_ranges[program_range];
+            if(program_entry + 1 < range.first_entry + range.entry_count && cur_track.track == program[program_entry + 1]) {
+                program_entry++;
+            }
+        }
+    }
+
+    bool Player::peek_next_range(MSF& start, MSF& end) {
+        if(play_mode == PlayMode::PLAYMODE_PROGRAM) {
+            if(!has_program() || program_range < 0 || program_range + 1 >= program_ranges.size()) return false;
+            start = program_ranges[program_range + 1].start;
+            end = program_ranges[program_range + 1].end;
+            return true;
+        }
+
+        auto const& tracks = get_active_slot().disc->tracks;
+        ShufflePlanner::Entry next;
+        // Another disc needs the changer anyway, that's left for when the range ends
+        if(!shuffle.peek(next) || next.slot != cur_slot || next.track >= tracks.size()) return false;
+        // Still within the range being played, follow_range_crossing takes it off once the drive gets there
+        if(cur_track.track <= next.track && MSF_TO_FRAMES(tracks[next.track].disc_position.position) < play_range_end) return false;
+
+        const int last = shuffle_range_last(next, 1);
+        start = tracks[next.track].disc_position.position;
+        end = (last == tracks.size() - 1) ? get_active_slot().disc->duration : tracks[last + 1].disc_position.position;
         return true;
     }
 
+    void Player::schedule_transition() {
+        if(transition.get_phase() != TransitionScheduler::Phase::IDLE) return;
+
+        int64_t left_us = (int64_t) (play_range_end - clock_position()) * 1000000 / MSF::FRAMES_IN_SECOND;
+        if(left_us <= 0 || left_us > TRANSITION_HORIZON_US) return;
+
+        MSF start, end;
+        if(!peek_next_range(start, end)) return;
+        // The drive cuts the current range off as soon as it takes the packet, not once it's done seeking,
+        // so the learned PLAY AUDIO latency would only throw away that much more of the range without shortening the gap
+        int64_t lead_us = (int64_t) TRANSITION_LEAD_FRAMES * 1000000 / MSF::FRAMES_IN_SECOND;
+
+        transition_range_start = MSF_TO_FRAMES(start);
+        transition_range_end = MSF_TO_FRAMES(end);
+        transition.arm(esp_timer_get_time() + left_us - lead_us, start, end);
+        ESP_LOGV(LOG_TAG, "Transition to %02i:%02i:%02i in %lli us", start.M, start.S, start.F, left_us - lead_us);
+    }
+
+    void Player::take_transition() {
+        if(play_mode == PlayMode::PLAYMODE_PROGRAM) {
+            if(program_range + 1 < program_ranges.size()) {
+                program_range++;
+                program_entry = program_ranges[program_range].first_entry;
+            }
+        } else {
+            ShufflePlanner::Entry taken;
+            shuffle.next(taken);
+        }
+        play_range_start = transition_range_start;
+        play_range_end = transition_range_end;
+        clock.running = false;
+    }
+
+    void Player::set_program(const std::vector<uint8_t>& tracks) {
+        xSemaphoreTake(_cmdSemaphore, portMAX_DELAY);
+        if(transition.cancel()) take_transition();
+        program = tracks;
+        program_range = -1;
+        program_entry = -1;
+        if(slots[cur_slot].disc_present && slots[cur_slot].disc != nullptr && !program.empty()) {
+            program_album = slots[cur_slot].disc;
+            program_ranges = compile_program(program, *program_album);
+            ESP_LOGI(LOG_TAG, "Program of %u tracks in %u ranges", program.size(), program_ranges.size());
+        } else {
+            program_album = nullptr;
+            program_ranges.clear();
+        }
+        xSemaphoreGive(_cmdSemaphore);
+    }
+
+    bool Player::play_program_entry(int entry) {
+        if(!has_program()) return false;
+        for(int i = 0; i < program_ranges.size(); i++) {
+            const PlayRange& range = program_ranges[i];
+            if(entry < range.first_entry || entry >= range.first_entry + range.entry_count) continue;
+
+            command_generation++;
+            clock.running = false;
+            program_range = i;
+            program_entry = entry;
+            // from the start of the entry's own track, on through the rest of its range
+            drive_play(get_active_slot().disc->tracks[program[entry] - 1].disc_position.position, range.end);
+            sts = State::PLAY;
+            return true;
+        }
+        // the entry was skipped for not being on the disc, so go on to the one after
+        return (entry + 1 < program.size()) && play_program_entry(entry + 1);
+    }
+
+    bool Player::play_shuffle_entry(const ShufflePlanner::Entry& entry) {
+        if(entry.slot == cur_slot) {
+            if(entry.track >= get_active_slot().disc->tracks.size()) return false;
+            command_generation++;
+            clock.running = false;
+            drive_play_track(entry.track, shuffle_range_last(entry, 0));
+            sts = State::PLAY;
+            return true;
+        }
+
+        if(entry.slot >= slots.size() || slots[entry.slot].disc_id == 0 || !change_to_slot(entry.slot)) return false;
+        // pick it up once the disc is in
+        shuffle_pending_track = entry.track;
+        want_auto_play = true;
+        return true;
+    }
+
+    void Player::drive_play(const MSF start, const MSF end) {
+        refresh_requested = true; // the status read before is now out of date
+        play_range_start = MSF_TO_FRAMES(start);
+        play_range_end = MSF_TO_FRAMES(end);
+        ATAPI::Device * dev = cdrom;
+        cdrom->submit(ATAPI::Device::Priority::USER, [dev, start, end]() { dev->play(start, end); });
+    }
+
+    void Player::drive_play_track(int trk_idx, int last_trk_idx) {
+        auto const& tracklist = get_active_slot().disc->tracks;
+        if(last_trk_idx < trk_idx) last_trk_idx = trk_idx;
+        drive_play(tracklist[trk_idx].disc_position.position, (last_trk_idx == (tracklist.size() - 1)) ? get_active_slot().disc->duration : tracklist[last_trk_idx + 1].disc_position.position);
+    }
+
+    void Player::drive_pause(bool pause) {
+        refresh_requested = true;
+        ATAPI::Device * dev = cdrom;
+        cdrom->submit(ATAPI::Device::Priority::USER, [dev, pause]() { dev->pause(pause); });
+    }
+
+    void Player::drive_stop() {
+        refresh_requested = true;
+        ATAPI::Device * dev = cdrom;
+        cdrom->submit(ATAPI::Device::Priority::USER, [dev]() { dev->stop(); });
+    }
+
+    void Player::drive_scan(bool forward, const MSF from) {
+        refresh_requested = true;
+        ATAPI::Device * dev = cdrom;
+        cdrom->submit(ATAPI::Device::Priority::USER, [dev, forward, from]() { dev->scan(forward, from); });
+    }
+
+    void Player::drive_eject(bool open) {
+        refresh_requested = true;
+        ATAPI::Device * dev = cdrom;
+        cdrom->submit(ATAPI::Device::Priority::USER, [dev, open]() { dev->eject(open); });
+    }
+
+    void Player::drive_load_unload(ATAPI::SlotNumber slot) {
+        refresh_requested = true;
+        ATAPI::Device * dev = cdrom;
+        cdrom->submit(ATAPI::Device::Priority::USER, [dev, slot]() { dev->load_unload(slot); });
+    }
+
+    void Player::publish_changes(bool fresh_position) {
+        EventBits_t changes = 0;
+        if(sts != published_sts) {
+            changes |= PlayerEvents::EVT_STATE;
+            published_sts = sts;
+        }
+        if(cur_track.track != published_track.track || cur_track.index != published_track.index) {
+            changes |= PlayerEvents::EVT_TRACK;
+            published_track = cur_track;
+        }
+        if(fresh_position) changes |= PlayerEvents::EVT_POSITION;
+
+        uint32_t slot_sig = cur_slot;
+        for(auto const& slot: slots) {
+            slot_sig = slot_sig * 31 + (slot.disc_present ? 1 : 0);
+            slot_sig = slot_sig * 31 + slot.disc_id;
+            slot_sig = slot_sig * 31 + (uint32_t) (uintptr_t) slot.disc.get();
+        }
+        if(slot_sig != published_slots) {
+            changes |= PlayerEvents::EVT_SLOTS;
+            published_slots = slot_sig;
+        }
+
+        events.publish(changes);
+    }
+
     void Player::power_down() {
+        flush_resume();
         cdrom->start(false);
     }
+
+    void Player::flush_resume() {
+        resume.flush();
+        last_resume_flush = xTaskGetTickCount();
+    }
+
+    void Player::offer_resume() {
+        auto const& album = slots[cur_slot].disc;
+        resume_offered = (play_mode == PlayMode::PLAYMODE_CONTINUE && resume.find(slots[cur_slot].disc_id, resume_point) && !album->tracks.empty()
+            && MSF_TO_FRAMES(resume_point) > MSF_TO_FRAMES(album->tracks.front().disc_position.position)
+            && MSF_TO_FRAMES(resume_point) < MSF_TO_FRAMES(album->duration));
+    }
+
+    void Player::wake_drive() {
+        xSemaphoreTake(_cmdSemaphore, portMAX_DELAY);
+        // give the user as much time as any other activity before the drive goes down again
+        last_activity_tick = xTaskGetTickCount();
+        power.pre_spin();
+        xSemaphoreGive(_cmdSemaphore);
+    }
 }
\ No newline at end of file
@@ -0,0 +1,252 @@
+#include <esper-cdp/player_bench.h>
+#include <esp32-hal-log.h>
+#include <esp_timer.h>
+#include <algorithm>
+
+static const char LOG_TAG[] = "BENCH";
+
+namespace CD {
+    static const int SILENT_DISC_TRACKS = 12;
+    static const int SILENT_TRACK_FRAMES = 20 * MSF::FRAMES_IN_SECOND;
+    /// @brief Long enough for the drive to be let down to standby by the power manager
+    static const uint32_t LONG_IDLE_MS = 70000;
+
+    static const char * command_names[] = {
+        "OPEN_CLOSE", "OPEN", "CLOSE", "PLAY", "PAUSE", "SEEK_FF", "SEEK_REW", "END_SEEK",
+        "STOP", "NEXT_TRACK", "PREV_TRACK", "NEXT_DISC", "PREV_DISC", "NEXT_INDEX", "PREV_INDEX"
+    };
+    static const int COMMAND_COUNT = sizeof(command_names) / sizeof(command_names[0]);
+
+    // xorshift32, so that a seed that found something finds it again
+    struct BenchRandom {
+        uint32_t state;
+
+        uint32_t next() {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            return state;
+        }
+
+        uint32_t below(uint32_t bound) {
+            return (uint32_t) (((uint64_t) next() * bound) >> 32);
+        }
+    };
+
+    /// @brief States that the player is supposed to leave on its own
+    static bool is_transient(Player::State state) {
+        return state == Player::State::INIT || state == Player::State::LOAD || state == Player::State::CLOSE || state == Player::State::CHANGE_DISC;
+    }
+
+    PlayerBench::PlayerBench(std::shared_ptr<const ATAPI::VirtualDisc> disc, uint8_t slot_count) {
+        this->disc = (disc == nullptr) ? ATAPI::VirtualDisc::silent(SILENT_DISC_TRACKS, SILENT_TRACK_FRAMES) : disc;
+        this->slot_count = std::max((uint8_t) 1, slot_count);
+
+        drive = new ATAPI::VirtualDrive(this->slot_count);
+        for(int i = 0; i < this->slot_count; i++) drive->insert_disc(i, this->disc);
+        device = new ATAPI::Device(drive);
+        device->reset();
+        player = new Player(device, &meta);
+
+        last_poll_change = esp_timer_get_time();
+        state_since = last_poll_change;
+    }
+
+    PlayerBench::~PlayerBench() {
+        delete player;
+        // The device's queue task has no way to be stopped, so the device and the drive behind it stay around
+    }
+
+    void PlayerBench::watch() {
+        const int64_t now = esp_timer_get_time();
+
+        const uint32_t poll_count = player->get_poll_count();
+        if(poll_count != last_poll_count) {
+            last_poll_count = poll_count;
+            last_poll_change = now;
+            stalled = false;
+        } else if(!stalled && now - last_poll_change > POLL_STALL_US) {
+            stalled = true;
+            stalls++;
+            ESP_LOGE(LOG_TAG, "Poll loop stalled in %s for %lli ms", Player::PlayerStateString(player->get_status()), (now - last_poll_change) / 1000);
+        }
+
+        const Player::State state = player->get_status();
+        if(state != last_state) {
+            last_state = state;
+            state_since = now;
+            wedged = false;
+        } else if(!wedged && is_transient(state) && now - state_since > WEDGE_US) {
+            wedged = true;
+            wedges++;
+            ESP_LOGE(LOG_TAG, "Stuck in %s for %lli ms", Player::PlayerStateString(state), (now - state_since) / 1000);
+        }
+    }
+
+    int64_t PlayerBench::wait_until(std::function<bool()> condition, uint32_t timeout_ms) {
+        const int64_t start = esp_timer_get_time();
+        const int64_t deadline = start + (int64_t) timeout_ms * 1000;
+        while(esp_timer_get_time() < deadline) {
+            watch();
+            if(condition()) return esp_timer_get_time() - start;
+            vTaskDelay(1);
+        }
+        return -1;
+    }
+
+    int64_t PlayerBench::wait_for_state(Player::State state, uint32_t timeout_ms) {
+        return wait_until([this, state]() { return player->get_status() == state; }, timeout_ms);
+    }
+
+    void PlayerBench::react(const char * name, Player::Command cmd, std::function<bool()> done, uint32_t timeout_ms) {
+        const int64_t start = esp_timer_get_time();
+        // do_command() itself may be held up by the poll cycle, so that counts too
+        player->do_command(cmd);
+        if(wait_until(done, timeout_ms) < 0) {
+            ESP_LOGW(LOG_TAG, "%s: no reaction in %u ms, now %s", name, timeout_ms, Player::PlayerStateString(player->get_status()));
+            return;
+        }
+        reactions[name].add(esp_timer_get_time() - start);
+    }
+
+    bool PlayerBench::settle() {
+        drive->set_door_open(false);
+        for(int attempt = 0; attempt < 5; attempt++) {
+            wait_until([this]() { return !is_transient(player->get_status()); }, 60000);
+            switch(player->get_status()) {
+                case Player::State::STOP:
+                    return true;
+                case Player::State::OPEN:
+                    player->do_command(Player::Command::CLOSE);
+                    break;
+                case Player::State::SEEK_FF:
+                case Player::State::SEEK_REW:
+                    player->do_command(Player::Command::END_SEEK);
+                    // fall through
+                case Player::State::PLAY:
+                case Player::State::PAUSE:
+                    player->do_command(Player::Command::STOP);
+                    break;
+                case Player::State::NO_DISC:
+                case Player::State::BAD_DISC:
+                    if(slot_count == 1) {
+                        // the disc was swapped behind a closed tray, which only a trip of the tray gets noticed
+                        player->do_command(Player::Command::OPEN);
+                        wait_for_state(Player::State::OPEN, 10000);
+                        player->do_command(Player::Command::CLOSE);
+                    }
+                    break;
+                default:
+                    // the player will find the discs once the changed media is noticed
+                    break;
+            }
+            if(wait_for_state(Player::State::STOP, 30000) >= 0) return true;
+        }
+        ESP_LOGE(LOG_TAG, "Can't get to STOP, now %s", Player::PlayerStateString(player->get_status()));
+        return false;
+    }
+
+    void PlayerBench::measure_commands(int rounds) {
+        if(!settle()) return;
+        const int track_count = disc->tracks.size();
+
+        for(int i = 0; i < rounds; i++) {
+            // playing for real means the position has come from the drive
+            react("PLAY", Player::Command::PLAY, [this]() { return player->get_status() == Player::State::PLAY && MSF_TO_FRAMES(player->get_current_absolute_time()) > 0; });
+
+            const int track = player->get_current_track_number().track;
+            if(track < track_count) {
+                react("NEXT_TRACK", Player::Command::NEXT_TRACK, [this, track]() { return player->get_current_track_number().track == track + 1; });
+            }
+
+            react("PAUSE", Player::Command::PAUSE, [this]() { return player->get_status() == Player::State::PAUSE; });
+            react("UNPAUSE", Player::Command::PLAY, [this]() { return player->get_status() == Player::State::PLAY; });
+            react("STOP", Player::Command::STOP, [this]() { return player->get_status() == Player::State::STOP; });
+            react("OPEN", Player::Command::OPEN, [this]() { return player->get_status() == Player::State::OPEN; });
+            react("CLOSE", Player::Command::CLOSE, [this]() { return player->get_status() == Player::State::STOP; }, 30000);
+        }
+    }
+
+    void PlayerBench::measure_load(int rounds) {
+        if(!settle()) return;
+
+        for(int i = 0; i < rounds; i++) {
+            drive->set_door_open(true);
+            if(wait_for_state(Player::State::OPEN, 10000) < 0) {
+                ESP_LOGW(LOG_TAG, "Tray opened by hand went unnoticed, now %s", Player::PlayerStateString(player->get_status()));
+                if(!settle()) return;
+                continue;
+            }
+
+            drive->set_door_open(false);
+            int64_t took = wait_until([this]() { return player->get_status() == Player::State::STOP && !player->get_active_slot().disc->tracks.empty(); }, 30000);
+            if(took < 0) {
+                ESP_LOGW(LOG_TAG, "No track list 30 s after closing, now %s", Player::PlayerStateString(player->get_status()));
+                if(!settle()) return;
+                continue;
+            }
+            load_times.add(took);
+        }
+    }
+
+    void PlayerBench::fuzz(uint32_t seed, int steps) {
+        BenchRandom rng = { .state = (seed == 0) ? 1 : seed };
+        ESP_LOGI(LOG_TAG, "Fuzzing %i steps with seed %u", steps, seed);
+
+        for(int i = 0; i < steps; i++) {
+            const uint32_t action = rng.below(COMMAND_COUNT + 5);
+            uint32_t idle_ms = rng.below(1500);
+
+            if(action < COMMAND_COUNT) {
+                ESP_LOGD(LOG_TAG, "#%i: %s in %s", i, command_names[action], Player::PlayerStateString(player->get_status()));
+                player->do_command((Player::Command) action);
+            } else switch(action - COMMAND_COUNT) {
+                case 0:
+                    ESP_LOGD(LOG_TAG, "#%i: tray out by hand", i);
+                    drive->set_door_open(true);
+                    break;
+                case 1:
+                    ESP_LOGD(LOG_TAG, "#%i: tray in by hand", i);
+                    drive->set_door_open(false);
+                    break;
+                case 2: {
+                    uint8_t slot = rng.below(slot_count);
+                    ESP_LOGD(LOG_TAG, "#%i: take out disc %u", i, slot);
+                    drive->remove_disc(slot);
+                    break;
+                }
+                case 3: {
+                    uint8_t slot = rng.below(slot_count);
+                    ESP_LOGD(LOG_TAG, "#%i: put in disc %u", i, slot);
+                    drive->insert_disc(slot, disc);
+                    break;
+                }
+                default:
+                    // now and then leave it be long enough for the drive to go to standby
+                    if(rng.below(10) == 0) idle_ms = LONG_IDLE_MS;
+                    ESP_LOGD(LOG_TAG, "#%i: idle %u ms", i, idle_ms);
+                    break;
+            }
+
+            wait_until([]() { return false; }, idle_ms);
+            fuzz_steps++;
+        }
+
+        for(int i = 0; i < slot_count; i++) drive->insert_disc(i, disc);
+        if(!settle()) {
+            wedges++;
+        }
+    }
+
+    void PlayerBench::log_report() {
+        for(auto& kv: reactions) {
+            const ATAPI::WaitHistogram& h = kv.second;
+            ESP_LOGI(LOG_TAG, "%s: %u times, avg %u ms, p50 %u ms, p95 %u ms, max %u ms", kv.first.c_str(), h.count, h.average_us() / 1000, h.percentile_us(50) / 1000, h.percentile_us(95) / 1000, h.max_us / 1000);
+        }
+        if(load_times.count > 0) {
+            ESP_LOGI(LOG_TAG, "Tray in to track list: %u times, avg %u ms, min %u ms, max %u ms", load_times.count, load_times.average_us() / 1000, load_times.min_us / 1000, load_times.max_us / 1000);
+        }
+        player->log_poll_stats();
+        ESP_LOGI(LOG_TAG, "%u fuzz steps, %u poll stalls, %u times stuck", fuzz_steps, stalls, wedges);
+    }
+}
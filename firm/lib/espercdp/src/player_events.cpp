@@ -0,0 +1,52 @@
+#include <esper-cdp/player_events.h>
+#include <esp32-hal-log.h>
+
+static const char LOG_TAG[] = "PLEVT";
+
+namespace CD {
+    PlayerEvents::PlayerEvents() {
+        for(int i = 0; i < MAX_SUBSCRIBERS; i++) {
+            groups[i] = xEventGroupCreate();
+            taken[i] = false;
+        }
+    }
+
+    PlayerEvents::~PlayerEvents() {
+        for(int i = 0; i < MAX_SUBSCRIBERS; i++) {
+            vEventGroupDelete(groups[i]);
+        }
+    }
+
+    PlayerEvents::Subscription PlayerEvents::subscribe() {
+        for(int i = 0; i < MAX_SUBSCRIBERS; i++) {
+            bool expected = false;
+            if(taken[i].compare_exchange_strong(expected, true)) {
+                // anything that happened so far is news to the new subscriber
+                xEventGroupSetBits(groups[i], EVT_ALL);
+                return i;
+            }
+        }
+        ESP_LOGE(LOG_TAG, "Out of subscriptions");
+        return NO_SUBSCRIPTION;
+    }
+
+    void PlayerEvents::unsubscribe(Subscription sub) {
+        if(sub < 0 || sub >= MAX_SUBSCRIBERS) return;
+        taken[sub] = false;
+    }
+
+    void PlayerEvents::publish(EventBits_t events) {
+        if(events == 0) return;
+        for(int i = 0; i < MAX_SUBSCRIBERS; i++) {
+            if(taken[i]) xEventGroupSetBits(groups[i], events);
+        }
+    }
+
+    EventBits_t PlayerEvents::wait(Subscription sub, TickType_t timeout, EventBits_t events) {
+        if(sub < 0 || sub >= MAX_SUBSCRIBERS) {
+            vTaskDelay(timeout);
+            return 0;
+        }
+        return xEventGroupWaitBits(groups[sub], events, pdTRUE, pdFALSE, timeout) & events;
+    }
+}
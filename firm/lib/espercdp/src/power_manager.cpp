@@ -0,0 +1,84 @@
+#include <esper-cdp/power_manager.h>
+#include <algorithm>
+#include <esp_timer.h>
+#include <esp32-hal-log.h>
+
+static const char LOG_TAG[] = "POWER";
+
+namespace CD {
+    void SpinUpHistogram::add(uint32_t ms) {
+        int bucket = std::min((int) (ms / BUCKET_MS), BUCKET_COUNT - 1);
+        buckets[bucket]++;
+        count++;
+        total_ms += ms;
+        if(ms > max_ms) max_ms = ms;
+    }
+
+    uint32_t SpinUpHistogram::percentile_ms(int pct) const {
+        if(count == 0) return 0;
+        uint32_t threshold = (uint32_t) (((uint64_t) count * pct + 99) / 100);
+        uint32_t seen = 0;
+        for(int i = 0; i < BUCKET_COUNT - 1; i++) {
+            seen += buckets[i];
+            if(seen >= threshold) return (i + 1) * BUCKET_MS;
+        }
+        return max_ms;
+    }
+
+    PowerManager::PowerManager(ATAPI::Device * device) {
+        cdrom = device;
+    }
+
+    PowerManager::~PowerManager() {
+        // The spin-up job records into this object, so it must not outlive it
+        if(pending_spin.valid()) pending_spin.wait();
+    }
+
+    bool PowerManager::take_step(const Thresholds& thresholds, TickType_t idle_for) {
+        ATAPI::Device * dev = cdrom;
+        if(level == Level::ACTIVE && thresholds.idle != NEVER && idle_for >= thresholds.idle) {
+            ESP_LOGI(LOG_TAG, "Idle for %u s, stopping the spindle", pdTICKS_TO_MS(idle_for) / 1000);
+            cdrom->submit(ATAPI::Device::Priority::BACKGROUND, [dev]() { dev->start(false); });
+            level = Level::IDLE;
+            return true;
+        }
+        if(level == Level::IDLE && thresholds.standby != NEVER && idle_for >= thresholds.standby) {
+            ESP_LOGI(LOG_TAG, "Idle for %u s, going to standby", pdTICKS_TO_MS(idle_for) / 1000);
+            cdrom->submit(ATAPI::Device::Priority::BACKGROUND, [dev]() { dev->standby(); });
+            level = Level::STANDBY;
+            return true;
+        }
+        return false;
+    }
+
+    void PowerManager::pre_spin() {
+        if(level == Level::ACTIVE || pre_spin_pending) return;
+
+        ESP_LOGI(LOG_TAG, "Spinning up ahead of time");
+        pre_spins++;
+        pre_spin_pending = true;
+        const uint32_t generation = activity_generation;
+        pending_spin = cdrom->submit(ATAPI::Device::Priority::USER, [this, generation]() {
+            // A command that came in meanwhile went first and spun the drive up by itself, no need to disturb it
+            if(activity_generation != generation) return;
+
+            int64_t start = esp_timer_get_time();
+            cdrom->start(true);
+            bool ready = cdrom->wait_ready();
+            uint32_t ms = (uint32_t) ((esp_timer_get_time() - start) / 1000);
+            if(ready) spin_up_latency.add(ms);
+            ESP_LOGI(LOG_TAG, "Spin-up took %u ms%s", ms, ready ? "" : ", still not ready");
+        }, [this]() { pre_spin_pending = false; });
+        level = Level::ACTIVE;
+    }
+
+    void PowerManager::note_active(bool by_user) {
+        activity_generation++;
+        if(by_user && level != Level::ACTIVE && !pre_spin_pending) cold_starts++;
+        level = Level::ACTIVE;
+    }
+
+    void PowerManager::log_summary() const {
+        ESP_LOGI(LOG_TAG, "Spin-up: n=%u avg=%ums p50<%ums p90<%ums max=%ums, %u pre-spins, %u cold starts", spin_up_latency.count, spin_up_latency.average_ms(), spin_up_latency.percentile_ms(50), spin_up_latency.percentile_ms(90), spin_up_latency.max_ms, pre_spins, cold_starts);
+    }
+}
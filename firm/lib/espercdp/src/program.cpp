@@ -0,0 +1,115 @@
+#include <esper-cdp/program.h>
+#include <esp32-hal-log.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <cstdio>
+#include <algorithm>
+
+static const char LOG_TAG[] = "PROGRAM";
+
+// Program file structure:
+// .../folder/Asdfgb.PRG
+// - Header
+// - track_count bytes of track numbers in the order to play
+#define PROGRAM_FILE_EXT ".PRG"
+#define PROGRAM_FILE_MAGIC 0x21475250 // 'PRG!'
+#define PROGRAM_FILE_VER 0x01
+
+struct __attribute__((packed)) ProgramFileHeader {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t track_count;
+};
+
+namespace CD {
+    std::vector<PlayRange> compile_program(const std::vector<uint8_t>& program, const Album& album) {
+        std::vector<PlayRange> ranges = {};
+        int last_track = -1;
+        for(int i = 0; i < program.size() && i <= UINT8_MAX; i++) {
+            const int track = program[i];
+            if(track < 1 || track > album.tracks.size()) continue;
+
+            const MSF end = (track == album.tracks.size()) ? album.duration : album.tracks[track].disc_position.position;
+            if(!ranges.empty() && track == last_track + 1 && ranges.back().first_entry + ranges.back().entry_count == i) {
+                ranges.back().end = end;
+                ranges.back().entry_count++;
+            } else {
+                ranges.push_back(PlayRange {
+                    .start = album.tracks[track - 1].disc_position.position,
+                    .end = end,
+                    .first_entry = (uint8_t) i,
+                    .entry_count = 1
+                });
+            }
+            last_track = track;
+        }
+        return ranges;
+    }
+
+    ProgramStore::ProgramStore(const char * path) {
+        this->path = (path == nullptr ? "" : std::string(path));
+        struct stat st = {0};
+        if(!this->path.empty() && stat(this->path.c_str(), &st) == -1) {
+            mkdir(this->path.c_str(), 0777);
+        }
+    }
+
+    const std::string ProgramStore::id_to_path(const std::string& id) {
+        return path + "/" + id + PROGRAM_FILE_EXT;
+    }
+
+    std::vector<uint8_t> ProgramStore::load(const Album& album) {
+        std::vector<uint8_t> program = {};
+        if(path.empty() || album.toc.empty()) return program;
+
+        const std::string file = id_to_path(MusicBrainzMetadataProvider::generate_id(album));
+        FILE * f = fopen(file.c_str(), "rb");
+        if(!f) return program;
+
+        ProgramFileHeader hdr;
+        if(fread(&hdr, 1, sizeof(hdr), f) != sizeof(hdr) || hdr.magic != PROGRAM_FILE_MAGIC || hdr.version != PROGRAM_FILE_VER) {
+            ESP_LOGE(LOG_TAG, "%s: bad header", file.c_str());
+            fclose(f);
+            return program;
+        }
+
+        program.resize(hdr.track_count);
+        if(fread(program.data(), 1, hdr.track_count, f) != hdr.track_count) {
+            ESP_LOGE(LOG_TAG, "%s: truncated", file.c_str());
+            program.clear();
+        }
+        fclose(f);
+
+        ESP_LOGI(LOG_TAG, "Loaded a program of %u tracks", program.size());
+        return program;
+    }
+
+    void ProgramStore::save(const Album& album, const std::vector<uint8_t>& program) {
+        if(path.empty() || album.toc.empty()) return;
+
+        const std::string file = id_to_path(MusicBrainzMetadataProvider::generate_id(album));
+        if(program.empty()) {
+            remove(file.c_str());
+            return;
+        }
+
+        const ProgramFileHeader hdr = {
+            .magic = PROGRAM_FILE_MAGIC,
+            .version = PROGRAM_FILE_VER,
+            .track_count = (uint8_t) std::min(program.size(), (size_t) UINT8_MAX)
+        };
+
+        FILE * f = fopen(file.c_str(), "wb");
+        if(!f) {
+            ESP_LOGE(LOG_TAG, "Failed to create %s", file.c_str());
+            return;
+        }
+        if(fwrite(&hdr, 1, sizeof(hdr), f) != sizeof(hdr) || fwrite(program.data(), 1, hdr.track_count, f) != hdr.track_count) {
+            ESP_LOGE(LOG_TAG, "Failed to write %s", file.c_str());
+            fclose(f);
+            remove(file.c_str());
+            return;
+        }
+        fclose(f);
+    }
+}
@@ -0,0 +1,44 @@
+#include <esper-cdp/recovery.h>
+#include <esper-cdp/atapi-protocol.h>
+
+namespace ATAPI {
+    // Matches any ASC or ASCQ
+    static const int ANY = -1;
+
+    struct RecoveryRule {
+        RequestSenseKey key;
+        int asc;
+        int ascq;
+        RecoveryStep step;
+    };
+
+    // First match wins, so the more specific rules go first
+    static const RecoveryRule recovery_table[] = {
+        { SENSE_NO_SENSE,        ANY,                         ANY,  { RecoveryAction::NONE,     0,   "no sense" } },
+        { SENSE_RECOVERED_ERROR, ANY,                         ANY,  { RecoveryAction::NONE,     0,   "recovered error" } },
+
+        { SENSE_NOT_READY,       ASC_NO_MEDIUM,               ANY,  { RecoveryAction::GIVE_UP,  0,   "no medium" } },
+        { SENSE_NOT_READY,       ASC_NOT_READY,               0x01, { RecoveryAction::BACK_OFF, 250, "becoming ready" } },
+        { SENSE_NOT_READY,       ANY,                         ANY,  { RecoveryAction::BACK_OFF, 500, "not ready" } },
+
+        { SENSE_MEDIUM_ERROR,    ANY,                         ANY,  { RecoveryAction::BACK_OFF, 100, "medium error" } },
+        { SENSE_HARDWARE_ERROR,  ANY,                         ANY,  { RecoveryAction::RESET,    0,   "hardware error" } },
+
+        { SENSE_ILLEGAL_REQUEST, ANY,                         ANY,  { RecoveryAction::GIVE_UP,  0,   "illegal request" } },
+
+        // Reported once after a reset or disc change, and cleared by reading it out
+        { SENSE_UNIT_ATTENTION,  ANY,                         ANY,  { RecoveryAction::RETRY,    20,  "unit attention" } },
+        { SENSE_ABORTED_COMMAND, ANY,                         ANY,  { RecoveryAction::RETRY,    50,  "aborted command" } },
+    };
+
+    static const RecoveryStep unknown_sense = { RecoveryAction::BACK_OFF, 500, "unknown sense" };
+
+    const RecoveryStep& recovery_step_for(const SenseData& sense) {
+        for(auto& rule: recovery_table) {
+            if(rule.key == sense.key && (rule.asc == ANY || rule.asc == sense.asc) && (rule.ascq == ANY || rule.ascq == sense.ascq)) {
+                return rule.step;
+            }
+        }
+        return unknown_sense;
+    }
+}
@@ -0,0 +1,225 @@
+#include <esper-cdp/resume_store.h>
+#include <esp32-hal-log.h>
+#include <esp_system.h>
+#include <cstdio>
+#include <cstddef>
+#include <algorithm>
+
+static const char LOG_TAG[] = "RESUME";
+
+// Log file structure:
+// - Header
+// - Records, appended as the points change. The last record of a disc wins.
+// Once the log grows past RESUME_LOG_MAX_SIZE, it is rewritten with one record per remembered disc.
+#define RESUME_LOG_MAGIC 0x21534552 // 'RES!'
+#define RESUME_LOG_VER 0x01
+#define RESUME_LOG_MAX_SIZE 4096
+#define RESUME_MAX_POINTS 32
+// Minutes value of a record that forgets the disc
+#define RESUME_FORGOTTEN 0xFF
+
+struct __attribute__((packed)) ResumeLogHeader {
+    uint32_t magic;
+    uint8_t version;
+};
+
+struct __attribute__((packed)) ResumeLogRecord {
+    uint32_t disc_id;
+    uint8_t M;
+    uint8_t S;
+    uint8_t F;
+    /// @brief Catches a record torn by a power cut in the middle of writing it
+    uint8_t check;
+};
+
+static uint8_t record_check(const ResumeLogRecord& rec) {
+    const uint8_t * bytes = (const uint8_t *) &rec;
+    uint8_t check = 0xA5;
+    for(int i = 0; i < offsetof(ResumeLogRecord, check); i++) check ^= bytes[i];
+    return check;
+}
+
+namespace CD {
+    // The shutdown handler takes no argument, and there's only ever one CD player anyway
+    static ResumeStore * shutdown_store = nullptr;
+
+    ResumeStore::ResumeStore(const char * path) {
+        this->path = (path == nullptr ? "" : std::string(path));
+        semaphore = xSemaphoreCreateMutex();
+        load();
+        if(shutdown_store == nullptr) {
+            shutdown_store = this;
+            esp_register_shutdown_handler(on_shutdown);
+        }
+    }
+
+    ResumeStore::~ResumeStore() {
+        flush();
+        if(shutdown_store == this) {
+            esp_unregister_shutdown_handler(on_shutdown);
+            shutdown_store = nullptr;
+        }
+        vSemaphoreDelete(semaphore);
+    }
+
+    void ResumeStore::on_shutdown() {
+        if(shutdown_store != nullptr) shutdown_store->flush();
+    }
+
+    ResumeStore::Point * ResumeStore::find_point(uint32_t disc_id) {
+        for(auto& p: points) {
+            if(p.disc_id == disc_id) return &p;
+        }
+        return nullptr;
+    }
+
+    void ResumeStore::note(uint32_t disc_id, const MSF position) {
+        if(disc_id == 0) return;
+        xSemaphoreTake(semaphore, portMAX_DELAY);
+        Point * p = find_point(disc_id);
+        if(p == nullptr) {
+            if(points.size() >= RESUME_MAX_POINTS) {
+                auto oldest = std::min_element(points.begin(), points.end(), [](const Point& a, const Point& b) { return a.used < b.used; });
+                points.erase(oldest);
+            }
+            points.push_back(Point { .disc_id = disc_id });
+            p = &points.back();
+        }
+        if(p->forgotten || p->position.M != position.M || p->position.S != position.S || p->position.F != position.F) {
+            p->position = position;
+            p->forgotten = false;
+            p->dirty = true;
+        }
+        p->used = ++use_counter;
+        xSemaphoreGive(semaphore);
+    }
+
+    void ResumeStore::forget(uint32_t disc_id) {
+        xSemaphoreTake(semaphore, portMAX_DELAY);
+        Point * p = find_point(disc_id);
+        if(p != nullptr && !p->forgotten) {
+            p->forgotten = true;
+            p->dirty = true;
+        }
+        xSemaphoreGive(semaphore);
+    }
+
+    bool ResumeStore::find(uint32_t disc_id, MSF& position) {
+        xSemaphoreTake(semaphore, portMAX_DELAY);
+        Point * p = find_point(disc_id);
+        bool found = (p != nullptr && !p->forgotten);
+        if(found) {
+            position = p->position;
+            p->used = ++use_counter;
+        }
+        xSemaphoreGive(semaphore);
+        return found;
+    }
+
+    void ResumeStore::load() {
+        if(path.empty()) return;
+        FILE * f = fopen(path.c_str(), "rb");
+        if(!f) return;
+
+        ResumeLogHeader hdr;
+        if(fread(&hdr, 1, sizeof(hdr), f) != sizeof(hdr) || hdr.magic != RESUME_LOG_MAGIC || hdr.version != RESUME_LOG_VER) {
+            ESP_LOGE(LOG_TAG, "Bad header, starting over");
+            fclose(f);
+            remove(path.c_str());
+            return;
+        }
+
+        log_size = sizeof(hdr);
+        ResumeLogRecord rec;
+        while(fread(&rec, 1, sizeof(rec), f) == sizeof(rec)) {
+            log_size += sizeof(rec);
+            if(rec.check != record_check(rec)) {
+                ESP_LOGW(LOG_TAG, "Torn record at %u, skipped", log_size - sizeof(rec));
+                continue;
+            }
+            if(rec.M == RESUME_FORGOTTEN) {
+                points.erase(std::remove_if(points.begin(), points.end(), [&rec](const Point& p) { return p.disc_id == rec.disc_id; }), points.end());
+            } else {
+                note(rec.disc_id, MSF { .M = rec.M, .S = rec.S, .F = rec.F });
+            }
+        }
+        fclose(f);
+
+        // it's all on flash already
+        for(auto& p: points) p.dirty = false;
+        ESP_LOGI(LOG_TAG, "Loaded %u resume points from %u bytes of log", points.size(), log_size);
+    }
+
+    void ResumeStore::flush() {
+        if(path.empty()) return;
+        xSemaphoreTake(semaphore, portMAX_DELAY);
+        std::vector<ResumeLogRecord> records = {};
+        for(auto& p: points) {
+            if(!p.dirty) continue;
+            ResumeLogRecord rec = {
+                .disc_id = p.disc_id,
+                .M = p.forgotten ? (uint8_t) RESUME_FORGOTTEN : p.position.M,
+                .S = p.position.S,
+                .F = p.position.F,
+                .check = 0
+            };
+            rec.check = record_check(rec);
+            records.push_back(rec);
+        }
+
+        if(!records.empty()) {
+            bool written = false;
+            if(log_size + records.size() * sizeof(ResumeLogRecord) > RESUME_LOG_MAX_SIZE || log_size == 0) {
+                written = compact();
+            } else {
+                FILE * f = fopen(path.c_str(), "ab");
+                if(!f || fwrite(records.data(), sizeof(ResumeLogRecord), records.size(), f) != records.size()) {
+                    ESP_LOGE(LOG_TAG, "Failed to append to %s", path.c_str());
+                } else {
+                    log_size += records.size() * sizeof(ResumeLogRecord);
+                    written = true;
+                    ESP_LOGV(LOG_TAG, "Appended %u records", records.size());
+                }
+                if(f) fclose(f);
+            }
+
+            // otherwise they stay dirty and go out with the next flush
+            if(written) {
+                for(auto& p: points) p.dirty = false;
+                points.erase(std::remove_if(points.begin(), points.end(), [](const Point& p) { return p.forgotten; }), points.end());
+            }
+        }
+        xSemaphoreGive(semaphore);
+    }
+
+    bool ResumeStore::compact() {
+        const std::string tmp_path = path + ".new";
+        FILE * f = fopen(tmp_path.c_str(), "wb");
+        if(!f) {
+            ESP_LOGE(LOG_TAG, "Failed to create %s", tmp_path.c_str());
+            return false;
+        }
+
+        const ResumeLogHeader hdr = { .magic = RESUME_LOG_MAGIC, .version = RESUME_LOG_VER };
+        bool ok = (fwrite(&hdr, 1, sizeof(hdr), f) == sizeof(hdr));
+        size_t size = sizeof(hdr);
+        for(auto& p: points) {
+            if(p.forgotten) continue;
+            ResumeLogRecord rec = { .disc_id = p.disc_id, .M = p.position.M, .S = p.position.S, .F = p.position.F, .check = 0 };
+            rec.check = record_check(rec);
+            ok = ok && (fwrite(&rec, 1, sizeof(rec), f) == sizeof(rec));
+            size += sizeof(rec);
+        }
+        fclose(f);
+
+        // the old log stays good until the new one is all there
+        if(!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+            ESP_LOGE(LOG_TAG, "Failed to compact %s", path.c_str());
+            remove(tmp_path.c_str());
+            return false;
+        }
+        ESP_LOGI(LOG_TAG, "Compacted %u bytes of log down to %u", log_size, size);
+        log_size = size;
+        return true;
+    }
+}
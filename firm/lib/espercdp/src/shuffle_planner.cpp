@@ -0,0 +1,167 @@
+#include <esper-cdp/shuffle_planner.h>
+#include <esper-core/prefs.h>
+#include <esp_heap_caps.h>
+#include <esp32-hal-log.h>
+#include <algorithm>
+#include <cstring>
+
+static const char LOG_TAG[] = "SHUFFLE";
+static const uint8_t SHUFFLE_STATE_VERSION = 1;
+static const Prefs::Key<std::vector<uint8_t>> PREFS_KEY_SHUFFLE_STATE = { "shuf_state", {} };
+
+namespace CD {
+    struct __attribute__((packed)) StoredShuffleState {
+        uint8_t version;
+        uint32_t layout;
+        uint32_t seed;
+        uint16_t cursor;
+        uint8_t tracks_per_disc;
+        int8_t first_slot;
+    };
+
+    // xorshift32: the plan has to come out the same from the same seed after a reboot, which the hardware RNG can't do
+    struct PlanRandom {
+        uint32_t state;
+
+        uint32_t next() {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            return state;
+        }
+
+        // Uniform in [0; bound) without the bias of a modulo
+        uint32_t below(uint32_t bound) {
+            return (uint32_t) (((uint64_t) next() * bound) >> 32);
+        }
+    };
+
+    template <typename T> static void fisher_yates(T * items, size_t count, PlanRandom& rng) {
+        for(size_t i = count; i > 1; i--) {
+            std::swap(items[i - 1], items[rng.below(i)]);
+        }
+    }
+
+    ShufflePlanner::ShufflePlanner(int tracks_per_disc) {
+        this->tracks_per_disc = std::max(1, tracks_per_disc);
+    }
+
+    ShufflePlanner::~ShufflePlanner() {
+        clear();
+    }
+
+    void ShufflePlanner::clear() {
+        if(entries != nullptr) {
+            free(entries);
+            entries = nullptr;
+        }
+        count = 0;
+        cursor = 0;
+    }
+
+    void ShufflePlanner::plan(const std::vector<uint8_t>& track_counts, uint32_t layout_id, uint32_t seed, int first_slot) {
+        clear();
+        PlanRandom rng = { .state = (seed == 0) ? 1 : seed };
+
+        // Every disc's tracks in random order, one disc after another
+        std::vector<Entry> pool = {};
+        std::vector<size_t> disc_start(track_counts.size(), 0);
+        std::vector<uint8_t> discs = {};
+        for(int slot = 0; slot < track_counts.size(); slot++) {
+            disc_start[slot] = pool.size();
+            if(track_counts[slot] == 0) continue;
+            for(int t = 0; t < track_counts[slot]; t++) {
+                pool.push_back(Entry { .slot = (uint8_t) slot, .track = (uint8_t) t });
+            }
+            fisher_yates(&pool[disc_start[slot]], track_counts[slot], rng);
+            discs.push_back(slot);
+        }
+        if(pool.empty()) return;
+
+        entries = (Entry *) heap_caps_malloc_prefer(pool.size() * sizeof(Entry), 2, MALLOC_CAP_8BIT | MALLOC_CAP_SPIRAM, MALLOC_CAP_8BIT | MALLOC_CAP_DEFAULT);
+        if(entries == nullptr) {
+            ESP_LOGE(LOG_TAG, "Out of memory for %u tracks", pool.size());
+            return;
+        }
+
+        // Then deal them out a few tracks off each disc at a time, with the discs in a new random order every round
+        std::vector<size_t> taken(track_counts.size(), 0);
+        int last_slot = first_slot;
+        size_t out = 0;
+        while(!discs.empty()) {
+            fisher_yates(discs.data(), discs.size(), rng);
+            // carry on with the disc already in the drive, that's one swap less
+            auto cur = std::find(discs.begin(), discs.end(), last_slot);
+            if(cur != discs.end()) std::iter_swap(discs.begin(), cur);
+
+            for(uint8_t slot: discs) {
+                size_t n = std::min((size_t) tracks_per_disc, track_counts[slot] - taken[slot]);
+                memcpy(&entries[out], &pool[disc_start[slot] + taken[slot]], n * sizeof(Entry));
+                out += n;
+                taken[slot] += n;
+                last_slot = slot;
+            }
+
+            discs.erase(std::remove_if(discs.begin(), discs.end(), [&taken, &track_counts](uint8_t slot) { return taken[slot] >= track_counts[slot]; }), discs.end());
+        }
+
+        count = out;
+        cursor = 0;
+        layout = layout_id;
+        this->seed = seed;
+        this->first_slot = first_slot;
+        ESP_LOGI(LOG_TAG, "Planned %u tracks of layout %08x, seed %08x", count, layout, seed);
+    }
+
+    bool ShufflePlanner::restore(const std::vector<uint8_t>& track_counts, uint32_t layout_id) {
+        const std::vector<uint8_t> blob = Prefs::get(PREFS_KEY_SHUFFLE_STATE);
+        if(blob.size() != sizeof(StoredShuffleState)) return false;
+
+        StoredShuffleState stored;
+        memcpy(&stored, blob.data(), sizeof(stored));
+        if(stored.version != SHUFFLE_STATE_VERSION || stored.layout != layout_id || stored.tracks_per_disc != tracks_per_disc) return false;
+
+        plan(track_counts, layout_id, stored.seed, stored.first_slot);
+        if(stored.cursor >= count) {
+            clear();
+            return false;
+        }
+        cursor = stored.cursor;
+        ESP_LOGI(LOG_TAG, "Resuming at %u of %u", cursor, count);
+        return true;
+    }
+
+    bool ShufflePlanner::next(Entry& out) {
+        if(cursor >= count) return false;
+        out = entries[cursor++];
+        save();
+        return true;
+    }
+
+    bool ShufflePlanner::previous(Entry& out) {
+        // the one before the track that is playing now
+        if(cursor < 2) return false;
+        cursor--;
+        out = entries[cursor - 1];
+        save();
+        return true;
+    }
+
+    bool ShufflePlanner::peek(Entry& out, size_t ahead) const {
+        if(cursor + ahead >= count) return false;
+        out = entries[cursor + ahead];
+        return true;
+    }
+
+    void ShufflePlanner::save() {
+        const StoredShuffleState stored = {
+            .version = SHUFFLE_STATE_VERSION,
+            .layout = layout,
+            .seed = seed,
+            .cursor = (uint16_t) cursor,
+            .tracks_per_disc = (uint8_t) tracks_per_disc,
+            .first_slot = (int8_t) first_slot
+        };
+        Prefs::set(PREFS_KEY_SHUFFLE_STATE, std::vector<uint8_t>((const uint8_t *) &stored, (const uint8_t *) &stored + sizeof(stored)));
+    }
+}
@@ -0,0 +1,73 @@
+#include <esper-cdp/transition_scheduler.h>
+#include <esp32-hal-log.h>
+#include <algorithm>
+
+static const char LOG_TAG[] = "TRANS";
+
+namespace CD {
+    TransitionScheduler::TransitionScheduler(ATAPI::Device * device) {
+        cdrom = device;
+        semaphore = xSemaphoreCreateMutex();
+        const esp_timer_create_args_t args = {
+            .callback = on_timer,
+            .arg = this,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "CDTrans",
+            .skip_unhandled_events = true
+        };
+        if(esp_timer_create(&args, &timer) != ESP_OK) {
+            ESP_LOGE(LOG_TAG, "Timer creation failed, transitions will be left to the poll cycle");
+            timer = nullptr;
+        }
+    }
+
+    TransitionScheduler::~TransitionScheduler() {
+        if(timer != nullptr) {
+            esp_timer_stop(timer);
+            esp_timer_delete(timer);
+        }
+        vSemaphoreDelete(semaphore);
+    }
+
+    void TransitionScheduler::arm(int64_t at_us, const MSF start, const MSF end) {
+        if(timer == nullptr) return;
+
+        xSemaphoreTake(semaphore, portMAX_DELAY);
+        esp_timer_stop(timer);
+        this->start = start;
+        this->end = end;
+        phase = Phase::ARMED;
+        esp_timer_start_once(timer, std::max((int64_t) 0, at_us - esp_timer_get_time()));
+        xSemaphoreGive(semaphore);
+    }
+
+    bool TransitionScheduler::cancel() {
+        if(timer == nullptr) return false;
+
+        xSemaphoreTake(semaphore, portMAX_DELAY);
+        esp_timer_stop(timer);
+        bool fired = (phase == Phase::FIRED);
+        phase = Phase::IDLE;
+        xSemaphoreGive(semaphore);
+        return fired;
+    }
+
+    void TransitionScheduler::acknowledge() {
+        xSemaphoreTake(semaphore, portMAX_DELAY);
+        if(phase == Phase::FIRED) phase = Phase::IDLE;
+        xSemaphoreGive(semaphore);
+    }
+
+    void TransitionScheduler::on_timer(void * arg) {
+        TransitionScheduler * that = static_cast<TransitionScheduler *>(arg);
+        xSemaphoreTake(that->semaphore, portMAX_DELAY);
+        if(that->phase == Phase::ARMED) {
+            ATAPI::Device * dev = that->cdrom;
+            const MSF start = that->start;
+            const MSF end = that->end;
+            dev->submit(ATAPI::Device::Priority::USER, [dev, start, end]() { dev->play(start, end); });
+            that->phase = Phase::FIRED;
+        }
+        xSemaphoreGive(that->semaphore);
+    }
+}
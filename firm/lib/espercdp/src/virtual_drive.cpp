@@ -0,0 +1,1022 @@
+#include <esper-cdp/virtual_drive.h>
+#include <esper-cdp/atapi-protocol.h>
+#include <esp_timer.h>
+#include <algorithm>
+#include <endian.h>
+#include <stdio.h>
+
+static const char LOG_TAG[] = "VCDROM";
+
+// How fast SCAN goes through the disc, in multiples of normal playback speed
+static const int SCAN_SPEED = 8;
+// Length assumed for a cue sheet FILE which could not be opened
+static const int MISSING_FILE_FRAMES = 60 * MSF::FRAMES_IN_SECOND;
+static const int BYTES_PER_FRAME = 2352;
+// Absolute address of the start of the program area
+static const int PROGRAM_AREA_START = 2 * MSF::FRAMES_IN_SECOND;
+
+static const uint8_t STS_ERR = (1 << 0);
+static const uint8_t STS_DRQ = (1 << 3);
+static const uint8_t STS_DSC = (1 << 4);
+static const uint8_t STS_DRDY = (1 << 6);
+static const uint8_t STS_BSY = (1 << 7);
+static const uint8_t ERR_ABRT = (1 << 2);
+
+// The sense this side of spin-up: not ready, but becoming ready
+static const uint8_t ASCQ_BECOMING_READY = 0x01;
+
+static uint8_t int_to_bcd(int val) { return ((val / 10) << 4) | (val % 10); }
+
+namespace ATAPI {
+    int VirtualTrack::start_frame() const {
+        for(auto& idx: indexes) {
+            if(idx.first == 1) return idx.second;
+        }
+        return indexes.front().second;
+    }
+
+    const VirtualTrack * VirtualDisc::track_at(int frame) const {
+        const VirtualTrack * trk = &tracks.front();
+        for(auto& t: tracks) {
+            if(t.pregap_frame() <= frame) trk = &t;
+        }
+        return trk;
+    }
+
+    static int wav_frame_count(const std::string& path, long * data_offset) {
+        FILE * f = fopen(path.c_str(), "rb");
+        if(f == nullptr) return -1;
+
+        int frames = -1;
+        char riff[12];
+        if(fread(riff, 1, sizeof(riff), f) == sizeof(riff) && memcmp(riff, "RIFF", 4) == 0 && memcmp(&riff[8], "WAVE", 4) == 0) {
+            struct __attribute__((packed)) {
+                char id[4];
+                uint32_t size;
+            } chunk;
+
+            while(fread(&chunk, sizeof(chunk), 1, f) == 1) {
+                if(memcmp(chunk.id, "data", 4) == 0) {
+                    frames = le32toh(chunk.size) / BYTES_PER_FRAME;
+                    *data_offset = ftell(f);
+                    break;
+                }
+                fseek(f, le32toh(chunk.size) + (le32toh(chunk.size) & 1), SEEK_CUR);
+            }
+        }
+
+        fclose(f);
+        return frames;
+    }
+
+    static int parse_cue_msf(const char * str) {
+        int m = 0, s = 0, f = 0;
+        sscanf(str, "%d:%d:%d", &m, &s, &f);
+        return (m * 60 + s) * MSF::FRAMES_IN_SECOND + f;
+    }
+
+    static std::string parse_cue_string(const char * str) {
+        while(*str == ' ') str++;
+        std::string rslt = str;
+        if(!rslt.empty() && rslt.front() == '"') {
+            size_t end = rslt.find('"', 1);
+            rslt = rslt.substr(1, end == std::string::npos ? std::string::npos : end - 1);
+        }
+        return rslt;
+    }
+
+    std::shared_ptr<VirtualDisc> VirtualDisc::silent(int track_count, int track_frames) {
+        auto disc = std::make_shared<VirtualDisc>();
+        int frame = PROGRAM_AREA_START;
+        for(int i = 1; i <= track_count; i++) {
+            disc->tracks.push_back(VirtualTrack {
+                .number = (uint8_t) i,
+                .indexes = { {1, frame} },
+                .preemphasis = false,
+                .title = "",
+                .performer = "",
+                .isrc = ""
+            });
+            frame += track_frames;
+        }
+        disc->lead_out_frame = frame;
+        return disc;
+    }
+
+    std::shared_ptr<VirtualDisc> VirtualDisc::from_cue(const char * path) {
+        FILE * f = fopen(path, "r");
+        if(f == nullptr) {
+            ESP_LOGE(LOG_TAG, "Cannot open cue sheet %s", path);
+            return nullptr;
+        }
+
+        std::string dir = path;
+        size_t slash = dir.find_last_of('/');
+        dir = (slash == std::string::npos) ? "" : dir.substr(0, slash + 1);
+
+        auto disc = std::make_shared<VirtualDisc>();
+        int file_start = PROGRAM_AREA_START;
+        int disc_end = PROGRAM_AREA_START;
+        char line[256];
+
+        while(fgets(line, sizeof(line), f) != nullptr) {
+            char * cmd = line;
+            while(*cmd == ' ' || *cmd == '\t') cmd++;
+            cmd[strcspn(cmd, "\r\n")] = 0;
+            char * arg = strchr(cmd, ' ');
+            if(arg == nullptr) continue;
+            *arg++ = 0;
+
+            if(!strcmp(cmd, "FILE")) {
+                std::string name = parse_cue_string(arg);
+                // the cue sheets in the wild are often made on Windows with absolute paths, so just take the file name
+                size_t sep = name.find_last_of("\\/");
+                if(sep != std::string::npos) name = name.substr(sep + 1);
+
+                long data_offset = 0;
+                std::string file_path = dir + name;
+                int frames = wav_frame_count(file_path, &data_offset);
+                if(frames < 0) {
+                    ESP_LOGW(LOG_TAG, "Cannot read %s, assuming %i frames", name.c_str(), MISSING_FILE_FRAMES);
+                    frames = MISSING_FILE_FRAMES;
+                    file_path = "";
+                }
+                file_start = disc_end;
+                disc_end += frames;
+                disc->files.push_back(VirtualFile {
+                    .path = file_path,
+                    .start_frame = file_start,
+                    .frame_count = frames,
+                    .data_offset = data_offset
+                });
+            }
+            else if(!strcmp(cmd, "TRACK")) {
+                disc->tracks.push_back(VirtualTrack {
+                    .number = (uint8_t) atoi(arg),
+                    .indexes = {},
+                    .preemphasis = false,
+                    .title = "",
+                    .performer = "",
+                    .isrc = ""
+                });
+            }
+            else if(!strcmp(cmd, "PREGAP") && !disc->tracks.empty()) {
+                // Silence which is not in the file: shift the file forward and index it as the track's pregap
+                int len = parse_cue_msf(arg);
+                disc->tracks.back().indexes.push_back({0, file_start});
+                file_start += len;
+                disc_end += len;
+                if(!disc->files.empty()) disc->files.back().start_frame = file_start;
+            }
+            else if(!strcmp(cmd, "INDEX") && !disc->tracks.empty()) {
+                int idx = 0;
+                char msf[16] = { 0 };
+                sscanf(arg, "%d %15s", &idx, msf);
+                disc->tracks.back().indexes.push_back({(uint8_t) idx, file_start + parse_cue_msf(msf)});
+            }
+            else if(!strcmp(cmd, "FLAGS") && !disc->tracks.empty()) {
+                disc->tracks.back().preemphasis = (strstr(arg, "PRE") != nullptr);
+            }
+            else if(!strcmp(cmd, "TITLE")) {
+                if(disc->tracks.empty()) disc->title = parse_cue_string(arg);
+                else disc->tracks.back().title = parse_cue_string(arg);
+            }
+            else if(!strcmp(cmd, "PERFORMER")) {
+                if(disc->tracks.empty()) disc->performer = parse_cue_string(arg);
+                else disc->tracks.back().performer = parse_cue_string(arg);
+            }
+            else if(!strcmp(cmd, "CATALOG")) {
+                disc->catalog = parse_cue_string(arg);
+            }
+            else if(!strcmp(cmd, "ISRC") && !disc->tracks.empty()) {
+                disc->tracks.back().isrc = parse_cue_string(arg);
+            }
+        }
+        fclose(f);
+
+        // Tracks which ended up without any index would crash the drive logic, drop them
+        disc->tracks.erase(std::remove_if(disc->tracks.begin(), disc->tracks.end(), [](const VirtualTrack& t) { return t.indexes.empty(); }), disc->tracks.end());
+        for(auto& t: disc->tracks) {
+            std::sort(t.indexes.begin(), t.indexes.end());
+        }
+        disc->lead_out_frame = disc_end;
+
+        if(disc->tracks.empty()) {
+            ESP_LOGE(LOG_TAG, "No tracks in cue sheet %s", path);
+            return nullptr;
+        }
+
+        ESP_LOGI(LOG_TAG, "Loaded %s: %i tracks, lead-out at frame %i", path, disc->tracks.size(), disc->lead_out_frame);
+        return disc;
+    }
+
+    VirtualDrive::VirtualDrive(uint8_t slot_count, Clock clk):
+        IDEBus(),
+        clock(clk == nullptr ? esp_timer_get_time : clk),
+        slots(std::max((uint8_t) 1, std::min(slot_count, (uint8_t) MAX_CHANGER_SLOTS)))
+    {
+        for(auto& s: slots) s = Slot { .disc = nullptr, .changed = false };
+    }
+
+    int64_t VirtualDrive::now() { return clock(); }
+
+    const VirtualDisc * VirtualDrive::current_disc() {
+        if(door_open || pending_slot >= 0) return nullptr;
+        return slots[current_slot].disc.get();
+    }
+
+    bool VirtualDrive::is_ready() {
+        return current_disc() != nullptr && spinning && now() >= spun_up_at;
+    }
+
+    void VirtualDrive::insert_disc(uint8_t slot, std::shared_ptr<const VirtualDisc> disc) {
+        if(slot >= slots.size()) return;
+        slots[slot] = Slot { .disc = disc, .changed = true };
+    }
+
+    void VirtualDrive::remove_disc(uint8_t slot) {
+        if(slot >= slots.size()) return;
+        if(slot == current_slot) audio = AudioState::NONE;
+        slots[slot] = Slot { .disc = nullptr, .changed = true };
+    }
+
+    void VirtualDrive::set_door_open(bool open) {
+        if(open == door_open) return;
+        door_open = open;
+        if(open) {
+            audio = AudioState::NONE;
+            spinning = false;
+        } else {
+            spinning = true;
+            spun_up_at = now() + latencies.spin_up;
+        }
+    }
+
+    void VirtualDrive::update_mechanism() {
+        if(pending_slot >= 0 && now() >= changer_ready_at) {
+            current_slot = pending_slot;
+            pending_slot = -1;
+            spinning = true;
+            spun_up_at = now() + latencies.spin_up;
+        }
+
+        if(audio == AudioState::PLAYING || audio == AudioState::SCANNING) {
+            int frame = current_frame();
+            if(audio == AudioState::PLAYING && frame >= play_end) {
+                audio_stopped_at = play_anchor + (int64_t) (play_end - play_pos) * 1000000 / MSF::FRAMES_IN_SECOND;
+                play_pos = play_end;
+                audio = AudioState::COMPLETED;
+            }
+            else if(audio == AudioState::SCANNING && (frame <= PROGRAM_AREA_START || frame >= play_end)) {
+                play_pos = std::max(PROGRAM_AREA_START, std::min(frame, play_end));
+                audio = AudioState::COMPLETED;
+            }
+        }
+    }
+
+    int VirtualDrive::current_frame() {
+        int64_t elapsed = std::max((int64_t) 0, now() - play_anchor);
+        int moved = (int) (elapsed * MSF::FRAMES_IN_SECOND / 1000000);
+        switch(audio) {
+            case AudioState::PLAYING:
+                return std::min(play_pos + moved, play_end);
+            case AudioState::SCANNING:
+                return scan_reverse ? (play_pos - moved * SCAN_SPEED) : (play_pos + moved * SCAN_SPEED);
+            default:
+                return play_pos;
+        }
+    }
+
+    data16 VirtualDrive::read(uint8_t reg) {
+        access_count++;
+        update_mechanism();
+        data16 rslt = {{ .low = 0, .high = 0 }};
+
+        switch(reg) {
+            case IDE::Register::Data:
+                if(phase == Phase::DATA_TO_HOST && now() >= busy_until && out_pos < out.size()) {
+                    rslt.low = out[out_pos++];
+                    rslt.high = (out_pos < out.size()) ? out[out_pos++] : 0;
+                    if(out_pos >= out.size()) phase = Phase::IDLE;
+                }
+                break;
+
+            case IDE::Register::Status:
+            case IDE::Register::AlternateStatus:
+                if(now() < busy_until) {
+                    rslt.low = STS_BSY;
+                } else {
+                    rslt.low = STS_DRDY | STS_DSC;
+                    if(err_flag) rslt.low |= STS_ERR;
+                    if(phase == Phase::RECEIVE_PACKET || (phase == Phase::DATA_TO_HOST && out_pos < out.size())) rslt.low |= STS_DRQ;
+                }
+                break;
+
+            case IDE::Register::Error:
+                rslt.low = error;
+                break;
+
+            case IDE::Register::CylinderLow:
+            case IDE::Register::CylinderHigh:
+                if(phase == Phase::DATA_TO_HOST) {
+                    size_t count = std::min(out.size() - out_pos, (size_t) 0xFFFE);
+                    rslt.low = (reg == IDE::Register::CylinderLow) ? (count & 0xFF) : (count >> 8);
+                } else {
+                    rslt.low = regs[reg & 0xF];
+                }
+                break;
+
+            default:
+                rslt.low = regs[reg & 0xF];
+                break;
+        }
+
+        return rslt;
+    }
+
+    void VirtualDrive::read_block(uint8_t reg, void * buf, size_t words) {
+        uint8_t * dst = (uint8_t *) buf;
+        for(size_t i = 0; i < words; i++) {
+            data16 val = read(reg);
+            *dst++ = val.low;
+            *dst++ = val.high;
+        }
+    }
+
+    void VirtualDrive::write(uint8_t reg, data16 data) {
+        access_count++;
+        update_mechanism();
+
+        switch(reg) {
+            case IDE::Register::Data:
+                if(phase == Phase::RECEIVE_PACKET) {
+                    packet.push_back(data.low);
+                    packet.push_back(data.high);
+                    if(packet.size() >= packet_expected) {
+                        if(packet[0] == OperationCodes::MODE_SELECT && packet_expected == 12) {
+                            // The parameter list follows the packet right away
+                            const Requests::ModeSelect * req = (const Requests::ModeSelect *) packet.data();
+                            packet_expected += be16toh(req->parameter_list_length);
+                            if(packet.size() < packet_expected) break;
+                        }
+                        execute_packet();
+                    }
+                }
+                break;
+
+            case IDE::Register::Command:
+                execute_command(data.low);
+                break;
+
+            default:
+                regs[reg & 0xF] = data.low;
+                break;
+        }
+    }
+
+    void VirtualDrive::write_block(uint8_t reg, const void * buf, size_t words) {
+        const uint8_t * src = (const uint8_t *) buf;
+        for(size_t i = 0; i < words; i++) {
+            write(reg, {{ .low = src[i * 2], .high = src[i * 2 + 1] }});
+        }
+    }
+
+    void VirtualDrive::reset() {
+        ESP_LOGI(LOG_TAG, "Reset");
+        phase = Phase::IDLE;
+        out.clear();
+        out_pos = 0;
+        err_flag = false;
+        error = 0x01;
+        audio = AudioState::NONE;
+        // ATAPI signature
+        regs[IDE::Register::CylinderLow & 0xF] = 0x14;
+        regs[IDE::Register::CylinderHigh & 0xF] = 0xEB;
+        busy_until = now() + latencies.command;
+        spinning = !door_open;
+        spun_up_at = now() + latencies.spin_up;
+    }
+
+    void VirtualDrive::execute_command(uint8_t cmd) {
+        err_flag = false;
+        error = 0;
+        out.clear();
+        out_pos = 0;
+
+        switch(cmd) {
+            case Command::WRITE_PACKET:
+                packet.clear();
+                packet_expected = 12;
+                phase = Phase::RECEIVE_PACKET;
+                break;
+
+            case Command::IDENTIFY_PACKET_DEVICE:
+                reply_identify();
+                finish(latencies.command, 0);
+                break;
+
+            case Command::EXECUTE_DEVICE_DIAGNOSTIC:
+                error = 0x01; // no error detected
+                regs[IDE::Register::CylinderLow & 0xF] = 0x14;
+                regs[IDE::Register::CylinderHigh & 0xF] = 0xEB;
+                phase = Phase::IDLE;
+                busy_until = now() + latencies.command;
+                break;
+
+            default:
+                // Nothing else is implemented by a real ATAPI device either, but be quiet about it
+                phase = Phase::IDLE;
+                busy_until = now() + latencies.command;
+                break;
+        }
+    }
+
+    void VirtualDrive::finish(uint32_t latency_us, uint8_t opcode) {
+        auto override = command_latency.find(opcode);
+        if(override != command_latency.end()) latency_us = override->second;
+
+        busy_until = now() + latency_us;
+        out_pos = 0;
+        phase = out.empty() ? Phase::IDLE : Phase::DATA_TO_HOST;
+    }
+
+    void VirtualDrive::fail(uint8_t key, uint8_t asc, uint8_t ascq) {
+        sense_key = key;
+        sense_asc = asc;
+        sense_ascq = ascq;
+        err_flag = true;
+        error = ERR_ABRT | (key << 4);
+        out.clear();
+    }
+
+    void VirtualDrive::fail_not_ready() {
+        if(current_disc() == nullptr) fail(SENSE_NOT_READY, ASC_NO_MEDIUM);
+        else fail(SENSE_NOT_READY, ASC_NOT_READY, ASCQ_BECOMING_READY);
+    }
+
+    void VirtualDrive::execute_packet() {
+        const uint8_t opcode = packet[0];
+        uint32_t latency = latencies.command;
+        out.clear();
+
+        ESP_LOGD(LOG_TAG, "Packet opcode 0x%02x", opcode);
+
+        switch(opcode) {
+            case OperationCodes::TEST_UNIT_READY:
+                if(!is_ready()) fail_not_ready();
+                break;
+
+            case OperationCodes::REQUEST_SENSE:
+                reply_request_sense();
+                break;
+
+            case OperationCodes::INQUIRY:
+                {
+                    // CD-ROM device, removable medium, then vendor, product and revision as in IDENTIFY
+                    static const uint8_t header[8] = { 0x05, 0x80, 0x00, 0x21, 31, 0, 0, 0 };
+                    out.insert(out.end(), header, header + sizeof(header));
+                    const char * strings = "ESPER   VIRTUAL CD-ROM  1.0 ";
+                    out.insert(out.end(), strings, strings + 28);
+                }
+                break;
+
+            case OperationCodes::START_STOP_UNIT:
+                {
+                    const Requests::StartStopUnit * req = (const Requests::StartStopUnit *) packet.data();
+                    if(req->load_eject) {
+                        set_door_open(!req->start);
+                    } else if(req->start) {
+                        if(!spinning) {
+                            spinning = true;
+                            spun_up_at = now() + latencies.spin_up;
+                        }
+                    } else {
+                        spinning = false;
+                        audio = AudioState::NONE;
+                    }
+                }
+                break;
+
+            case OperationCodes::PREVENT_ALLOW_MEDIA_REMOVAL:
+            case OperationCodes::SET_CD_SPEED:
+                break;
+
+            case OperationCodes::READ_SUBCHANNEL:
+                reply_subchannel();
+                break;
+
+            case OperationCodes::READ_TOC_PMA_ATIP:
+                if(current_disc() == nullptr) {
+                    fail_not_ready();
+                } else {
+                    const Requests::ReadTOC * req = (const Requests::ReadTOC *) packet.data();
+                    if(req->format == TocFormat::TOC_FMT_CD_TEXT) {
+                        reply_cd_text();
+                        latency = latencies.read_cd_text;
+                    } else {
+                        reply_read_toc();
+                        latency = latencies.read_toc;
+                    }
+                }
+                break;
+
+            case OperationCodes::READ_CD:
+                if(!is_ready()) {
+                    fail_not_ready();
+                } else {
+                    reply_read_cd();
+                    // A CD-DA read stops the audio play, same as on most real drives
+                    audio = AudioState::NONE;
+                }
+                break;
+
+            case OperationCodes::PLAY_AUDIO_MSF:
+                if(!is_ready()) {
+                    fail_not_ready();
+                } else {
+                    const Requests::PlayAudioMSF * req = (const Requests::PlayAudioMSF *) packet.data();
+                    bool transition = (audio == AudioState::PLAYING || audio == AudioState::COMPLETED || audio == AudioState::REPORTED);
+                    if(audio == AudioState::PLAYING) {
+                        int frame = current_frame();
+                        if(frame < play_end) {
+                            // cut off right away, the same as on a real drive
+                            cut_frames += play_end - frame;
+                            audio_stopped_at = now();
+                        } else {
+                            // ran out before anyone looked
+                            audio_stopped_at = play_anchor + (int64_t) (play_end - play_pos) * 1000000 / MSF::FRAMES_IN_SECOND;
+                        }
+                    }
+                    play_pos = MSF_TO_FRAMES(req->start_position);
+                    play_end = std::min(MSF_TO_FRAMES(req->end_position), current_disc()->lead_out_frame);
+                    audio = AudioState::PLAYING;
+                    latency = latencies.seek;
+                    play_anchor = now() + latency;
+                    if(transition && play_anchor - audio_stopped_at < GAP_WINDOW_US) {
+                        play_gaps.add((uint32_t) (play_anchor - audio_stopped_at));
+                    }
+                }
+                break;
+
+            case OperationCodes::SEEK:
+                if(!is_ready()) {
+                    fail_not_ready();
+                } else {
+                    // MMC: a seek ends any audio operation, and the head stays where it went
+                    const Requests::Seek * req = (const Requests::Seek *) packet.data();
+                    play_pos = (int) be32toh(req->lba) + PROGRAM_AREA_START;
+                    audio = AudioState::NONE;
+                    latency = latencies.seek;
+                }
+                break;
+
+            case OperationCodes::SCAN:
+                if(!is_ready()) {
+                    fail_not_ready();
+                } else {
+                    const Requests::Scan * req = (const Requests::Scan *) packet.data();
+                    play_pos = MSF_TO_FRAMES(req->msf);
+                    play_end = current_disc()->lead_out_frame;
+                    scan_reverse = req->direct;
+                    audio = AudioState::SCANNING;
+                    latency = latencies.seek;
+                    play_anchor = now() + latency;
+                }
+                break;
+
+            case OperationCodes::PAUSE_RESUME:
+                {
+                    const Requests::PauseResume * req = (const Requests::PauseResume *) packet.data();
+                    if(req->resume && audio == AudioState::PAUSED) {
+                        audio = AudioState::PLAYING;
+                        play_anchor = now();
+                    } else if(!req->resume && (audio == AudioState::PLAYING || audio == AudioState::SCANNING)) {
+                        play_pos = current_frame();
+                        audio = AudioState::PAUSED;
+                    }
+                }
+                break;
+
+            case OperationCodes::STOP_PLAY_SCAN:
+                if(audio == AudioState::SCANNING) {
+                    // MMC: stopping a scan resumes the play operation that was going on
+                    play_pos = current_frame();
+                    play_anchor = now();
+                    audio = AudioState::PLAYING;
+                } else {
+                    audio = AudioState::NONE;
+                }
+                break;
+
+            case OperationCodes::LOAD_UNLOAD:
+                {
+                    const Requests::LoadUnload * req = (const Requests::LoadUnload *) packet.data();
+                    if(req->slot >= slots.size()) {
+                        fail(SENSE_ILLEGAL_REQUEST, ASC_INVALID_OPCODE);
+                    } else if(req->slot != current_slot) {
+                        audio = AudioState::NONE;
+                        pending_slot = req->slot;
+                        changer_ready_at = now() + latencies.changer_load;
+                    }
+                }
+                break;
+
+            case OperationCodes::MECHANISM_STATUS:
+                reply_mech_status();
+                break;
+
+            case OperationCodes::MODE_SENSE:
+                reply_mode_sense();
+                break;
+
+            case OperationCodes::MODE_SELECT:
+                accept_mode_select();
+                break;
+
+            default:
+                ESP_LOGW(LOG_TAG, "Unsupported packet opcode 0x%02x", opcode);
+                fail(SENSE_ILLEGAL_REQUEST, ASC_INVALID_OPCODE);
+                break;
+        }
+
+        // Like a real drive, never send more than the host asked for
+        size_t allocation_length = out.size();
+        switch(opcode) {
+            case OperationCodes::REQUEST_SENSE:
+            case OperationCodes::INQUIRY:
+                allocation_length = packet[4];
+                break;
+            case OperationCodes::READ_SUBCHANNEL:
+            case OperationCodes::READ_TOC_PMA_ATIP:
+            case OperationCodes::MODE_SENSE:
+                allocation_length = (packet[7] << 8) | packet[8];
+                break;
+            case OperationCodes::MECHANISM_STATUS:
+                allocation_length = (packet[8] << 8) | packet[9];
+                break;
+            default: break;
+        }
+        if(out.size() > allocation_length) out.resize(allocation_length);
+
+        finish(latency, opcode);
+    }
+
+    void VirtualDrive::reply_identify() {
+        Responses::IdentifyPacket id;
+        out.assign(512, 0);
+        memset(&id, 0, sizeof(id));
+        id.general_config = 0x8580; // ATAPI, CD-ROM, removable, 12 byte packets
+
+        auto put_ata_string = [](char * dst, size_t len, const char * src) {
+            memset(dst, ' ', len);
+            memcpy(dst, src, std::min(len, strlen(src)));
+            for(size_t i = 0; i < len; i += 2) std::swap(dst[i], dst[i + 1]);
+        };
+        put_ata_string(id.serial_no, sizeof(id.serial_no), "VIRT0001");
+        put_ata_string(id.firmware_rev, sizeof(id.firmware_rev), "1.0");
+        put_ata_string(id.model, sizeof(id.model), "ESPer Virtual CD-ROM");
+
+        memcpy(out.data(), &id, sizeof(id));
+    }
+
+    void VirtualDrive::reply_read_toc() {
+        const VirtualDisc * disc = current_disc();
+        const Requests::ReadTOC * req = (const Requests::ReadTOC *) packet.data();
+
+        Responses::ReadTOCResponseHeader hdr = {
+            .data_length = htobe16((disc->tracks.size() + 1) * sizeof(Responses::NormalTOCEntry) + 2),
+            .first_track_no = disc->tracks.front().number,
+            .last_track_no = disc->tracks.back().number
+        };
+        out.insert(out.end(), (uint8_t *) &hdr, (uint8_t *) &hdr + sizeof(hdr));
+
+        auto add_entry = [this, req](uint8_t number, int frame, bool preemph) {
+            Responses::NormalTOCEntry entry;
+            memset(&entry, 0, sizeof(entry));
+            entry.adr = SubchannelAdr::SUBCH_ADR_CUR_POS_DATA;
+            entry.pre_emphasis = preemph;
+            entry.track_no = number;
+            if(req->msf) {
+                entry.address = FRAMES_TO_MSF(frame);
+            } else {
+                uint32_t lba = htobe32(frame - PROGRAM_AREA_START);
+                memcpy(entry.lba, &lba, sizeof(lba));
+            }
+            out.insert(out.end(), (uint8_t *) &entry, (uint8_t *) &entry + sizeof(entry));
+        };
+
+        for(auto& t: disc->tracks) add_entry(t.number, t.start_frame(), t.preemphasis);
+        add_entry(TRK_NUM_LEAD_OUT, disc->lead_out_frame, false);
+    }
+
+    void VirtualDrive::reply_cd_text() {
+        const VirtualDisc * disc = current_disc();
+        std::vector<uint8_t> packs = {};
+        uint8_t seq = 0;
+
+        auto add_packs = [&](uint8_t kind, std::vector<std::string> strings) {
+            // Strings for album and every track go back to back, each terminated by a NUL, chopped into 12 byte payloads
+            std::vector<std::pair<uint8_t, uint8_t>> owner = {}; // (track, char position) of each byte
+            std::string stream = "";
+            for(size_t t = 0; t < strings.size(); t++) {
+                for(size_t c = 0; c <= strings[t].size(); c++) owner.push_back({(uint8_t) t, (uint8_t) std::min(c, (size_t) 15)});
+                stream += strings[t];
+                stream += '\0';
+            }
+
+            for(size_t pos = 0; pos < stream.size(); pos += 12) {
+                uint8_t pack[18] = { 0 };
+                pack[0] = kind;
+                pack[1] = owner[pos].first;
+                pack[2] = seq++;
+                pack[3] = owner[pos].second & 0xF;
+                memcpy(&pack[4], &stream[pos], std::min((size_t) 12, stream.size() - pos));
+
+                uint16_t crc = 0;
+                for(int i = 0; i < 16; i++) {
+                    crc ^= (uint16_t) pack[i] << 8;
+                    for(int j = 0; j < 8; j++) crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+                }
+                crc = ~crc;
+                pack[16] = crc >> 8;
+                pack[17] = crc & 0xFF;
+
+                packs.insert(packs.end(), pack, pack + sizeof(pack));
+            }
+        };
+
+        std::vector<std::string> titles = { disc->title };
+        std::vector<std::string> performers = { disc->performer };
+        for(auto& t: disc->tracks) {
+            titles.push_back(t.title);
+            performers.push_back(t.performer);
+        }
+        add_packs(0x80, titles);
+        add_packs(0x81, performers);
+
+        uint16_t len = htobe16(packs.size() + 2);
+        out.insert(out.end(), (uint8_t *) &len, (uint8_t *) &len + sizeof(len));
+        out.push_back(0);
+        out.push_back(0);
+        out.insert(out.end(), packs.begin(), packs.end());
+    }
+
+    void VirtualDrive::reply_subchannel() {
+        const Requests::ReadSubchannel * req = (const Requests::ReadSubchannel *) packet.data();
+        const VirtualDisc * disc = current_disc();
+        Responses::ReadSubchannel res;
+        memset(&res, 0, sizeof(res));
+        res.data_format = req->data_format;
+        res.data_length = htobe16(sizeof(res) - 4);
+
+        switch(audio) {
+            case AudioState::PLAYING:
+            case AudioState::SCANNING:
+                res.audio_status = Responses::ReadSubchannel::SubchannelAudioStatus::AUDIOSTS_PLAYING;
+                break;
+            case AudioState::PAUSED:
+                res.audio_status = Responses::ReadSubchannel::SubchannelAudioStatus::AUDIOSTS_PAUSED;
+                break;
+            case AudioState::COMPLETED:
+                res.audio_status = Responses::ReadSubchannel::SubchannelAudioStatus::AUDIOSTS_COMPLETED;
+                audio = AudioState::REPORTED; // reported only once
+                break;
+            default:
+                res.audio_status = Responses::ReadSubchannel::SubchannelAudioStatus::AUDIOSTS_NONE;
+                break;
+        }
+
+        if(req->data_format == SubchannelFormat::SUBCH_FMT_CD_POS && disc != nullptr && !disc->tracks.empty()) {
+            int frame = std::max(PROGRAM_AREA_START, std::min(current_frame(), disc->lead_out_frame));
+            auto& pos = res.current_position_data;
+            pos.adr = SubchannelAdr::SUBCH_ADR_CUR_POS_DATA;
+            pos.absolute_address = FRAMES_TO_MSF(frame);
+
+            if(frame >= disc->lead_out_frame) {
+                pos.track_no = TRK_NUM_LEAD_OUT;
+                pos.index_no = 1;
+            } else {
+                const VirtualTrack * trk = disc->track_at(frame);
+                pos.track_no = trk->number;
+                pos.pre_emphasis = trk->preemphasis;
+                for(auto& idx: trk->indexes) {
+                    if(idx.second <= frame) pos.index_no = idx.first;
+                }
+                // in the pregap the relative time counts down towards index 1
+                pos.relative_address = FRAMES_TO_MSF(abs(frame - trk->start_frame()));
+            }
+        }
+        else if(req->data_format == SubchannelFormat::SUBCH_FMT_UPC_BARCODE && disc != nullptr && !disc->catalog.empty()) {
+            res.upc_barcode_data.mc_val = true;
+            strncpy(res.upc_barcode_data.upc, disc->catalog.c_str(), sizeof(res.upc_barcode_data.upc) - 1);
+        }
+        else if(req->data_format == SubchannelFormat::SUBCH_FMT_ISRC && disc != nullptr) {
+            for(auto& trk: disc->tracks) {
+                if(trk.number != req->track_no_for_isrc || trk.isrc.empty()) continue;
+                res.isrc_data.adr = SubchannelAdr::SUBCH_ADR_ISRC;
+                res.isrc_data.track_no = trk.number;
+                res.isrc_data.tc_val = true;
+                memcpy(res.isrc_data.isrc, trk.isrc.c_str(), std::min(trk.isrc.size(), sizeof(res.isrc_data.isrc)));
+                break;
+            }
+        }
+
+        out.insert(out.end(), (uint8_t *) &res, (uint8_t *) &res + sizeof(res));
+    }
+
+    void VirtualDrive::reply_read_cd() {
+        const Requests::ReadCD * req = (const Requests::ReadCD *) packet.data();
+        const VirtualDisc * disc = current_disc();
+        const int first = (int) be32toh(req->lba) + PROGRAM_AREA_START;
+        const int count = (req->transfer_length[0] << 16) | (req->transfer_length[1] << 8) | req->transfer_length[2];
+
+        if(first < PROGRAM_AREA_START || first + count > disc->lead_out_frame) {
+            fail(SENSE_ILLEGAL_REQUEST, ASC_LBA_OUT_OF_RANGE);
+            return;
+        }
+
+        const size_t c2_size = (req->error_field == Requests::ReadCD::ErrorField::ERRF_C2) ? 294 : (req->error_field == Requests::ReadCD::ErrorField::ERRF_C2_AND_BLOCK) ? 296 : 0;
+        const size_t q_size = (req->subchannel == Requests::ReadCD::SubchannelSelect::SUBCH_Q) ? 16 : 0;
+        const size_t sector_size = BYTES_PER_FRAME + c2_size + q_size;
+        out.assign(count * sector_size, 0);
+
+        FILE * f = nullptr;
+        const VirtualFile * open_file = nullptr;
+        for(int i = 0; i < count; i++) {
+            const int frame = first + i;
+            uint8_t * sector = &out[i * sector_size];
+
+            for(auto& file: disc->files) {
+                if(frame < file.start_frame || frame >= file.start_frame + file.frame_count) continue;
+                if(file.path.empty()) break; // silence
+                if(&file != open_file) {
+                    if(f != nullptr) fclose(f);
+                    f = fopen(file.path.c_str(), "rb");
+                    open_file = &file;
+                }
+                if(f != nullptr) {
+                    fseek(f, file.data_offset + (long) (frame - file.start_frame) * BYTES_PER_FRAME, SEEK_SET);
+                    fread(sector, 1, BYTES_PER_FRAME, f);
+                }
+                break;
+            }
+
+            // The disc is always perfect, so the C2 bits stay zero
+            if(q_size > 0) {
+                uint8_t * q = &sector[BYTES_PER_FRAME + c2_size];
+                const VirtualTrack * trk = disc->track_at(frame);
+                uint8_t index = 0;
+                for(auto& idx: trk->indexes) {
+                    if(idx.second <= frame) index = idx.first;
+                }
+                const MSF rel = FRAMES_TO_MSF(abs(frame - trk->start_frame()));
+                const MSF abs_pos = FRAMES_TO_MSF(frame);
+                q[0] = SubchannelAdr::SUBCH_ADR_CUR_POS_DATA | (trk->preemphasis ? 0x10 : 0);
+                q[1] = int_to_bcd(trk->number);
+                q[2] = int_to_bcd(index);
+                q[3] = int_to_bcd(rel.M);
+                q[4] = int_to_bcd(rel.S);
+                q[5] = int_to_bcd(rel.F);
+                q[7] = int_to_bcd(abs_pos.M);
+                q[8] = int_to_bcd(abs_pos.S);
+                q[9] = int_to_bcd(abs_pos.F);
+            }
+        }
+        if(f != nullptr) fclose(f);
+    }
+
+    void VirtualDrive::reply_mech_status() {
+        Responses::MechanismStatusHeader hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.current_slot = (pending_slot >= 0) ? pending_slot : current_slot;
+        hdr.changer_state = (pending_slot >= 0) ? Responses::MechanismStatusHeader::ChangerState::Loading : Responses::MechanismStatusHeader::ChangerState::Ready;
+        hdr.door_open = door_open;
+        hdr.mechanism_state = (audio == AudioState::PLAYING) ? Responses::MechanismStatusHeader::MechState::Audio :
+                              (audio == AudioState::SCANNING) ? Responses::MechanismStatusHeader::MechState::Scan :
+                              Responses::MechanismStatusHeader::MechState::Idle;
+
+        if(slots.size() > 1) {
+            hdr.num_slots = slots.size();
+            hdr.slot_tbl_len = htobe16(slots.size() * sizeof(Responses::MechanismStatusSlotTable));
+        }
+        out.insert(out.end(), (uint8_t *) &hdr, (uint8_t *) &hdr + sizeof(hdr));
+
+        if(slots.size() > 1) {
+            for(auto& s: slots) {
+                Responses::MechanismStatusSlotTable tbl;
+                memset(&tbl, 0, sizeof(tbl));
+                tbl.disc_present = (s.disc != nullptr);
+                tbl.disc_changed = s.changed;
+                s.changed = false;
+                out.insert(out.end(), (uint8_t *) &tbl, (uint8_t *) &tbl + sizeof(tbl));
+            }
+        }
+    }
+
+    void VirtualDrive::reply_mode_sense() {
+        const Requests::ModeSense * req = (const Requests::ModeSense *) packet.data();
+        Responses::ModeSense hdr;
+        memset(&hdr, 0, sizeof(hdr));
+
+        if(door_open) hdr.media_type = MediaTypeCode::MTC_DOOR_OPEN;
+        else if(pending_slot >= 0) hdr.media_type = MediaTypeCode::MTC_DOOR_CLOSED_UNKNOWN;
+        else if(slots[current_slot].disc == nullptr) hdr.media_type = MediaTypeCode::MTC_NO_DISC;
+        else if(!is_ready()) hdr.media_type = MediaTypeCode::MTC_DOOR_CLOSED_UNKNOWN;
+        else hdr.media_type = MediaTypeCode::MTC_AUDIO_120MM;
+
+        std::vector<uint8_t> page = {};
+        switch(req->page) {
+            case ModeSensePageCode::MSPC_CDA_CONTROL:
+                {
+                    ModeSenseCDAControlModePage cda;
+                    memset(&cda, 0, sizeof(cda));
+                    cda.page_code = ModeSensePageCode::MSPC_CDA_CONTROL;
+                    cda.page_length = sizeof(cda) - 2;
+                    cda.immed = true;
+                    for(int i = 0; i < 4; i++) {
+                        cda.ports[i].channel = cda_ports[i][0];
+                        cda.ports[i].volume = cda_ports[i][1];
+                    }
+                    page.assign((uint8_t *) &cda, (uint8_t *) &cda + sizeof(cda));
+                }
+                break;
+
+            case ModeSensePageCode::MSPC_POWER_CONDITION:
+                {
+                    Responses::ModeSensePowerConditionModePage pwr;
+                    memset(&pwr, 0, sizeof(pwr));
+                    pwr.page_code = ModeSensePageCode::MSPC_POWER_CONDITION;
+                    pwr.page_length = sizeof(pwr) - 2;
+                    page.assign((uint8_t *) &pwr, (uint8_t *) &pwr + sizeof(pwr));
+                }
+                break;
+
+            case ModeSensePageCode::MSPC_CAPABILITIES_MECH_STS:
+                {
+                    CapabilitiesMechStatusModePage caps;
+                    memset(&caps, 0, sizeof(caps));
+                    caps.page_code = ModeSensePageCode::MSPC_CAPABILITIES_MECH_STS;
+                    caps.page_length = sizeof(caps) - 2;
+                    caps.audio_play = true;
+                    caps.digital1 = true;
+                    caps.cdda_cmds = true;
+                    caps.cdda_accurate = true;
+                    caps.rw_subcode_supp = true;
+                    caps.rw_deint_corr = true;
+                    caps.pw_subcode_leadin = true;
+                    caps.upc = true;
+                    caps.isrc = true;
+                    caps.lock = true;
+                    caps.eject = true;
+                    caps.loading_mech = (slots.size() > 1) ? CapabilitiesMechStatusModePage::EjectMecha::MECHTYPE_CHANGER_INDIVIDUAL : CapabilitiesMechStatusModePage::EjectMecha::MECHTYPE_TRAY;
+                    caps.chgr_disc_presence = (slots.size() > 1);
+                    caps.chgr_sss = (slots.size() > 1);
+                    page.assign((uint8_t *) &caps, (uint8_t *) &caps + sizeof(caps));
+                }
+                break;
+
+            default:
+                // Only the header matters for e.g. the media type check
+                break;
+        }
+
+        hdr.data_length = htobe16(sizeof(hdr) + page.size() - 2);
+        out.insert(out.end(), (uint8_t *) &hdr, (uint8_t *) &hdr + sizeof(hdr));
+        out.insert(out.end(), page.begin(), page.end());
+    }
+
+    void VirtualDrive::accept_mode_select() {
+        const size_t page_ofs = 12 + sizeof(Responses::ModeSense);
+        if(packet.size() >= page_ofs + sizeof(ModeSenseCDAControlModePage) && (packet[page_ofs] & 0x3F) == ModeSensePageCode::MSPC_CDA_CONTROL) {
+            const ModeSenseCDAControlModePage * cda = (const ModeSenseCDAControlModePage *) &packet[page_ofs];
+            for(int i = 0; i < 4; i++) {
+                cda_ports[i][0] = cda->ports[i].channel;
+                cda_ports[i][1] = cda->ports[i].volume;
+            }
+        }
+        // Power conditions are accepted and ignored: the virtual drive never sleeps
+    }
+
+    void VirtualDrive::reply_request_sense() {
+        Responses::RequestSense res;
+        memset(&res, 0, sizeof(res));
+        res.valid = true;
+        res.additional_sense_length = 10;
+
+        if(sense_key != 0) {
+            res.sense_key = (RequestSenseKey) sense_key;
+            res.additional_sense_code = (RequestSenseAsc) sense_asc;
+            res.additional_sense_code_qualifier = sense_ascq;
+            sense_key = 0;
+            sense_asc = 0;
+            sense_ascq = 0;
+        }
+        else if(current_disc() != nullptr && !is_ready()) {
+            res.sense_key = RequestSenseKey::SENSE_NOT_READY;
+            res.additional_sense_code = RequestSenseAsc::ASC_NOT_READY;
+            res.additional_sense_code_qualifier = ASCQ_BECOMING_READY;
+        }
+
+        out.insert(out.end(), (uint8_t *) &res, (uint8_t *) &res + sizeof(res));
+    }
+}
@@ -0,0 +1,77 @@
+#include <esper-cdp/wait_profile.h>
+#include <esp_log.h>
+
+static const char LOG_TAG[] = "WAITPROF";
+
+namespace ATAPI {
+    void WaitHistogram::add(uint32_t us) {
+        int bucket = 0;
+        while(bucket < BUCKET_COUNT - 1 && us >= bucket_upper_bound_us(bucket)) bucket++;
+        buckets[bucket]++;
+        count++;
+        total_us += us;
+        if(us < min_us) min_us = us;
+        if(us > max_us) max_us = us;
+    }
+
+    uint32_t WaitHistogram::percentile_us(int pct) const {
+        if(count == 0) return 0;
+        uint32_t threshold = (uint32_t) (((uint64_t) count * pct + 99) / 100);
+        uint32_t seen = 0;
+        for(int i = 0; i < BUCKET_COUNT - 1; i++) {
+            seen += buckets[i];
+            if(seen >= threshold) return bucket_upper_bound_us(i);
+        }
+        return max_us;
+    }
+
+    WaitProfile::WaitProfile() {
+        semaphore = xSemaphoreCreateMutex();
+    }
+
+    WaitProfile::~WaitProfile() {
+        vSemaphoreDelete(semaphore);
+    }
+
+    void WaitProfile::record(const char * tag, int opcode, uint32_t us) {
+        xSemaphoreTake(semaphore, portMAX_DELAY);
+        histograms[tag].add(us);
+        xSemaphoreGive(semaphore);
+
+        if(opcode >= 0 && opcode < 256) {
+            uint32_t& avg = opcode_ewma[opcode];
+            // weight of 1/8 to the new sample: follows the drive spinning up/down in a few commands, yet doesn't jump around on a single slow one
+            avg = (avg == 0) ? us : (avg - (avg >> 3) + (us >> 3));
+        }
+    }
+
+    uint32_t WaitProfile::expected_us(int opcode) const {
+        if(opcode < 0 || opcode >= 256) return 0;
+        return opcode_ewma[opcode];
+    }
+
+    std::map<std::string, WaitHistogram> WaitProfile::get_histograms() const {
+        xSemaphoreTake(semaphore, portMAX_DELAY);
+        auto rslt = histograms;
+        xSemaphoreGive(semaphore);
+        return rslt;
+    }
+
+    void WaitProfile::reset() {
+        xSemaphoreTake(semaphore, portMAX_DELAY);
+        histograms.clear();
+        xSemaphoreGive(semaphore);
+        for(auto& v: opcode_ewma) v = 0;
+    }
+
+    void WaitProfile::log_summary() const {
+        // not logging under the lock, so that the drive's task isn't held up by the UART
+        for(auto& kv: get_histograms()) {
+            const WaitHistogram& h = kv.second;
+            ESP_LOGI(LOG_TAG, "%s: n=%u avg=%uus p50<%uus p90<%uus max=%uus", kv.first.c_str(), h.count, h.average_us(), h.percentile_us(50), h.percentile_us(90), h.max_us);
+        }
+        for(int i = 0; i < 256; i++) {
+            if(opcode_ewma[i] != 0) ESP_LOGI(LOG_TAG, "Opcode 0x%02x: expected %uus", i, opcode_ewma[i]);
+        }
+    }
+}
@@ -49,22 +49,60 @@ namespace Platform {
         /// @param address_flags Address of the expander with the port B connected to the flags pins of the IDE bus
         /// @param address_databus Address of the expander with ports A and B connected to the 16 data bits of the IDE bus
         IDEBus(Core::ThreadSafeI2C * i2c, uint8_t address_flags = 0x20, uint8_t address_databus = 0x22);
+        virtual ~IDEBus() = default;
 
         DeviceNumber active_device = DeviceNumber::IDE_MASTER; // <- dont seem to be able to address other device but still
 
-        data16 read(uint8_t reg);
-        void write(uint8_t reg, data16 data);
-        void reset();
+        virtual data16 read(uint8_t reg);
+        virtual void write(uint8_t reg, data16 data);
+        virtual void reset();
+
+        /// @brief Read several words in a row from the same register, e.g. a PIO data block
+        /// @param buf Buffer of at least `words * 2` bytes, filled low byte first
+        virtual void read_block(uint8_t reg, void * buf, size_t words);
+        /// @brief Write several words in a row into the same register, e.g. a PIO data block
+        /// @param buf Buffer of at least `words * 2` bytes, low byte first
+        virtual void write_block(uint8_t reg, const void * buf, size_t words);
+
+        /// @brief Number of I2C transactions issued to the expanders since creation
+        virtual uint32_t get_transaction_count() { return transaction_count; }
+
+    protected:
+        /// @brief For bus implementations that don't talk to the real hardware, e.g. trace replay
+        IDEBus(): IDEBus(nullptr) {}
 
     private:
+        /// @brief Last value known to be in a register of the expander, to skip writes that don't change anything
+        struct ShadowRegister {
+            uint8_t value;
+            bool valid;
+        };
+
         Core::ThreadSafeI2C * _bus;
         uint8_t _addr_flags;
         uint8_t _addr_databus;
         uint8_t control_register = 0xF8;
         uint8_t last_sel_device = 0xFF;
+        uint32_t transaction_count = 0;
+
+        ShadowRegister shadow_flags_out = { 0 };
+        ShadowRegister shadow_databus_cfg[2] = { 0 };
+        ShadowRegister shadow_databus_out[2] = { 0 };
         
-        void transact_out(uint8_t addr, uint8_t reg, uint8_t val);
-        uint8_t transact_in(uint8_t addr, uint8_t reg);
+        bool transact_out(uint8_t addr, uint8_t reg, uint8_t val);
+        void transact_out_cached(uint8_t addr, uint8_t reg, uint8_t val, ShadowRegister * shadow);
+        // Register pair accessors making use of the PCA9555 auto-increment (port 0 -> port 1 in one transaction)
+        bool transact_out_pair(uint8_t addr, uint8_t reg, data16 val);
+        data16 transact_in_pair(uint8_t addr, uint8_t reg);
+        /// @brief Read the register pair that the last `transact_in_pair()` on the expander pointed to, without setting the pointer again
+        /// @param ok Set to false if the read failed, and the pointer has to be set anew
+        data16 transact_in_pair_again(uint8_t addr, bool * ok);
+
+        void set_address(uint8_t reg);
+        void set_databus_output(data16 data);
+
+        void set_control_register();
+        void set_databus_direction(bool output);
 
         void ensure_sel_device();
         void write_internal(uint8_t reg, data16 data);
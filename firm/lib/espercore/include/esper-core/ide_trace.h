@@ -0,0 +1,102 @@
+#pragma once
+#include "ide.h"
+#include <vector>
+
+namespace Platform {
+    /// @brief A single access to the IDE bus as stored in a trace
+    struct __attribute__((packed)) IDETraceRecord {
+        enum Kind: uint8_t {
+            TRACE_READ,
+            TRACE_WRITE,
+            TRACE_RESET
+        };
+
+        /// @brief Microseconds since the start of the recording
+        uint32_t timestamp;
+        Kind kind;
+        uint8_t reg;
+        data16 value;
+    };
+
+    namespace IDETrace {
+        struct CommandTiming {
+            /// @brief ATA command written into the Command register
+            uint8_t command;
+            /// @brief First byte of the packet if the command was a PACKET one, 0 otherwise
+            uint8_t opcode;
+            /// @brief Microseconds since the start of the recording
+            uint32_t start;
+            /// @brief Microseconds until the next command was issued or the trace ended
+            uint32_t duration;
+        };
+
+        /// @brief Write a trace into a file in the compact binary format
+        bool save(const char * path, const IDETraceRecord * records, size_t count);
+        /// @brief Read a trace file written by `save()`. Returns an empty trace if the file is not a valid trace.
+        std::vector<IDETraceRecord> load(const char * path);
+        /// @brief Split the trace into individual commands and find out how long each of them took
+        std::vector<CommandTiming> command_timings(const std::vector<IDETraceRecord>& trace);
+    }
+
+    /// @brief IDE bus decorator which logs every register access going through it into a trace buffer
+    class IDEBusRecorder: public IDEBus {
+    public:
+        /// @param inner The bus doing the actual work
+        /// @param max_records Size of the trace buffer. Located in PSRAM if available.
+        IDEBusRecorder(IDEBus * inner, size_t max_records = 32768);
+        ~IDEBusRecorder();
+
+        data16 read(uint8_t reg) override;
+        void write(uint8_t reg, data16 data) override;
+        void reset() override;
+        void read_block(uint8_t reg, void * buf, size_t words) override;
+        void write_block(uint8_t reg, const void * buf, size_t words) override;
+        uint32_t get_transaction_count() override { return _inner->get_transaction_count(); }
+
+        /// @brief Start a new recording, discarding the previous one
+        void start();
+        void stop();
+        bool is_recording() { return recording; }
+        size_t get_record_count() { return count; }
+        bool save(const char * path);
+
+        /// @brief When set, the trace is saved here once the buffer fills up
+        const char * auto_save_path = nullptr;
+
+    private:
+        IDEBus * _inner;
+        IDETraceRecord * records;
+        size_t capacity;
+        size_t count = 0;
+        int64_t start_time = 0;
+        bool recording = false;
+
+        void log(IDETraceRecord::Kind kind, uint8_t reg, data16 value);
+    };
+
+    /// @brief IDE bus which plays back a previously recorded trace instead of talking to a drive
+    class IDEBusReplayer: public IDEBus {
+    public:
+        IDEBusReplayer(const std::vector<IDETraceRecord>& trace);
+
+        data16 read(uint8_t reg) override;
+        void write(uint8_t reg, data16 data) override;
+        void reset() override;
+        void read_block(uint8_t reg, void * buf, size_t words) override;
+        void write_block(uint8_t reg, const void * buf, size_t words) override;
+        uint32_t get_transaction_count() override { return position; }
+
+        /// @brief Whether all of the trace has been consumed
+        bool is_finished() { return position >= trace.size(); }
+        /// @brief How many accesses didn't match the trace, i.e. the code under test behaves differently from when it was recorded
+        size_t get_mismatch_count() { return mismatches; }
+
+    private:
+        std::vector<IDETraceRecord> trace;
+        size_t position = 0;
+        size_t mismatches = 0;
+        data16 last_read[256];
+
+        const IDETraceRecord * seek(IDETraceRecord::Kind kind, uint8_t reg);
+    };
+}
@@ -3,5 +3,6 @@
 #include "keypad.h"
 #include "spdif.h"
 #include "ide.h"
+#include "ide_trace.h"
 #include "audio_router.h"
 #include "remote.h"
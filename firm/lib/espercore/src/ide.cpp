@@ -26,71 +26,118 @@ namespace Platform {
         data16 rslt = { .value = 0xFFFF };
 
         // set data bus to input
-        transact_out(_addr_databus, PCA_CFG_REGI_A, 0xFF);
-        transact_out(_addr_databus, PCA_CFG_REGI_B, 0xFF);
+        set_databus_direction(false);
 
-        reg &= ~CTL_MASK;
-        control_register &= CTL_MASK;
-        control_register |= reg;
+        set_address(reg);
         control_register &= ~CTL_DIOR; // DIOR low
-        transact_out(_addr_flags, PCA_DATA_OUT_REGI_B, control_register);
+        set_control_register();
 
-        rslt.low = transact_in(_addr_databus, PCA_DATA_IN_REGI_A);
-        rslt.high = transact_in(_addr_databus, PCA_DATA_IN_REGI_B);
+        rslt = transact_in_pair(_addr_databus, PCA_DATA_IN_REGI_A);
         
         control_register |= CTL_DIOR; // DIOR high
-        transact_out(_addr_flags, PCA_DATA_OUT_REGI_B, control_register);
+        set_control_register();
 
         ESP_LOGD(LOG_TAG, "read reg = 0x%02x, rslt low = 0x%02x, hi = 0x%02x", reg, rslt.low, rslt.high);
 
         return rslt;
     }
 
+    void IDEBus::read_block(uint8_t reg, void * buf, size_t words) {
+        ensure_sel_device();
+        uint8_t * out = (uint8_t *) buf;
+
+        set_databus_direction(false);
+        set_address(reg);
+
+        // After reading both ports the PCA9555 points back at the first one, so within the block the command byte only needs to go out once
+        bool pointer_set = false;
+        for(size_t i = 0; i < words; i++) {
+            control_register &= ~CTL_DIOR;
+            set_control_register();
+
+            data16 val;
+            if(pointer_set) {
+                val = transact_in_pair_again(_addr_databus, &pointer_set);
+            } else {
+                val = transact_in_pair(_addr_databus, PCA_DATA_IN_REGI_A);
+                pointer_set = true;
+            }
+            *out++ = val.low;
+            *out++ = val.high;
+
+            control_register |= CTL_DIOR;
+            set_control_register();
+        }
+
+        ESP_LOGD(LOG_TAG, "read block reg = 0x%02x, %i words", reg, words);
+    }
+
     void IDEBus::write(uint8_t reg, data16 data) { 
         ensure_sel_device();
         write_internal(reg, data);
     }
 
+    void IDEBus::write_block(uint8_t reg, const void * buf, size_t words) {
+        ensure_sel_device();
+        const uint8_t * in = (const uint8_t *) buf;
+
+        set_address(reg);
+        control_register |= CTL_DIOW;
+        set_control_register();
+        set_databus_direction(true);
+
+        for(size_t i = 0; i < words; i++) {
+            set_databus_output({{ .low = in[0], .high = in[1] }});
+            in += 2;
+
+            control_register &= ~CTL_DIOW;
+            set_control_register();
+            control_register |= CTL_DIOW;
+            set_control_register();
+        }
+
+        ESP_LOGD(LOG_TAG, "write block reg = 0x%02x, %i words", reg, words);
+    }
+
     void IDEBus::write_internal(uint8_t reg, data16 data) { 
-        reg = reg & ~CTL_MASK; // don't allow changing DIOW/DIOR/RST from outside
-        control_register &= CTL_MASK; // clear CS3FX, CS1FX, A2-A0
-        control_register |= reg; // set CS3FX, CS1FX, A2-A0 from input argument
+        set_address(reg);
 
         // Set DIOW high
         control_register |= CTL_DIOW;
-        transact_out(_addr_flags, PCA_DATA_OUT_REGI_B, control_register);
+        set_control_register();
 
         ESP_LOGD(LOG_TAG, "write reg = 0x%02x, low = 0x%02x, hi = 0x%02x", reg, data.low, data.high);
 
         // enable data bus output
-        transact_out(_addr_databus, PCA_CFG_REGI_A, 0x00);
-        transact_out(_addr_databus, PCA_CFG_REGI_B, 0x00);
+        set_databus_direction(true);
 
         // set data bus
-        transact_out(_addr_databus, PCA_DATA_OUT_REGI_A, data.low);
-        transact_out(_addr_databus, PCA_DATA_OUT_REGI_B, data.high);
+        set_databus_output(data);
 
         // DIOW low then high
         control_register &= ~CTL_DIOW;
-        transact_out(_addr_flags, PCA_DATA_OUT_REGI_B, control_register);
+        set_control_register();
         control_register |= CTL_DIOW;
-        transact_out(_addr_flags, PCA_DATA_OUT_REGI_B, control_register);
+        set_control_register();
 
-        // return data bus to high-z
-        transact_out(_addr_databus, PCA_CFG_REGI_A, 0xFF);
-        transact_out(_addr_databus, PCA_CFG_REGI_B, 0xFF);
+        // The data bus is left driven here: the drive only ever drives it while DIOR is asserted,
+        // and `read()` turns it back to high-Z before doing that. This saves 4 transactions on every back-to-back write.
     }
 
     void IDEBus::reset() {
         ESP_LOGI(LOG_TAG, "Reset");
 
         transact_out(_addr_flags, PCA_CFG_REGI_B, 0x00); // all outputs
-        transact_out(_addr_flags, PCA_DATA_OUT_REGI_B, ~CTL_RST);
+        control_register = ~CTL_RST;
+        set_control_register();
         
         delay(40);
 
         control_register = 0xFF;
-        transact_out(_addr_flags, PCA_DATA_OUT_REGI_B, control_register);
+        set_control_register();
+
+        // Don't drive the data bus while the drive comes up
+        set_databus_direction(false);
 
         delay(20);
 
@@ -115,10 +162,42 @@ namespace Platform {
         last_sel_device = active_device;
     }
 
-    void IDEBus::transact_out(uint8_t addr, uint8_t reg, uint8_t val) {
+    void IDEBus::set_control_register() {
+        transact_out_cached(_addr_flags, PCA_DATA_OUT_REGI_B, control_register, &shadow_flags_out);
+    }
+
+    void IDEBus::set_address(uint8_t reg) {
+        reg &= ~CTL_MASK; // don't allow changing DIOW/DIOR/RST from outside
+        control_register &= CTL_MASK; // clear CS3FX, CS1FX, A2-A0
+        control_register |= reg; // set CS3FX, CS1FX, A2-A0 from input argument
+    }
+
+    void IDEBus::set_databus_output(data16 data) {
+        if(shadow_databus_out[0].valid && shadow_databus_out[1].valid && shadow_databus_out[0].value == data.low && shadow_databus_out[1].value == data.high) return;
+
+        bool ok = transact_out_pair(_addr_databus, PCA_DATA_OUT_REGI_A, data);
+        shadow_databus_out[0] = { .value = data.low, .valid = ok };
+        shadow_databus_out[1] = { .value = data.high, .valid = ok };
+    }
+
+    void IDEBus::set_databus_direction(bool output) {
+        const uint8_t cfg = output ? 0x00 : 0xFF;
+        transact_out_cached(_addr_databus, PCA_CFG_REGI_A, cfg, &shadow_databus_cfg[0]);
+        transact_out_cached(_addr_databus, PCA_CFG_REGI_B, cfg, &shadow_databus_cfg[1]);
+    }
+
+    void IDEBus::transact_out_cached(uint8_t addr, uint8_t reg, uint8_t val, ShadowRegister * shadow) {
+        if(shadow->valid && shadow->value == val) return;
+
+        // If the write failed we don't really know what's in the register now, so force a rewrite next time
+        shadow->valid = transact_out(addr, reg, val);
+        shadow->value = val;
+    }
+
+    bool IDEBus::transact_out(uint8_t addr, uint8_t reg, uint8_t val) {
         if(!_bus->lock()) {
             ESP_LOGE(LOG_TAG, "Could not acquire bus");
-            return;
+            return false;
         }
 
         auto wire = _bus->get();
@@ -127,36 +206,86 @@ namespace Platform {
         wire->write(reg);
         wire->write(val);
         int err = wire->endTransmission();
+        transaction_count++;
         if(err) {
             ESP_LOGE(LOG_TAG, "Fail writing to 0x%02x::0x%02x, error = %i", addr, reg, err);
         }
 
         _bus->release();
+        return (err == 0);
     }
 
-    uint8_t IDEBus::transact_in(uint8_t addr, uint8_t reg) {
+    bool IDEBus::transact_out_pair(uint8_t addr, uint8_t reg, data16 val) {
         if(!_bus->lock()) {
             ESP_LOGE(LOG_TAG, "Could not acquire bus");
-            return 0xFF;
+            return false;
         }
 
         auto wire = _bus->get();
-        uint8_t rslt = 0xFF;
 
         wire->beginTransmission(addr);
         wire->write(reg);
+        wire->write(val.low);
+        wire->write(val.high); // <- lands in the other register of the pair
         int err = wire->endTransmission();
+        transaction_count++;
+        if(err) {
+            ESP_LOGE(LOG_TAG, "Fail writing pair to 0x%02x::0x%02x, error = %i", addr, reg, err);
+        }
+
+        _bus->release();
+        return (err == 0);
+    }
+
+    data16 IDEBus::transact_in_pair(uint8_t addr, uint8_t reg) {
+        data16 rslt = { .value = 0xFFFF };
+        if(!_bus->lock()) {
+            ESP_LOGE(LOG_TAG, "Could not acquire bus");
+            return rslt;
+        }
+
+        auto wire = _bus->get();
+
+        wire->beginTransmission(addr);
+        wire->write(reg);
+        int err = wire->endTransmission();
+        transaction_count++;
         if(err) {
             ESP_LOGE(LOG_TAG, "Fail writing to 0x%02x::0x%02x, error = %i", addr, reg, err);
         } else {
-            if(wire->requestFrom(addr, (uint8_t)1) != 1) {
-                ESP_LOGE(LOG_TAG, "Fail reading from 0x%02x::0x%02x", addr, reg);
+            transaction_count++;
+            if(wire->requestFrom(addr, (uint8_t)2) != 2) {
+                ESP_LOGE(LOG_TAG, "Fail reading pair from 0x%02x::0x%02x", addr, reg);
             } else {
-                rslt = wire->read();
+                rslt.low = wire->read();
+                rslt.high = wire->read();
             }
         }
 
         _bus->release();
         return rslt;
     }
+
+    data16 IDEBus::transact_in_pair_again(uint8_t addr, bool * ok) {
+        data16 rslt = { .value = 0xFFFF };
+        *ok = false;
+        if(!_bus->lock()) {
+            ESP_LOGE(LOG_TAG, "Could not acquire bus");
+            return rslt;
+        }
+
+        auto wire = _bus->get();
+
+        transaction_count++;
+        if(wire->requestFrom(addr, (uint8_t)2) != 2) {
+            ESP_LOGE(LOG_TAG, "Fail reading pair from 0x%02x", addr);
+        } else {
+            rslt.low = wire->read();
+            rslt.high = wire->read();
+            *ok = true;
+        }
+
+        _bus->release();
+        return rslt;
+    }
 }
\ No newline at end of file
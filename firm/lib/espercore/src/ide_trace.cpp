@@ -0,0 +1,250 @@
+#include <esper-core/ide_trace.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <stdio.h>
+
+static const char LOG_TAG[] = "IDETRC";
+
+static const char TRACE_MAGIC[4] = { 'I', 'D', 'E', 'T' };
+static const uint8_t TRACE_VERSION = 1;
+// How far ahead to look for a matching access when the replayed code diverges from the trace
+static const size_t REPLAY_RESYNC_WINDOW = 64;
+
+namespace Platform {
+    namespace IDETrace {
+        struct __attribute__((packed)) FileHeader {
+            char magic[4];
+            uint8_t version;
+            uint8_t record_size;
+            uint16_t reserved;
+            uint32_t count;
+        };
+
+        bool save(const char * path, const IDETraceRecord * records, size_t count) {
+            FILE * f = fopen(path, "wb");
+            if(f == nullptr) {
+                ESP_LOGE(LOG_TAG, "Could not open %s for writing", path);
+                return false;
+            }
+
+            FileHeader hdr = {
+                .magic = { TRACE_MAGIC[0], TRACE_MAGIC[1], TRACE_MAGIC[2], TRACE_MAGIC[3] },
+                .version = TRACE_VERSION,
+                .record_size = sizeof(IDETraceRecord),
+                .reserved = 0,
+                .count = (uint32_t) count
+            };
+
+            bool ok = (fwrite(&hdr, sizeof(hdr), 1, f) == 1) && (count == 0 || fwrite(records, sizeof(IDETraceRecord), count, f) == count);
+            fclose(f);
+
+            if(!ok) ESP_LOGE(LOG_TAG, "Write error on %s", path);
+            else ESP_LOGI(LOG_TAG, "Saved %i records to %s", count, path);
+            return ok;
+        }
+
+        std::vector<IDETraceRecord> load(const char * path) {
+            std::vector<IDETraceRecord> rslt = {};
+            FILE * f = fopen(path, "rb");
+            if(f == nullptr) {
+                ESP_LOGE(LOG_TAG, "Could not open %s", path);
+                return rslt;
+            }
+
+            FileHeader hdr;
+            if(fread(&hdr, sizeof(hdr), 1, f) != 1 || memcmp(hdr.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0) {
+                ESP_LOGE(LOG_TAG, "%s is not a trace", path);
+            }
+            else if(hdr.version != TRACE_VERSION || hdr.record_size != sizeof(IDETraceRecord)) {
+                ESP_LOGE(LOG_TAG, "%s is of unsupported version %i (record size %i)", path, hdr.version, hdr.record_size);
+            }
+            else {
+                rslt.resize(hdr.count);
+                size_t got = fread(rslt.data(), sizeof(IDETraceRecord), hdr.count, f);
+                if(got != hdr.count) {
+                    ESP_LOGW(LOG_TAG, "%s is truncated: %i of %i records", path, got, hdr.count);
+                    rslt.resize(got);
+                }
+            }
+
+            fclose(f);
+            return rslt;
+        }
+
+        std::vector<CommandTiming> command_timings(const std::vector<IDETraceRecord>& trace) {
+            std::vector<CommandTiming> rslt = {};
+            bool want_opcode = false;
+
+            for(auto& rec: trace) {
+                if(rec.kind != IDETraceRecord::Kind::TRACE_WRITE) continue;
+
+                if(rec.reg == IDE::Register::Command) {
+                    if(!rslt.empty()) rslt.back().duration = rec.timestamp - rslt.back().start;
+                    rslt.push_back(CommandTiming {
+                        .command = rec.value.low,
+                        .opcode = 0,
+                        .start = rec.timestamp,
+                        .duration = 0
+                    });
+                    want_opcode = (rec.value.low == 0xA0); // PACKET
+                }
+                else if(rec.reg == IDE::Register::Data && want_opcode) {
+                    rslt.back().opcode = rec.value.low;
+                    want_opcode = false;
+                }
+            }
+
+            if(!rslt.empty() && !trace.empty()) rslt.back().duration = trace.back().timestamp - rslt.back().start;
+
+            return rslt;
+        }
+    }
+
+    IDEBusRecorder::IDEBusRecorder(IDEBus * inner, size_t max_records):
+        _inner(inner),
+        capacity(max_records)
+    {
+        records = (IDETraceRecord *) heap_caps_malloc(sizeof(IDETraceRecord) * capacity, MALLOC_CAP_SPIRAM);
+        if(records == nullptr) {
+            ESP_LOGW(LOG_TAG, "No PSRAM for trace buffer, trying internal RAM");
+            records = (IDETraceRecord *) malloc(sizeof(IDETraceRecord) * capacity);
+        }
+        if(records == nullptr) {
+            ESP_LOGE(LOG_TAG, "Could not allocate trace buffer of %i records", capacity);
+            capacity = 0;
+        }
+    }
+
+    IDEBusRecorder::~IDEBusRecorder() {
+        if(records != nullptr) free(records);
+    }
+
+    void IDEBusRecorder::start() {
+        count = 0;
+        start_time = esp_timer_get_time();
+        recording = (capacity > 0);
+        ESP_LOGI(LOG_TAG, "Recording started");
+    }
+
+    void IDEBusRecorder::stop() {
+        recording = false;
+        ESP_LOGI(LOG_TAG, "Recording stopped with %i records", count);
+    }
+
+    bool IDEBusRecorder::save(const char * path) {
+        return IDETrace::save(path, records, count);
+    }
+
+    void IDEBusRecorder::log(IDETraceRecord::Kind kind, uint8_t reg, data16 value) {
+        if(!recording) return;
+
+        records[count++] = IDETraceRecord {
+            .timestamp = (uint32_t) (esp_timer_get_time() - start_time),
+            .kind = kind,
+            .reg = reg,
+            .value = value
+        };
+
+        if(count == capacity) {
+            ESP_LOGW(LOG_TAG, "Trace buffer full");
+            stop();
+            if(auto_save_path != nullptr) save(auto_save_path);
+        }
+    }
+
+    data16 IDEBusRecorder::read(uint8_t reg) {
+        _inner->active_device = active_device;
+        data16 rslt = _inner->read(reg);
+        log(IDETraceRecord::Kind::TRACE_READ, reg, rslt);
+        return rslt;
+    }
+
+    void IDEBusRecorder::write(uint8_t reg, data16 data) {
+        _inner->active_device = active_device;
+        log(IDETraceRecord::Kind::TRACE_WRITE, reg, data);
+        _inner->write(reg, data);
+    }
+
+    void IDEBusRecorder::reset() {
+        log(IDETraceRecord::Kind::TRACE_RESET, 0, {{ .low = 0, .high = 0 }});
+        _inner->reset();
+    }
+
+    void IDEBusRecorder::read_block(uint8_t reg, void * buf, size_t words) {
+        _inner->active_device = active_device;
+        _inner->read_block(reg, buf, words);
+        const uint8_t * data = (const uint8_t *) buf;
+        for(size_t i = 0; i < words; i++) {
+            log(IDETraceRecord::Kind::TRACE_READ, reg, {{ .low = data[i * 2], .high = data[i * 2 + 1] }});
+        }
+    }
+
+    void IDEBusRecorder::write_block(uint8_t reg, const void * buf, size_t words) {
+        _inner->active_device = active_device;
+        const uint8_t * data = (const uint8_t *) buf;
+        for(size_t i = 0; i < words; i++) {
+            log(IDETraceRecord::Kind::TRACE_WRITE, reg, {{ .low = data[i * 2], .high = data[i * 2 + 1] }});
+        }
+        _inner->write_block(reg, buf, words);
+    }
+
+    IDEBusReplayer::IDEBusReplayer(const std::vector<IDETraceRecord>& records):
+        IDEBus(),
+        trace(records)
+    {
+        for(auto& v: last_read) v.value = 0xFFFF;
+    }
+
+    const IDETraceRecord * IDEBusReplayer::seek(IDETraceRecord::Kind kind, uint8_t reg) {
+        size_t limit = std::min(trace.size(), position + REPLAY_RESYNC_WINDOW);
+        for(size_t i = position; i < limit; i++) {
+            if(trace[i].kind == kind && trace[i].reg == reg) {
+                if(i != position) {
+                    ESP_LOGW(LOG_TAG, "Replay diverged at record %i, skipped %i records", position, i - position);
+                    mismatches++;
+                }
+                position = i + 1;
+                return &trace[i];
+            }
+        }
+
+        ESP_LOGW(LOG_TAG, "Replay diverged at record %i, no %s of reg 0x%02x nearby", position, kind == IDETraceRecord::Kind::TRACE_READ ? "read" : "write", reg);
+        mismatches++;
+        return nullptr;
+    }
+
+    data16 IDEBusReplayer::read(uint8_t reg) {
+        const IDETraceRecord * rec = seek(IDETraceRecord::Kind::TRACE_READ, reg);
+        // When out of sync, keep answering with whatever the register held last time, which is what a real register would do
+        if(rec != nullptr) last_read[reg] = rec->value;
+        return last_read[reg];
+    }
+
+    void IDEBusReplayer::write(uint8_t reg, data16 data) {
+        const IDETraceRecord * rec = seek(IDETraceRecord::Kind::TRACE_WRITE, reg);
+        if(rec != nullptr && rec->value.value != data.value) {
+            ESP_LOGW(LOG_TAG, "Replay write mismatch on reg 0x%02x: expected 0x%04x, got 0x%04x", reg, rec->value.value, data.value);
+            mismatches++;
+        }
+    }
+
+    void IDEBusReplayer::reset() {
+        seek(IDETraceRecord::Kind::TRACE_RESET, 0);
+    }
+
+    void IDEBusReplayer::read_block(uint8_t reg, void * buf, size_t words) {
+        uint8_t * out = (uint8_t *) buf;
+        for(size_t i = 0; i < words; i++) {
+            data16 val = read(reg);
+            *out++ = val.low;
+            *out++ = val.high;
+        }
+    }
+
+    void IDEBusReplayer::write_block(uint8_t reg, const void * buf, size_t words) {
+        const uint8_t * in = (const uint8_t *) buf;
+        for(size_t i = 0; i < words; i++) {
+            write(reg, {{ .low = in[i * 2], .high = in[i * 2 + 1] }});
+        }
+    }
+}
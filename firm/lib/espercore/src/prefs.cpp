@@ -76,6 +76,10 @@ namespace Prefs {
             }
         }
 
+        template <> void set(Key<std::vector<uint8_t>> key, const std::vector<uint8_t>& val) {
+            get_store()->putBytes(key.first.c_str(), val.data(), val.size());
+        }
+
         template <typename DataType> void erase(Key<DataType> key) {
             get_store()->remove(key.first);
         }
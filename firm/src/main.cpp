@@ -10,6 +10,9 @@
 #include <consts.h>
 #include <mount.h>
 #include <otafvu.h>
+#ifdef ESPER_VIRTUAL_CDROM_CUE
+#include <esper-cdp/virtual_drive.h>
+#endif
 
 static char LOG_TAG[] = "APL_MAIN";
 
@@ -92,7 +95,20 @@ void setup(void) {
   i2c = new Core::ThreadSafeI2C(&Wire);
   keypad = new Platform::Keypad(i2c);
   remote = new Platform::Remote(keymap);
+#if defined(ESPER_VIRTUAL_CDROM_CUE)
+  mount_fs_if_needed();
+  auto virtual_drive = new ATAPI::VirtualDrive();
+  auto virtual_disc = ATAPI::VirtualDisc::from_cue(ESPER_VIRTUAL_CDROM_CUE);
+  if(virtual_disc) virtual_drive->insert_disc(0, virtual_disc);
+  ide = virtual_drive;
+#elif defined(ESPER_IDE_TRACE_PATH)
+  auto ide_recorder = new Platform::IDEBusRecorder(new Platform::IDEBus(i2c));
+  ide_recorder->auto_save_path = ESPER_IDE_TRACE_PATH;
+  ide_recorder->start();
+  ide = ide_recorder;
+#else
   ide = new Platform::IDEBus(i2c);
+#endif
   cdrom = new ATAPI::Device(ide);
   spdif = new Platform::WM8805(i2c);
   router = new Platform::AudioRouter(
@@ -44,6 +44,20 @@ static const EGImage shuffle_icon = {
     .data = shuffle_icon_data
 };
 
+static const uint8_t program_icon_data[] = {
+    0b00111100,
+    0b00100010,
+    0b00111100,
+    0b00100000,
+    0b00100000,
+};
+
+static const EGImage program_icon = {
+    .format = EG_FMT_HORIZONTAL,
+    .size = {8, 5},
+    .data = program_icon_data
+};
+
 class CDMode::CDPView: public UI::View {
 public:
     std::shared_ptr<UI::Label> lblSmallTop;
@@ -122,7 +136,8 @@ private:
 
 CDMode::CDMode(const PlatformSharedResources res, ModeHost * host): 
         meta { CD::CachingMetadataAggregateProvider(META_CACHE_PREFIX) },
-        player { Player(res.cdrom, &meta) },
+        programs { CD::ProgramStore(PROGRAM_PREFIX) },
+        player { Player(res.cdrom, &meta, RESUME_LOG_PATH) },
         stopEject { Button(resources.keypad, (1 << 0)) },
         playPause { Button(resources.keypad, (1 << 1)) },
         rewind { Button(resources.keypad, (1 << 2)) },
@@ -165,9 +180,11 @@ CDMode::CDMode(const PlatformSharedResources res, ModeHost * host):
     lyrics_enabled = Prefs::get(PREFS_KEY_CD_LYRICS_ENABLED);
 
     rootView = new CDPView();
+    player_events = player.get_events().subscribe();
 }
 
 CDMode::~CDMode() {
+    player.get_events().unsubscribe(player_events);
     delete rootView;
     if(scrobbler != nullptr) {
         delete scrobbler;
@@ -179,7 +196,7 @@ void CDMode::setup() {
 }
 
 void CDMode::update_title(const std::shared_ptr<CD::Album> disc, const CD::Track& metadata, const Player::TrackNo trk) {
-    rootView->imgShuffleIcon->hidden = (player.get_play_mode() != Player::PlayMode::PLAYMODE_SHUFFLE || player.get_status() == Player::State::STOP);
+    rootView->imgShuffleIcon->hidden = (player.get_play_mode() == Player::PlayMode::PLAYMODE_CONTINUE || player.get_status() == Player::State::STOP);
     if(disc->tracks.size() == 0 || metadata.title == "") {
         rootView->lblTrackIndicator->hidden = true;
     } else {
@@ -209,9 +226,7 @@ void CDMode::update_title(const std::shared_ptr<CD::Album> disc, const CD::Track
     }
 }
 
-void CDMode::loop() {
-    static uint8_t kp_sts = 0;
-
+void CDMode::update_view() {
     auto const& trk = player.get_current_track_number();
     auto const sts = player.get_status();
     auto const& msf_now = player.get_current_track_time();
@@ -232,6 +247,20 @@ void CDMode::loop() {
         rootView->lblDiscIndicator->hidden = true;
     }
 
+    if(disc != program_disc && !disc->toc.empty()) {
+        load_program(disc);
+    }
+    if(editing_program && sts != Player::State::STOP) {
+        // the disc went away or started playing from under the editor
+        editing_program = false;
+        entered_digits = 0;
+    }
+    bool want_program_icon = (player.get_play_mode() == Player::PlayMode::PLAYMODE_PROGRAM || editing_program);
+    if(want_program_icon != program_icon_shown) {
+        rootView->imgShuffleIcon->set_image(want_program_icon ? &program_icon : &shuffle_icon);
+        program_icon_shown = want_program_icon;
+    }
+
     rootView->lblTrackInputField->hidden = (entered_digits == 0 || ((xTaskGetTickCount() - last_digit_time) > digit_timeout));
     if(!rootView->lblTrackInputField->hidden) {
         rootView->lblTrackInputField->set_value(std::to_string(entered_digits) + "-");
@@ -252,12 +281,24 @@ void CDMode::loop() {
 
         case Player::State::STOP:
             rootView->set_lyric_show(false, 0);
-            if(must_show_title_stopped && tracklist.size() >= trk.track && trk.track > 0) {
+            if(editing_program) {
+                rootView->lblTrackIndicator->hidden = true;
+                rootView->imgShuffleIcon->hidden = false;
+                rootView->lblSmallTop->set_value(localized_string("Program") + " (" + std::to_string(edited_program.size()) + ")");
+                rootView->lblSmallTop->hidden = false;
+                std::string list = "";
+                for(uint8_t t: edited_program) {
+                    if(!list.empty()) list += " ";
+                    list += std::to_string(t);
+                }
+                rootView->lblBigMiddle->set_value(list.empty() ? "--" : list);
+            }
+            else if(must_show_title_stopped && tracklist.size() >= trk.track && trk.track > 0) {
                 auto metadata = tracklist[trk.track - 1];
                 update_title(disc, metadata, trk);
             } else {
                 rootView->lblTrackIndicator->hidden = true;
-                rootView->imgShuffleIcon->hidden = (player.get_play_mode() != Player::PlayMode::PLAYMODE_SHUFFLE);
+                rootView->imgShuffleIcon->hidden = (player.get_play_mode() == Player::PlayMode::PLAYMODE_CONTINUE);
                 if(disc->title != "") {
                     rootView->lblBigMiddle->set_value(disc->title);
                 } else {
@@ -292,31 +333,58 @@ void CDMode::loop() {
         commit_entered_digits();
     }
 
+    // now you know why we have constraints autolayout all that shite in the "real world", duh
+    rootView->lblBigMiddle->frame = (rootView->lblSmallTop->hidden && !rootView->timeBar->hidden && (!rootView->lblTrackIndicator->hidden || !rootView->imgShuffleIcon->hidden)) ? EGRect {EGPointZero, {160, 24}} : EGRect {{0, 8}, {160, 16}};
+}
+
+void CDMode::feed_lyrics() {
+    auto const sts = player.get_status();
     if(sts != Player::State::PLAY) {
         rootView->set_lyric_show(false, 0);
         lrc.reset();
-    } else if(tracklist.size() >= trk.track && trk.track > 0 && trk.index > 0) {
-        auto metadata = tracklist[trk.track - 1];
-        lrc.feed_track(trk, metadata);
-        const auto line = lrc.feed_position(msf_now);
-        if(lyrics_enabled) {
-            if (!line.line.empty() && line.length > 0) {
-                rootView->lblLyric->set_value(line.line);
-                rootView->set_lyric_show(true, line.length + 5000);
-            }
-            else if (line.must_clear) {
-                rootView->set_lyric_show(false, 0);
-            }
-        }
+        return;
+    }
 
-        if(scrobbler != nullptr) {
-            scrobbler->feed_track(trk, metadata);
-            scrobbler->feed_position(msf_now);
+    auto const& trk = player.get_current_track_number();
+    auto const disc = player.get_active_slot().disc;
+    auto const& tracklist = disc->tracks;
+    if(tracklist.size() < trk.track || trk.track == 0 || trk.index == 0) return;
+
+    // Extrapolated by the player between the position reads, so the lines come on time whatever the redraw rate is
+    auto const msf_now = player.get_current_track_time();
+    auto const& metadata = tracklist[trk.track - 1];
+    lrc.feed_track(trk, metadata);
+    const auto line = lrc.feed_position(msf_now);
+    if(lyrics_enabled) {
+        if (!line.line.empty() && line.length > 0) {
+            rootView->lblLyric->set_value(line.line);
+            rootView->set_lyric_show(true, line.length + 5000);
+        }
+        else if (line.must_clear) {
+            rootView->set_lyric_show(false, 0);
         }
     }
 
-    // now you know why we have constraints autolayout all that shite in the "real world", duh
-    rootView->lblBigMiddle->frame = (rootView->lblSmallTop->hidden && !rootView->timeBar->hidden && (!rootView->lblTrackIndicator->hidden || !rootView->imgShuffleIcon->hidden)) ? EGRect {EGPointZero, {160, 24}} : EGRect {{0, 8}, {160, 16}};
+    if(scrobbler != nullptr) {
+        scrobbler->feed_track(trk, metadata);
+        scrobbler->feed_position(msf_now);
+    }
+}
+
+void CDMode::loop() {
+    static uint8_t kp_sts = 0;
+
+    auto const sts = player.get_status();
+    const TickType_t now = xTaskGetTickCount();
+    const bool moving = (sts == Player::State::PLAY || sts == Player::State::SEEK_FF || sts == Player::State::SEEK_REW);
+    // Only redraw when the player said something changed, or as the time goes by while playing
+    if(pending_changes != 0 || view_stale || entered_digits != 0 || (moving && now - last_view_update >= view_tick_interval)) {
+        pending_changes = 0;
+        view_stale = false;
+        last_view_update = now;
+        update_view();
+    }
+    feed_lyrics();
 
     if(stopEject.is_clicked()) {
         player.do_command((sts == Player::State::PLAY || sts == Player::State::PAUSE || sts == Player::State::SEEK_FF || sts == Player::State::SEEK_REW) ? Player::Command::STOP : Player::Command::OPEN_CLOSE);
@@ -351,21 +419,21 @@ void CDMode::loop() {
         player.do_command(Player::Command::NEXT_DISC);
     }
     else if(playMode.is_clicked()) {
-        if(player.get_play_mode() == Player::PlayMode::PLAYMODE_SHUFFLE) {
-            player.set_play_mode(Player::PlayMode::PLAYMODE_CONTINUE);
-        } else {
-            player.set_play_mode(Player::PlayMode::PLAYMODE_SHUFFLE);
-        }
+        toggle_play_mode();
     }
 
     // any key cancels lyrics
     uint8_t kp_new_sts = resources.keypad->get_value();
     if(kp_new_sts != kp_sts) {
         rootView->set_lyric_show(false, 0);
+        // a key going down is a good hint the drive is about to be needed, and the click only comes once it's released
+        if(kp_new_sts != 0) player.wake_drive();
         kp_sts = kp_new_sts;
+        view_stale = true;
     }
 
-    delay(10);
+    // sleeps as long as the delay before did, but wakes up right away when there's news
+    pending_changes |= player.get_events().wait(player_events, pdMS_TO_TICKS(10));
 }
 
 void CDMode::prev_trk_button() {
@@ -383,6 +451,8 @@ void CDMode::next_trk_button() {
 void CDMode::on_remote_key_pressed(VirtualKey key) {
     // any key cancels lyrics
     rootView->set_lyric_show(false, 0);
+    view_stale = true;
+    player.wake_drive();
 
     const std::unordered_map<VirtualKey, Player::Command> key_to_cmd = {
         {RVK_DISK_NEXT, Player::Command::NEXT_DISC},
@@ -396,9 +466,29 @@ void CDMode::on_remote_key_pressed(VirtualKey key) {
     };
     
     auto const cmd = key_to_cmd.find(key);
-    if((key == RVK_CURS_ENTER || key == RVK_PLAY) && entered_digits != 0) {
+    if((key == RVK_CURS_ENTER || key == RVK_PLAY) && entered_digits != 0 && !editing_program) {
         commit_entered_digits();
     }
+    else if(key == RVK_PROGRAM) {
+        if(editing_program) {
+            finish_program();
+        } else if(player.get_status() == Player::State::STOP) {
+            editing_program = true;
+            edited_program = player.get_program();
+        }
+    }
+    else if(editing_program && (key == RVK_PLAY || key == RVK_CURS_ENTER)) {
+        finish_program();
+        if(key == RVK_PLAY) player.do_command(Player::Command::PLAY);
+    }
+    else if(editing_program && key == RVK_DEL) {
+        if(!edited_program.empty()) edited_program.pop_back();
+    }
+    else if(editing_program && key == RVK_STOP) {
+        // leave without changing anything
+        editing_program = false;
+        entered_digits = 0;
+    }
     else if(cmd != key_to_cmd.cend()) {
         player.do_command(cmd->second);
     }
@@ -447,12 +537,50 @@ void CDMode::on_remote_key_pressed(VirtualKey key) {
 }
 
 void CDMode::commit_entered_digits() {
-    if(player.get_status() == Player::State::STOP) must_show_title_stopped = true;
-    player.navigate_to_track(entered_digits);
+    if(editing_program) {
+        if(entered_digits > 0 && entered_digits <= player.get_active_slot().disc->tracks.size() && edited_program.size() < UINT8_MAX) {
+            edited_program.push_back(entered_digits);
+        }
+    } else {
+        if(player.get_status() == Player::State::STOP) must_show_title_stopped = true;
+        player.navigate_to_track(entered_digits);
+    }
     last_digit_time = 0;
     entered_digits = 0;
 }
 
+void CDMode::load_program(const std::shared_ptr<CD::Album> disc) {
+    program_disc = disc;
+    editing_program = false;
+    player.set_program(programs.load(*disc));
+    if(player.get_program().empty() && player.get_play_mode() == Player::PlayMode::PLAYMODE_PROGRAM) {
+        player.set_play_mode(Player::PlayMode::PLAYMODE_CONTINUE);
+    }
+}
+
+void CDMode::finish_program() {
+    if(entered_digits != 0) commit_entered_digits();
+    editing_program = false;
+    programs.save(*player.get_active_slot().disc, edited_program);
+    player.set_program(edited_program);
+    player.set_play_mode(edited_program.empty() ? Player::PlayMode::PLAYMODE_CONTINUE : Player::PlayMode::PLAYMODE_PROGRAM);
+}
+
+void CDMode::toggle_play_mode() {
+    // continue -> shuffle -> program (if the disc has one) -> continue
+    switch(player.get_play_mode()) {
+        case Player::PlayMode::PLAYMODE_CONTINUE:
+            player.set_play_mode(Player::PlayMode::PLAYMODE_SHUFFLE);
+            break;
+        case Player::PlayMode::PLAYMODE_SHUFFLE:
+            player.set_play_mode(player.get_program().empty() ? Player::PlayMode::PLAYMODE_CONTINUE : Player::PlayMode::PLAYMODE_PROGRAM);
+            break;
+        default:
+            player.set_play_mode(Player::PlayMode::PLAYMODE_CONTINUE);
+            break;
+    }
+}
+
 void CDMode::teardown() {
     player.do_command(Player::Command::STOP);
 
@@ -0,0 +1,26 @@
+#pragma once
+#include "AudioTools.h"
+#include <esper-cdp/extractor.h>
+
+/// Source side of the CPU audio route for discs played by extraction: copy it into the output nub of the AudioRouter, e.g. with a StreamCopy.
+class CDDAStream: public AudioStream {
+public:
+    CDDAStream(ATAPI::CDDAExtractor * extractor): _extractor(extractor) {
+        setAudioInfo(AudioInfo(44100, 2, 16));
+    }
+
+    size_t readBytes(uint8_t *data, size_t len) override {
+        return _extractor->read(data, len);
+    }
+
+    int available() override {
+        return _extractor->available();
+    }
+
+    size_t write(const uint8_t *data, size_t len) override {
+        return 0;
+    }
+
+private:
+    ATAPI::CDDAExtractor * _extractor;
+};
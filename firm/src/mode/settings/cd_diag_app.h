@@ -61,6 +61,7 @@ public:
             std::make_shared<BoolDisplayItem>("ATAPI", diags->is_atapi),
             std::make_shared<DetailTextMenuNode>("Self Test Code", selftest_hex),
             std::make_shared<DetailTextMenuNode>("Media Code", std::to_string((int) _host->resources.cdrom->check_media())),
+            std::make_shared<DetailTextMenuNode>("I2C Transactions", std::to_string(_host->resources.ide->get_transaction_count())),
             std::make_shared<DetailTextMenuNode>("", "Capabilities"),
             std::make_shared<DetailTextMenuNode>("Type", tray_type),
             std::make_shared<BoolDisplayItem>("CD-R", diags->capas.cdr_read),
@@ -95,6 +96,22 @@ public:
             }
         }
 
+        if(diags->command_count > 0) {
+            subnodes.push_back(std::make_shared<DetailTextMenuNode>("", "Commands"));
+            for(int i = 0; i < diags->command_count; i++) {
+                const ATAPI::Device::CommandStats& cmd = diags->commands[i];
+                char title[24] = { 0 };
+                char detail[24] = { 0 };
+                snprintf(title, sizeof(title), "%02X x%u", cmd.opcode, cmd.latency.count);
+                snprintf(detail, sizeof(detail), "%.1f/%.1fms", cmd.latency.average_us() / 1000.0, cmd.latency.percentile_us(99) / 1000.0);
+                subnodes.push_back(std::make_shared<DetailTextMenuNode>(title, detail));
+                if(cmd.errors > 0 || cmd.retries > 0 || cmd.underruns > 0 || cmd.flushes > 0) {
+                    snprintf(detail, sizeof(detail), "E%u R%u U%u F%u", cmd.errors, cmd.retries, cmd.underruns, cmd.flushes);
+                    subnodes.push_back(std::make_shared<DetailTextMenuNode>("", detail));
+                }
+            }
+        }
+
         static const ATAPI::Device::Quirks empty_quirks = {0};
         if(memcmp(&quirks, &empty_quirks, sizeof(ATAPI::Device::Quirks)) != 0) {
             subnodes.push_back(std::make_shared<DetailTextMenuNode>("", "Quirks"));
@@ -122,6 +139,7 @@ public:
         ESP_LOGI(LOG_TAG, "[Basic] ATAPI: %s", diags->is_atapi ? "Yes" : "No");
         ESP_LOGI(LOG_TAG, "[Basic] Self Test Code: %s", selftest_hex);
         ESP_LOGI(LOG_TAG, "[Basic] Media Code: %d", (int)_host->resources.cdrom->check_media());
+        ESP_LOGI(LOG_TAG, "[Basic] I2C Transactions: %u", _host->resources.ide->get_transaction_count());
 
         // CAPABILITIES
         ESP_LOGI(LOG_TAG, "[Caps] Type: %s", tray_type.c_str());
@@ -166,6 +184,10 @@ public:
             if(quirks.alternate_max_speed) ESP_LOGI(LOG_TAG, "[Quirks] Speed Limit: %d", quirks.alternate_max_speed);
         }
 
+        // COMMANDS
+        _host->resources.cdrom->log_command_stats();
+        _host->resources.cdrom->get_wait_profile().log_summary();
+
         ESP_LOGI(LOG_TAG, "======================");
 
         ListMenuNode::on_presented();
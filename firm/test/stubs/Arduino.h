@@ -0,0 +1,25 @@
+#pragma once
+#include <stdint.h>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <esp32-hal-log.h>
+#include "host_clock.h"
+
+// Just enough of the Arduino core for the library sources under test to build on the host, on the virtual clock
+
+inline void delay(uint32_t ms) { vTaskDelay(ms); }
+/// @note Spins on the real thing, so doesn't let the other tasks run either
+inline void delayMicroseconds(uint32_t us) { HostClock::advance(us); }
+inline unsigned long millis() { return (unsigned long) (HostClock::now_us / 1000); }
+inline unsigned long micros() { return (unsigned long) HostClock::now_us; }
+/// @brief The same numbers on every run
+inline uint32_t esp_random() {
+    static uint32_t state = 0x12345678;
+    state = state * 1664525 + 1013904223;
+    return state;
+}
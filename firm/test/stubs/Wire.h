@@ -0,0 +1,19 @@
+#pragma once
+#include <Arduino.h>
+
+// The I2C bus as seen by the library sources. Nothing answers on this one, the tests put fakes in its place.
+
+class TwoWire {
+public:
+    virtual ~TwoWire() = default;
+
+    virtual void beginTransmission(uint8_t address) {}
+    virtual size_t write(uint8_t data) { return 1; }
+    /// @returns 0 on success, 2 when the address was not acknowledged
+    virtual uint8_t endTransmission(bool sendStop = true) { return 2; }
+    virtual uint8_t requestFrom(uint8_t address, uint8_t quantity) { return 0; }
+    virtual int available() { return 0; }
+    virtual int read() { return -1; }
+};
+
+inline TwoWire Wire;
@@ -0,0 +1,5 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Only included, the CD-TEXT provider works out its CRCs itself
@@ -0,0 +1,15 @@
+#pragma once
+#include <stdlib.h>
+#include <stdint.h>
+
+// There is only the one kind of memory on the host
+
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_DEFAULT (1 << 12)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+inline void * heap_caps_malloc(size_t size, uint32_t caps) { return malloc(size); }
+inline void * heap_caps_calloc(size_t n, size_t size, uint32_t caps) { return calloc(n, size); }
+inline void heap_caps_free(void * ptr) { free(ptr); }
+inline void * heap_caps_malloc_prefer(size_t size, size_t num, ...) { return malloc(size); }
@@ -0,0 +1,8 @@
+#pragma once
+#include "esp_err.h"
+
+typedef void (*shutdown_handler_t)(void);
+
+// Nothing ever shuts down on the host, so the handlers never get called
+inline esp_err_t esp_register_shutdown_handler(shutdown_handler_t) { return ESP_OK; }
+inline esp_err_t esp_unregister_shutdown_handler(shutdown_handler_t) { return ESP_OK; }
@@ -0,0 +1,101 @@
+#pragma once
+#include "host_clock.h"
+#include "host_scheduler.h"
+#include <algorithm>
+#include "esp_err.h"
+
+// High resolution timers on the virtual clock. The callbacks run from a task of their own, like with ESP_TIMER_TASK.
+
+typedef void (*esp_timer_cb_t)(void * arg);
+typedef enum { ESP_TIMER_TASK } esp_timer_dispatch_t;
+
+typedef struct {
+    esp_timer_cb_t callback;
+    void * arg;
+    esp_timer_dispatch_t dispatch_method;
+    const char * name;
+    bool skip_unhandled_events;
+} esp_timer_create_args_t;
+
+struct esp_timer {
+    esp_timer_create_args_t args;
+    /// @brief When it goes off next, -1 if stopped
+    int64_t due;
+    uint64_t period;
+};
+
+typedef esp_timer * esp_timer_handle_t;
+
+// Reading the clock takes about a microsecond on the chip as well, and code that spins on it has to get somewhere
+inline int64_t esp_timer_get_time() {
+    const int64_t rslt = HostClock::now_us;
+    HostClock::advance(1);
+    return rslt;
+}
+
+namespace HostTimers {
+    inline std::vector<esp_timer_handle_t> timers;
+    inline HostScheduler::Task * task = nullptr;
+    /// @brief Make this many of the next `esp_timer_create()` calls fail, as if out of memory
+    inline int fail_next_create = 0;
+
+    inline int64_t nearest() {
+        int64_t rslt = -1;
+        for(auto t: timers) if(t->due >= 0 && (rslt < 0 || t->due < rslt)) rslt = t->due;
+        return rslt;
+    }
+
+    inline void run() {
+        while(true) {
+            HostScheduler::wait_for_deadline(nullptr, nearest);
+            // Another timer may be started from a callback, so look again each time
+            esp_timer_handle_t due = nullptr;
+            do {
+                due = nullptr;
+                for(auto t: timers) if(t->due >= 0 && t->due <= HostClock::now_us && (due == nullptr || t->due < due->due)) due = t;
+                if(due != nullptr) {
+                    due->due = (due->period > 0) ? (due->due + (int64_t) due->period) : -1;
+                    due->args.callback(due->args.arg);
+                }
+            } while(due != nullptr);
+        }
+    }
+}
+
+inline esp_err_t esp_timer_create(const esp_timer_create_args_t * args, esp_timer_handle_t * out) {
+    if(HostTimers::fail_next_create > 0) {
+        HostTimers::fail_next_create--;
+        return ESP_ERR_NO_MEM;
+    }
+    if(HostTimers::task == nullptr) HostTimers::task = HostScheduler::create("esp_timer", HostTimers::run);
+    *out = new esp_timer { .args = *args, .due = -1, .period = 0 };
+    HostTimers::timers.push_back(*out);
+    return ESP_OK;
+}
+
+inline esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+    if(timer->due >= 0) return ESP_ERR_INVALID_STATE;
+    timer->due = HostClock::now_us + (int64_t) timeout_us;
+    timer->period = 0;
+    return ESP_OK;
+}
+
+inline esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us) {
+    if(timer->due >= 0) return ESP_ERR_INVALID_STATE;
+    timer->due = HostClock::now_us + (int64_t) period_us;
+    timer->period = period_us;
+    return ESP_OK;
+}
+
+inline esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    if(timer->due < 0) return ESP_ERR_INVALID_STATE;
+    timer->due = -1;
+    return ESP_OK;
+}
+
+inline esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+    auto& all = HostTimers::timers;
+    all.erase(std::remove(all.begin(), all.end(), timer), all.end());
+    delete timer;
+    return ESP_OK;
+}
@@ -0,0 +1,170 @@
+#pragma once
+#include <Wire.h>
+#include <vector>
+#include <esper-core/ide.h>
+#include <esper-core/consts.h>
+#include "host_clock.h"
+
+// The two PCA9555 expanders of the IDE bus, with a drive hanging off their pins.
+// Counts every I2C transaction and bills the virtual clock for the time it would take on the wire.
+
+/// @brief What sits on the other side of the IDE connector
+class FakeIDEDrive {
+public:
+    virtual ~FakeIDEDrive() = default;
+    /// @param reg One of `IDE::Register`
+    virtual data16 read(uint8_t reg) = 0;
+    virtual void write(uint8_t reg, data16 data) = 0;
+    virtual void reset() {}
+};
+
+/// @brief A drive that just keeps whatever was written into its registers
+class FakeRegisterFile: public FakeIDEDrive {
+public:
+    data16 regs[32] = {};
+
+    data16 read(uint8_t reg) override { return regs[reg & 0x1F]; }
+    void write(uint8_t reg, data16 data) override { regs[reg & 0x1F] = data; }
+};
+
+class FakePCA9555Pair: public TwoWire {
+public:
+    /// @brief I2C transactions seen so far, counted the same way as `IDEBus::get_transaction_count()`
+    uint32_t transactions = 0;
+    /// @brief Times the host drove the data bus while the drive was driving it as well
+    uint32_t conflicts = 0;
+    /// @brief Times the drive latched a write with the data bus not driven by the host
+    uint32_t floating_writes = 0;
+    /// @brief Make this many of the next transactions fail as if not acknowledged
+    int fail_next = 0;
+    uint32_t bus_hz = 400000;
+
+    FakePCA9555Pair(FakeIDEDrive * drive, uint8_t address_flags = 0x20, uint8_t address_databus = 0x22):
+        drive(drive), addr_flags(address_flags), addr_databus(address_databus) {
+        reset_chip(flags);
+        reset_chip(databus);
+    }
+
+    void beginTransmission(uint8_t address) override {
+        tx_addr = address;
+        tx.clear();
+    }
+
+    size_t write(uint8_t data) override {
+        tx.push_back(data);
+        return 1;
+    }
+
+    uint8_t endTransmission(bool sendStop = true) override {
+        transactions++;
+        bill(tx.size());
+        if(fail(tx_addr)) return 2;
+
+        uint8_t * chip = regs_of(tx_addr);
+        uint8_t& pointer = pointer_of(tx_addr);
+        if(!tx.empty()) pointer = tx[0] & 7;
+        for(size_t i = 1; i < tx.size(); i++) {
+            chip[pointer] = tx[i];
+            if(chip == flags && pointer == PCA_DATA_OUT_REGI_B) control_changed();
+            pointer ^= 1; // auto-increment within the register pair
+        }
+        if(chip == databus && !(control & CTL_DIOR) && host_drives_databus()) conflicts++;
+        return 0;
+    }
+
+    uint8_t requestFrom(uint8_t address, uint8_t quantity) override {
+        transactions++;
+        bill(quantity);
+        rx.clear();
+        if(fail(address)) return 0;
+
+        uint8_t& pointer = pointer_of(address);
+        for(uint8_t i = 0; i < quantity; i++) {
+            rx.push_back(read_register(address, pointer));
+            pointer ^= 1;
+        }
+        rx_pos = 0;
+        return quantity;
+    }
+
+    int available() override { return rx.size() - rx_pos; }
+    int read() override { return rx_pos < rx.size() ? rx[rx_pos++] : -1; }
+
+private:
+    static const uint8_t CTL_ADDRESS = 0x1F;
+    static const uint8_t CTL_RST = (1 << 5);
+    static const uint8_t CTL_DIOW = (1 << 6);
+    static const uint8_t CTL_DIOR = (1 << 7);
+
+    FakeIDEDrive * drive;
+    uint8_t addr_flags;
+    uint8_t addr_databus;
+    uint8_t flags[8];
+    uint8_t databus[8];
+    uint8_t control = 0xFF;
+    uint8_t pointers[2] = { 0 };
+    uint8_t tx_addr = 0;
+    std::vector<uint8_t> tx;
+    std::vector<uint8_t> rx;
+    size_t rx_pos = 0;
+    /// @brief What the drive puts on the data bus while DIOR is low
+    data16 driven = {{ .low = 0xFF, .high = 0xFF }};
+
+    static void reset_chip(uint8_t * regs) {
+        // PCA9555 power-on state: all pins inputs, outputs latched high
+        memset(regs, 0, 8);
+        regs[PCA_DATA_OUT_REGI_A] = regs[PCA_DATA_OUT_REGI_B] = 0xFF;
+        regs[PCA_CFG_REGI_A] = regs[PCA_CFG_REGI_B] = 0xFF;
+    }
+
+    void bill(size_t bytes) {
+        // START, address byte and the data bytes with their ACKs, STOP
+        const int64_t bits = 2 + 9 * (1 + (int64_t) bytes);
+        HostClock::advance((bits * 1000000 + bus_hz - 1) / bus_hz);
+    }
+
+    bool fail(uint8_t address) {
+        if(address != addr_flags && address != addr_databus) return true;
+        if(fail_next > 0) {
+            fail_next--;
+            return true;
+        }
+        return false;
+    }
+
+    uint8_t * regs_of(uint8_t address) { return address == addr_flags ? flags : databus; }
+    uint8_t& pointer_of(uint8_t address) { return pointers[address == addr_flags ? 0 : 1]; }
+
+    bool host_drives_databus() { return databus[PCA_CFG_REGI_A] != 0xFF || databus[PCA_CFG_REGI_B] != 0xFF; }
+
+    uint8_t read_register(uint8_t address, uint8_t reg) {
+        if(address == addr_databus && reg == PCA_DATA_IN_REGI_A) return databus_pins().low;
+        if(address == addr_databus && reg == PCA_DATA_IN_REGI_B) return databus_pins().high;
+        return regs_of(address)[reg];
+    }
+
+    data16 databus_pins() {
+        if(!(control & CTL_DIOR)) return driven;
+        if(host_drives_databus()) return {{ .low = databus[PCA_DATA_OUT_REGI_A], .high = databus[PCA_DATA_OUT_REGI_B] }};
+        return {{ .low = 0xFF, .high = 0xFF }}; // pulled up
+    }
+
+    void control_changed() {
+        const uint8_t prev = control;
+        control = flags[PCA_DATA_OUT_REGI_B];
+        const uint8_t reg = (control & CTL_ADDRESS) | 0xE0;
+
+        if((prev & CTL_RST) && !(control & CTL_RST)) drive->reset();
+
+        if((prev & CTL_DIOR) && !(control & CTL_DIOR)) {
+            driven = drive->read(reg);
+        }
+        if(!(control & CTL_DIOR) && host_drives_databus()) conflicts++;
+
+        // The drive latches the data on the rising edge of DIOW
+        if(!(prev & CTL_DIOW) && (control & CTL_DIOW)) {
+            if(!host_drives_databus()) floating_writes++;
+            drive->write(reg, {{ .low = databus[PCA_DATA_OUT_REGI_A], .high = databus[PCA_DATA_OUT_REGI_B] }});
+        }
+    }
+};
@@ -0,0 +1,21 @@
+#pragma once
+#include <stdint.h>
+#include "../host_clock.h"
+
+// Just enough of FreeRTOS for the library sources under test to build on the host.
+// There is only ever the one thread, so a tick is a millisecond of the virtual clock.
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define portMAX_DELAY ((TickType_t) 0xFFFFFFFF)
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t) (ms))
+#define pdTICKS_TO_MS(ticks) ((uint32_t) (ticks))
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+
+inline TickType_t xTaskGetTickCount() { return (TickType_t) (HostClock::now_us / 1000); }
@@ -0,0 +1,33 @@
+#pragma once
+#include "FreeRTOS.h"
+#include "../host_scheduler.h"
+
+typedef uint32_t EventBits_t;
+
+struct HostEventGroup {
+    EventBits_t bits;
+};
+
+typedef HostEventGroup * EventGroupHandle_t;
+
+inline EventGroupHandle_t xEventGroupCreate() { return new HostEventGroup { .bits = 0 }; }
+inline void vEventGroupDelete(EventGroupHandle_t group) { delete group; }
+
+inline EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) { return group->bits |= bits; }
+inline EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+    EventBits_t rslt = group->bits;
+    group->bits &= ~bits;
+    return rslt;
+}
+inline EventBits_t xEventGroupGetBits(EventGroupHandle_t group) { return group->bits; }
+
+inline EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear, BaseType_t all, TickType_t wait) {
+    auto satisfied = [group, bits, all]() { return all ? ((group->bits & bits) == bits) : ((group->bits & bits) != 0); };
+    if(!satisfied() && wait > 0) {
+        const int64_t deadline = (wait == portMAX_DELAY) ? -1 : (HostClock::now_us + (int64_t) wait * 1000);
+        HostScheduler::wait(satisfied, deadline);
+    }
+    EventBits_t rslt = group->bits;
+    if(clear && satisfied()) group->bits &= ~bits;
+    return rslt;
+}
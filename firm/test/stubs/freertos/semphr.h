@@ -0,0 +1,33 @@
+#pragma once
+#include "FreeRTOS.h"
+#include "../host_scheduler.h"
+
+// Counting semaphores that block on the host scheduler. Mutexes are the same thing here, nobody needs priority inheritance in a test.
+
+struct HostSemaphore {
+    int count;
+    int max;
+};
+
+typedef HostSemaphore * SemaphoreHandle_t;
+
+inline SemaphoreHandle_t xSemaphoreCreateBinary() { return new HostSemaphore { .count = 0, .max = 1 }; }
+inline SemaphoreHandle_t xSemaphoreCreateMutex() { return new HostSemaphore { .count = 1, .max = 1 }; }
+inline SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial) { return new HostSemaphore { .count = (int) initial, .max = (int) max }; }
+inline void vSemaphoreDelete(SemaphoreHandle_t sem) { delete sem; }
+
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t wait) {
+    if(sem->count == 0) {
+        if(wait == 0) return pdFALSE;
+        const int64_t deadline = (wait == portMAX_DELAY) ? -1 : (HostClock::now_us + (int64_t) wait * 1000);
+        if(!HostScheduler::wait([sem]() { return sem->count > 0; }, deadline)) return pdFALSE;
+    }
+    sem->count--;
+    return pdTRUE;
+}
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+    if(sem->count >= sem->max) return pdFALSE;
+    sem->count++;
+    return pdTRUE;
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include "FreeRTOS.h"
+#include "../host_scheduler.h"
+
+// Tasks run one at a time on the host scheduler, switching only where they block
+
+typedef HostScheduler::Task * TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+inline BaseType_t xTaskCreate(TaskFunction_t code, const char * name, uint32_t stack, void * param, UBaseType_t priority, TaskHandle_t * handle) {
+    TaskHandle_t task = HostScheduler::create(name, [code, param]() { code(param); });
+    if(handle != nullptr) *handle = task;
+    return pdPASS;
+}
+
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char * name, uint32_t stack, void * param, UBaseType_t priority, TaskHandle_t * handle, BaseType_t core) {
+    return xTaskCreate(code, name, stack, param, priority, handle);
+}
+
+inline void vTaskDelete(TaskHandle_t task) {
+    if(task == nullptr || task == HostScheduler::current()) throw HostScheduler::TaskExit();
+    HostScheduler::remove(task);
+}
+
+inline void vTaskDelay(TickType_t ticks) {
+    if(ticks == 0) HostScheduler::yield();
+    else HostScheduler::sleep_until(HostClock::now_us + (int64_t) ticks * 1000);
+}
+
+inline BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    task->notifications++;
+    return pdPASS;
+}
+
+inline uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t wait) {
+    TaskHandle_t me = HostScheduler::current();
+    if(me->notifications == 0 && wait > 0) {
+        const int64_t deadline = (wait == portMAX_DELAY) ? -1 : (HostClock::now_us + (int64_t) wait * 1000);
+        HostScheduler::wait([me]() { return me->notifications > 0; }, deadline);
+    }
+    uint32_t rslt = me->notifications;
+    if(clear) me->notifications = 0;
+    else if(rslt > 0) me->notifications--;
+    return rslt;
+}
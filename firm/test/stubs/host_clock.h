@@ -0,0 +1,11 @@
+#pragma once
+#include <stdint.h>
+
+// Virtual time for the host tests. Nothing moves it forward but the code under test sleeping
+// and the fakes taking as long as the real thing would, so the timings come out the same on every run.
+
+namespace HostClock {
+    inline int64_t now_us = 0;
+
+    inline void advance(int64_t us) { if(us > 0) now_us += us; }
+}
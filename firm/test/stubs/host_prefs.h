@@ -0,0 +1,21 @@
+#pragma once
+#include <esper-core/prefs.h>
+#include <any>
+#include <map>
+
+// The NVS settings, kept in memory and starting out empty on every run
+
+namespace Prefs {
+    inline std::map<std::string, std::any> host_store;
+
+    template <typename DataType> DataType get(Key<DataType> key) {
+        auto it = host_store.find(key.first);
+        if(it == host_store.end()) return key.second;
+        const DataType * val = std::any_cast<DataType>(&it->second);
+        return (val != nullptr) ? *val : key.second;
+    }
+
+    template <typename DataType> void set(Key<DataType> key, const DataType& val) { host_store[key.first] = val; }
+    template <typename DataType> void erase(Key<DataType> key) { host_store.erase(key.first); }
+    inline void reset_all() { host_store.clear(); }
+}
@@ -0,0 +1,185 @@
+#pragma once
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "host_clock.h"
+
+// FreeRTOS tasks on the host. Every task is a thread of its own, but only one of them runs at a time,
+// and it only lets the others go when it blocks. Once all of them are blocked the virtual clock jumps
+// to the nearest timeout, so waiting takes no real time and every run goes the same way.
+// The test itself runs as the task "main".
+
+namespace HostScheduler {
+    /// @brief Thrown to end the task from within, as `vTaskDelete(NULL)` doesn't return
+    struct TaskExit {};
+
+    struct Task {
+        std::string name;
+        std::condition_variable cv;
+        bool blocked = false;
+        bool finished = false;
+        /// @brief Lets a blocked task go on once it returns true
+        std::function<bool()> ready = nullptr;
+        /// @brief Lets a blocked task go on once the virtual clock is there, -1 for never
+        std::function<int64_t()> deadline = nullptr;
+        uint32_t notifications = 0;
+    };
+
+    struct State {
+        std::mutex mutex;
+        std::vector<Task *> tasks;
+        Task * running = nullptr;
+        size_t next = 0;
+    };
+
+    /// @brief Never destroyed, as the task threads still wait on it when the test exits
+    inline State& state() {
+        static State * s = new State();
+        return *s;
+    }
+
+    inline thread_local Task * self = nullptr;
+
+    /// @note With the lock held
+    inline Task * current_locked() {
+        State& s = state();
+        if(self == nullptr) {
+            // Only the test's own thread gets here without being a task yet, and then it is the one running
+            self = new Task();
+            self->name = "main";
+            s.tasks.push_back(self);
+            s.running = self;
+        }
+        return self;
+    }
+
+    inline bool can_run_locked(Task * t) {
+        if(t->finished) return false;
+        if(!t->blocked) return true;
+        if(t->ready && t->ready()) return true;
+        if(t->deadline) {
+            int64_t at = t->deadline();
+            if(at >= 0 && HostClock::now_us >= at) return true;
+        }
+        return false;
+    }
+
+    /// @note With the lock held
+    inline Task * pick_locked() {
+        State& s = state();
+        while(true) {
+            const size_t count = s.tasks.size();
+            // Round robin, so that a task polling in a loop doesn't keep the others out
+            for(size_t i = 0; i < count; i++) {
+                size_t idx = (s.next + i) % count;
+                if(can_run_locked(s.tasks[idx])) {
+                    s.next = idx + 1;
+                    return s.tasks[idx];
+                }
+            }
+
+            int64_t nearest = -1;
+            for(Task * t: s.tasks) {
+                if(t->finished || !t->deadline) continue;
+                int64_t at = t->deadline();
+                if(at >= 0 && (nearest < 0 || at < nearest)) nearest = at;
+            }
+            if(nearest < 0) {
+                fprintf(stderr, "HostScheduler: every task waits for something that will never happen:\n");
+                for(Task * t: s.tasks) if(!t->finished) fprintf(stderr, "  %s\n", t->name.c_str());
+                abort();
+            }
+            HostClock::now_us = std::max(HostClock::now_us, nearest);
+        }
+    }
+
+    /// @brief Hand over to whoever can run next, and come back once it's this task's turn again
+    /// @note With the lock held
+    inline void switch_locked(std::unique_lock<std::mutex>& lock, Task * me) {
+        State& s = state();
+        Task * next = pick_locked();
+        s.running = next;
+        if(next == me) return;
+
+        next->cv.notify_one();
+        if(me->finished) return;
+        me->cv.wait(lock, [&s, me]() { return s.running == me; });
+    }
+
+    /// @brief Block the calling task until `ready` returns true, or until the virtual clock reaches the deadline
+    /// @param deadline Absolute time in microseconds, -1 to wait without a timeout
+    /// @returns Whether `ready` was true in the end
+    inline bool wait(std::function<bool()> ready, int64_t deadline) {
+        std::unique_lock<std::mutex> lock(state().mutex);
+        Task * me = current_locked();
+        me->blocked = true;
+        me->ready = ready;
+        me->deadline = [deadline]() { return deadline; };
+        switch_locked(lock, me);
+        bool rslt = ready && ready();
+        me->blocked = false;
+        me->ready = nullptr;
+        me->deadline = nullptr;
+        return rslt;
+    }
+
+    /// @brief Same as above, but with a deadline that may move while waiting, e.g. when a timer gets started
+    inline void wait_for_deadline(std::function<bool()> ready, std::function<int64_t()> deadline) {
+        std::unique_lock<std::mutex> lock(state().mutex);
+        Task * me = current_locked();
+        me->blocked = true;
+        me->ready = ready;
+        me->deadline = deadline;
+        switch_locked(lock, me);
+        me->blocked = false;
+        me->ready = nullptr;
+        me->deadline = nullptr;
+    }
+
+    inline void sleep_until(int64_t at) { wait(nullptr, at); }
+
+    /// @brief Let the other tasks that can run have their turn
+    inline void yield() { wait([]() { return true; }, -1); }
+
+    inline Task * create(const char * name, std::function<void()> entry) {
+        std::unique_lock<std::mutex> lock(state().mutex);
+        current_locked();
+        Task * task = new Task();
+        task->name = name;
+        state().tasks.push_back(task);
+
+        std::thread([task, entry]() {
+            {
+                std::unique_lock<std::mutex> lock(state().mutex);
+                self = task;
+                task->cv.wait(lock, [task]() { return state().running == task; });
+            }
+            try {
+                entry();
+            } catch(TaskExit&) {}
+
+            std::unique_lock<std::mutex> lock(state().mutex);
+            task->finished = true;
+            switch_locked(lock, task);
+        }).detach();
+
+        return task;
+    }
+
+    /// @brief The calling task, registering the test's thread as "main" if it's the first time around
+    inline Task * current() {
+        std::unique_lock<std::mutex> lock(state().mutex);
+        return current_locked();
+    }
+
+    /// @brief Stop another task for good. Its thread stays parked forever.
+    inline void remove(Task * task) {
+        std::unique_lock<std::mutex> lock(state().mutex);
+        task->finished = true;
+    }
+}
@@ -0,0 +1,172 @@
+#include <unity.h>
+#include <host_prefs.h>
+// Every source has its own LOG_TAG, so they need different names once compiled in together
+#define LOG_TAG TSI2C_LOG_TAG
+#include "../../lib/espercore/src/thread_safe_i2c.cpp"
+#undef LOG_TAG
+#define LOG_TAG IDE_LOG_TAG
+#include "../../lib/espercore/src/ide.cpp"
+#undef LOG_TAG
+#include "../../lib/espercdp/src/utils.cpp"
+#define LOG_TAG CKSUM_LOG_TAG
+#include "../../lib/espercdp/src/checksum.cpp"
+#undef LOG_TAG
+#define LOG_TAG WAITPROF_LOG_TAG
+#include "../../lib/espercdp/src/wait_profile.cpp"
+#undef LOG_TAG
+#define LOG_TAG RECOVERY_LOG_TAG
+#include "../../lib/espercdp/src/recovery.cpp"
+#undef LOG_TAG
+#define LOG_TAG VCDROM_LOG_TAG
+#include "../../lib/espercdp/src/virtual_drive.cpp"
+#undef LOG_TAG
+#define LOG_TAG ATAPI_LOG_TAG
+#include "../../lib/espercdp/src/atapi.cpp"
+#undef LOG_TAG
+#define LOG_TAG CDTEXT_LOG_TAG
+#include "../../lib/espercdp/src/metadata/cdtext.cpp"
+#undef LOG_TAG
+#define LOG_TAG EVENTS_LOG_TAG
+#include "../../lib/espercdp/src/player_events.cpp"
+#undef LOG_TAG
+#define LOG_TAG POWER_LOG_TAG
+#include "../../lib/espercdp/src/power_manager.cpp"
+#undef LOG_TAG
+#define LOG_TAG PROGRAM_LOG_TAG
+#include "../../lib/espercdp/src/program.cpp"
+#undef LOG_TAG
+#define LOG_TAG RESUME_LOG_TAG
+#include "../../lib/espercdp/src/resume_store.cpp"
+#undef LOG_TAG
+#define LOG_TAG SHUFFLE_LOG_TAG
+#include "../../lib/espercdp/src/shuffle_planner.cpp"
+#undef LOG_TAG
+#define LOG_TAG TRANSITION_LOG_TAG
+#include "../../lib/espercdp/src/transition_scheduler.cpp"
+#undef LOG_TAG
+#define LOG_TAG IDXSCAN_LOG_TAG
+#define LBA_OFFSET IDXSCAN_LBA_OFFSET
+#include "../../lib/espercdp/src/index_scanner.cpp"
+#undef LBA_OFFSET
+#undef LOG_TAG
+#include "../../lib/espercdp/src/player.cpp"
+
+// The rest of the MusicBrainz provider needs the network, while the program store only wants a file name out of it
+const std::string CD::MusicBrainzMetadataProvider::generate_id(const CD::Album& album) {
+    return "cd_text";
+}
+
+using ATAPI::VirtualDrive;
+using ATAPI::VirtualDisc;
+using CD::Player;
+
+/// @brief A drive that takes its time over the CD-TEXT, as some do
+static const uint32_t SLOW_CD_TEXT_US = 3000000;
+
+/// @brief The test suite's cue sheet, found from where this file is
+static std::string layout_path() {
+    std::string here = __FILE__;
+    return here.substr(0, here.rfind('/') + 1) + "../../../test-suite/Layout.cue";
+}
+
+static std::shared_ptr<VirtualDisc> disc;
+static ATAPI::Device * cdrom;
+static VirtualDrive * vdrive;
+static CD::CDTextMetadataProvider meta;
+static Player * player;
+
+/// @brief Wait on the virtual clock for the condition to come true
+/// @returns Microseconds it took, or -1 on timeout
+static int64_t wait_until(std::function<bool()> condition, uint32_t timeout_ms) {
+    const int64_t start = esp_timer_get_time();
+    const int64_t deadline = start + (int64_t) timeout_ms * 1000;
+    while(esp_timer_get_time() < deadline) {
+        if(condition()) return esp_timer_get_time() - start;
+        vTaskDelay(1);
+    }
+    return -1;
+}
+
+static void attach(uint32_t cd_text_us) {
+    vdrive = new VirtualDrive();
+    vdrive->latencies.read_cd_text = cd_text_us;
+    vdrive->insert_disc(0, disc);
+    cdrom = new ATAPI::Device(vdrive);
+    cdrom->reset();
+}
+
+struct LoadTimes {
+    /// @brief Tray in to the track list being there
+    int64_t track_list;
+    /// @brief Tray in to the CD-TEXT being there
+    int64_t cd_text;
+    /// @brief The READ TOC for the CD-TEXT alone, as the load used to have it inline
+    int64_t cd_text_read;
+};
+
+/// @brief Start the player on a drive with the disc in, and take it through a tray trip so that the load is timed from the tray going in
+static LoadTimes measure_load(uint32_t cd_text_us) {
+    LoadTimes rslt = {};
+    attach(cd_text_us);
+    player = new Player(cdrom, &meta);
+    TEST_ASSERT_TRUE(wait_until([]() { return player->get_status() == Player::State::STOP && !player->is_processing_metadata(); }, 30000) >= 0);
+
+    vdrive->set_door_open(true);
+    TEST_ASSERT_TRUE(wait_until([]() { return player->get_status() == Player::State::OPEN; }, 10000) >= 0);
+    vdrive->set_door_open(false);
+    const int64_t start = esp_timer_get_time();
+    TEST_ASSERT_TRUE(wait_until([]() { return player->get_status() == Player::State::STOP && !player->get_active_slot().disc->tracks.empty(); }, 30000) >= 0);
+    rslt.track_list = esp_timer_get_time() - start;
+    TEST_ASSERT_TRUE(wait_until([]() { return player->get_active_slot().disc->title == "TEST_CD"; }, 30000) >= 0);
+    rslt.cd_text = esp_timer_get_time() - start;
+    TEST_ASSERT_EQUAL_STRING("TEST_ARTIST", player->get_active_slot().disc->artist.c_str());
+
+    // Same as the background job does, only timed on its own
+    const int64_t read_start = esp_timer_get_time();
+    int packs = 0;
+    cdrom->read_cd_text([&packs](const uint8_t *) { packs++; });
+    rslt.cd_text_read = esp_timer_get_time() - read_start;
+    TEST_ASSERT_TRUE(packs > 0);
+
+    delete player;
+    // The device's queue task has no way to be stopped, so the device and the drive behind it stay around
+    return rslt;
+}
+
+static void print_load(const char * what, const LoadTimes& t) {
+    char msg[200];
+    snprintf(msg, sizeof(msg), "%s: track list %lli ms, CD-TEXT %lli ms after tray in; inline CD-TEXT would have put the track list at %lli ms",
+        what, (long long) t.track_list / 1000, (long long) t.cd_text / 1000, (long long) (t.track_list + t.cd_text_read) / 1000);
+    TEST_MESSAGE(msg);
+}
+
+void setUp() {
+    if(disc == nullptr) disc = VirtualDisc::from_cue(layout_path().c_str());
+    TEST_ASSERT_TRUE(disc != nullptr);
+}
+
+void tearDown() {}
+
+void test_cd_text_is_read() {
+    const LoadTimes t = measure_load(VirtualDrive().latencies.read_cd_text);
+    print_load("Quick CD-TEXT", t);
+    TEST_ASSERT_TRUE(t.cd_text >= t.track_list);
+}
+
+void test_slow_cd_text_does_not_hold_up_track_list() {
+    const LoadTimes quick = measure_load(VirtualDrive().latencies.read_cd_text);
+    const LoadTimes slow = measure_load(SLOW_CD_TEXT_US);
+    print_load("Slow CD-TEXT", slow);
+    // the track list comes just as soon, give or take a poll
+    TEST_ASSERT_TRUE(slow.track_list < quick.track_list + 500000);
+    // while the CD-TEXT only shows up after the drive has had its time with it
+    TEST_ASSERT_TRUE(slow.cd_text >= slow.track_list + SLOW_CD_TEXT_US);
+    TEST_ASSERT_TRUE(slow.cd_text_read >= SLOW_CD_TEXT_US);
+}
+
+int main(int argc, char ** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_cd_text_is_read);
+    RUN_TEST(test_slow_cd_text_does_not_hold_up_track_list);
+    return UNITY_END();
+}
@@ -0,0 +1,105 @@
+#include <unity.h>
+#include <chrono>
+#include <vector>
+#include <esper-cdp/checksum.h>
+#include "../../lib/espercdp/src/checksum.cpp"
+
+using ATAPI::TrackChecksum;
+
+// Expected values below were worked out with zlib.crc32 and a straightforward Python take on the AccurateRip sums
+static const uint32_t TRACK_SECTORS = 10;
+
+static std::vector<uint8_t> make_track() {
+    std::vector<uint8_t> data(TRACK_SECTORS * TrackChecksum::SECTOR_SIZE);
+    for(size_t i = 0; i < data.size(); i++) data[i] = (uint8_t) (i * 7 + 3);
+    return data;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_crc32_check_value() {
+    const char * check = "123456789";
+    TEST_ASSERT_EQUAL_HEX32(0xCBF43926, ~ATAPI::crc32_update(0xFFFFFFFF, (const uint8_t *) check, 9));
+}
+
+void test_crc32_of_track() {
+    const auto data = make_track();
+    TrackChecksum sum(TRACK_SECTORS, false, false);
+    sum.update(data.data(), TRACK_SECTORS);
+    TEST_ASSERT_TRUE(sum.is_complete());
+    TEST_ASSERT_EQUAL_HEX32(0x2E71AB3D, sum.get_crc32());
+}
+
+void test_crc32_same_in_pieces() {
+    const auto data = make_track();
+    TrackChecksum whole(TRACK_SECTORS, false, false);
+    whole.update(data.data(), TRACK_SECTORS);
+
+    TrackChecksum pieces(TRACK_SECTORS, false, false);
+    for(uint32_t i = 0; i < TRACK_SECTORS; i++) pieces.update(&data[i * TrackChecksum::SECTOR_SIZE], 1);
+
+    TEST_ASSERT_EQUAL_HEX32(whole.get_crc32(), pieces.get_crc32());
+    TEST_ASSERT_EQUAL_HEX32(whole.get_accuraterip_v1(), pieces.get_accuraterip_v1());
+    TEST_ASSERT_EQUAL_HEX32(whole.get_accuraterip_v2(), pieces.get_accuraterip_v2());
+}
+
+static void check_accuraterip(bool first, bool last, uint32_t v1, uint32_t v2) {
+    const auto data = make_track();
+    TrackChecksum sum(TRACK_SECTORS, first, last);
+    sum.update(data.data(), TRACK_SECTORS);
+    TEST_ASSERT_EQUAL_HEX32(v1, sum.get_accuraterip_v1());
+    TEST_ASSERT_EQUAL_HEX32(v2, sum.get_accuraterip_v2());
+}
+
+void test_accuraterip_middle_track() { check_accuraterip(false, false, 0xB37DE474, 0xB4002BE8); }
+void test_accuraterip_first_track() { check_accuraterip(true, false, 0x908CEBF6, 0x90EEB0F0); }
+void test_accuraterip_last_track() { check_accuraterip(false, true, 0xF0095722, 0xF029DFE9); }
+void test_accuraterip_only_track() { check_accuraterip(true, true, 0xCD185EA4, 0xCD1864F1); }
+
+void test_reset_starts_over() {
+    const auto data = make_track();
+    TrackChecksum sum(TRACK_SECTORS, false, false);
+    sum.update(data.data(), 3);
+    sum.reset();
+    sum.update(data.data(), TRACK_SECTORS);
+    TEST_ASSERT_EQUAL_HEX32(0x2E71AB3D, sum.get_crc32());
+    TEST_ASSERT_EQUAL_HEX32(0xB37DE474, sum.get_accuraterip_v1());
+}
+
+void test_throughput() {
+    // About 5 minutes of audio
+    const uint32_t sectors = 5 * 60 * MSF::FRAMES_IN_SECOND;
+    std::vector<uint8_t> data(sectors * TrackChecksum::SECTOR_SIZE);
+    for(size_t i = 0; i < data.size(); i++) data[i] = (uint8_t) (i * 31 + (i >> 11));
+
+    auto start = std::chrono::steady_clock::now();
+    volatile uint32_t crc = ATAPI::crc32_update(0xFFFFFFFF, data.data(), data.size());
+    double crc_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    TrackChecksum sum(sectors, false, false);
+    sum.update(data.data(), sectors);
+    volatile uint32_t ar = sum.get_accuraterip_v2();
+    double track_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    (void) crc; (void) ar;
+
+    const double mb = data.size() / 1048576.0;
+    char msg[128];
+    snprintf(msg, sizeof(msg), "CRC32 alone %.0f MB/s, CRC32 + AccurateRip %.0f MB/s (1x CD is 0.17 MB/s)", mb / crc_s, mb / track_s);
+    TEST_MESSAGE(msg);
+}
+
+int main(int argc, char ** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_crc32_check_value);
+    RUN_TEST(test_crc32_of_track);
+    RUN_TEST(test_crc32_same_in_pieces);
+    RUN_TEST(test_accuraterip_middle_track);
+    RUN_TEST(test_accuraterip_first_track);
+    RUN_TEST(test_accuraterip_last_track);
+    RUN_TEST(test_accuraterip_only_track);
+    RUN_TEST(test_reset_starts_over);
+    RUN_TEST(test_throughput);
+    return UNITY_END();
+}
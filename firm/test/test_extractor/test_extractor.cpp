@@ -0,0 +1,187 @@
+#include <unity.h>
+#include <string>
+#include <vector>
+#include <fake_pca9555.h>
+#include <host_prefs.h>
+// Every source has its own LOG_TAG, so they need different names once compiled in together
+#define LOG_TAG TSI2C_LOG_TAG
+#include "../../lib/espercore/src/thread_safe_i2c.cpp"
+#undef LOG_TAG
+#define LOG_TAG IDE_LOG_TAG
+#include "../../lib/espercore/src/ide.cpp"
+#undef LOG_TAG
+#include "../../lib/espercdp/src/utils.cpp"
+#define LOG_TAG CKSUM_LOG_TAG
+#include "../../lib/espercdp/src/checksum.cpp"
+#undef LOG_TAG
+#define LOG_TAG WAITPROF_LOG_TAG
+#include "../../lib/espercdp/src/wait_profile.cpp"
+#undef LOG_TAG
+#define LOG_TAG RECOVERY_LOG_TAG
+#include "../../lib/espercdp/src/recovery.cpp"
+#undef LOG_TAG
+#define LOG_TAG VCDROM_LOG_TAG
+#include "../../lib/espercdp/src/virtual_drive.cpp"
+#undef LOG_TAG
+#define LOG_TAG ATAPI_LOG_TAG
+#include "../../lib/espercdp/src/atapi.cpp"
+#undef LOG_TAG
+#define LBA_OFFSET CDDAX_LBA_OFFSET
+#include "../../lib/espercdp/src/extractor.cpp"
+#undef LBA_OFFSET
+
+using ATAPI::VirtualDrive;
+using ATAPI::VirtualDisc;
+using ATAPI::CDDAExtractor;
+
+static const size_t SECTOR = ATAPI::Device::CDDA_SECTOR_SIZE;
+/// @brief Audio CD at 1x, in bytes per second
+static const uint32_t SPEED_1X = 176400;
+/// @brief Track 1 index 1 of the test suite disc, which has its own WAV file
+static const int TRACK_FILE = 1;
+static const int SECTORS = 200;
+
+/// @brief The test suite's cue sheet, found from where this file is
+static std::string layout_path() {
+    std::string here = __FILE__;
+    return here.substr(0, here.rfind('/') + 1) + "../../../test-suite/Layout.cue";
+}
+
+/// @brief The virtual drive's registers, but reached through the expander pins instead of directly
+class VirtualDriveOnPins: public FakeIDEDrive {
+public:
+    VirtualDriveOnPins(VirtualDrive * drive): drive(drive) {}
+    data16 read(uint8_t reg) override { return drive->read(reg); }
+    void write(uint8_t reg, data16 data) override { drive->write(reg, data); }
+    void reset() override { drive->reset(); }
+private:
+    VirtualDrive * drive;
+};
+
+static std::shared_ptr<VirtualDisc> disc;
+static VirtualDrive * vdrive;
+static FakePCA9555Pair * wire;
+static ATAPI::Device * cdrom;
+
+/// @brief A drive with the test suite disc in it, either straight on the bus interface or behind the PCA9555 pair
+static void attach(bool over_pins) {
+    vdrive = new VirtualDrive();
+    vdrive->insert_disc(0, disc);
+    if(over_pins) {
+        wire = new FakePCA9555Pair(new VirtualDriveOnPins(vdrive));
+        cdrom = new ATAPI::Device(new Platform::IDEBus(new Core::ThreadSafeI2C(wire)));
+    } else {
+        wire = nullptr;
+        cdrom = new ATAPI::Device(vdrive);
+    }
+    cdrom->reset();
+    // let the disc spin up
+    delay(vdrive->latencies.spin_up / 1000 + 100);
+}
+
+/// @brief Run the extractor over the range, reading out everything like the I2S side would
+/// @returns Microseconds from the start until the last byte came out
+static int64_t extract(CDDAExtractor * extractor, int from, int count, std::vector<uint8_t>& out) {
+    static uint8_t buf[SECTOR * 4];
+    out.clear();
+    const int64_t start = esp_timer_get_time();
+    extractor->start(FRAMES_TO_MSF(from), FRAMES_TO_MSF(from + count));
+    while(out.size() < count * SECTOR) {
+        size_t got = extractor->read(buf, sizeof(buf));
+        out.insert(out.end(), buf, buf + got);
+        if(got == 0) delay(10);
+    }
+    return esp_timer_get_time() - start;
+}
+
+static std::vector<uint8_t> wav_data(const ATAPI::VirtualFile& file, int sectors) {
+    std::vector<uint8_t> rslt(sectors * SECTOR);
+    FILE * f = fopen(file.path.c_str(), "rb");
+    TEST_ASSERT_TRUE_MESSAGE(f != nullptr, file.path.c_str());
+    fseek(f, file.data_offset, SEEK_SET);
+    TEST_ASSERT_EQUAL_INT(rslt.size(), fread(rslt.data(), 1, rslt.size(), f));
+    fclose(f);
+    return rslt;
+}
+
+static void print_rate(const char * what, size_t bytes, int64_t us, uint32_t transactions) {
+    char msg[160];
+    snprintf(msg, sizeof(msg), "%s: %zu bytes in %lli ms = %.0f bytes/s (%.3fx), %u I2C transactions", what, bytes, (long long) us / 1000, bytes * 1000000.0 / us, bytes * 1000000.0 / us / SPEED_1X, transactions);
+    TEST_MESSAGE(msg);
+}
+
+void setUp() {
+    if(disc == nullptr) disc = VirtualDisc::from_cue(layout_path().c_str());
+    TEST_ASSERT_TRUE(disc != nullptr);
+    TEST_ASSERT_FALSE(disc->files[TRACK_FILE].path.empty());
+}
+
+void tearDown() {
+    // The device outlives the test, its queue task still holds on to it and the drive
+}
+
+void test_extracts_what_is_on_disc() {
+    attach(false);
+    CDDAExtractor * extractor = new CDDAExtractor(cdrom, 64);
+    const ATAPI::VirtualFile& file = disc->files[TRACK_FILE];
+    std::vector<uint8_t> pcm;
+    // more than the buffer holds, so that it wraps around a few times
+    extract(extractor, file.start_frame, SECTORS, pcm);
+
+    std::vector<uint8_t> expect = wav_data(file, SECTORS);
+    TEST_ASSERT_TRUE(pcm == expect);
+
+    ATAPI::TrackChecksum sums(SECTORS, false, false);
+    sums.update(expect.data(), SECTORS);
+    TEST_ASSERT_EQUAL_HEX32(sums.get_crc32(), extractor->get_checksum().get_crc32());
+    TEST_ASSERT_EQUAL_HEX32(sums.get_accuraterip_v2(), extractor->get_checksum().get_accuraterip_v2());
+
+    const CDDAExtractor::Stats& stats = extractor->get_stats();
+    TEST_ASSERT_EQUAL_INT(SECTORS, stats.sectors_read);
+    TEST_ASSERT_EQUAL_INT(0, stats.sectors_lost);
+    TEST_ASSERT_EQUAL_INT(0, stats.retries);
+    TEST_ASSERT_TRUE(extractor->is_finished());
+    delete extractor;
+}
+
+void test_throughput_over_pins() {
+    attach(true);
+    const int from = disc->files[TRACK_FILE].start_frame;
+
+    // What a READ CD per sector gets, one after another
+    static uint8_t buf[SECTOR];
+    int64_t start = esp_timer_get_time();
+    uint32_t before = wire->transactions;
+    for(int i = 0; i < SECTORS; i++) TEST_ASSERT_TRUE(cdrom->read_cd(from + i - 150, 1, buf));
+    const int64_t single_us = esp_timer_get_time() - start;
+    const uint32_t single_transactions = wire->transactions - before;
+    print_rate("READ CD per sector", SECTORS * SECTOR, single_us, single_transactions);
+
+    CDDAExtractor * extractor = new CDDAExtractor(cdrom);
+    std::vector<uint8_t> pcm;
+    before = wire->transactions;
+    const int64_t extract_us = extract(extractor, from, SECTORS, pcm);
+    const uint32_t extract_transactions = wire->transactions - before;
+    print_rate("CDDAExtractor", pcm.size(), extract_us, extract_transactions);
+
+    const CDDAExtractor::Stats& stats = extractor->get_stats();
+    char msg[128];
+    snprintf(msg, sizeof(msg), "Settled on %u sectors per READ CD, last reported rate %u bytes/s", stats.chunk_sectors, stats.bytes_per_second);
+    TEST_MESSAGE(msg);
+
+    TEST_ASSERT_TRUE(pcm == wav_data(disc->files[TRACK_FILE], SECTORS));
+    TEST_ASSERT_TRUE(extract_us < single_us);
+    TEST_ASSERT_TRUE(extract_transactions < single_transactions);
+    // the rate the extractor reports about itself has to be about what was measured here
+    const uint32_t measured = (uint32_t) (pcm.size() * 1000000LL / extract_us);
+    TEST_ASSERT_TRUE(stats.bytes_per_second > measured * 95 / 100 && stats.bytes_per_second < measured * 105 / 100);
+    TEST_ASSERT_EQUAL_INT(0, wire->conflicts);
+    delete extractor;
+}
+
+int main(int argc, char ** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_extracts_what_is_on_disc);
+    RUN_TEST(test_throughput_over_pins);
+    return UNITY_END();
+}
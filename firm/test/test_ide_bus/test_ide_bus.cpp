@@ -0,0 +1,163 @@
+#include <unity.h>
+#include <functional>
+#include <fake_pca9555.h>
+// Every source has its own LOG_TAG, so they need different names once compiled in together
+#define LOG_TAG TSI2C_LOG_TAG
+#include "../../lib/espercore/src/thread_safe_i2c.cpp"
+#undef LOG_TAG
+#include "../../lib/espercore/src/ide.cpp"
+
+using Platform::IDEBus;
+
+// What every access used to cost when IDEBus rewrote the expander registers each time:
+// a read set both direction registers, lowered DIOR, read the two input ports one by one and raised DIOR again,
+// a write set DIOW, both direction registers, both output ports, pulsed DIOW and then went back to high-Z.
+static const uint32_t UNCACHED_READ = 8;
+static const uint32_t UNCACHED_WRITE = 9;
+
+static FakeRegisterFile * drive;
+static FakePCA9555Pair * wire;
+static Core::ThreadSafeI2C * i2c;
+static IDEBus * bus;
+
+static data16 word(uint8_t low, uint8_t high = 0xFF) { return {{ .low = low, .high = high }}; }
+
+/// @brief How many transactions the access takes, checking that the bus and the fake agree on the count
+static uint32_t cost(std::function<void()> access) {
+    const uint32_t before = wire->transactions;
+    const uint32_t bus_before = bus->get_transaction_count();
+    access();
+    const uint32_t rslt = wire->transactions - before;
+    TEST_ASSERT_EQUAL_INT(rslt, bus->get_transaction_count() - bus_before);
+    return rslt;
+}
+
+void setUp() {
+    drive = new FakeRegisterFile();
+    wire = new FakePCA9555Pair(drive);
+    i2c = new Core::ThreadSafeI2C(wire);
+    bus = new IDEBus(i2c);
+    bus->reset();
+}
+
+void tearDown() {
+    delete bus;
+    delete i2c;
+    delete wire;
+    delete drive;
+}
+
+void test_write_reaches_drive() {
+    bus->write(IDE::Register::SectorCount, word(0x12));
+    bus->write(IDE::Register::CylinderLow, word(0x34));
+    bus->write(IDE::Register::CylinderHigh, word(0x56));
+    TEST_ASSERT_EQUAL_INT(0x12, drive->read(IDE::Register::SectorCount).low);
+    TEST_ASSERT_EQUAL_INT(0x34, drive->read(IDE::Register::CylinderLow).low);
+    TEST_ASSERT_EQUAL_INT(0x56, drive->read(IDE::Register::CylinderHigh).low);
+    TEST_ASSERT_EQUAL_INT(0, wire->floating_writes);
+}
+
+void test_read_back_after_write() {
+    bus->write(IDE::Register::CylinderLow, word(0xA5, 0x5A));
+    data16 val = bus->read(IDE::Register::CylinderLow);
+    TEST_ASSERT_EQUAL_HEX32(0x5AA5, val.value);
+    // the data bus must be back to inputs before the drive starts driving it
+    TEST_ASSERT_EQUAL_INT(0, wire->conflicts);
+}
+
+void test_repeated_read_is_cheaper() {
+    drive->write(IDE::Register::Status, word(0x58));
+    bus->read(IDE::Register::Status);
+
+    uint32_t n = cost([]() { TEST_ASSERT_EQUAL_INT(0x58, bus->read(IDE::Register::Status).low); });
+    // DIOR low, both input ports in one go (pointer write + read), DIOR high
+    TEST_ASSERT_EQUAL_INT(4, n);
+    TEST_ASSERT_TRUE(n < UNCACHED_READ);
+}
+
+void test_read_after_write_is_cheaper() {
+    bus->write(IDE::Register::Feature, word(0x00));
+    uint32_t n = cost([]() { bus->read(IDE::Register::Status); });
+    // the same as a repeated read, plus turning the data bus around
+    TEST_ASSERT_EQUAL_INT(6, n);
+    TEST_ASSERT_TRUE(n < UNCACHED_READ);
+}
+
+void test_repeated_write_is_cheaper() {
+    bus->write(IDE::Register::SectorCount, word(0x01));
+
+    // another register: address, both output ports in one go, DIOW pulse
+    TEST_ASSERT_EQUAL_INT(4, cost([]() { bus->write(IDE::Register::SectorNumber, word(0x02)); }));
+    // the same register: nothing but the data and the pulse
+    TEST_ASSERT_EQUAL_INT(3, cost([]() { bus->write(IDE::Register::SectorNumber, word(0x03)); }));
+    // the same value again: only the pulse
+    TEST_ASSERT_EQUAL_INT(2, cost([]() { bus->write(IDE::Register::SectorNumber, word(0x03)); }));
+    TEST_ASSERT_EQUAL_INT(0x03, drive->read(IDE::Register::SectorNumber).low);
+}
+
+void test_block_read_sets_pointer_once() {
+    static const size_t WORDS = 16;
+    uint8_t buf[WORDS * 2];
+    drive->write(IDE::Register::Data, word(0x34, 0x12));
+    bus->read(IDE::Register::Data);
+
+    uint32_t n = cost([&buf]() { bus->read_block(IDE::Register::Data, buf, WORDS); });
+    // DIOR low, the ports, DIOR high for every word, plus pointing at the input ports once
+    TEST_ASSERT_EQUAL_INT(WORDS * 3 + 1, n);
+    for(size_t i = 0; i < WORDS; i++) {
+        TEST_ASSERT_EQUAL_INT(0x34, buf[i * 2]);
+        TEST_ASSERT_EQUAL_INT(0x12, buf[i * 2 + 1]);
+    }
+}
+
+void test_packet_command_sequence() {
+    // What `Device::send_packet()` does for a 12 byte packet, and the status polls after it
+    static const uint8_t packet[12] = { 0x43, 0x02, 0, 0, 0, 0, 0, 0x03, 0x24, 0, 0, 0 };
+    static const int STATUS_POLLS = 3;
+    drive->write(IDE::Register::Status, word(0x50));
+    bus->read(IDE::Register::Status);
+
+    uint32_t n = cost([]() {
+        bus->write(IDE::Register::DeviceControl, word(0x02));
+        bus->write(IDE::Register::Command, word(0xA0));
+        bus->write_block(IDE::Register::Data, packet, sizeof(packet) / 2);
+        for(int i = 0; i < STATUS_POLLS; i++) bus->read(IDE::Register::Status);
+    });
+
+    // the packet used to be written out one word at a time, too
+    const uint32_t uncached = (2 + sizeof(packet) / 2) * UNCACHED_WRITE + STATUS_POLLS * UNCACHED_READ;
+    char msg[96];
+    snprintf(msg, sizeof(msg), "Packet command: %u I2C transactions, %u without the shadow registers", n, uncached);
+    TEST_MESSAGE(msg);
+
+    TEST_ASSERT_TRUE(n * 2 < uncached);
+    TEST_ASSERT_EQUAL_INT(0, wire->conflicts);
+    TEST_ASSERT_EQUAL_INT(0, wire->floating_writes);
+}
+
+void test_failed_write_is_not_cached() {
+    bus->write(IDE::Register::SectorCount, word(0x10));
+    bus->write(IDE::Register::SectorCount, word(0x10));
+
+    // the output ports write gets lost, so the drive latches the old value
+    wire->fail_next = 1;
+    bus->write(IDE::Register::SectorCount, word(0x20));
+    TEST_ASSERT_EQUAL_INT(0x10, drive->read(IDE::Register::SectorCount).low);
+
+    // and since nobody knows what's in the expander now, the next write must not be skipped
+    TEST_ASSERT_EQUAL_INT(3, cost([]() { bus->write(IDE::Register::SectorCount, word(0x20)); }));
+    TEST_ASSERT_EQUAL_INT(0x20, drive->read(IDE::Register::SectorCount).low);
+}
+
+int main(int argc, char ** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_write_reaches_drive);
+    RUN_TEST(test_read_back_after_write);
+    RUN_TEST(test_repeated_read_is_cheaper);
+    RUN_TEST(test_read_after_write_is_cheaper);
+    RUN_TEST(test_repeated_write_is_cheaper);
+    RUN_TEST(test_block_read_sets_pointer_once);
+    RUN_TEST(test_packet_command_sequence);
+    RUN_TEST(test_failed_write_is_not_cached);
+    return UNITY_END();
+}
@@ -0,0 +1,148 @@
+#include <unity.h>
+#include <ArduinoJson.h>
+#include <esper-cdp/musicbrainz_json.h>
+#include "../../lib/espercdp/src/metadata/musicbrainz_json.cpp"
+
+// Trimmed down replies of /ws/2/discid/<id>?inc=recordings+artist-credits+isrcs, with only the keys that are looked at
+static const char DISC_ID[] = "lwHl8fGzJyLXQR33ug60E8jhf4k-";
+
+static const char BARCODES[] = R"({"releases": [
+    {"title": "Japan", "barcode": "4988006123456", "media": [{"discs": [{"id": "lwHl8fGzJyLXQR33ug60E8jhf4k-"}], "tracks": []}]},
+    {"title": "US", "barcode": "724384960650", "media": [{"discs": [{"id": "lwHl8fGzJyLXQR33ug60E8jhf4k-"}], "tracks": []}]},
+    {"title": "Europe", "barcode": null, "media": [{"discs": [{"id": "lwHl8fGzJyLXQR33ug60E8jhf4k-"}], "tracks": []}]}
+]})";
+
+// Both of the first two have the disc's barcode. The third has all the ISRCs, but not the barcode, so it must not win.
+static const char SHARED_BARCODE[] = R"({"releases": [
+    {"title": "First pressing", "barcode": "4988006123456", "media": [
+        {"discs": [{"id": "lwHl8fGzJyLXQR33ug60E8jhf4k-"}], "tracks": [
+            {"recording": {"isrcs": ["JPTO09400001"]}},
+            {"recording": {"isrcs": []}},
+            {"recording": {"isrcs": ["JPTO09400099"]}}
+        ]}
+    ]},
+    {"title": "Remaster", "barcode": "4988006123456", "media": [
+        {"discs": [{"id": "some-other-disc-id"}], "tracks": []},
+        {"discs": [{"id": "lwHl8fGzJyLXQR33ug60E8jhf4k-"}], "tracks": [
+            {"recording": {"isrcs": ["JPTO09400001"]}},
+            {"recording": {"isrcs": ["JPTO09400002", "JPTO00000002"]}},
+            {"recording": {"isrcs": ["JPTO09400003"]}}
+        ]}
+    ]},
+    {"title": "Bootleg", "barcode": "1234567890128", "media": [
+        {"discs": [{"id": "lwHl8fGzJyLXQR33ug60E8jhf4k-"}], "tracks": [
+            {"recording": {"isrcs": ["JPTO09400001"]}},
+            {"recording": {"isrcs": ["JPTO09400002"]}},
+            {"recording": {"isrcs": ["JPTO09400003"]}}
+        ]}
+    ]}
+]})";
+
+// None of them has the disc's barcode, and only the last one has all of its ISRCs
+static const char ISRC_PICKS_ONE[] = R"({"releases": [
+    {"title": "Japan", "barcode": "4988006123456", "media": [
+        {"discs": [{"id": "lwHl8fGzJyLXQR33ug60E8jhf4k-"}], "tracks": [
+            {"recording": {"isrcs": ["JPTO09400001"]}},
+            {"recording": {"isrcs": []}},
+            {"recording": {"isrcs": ["JPTO09400099"]}}
+        ]}
+    ]},
+    {"title": "Europe", "barcode": null, "media": [
+        {"discs": [{"id": "lwHl8fGzJyLXQR33ug60E8jhf4k-"}], "tracks": [
+            {"recording": {"isrcs": ["JPTO09400001"]}},
+            {"recording": {"isrcs": ["JPTO09400002"]}}
+        ]}
+    ]},
+    {"title": "US", "barcode": "724384960650", "media": [
+        {"discs": [{"id": "some-other-disc-id"}], "tracks": []},
+        {"discs": [{"id": "lwHl8fGzJyLXQR33ug60E8jhf4k-"}], "tracks": [
+            {"recording": {"isrcs": ["JPTO09400001"]}},
+            {"recording": {"isrcs": ["JPTO00000002", "JPTO09400002"]}},
+            {"recording": {"isrcs": ["JPTO09400003"]}}
+        ]}
+    ]}
+]})";
+
+static const char ISRC_TIE[] = R"({"releases": [
+    {"title": "CD", "media": [
+        {"discs": [{"id": "lwHl8fGzJyLXQR33ug60E8jhf4k-"}], "tracks": [
+            {"recording": {"isrcs": ["JPTO09400001"]}},
+            {"recording": {"isrcs": ["JPTO09400002"]}}
+        ]}
+    ]},
+    {"title": "CD again", "media": [
+        {"discs": [{"id": "lwHl8fGzJyLXQR33ug60E8jhf4k-"}], "tracks": [
+            {"recording": {"isrcs": ["JPTO09400001"]}},
+            {"recording": {"isrcs": ["JPTO09400002"]}}
+        ]}
+    ]}
+]})";
+
+static const std::vector<std::string> DISC_ISRCS = { "JPTO09400001", "JPTO09400002", "JPTO09400003" };
+static const std::vector<std::string> NO_ISRCS = { "", "", "" };
+
+static JsonDocument doc;
+
+static JsonArray parse(const char * json) {
+    doc.clear();
+    DeserializationError error = deserializeJson(doc, json);
+    TEST_ASSERT_FALSE_MESSAGE(error, error.c_str());
+    return doc["releases"].as<JsonArray>();
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_medium_with_disc_id() {
+    JsonArray releases = parse(SHARED_BARCODE);
+    TEST_ASSERT_EQUAL_INT(0, MBJsonFindMediumIndex(releases[0].as<JsonObject>(), DISC_ID));
+    TEST_ASSERT_EQUAL_INT(1, MBJsonFindMediumIndex(releases[1].as<JsonObject>(), DISC_ID));
+    TEST_ASSERT_EQUAL_INT(-1, MBJsonFindMediumIndex(releases[1].as<JsonObject>(), "not-on-any-medium"));
+}
+
+void test_barcode_picks_one() {
+    // The MCN is always 13 digits, the UPC on the release is 12
+    JsonArray releases = parse(BARCODES);
+    TEST_ASSERT_EQUAL_INT(1, MBJsonPickRelease(releases, "0724384960650", NO_ISRCS, DISC_ID));
+    TEST_ASSERT_EQUAL_INT(0, MBJsonPickRelease(releases, "4988006123456", NO_ISRCS, DISC_ID));
+}
+
+void test_shared_barcode_settled_by_isrc() {
+    JsonArray releases = parse(SHARED_BARCODE);
+    TEST_ASSERT_EQUAL_INT(1, MBJsonPickRelease(releases, "4988006123456", DISC_ISRCS, DISC_ID));
+}
+
+void test_unknown_barcode_falls_back_to_isrc() {
+    JsonArray releases = parse(SHARED_BARCODE);
+    TEST_ASSERT_EQUAL_INT(-1, MBJsonPickRelease(releases, "0000000000017", DISC_ISRCS, DISC_ID));
+    TEST_ASSERT_EQUAL_INT(-1, MBJsonPickRelease(releases, "", DISC_ISRCS, DISC_ID));
+    // with only the first two ISRCs known, the remaster and the bootleg tie
+    const std::vector<std::string> two = { "JPTO09400001", "JPTO09400002", "" };
+    TEST_ASSERT_EQUAL_INT(-1, MBJsonPickRelease(releases, "", two, DISC_ID));
+
+    releases = parse(ISRC_PICKS_ONE);
+    TEST_ASSERT_EQUAL_INT(2, MBJsonPickRelease(releases, "0000000000017", DISC_ISRCS, DISC_ID));
+    TEST_ASSERT_EQUAL_INT(2, MBJsonPickRelease(releases, "", DISC_ISRCS, DISC_ID));
+}
+
+void test_isrc_tie() {
+    JsonArray releases = parse(ISRC_TIE);
+    TEST_ASSERT_EQUAL_INT(-1, MBJsonPickRelease(releases, "", DISC_ISRCS, DISC_ID));
+}
+
+void test_no_identifiers() {
+    JsonArray releases = parse(SHARED_BARCODE);
+    TEST_ASSERT_EQUAL_INT(-1, MBJsonPickRelease(releases, "", NO_ISRCS, DISC_ID));
+    TEST_ASSERT_EQUAL_INT(-1, MBJsonPickRelease(releases, "", {}, DISC_ID));
+}
+
+int main(int argc, char ** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_medium_with_disc_id);
+    RUN_TEST(test_barcode_picks_one);
+    RUN_TEST(test_shared_barcode_settled_by_isrc);
+    RUN_TEST(test_unknown_barcode_falls_back_to_isrc);
+    RUN_TEST(test_isrc_tie);
+    RUN_TEST(test_no_identifiers);
+    return UNITY_END();
+}
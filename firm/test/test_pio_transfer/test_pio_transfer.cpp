@@ -0,0 +1,146 @@
+#include <unity.h>
+#include <fake_pca9555.h>
+#include <host_prefs.h>
+// Every source has its own LOG_TAG, so they need different names once compiled in together
+#define LOG_TAG TSI2C_LOG_TAG
+#include "../../lib/espercore/src/thread_safe_i2c.cpp"
+#undef LOG_TAG
+#define LOG_TAG IDE_LOG_TAG
+#include "../../lib/espercore/src/ide.cpp"
+#undef LOG_TAG
+#include "../../lib/espercdp/src/utils.cpp"
+#define LOG_TAG CKSUM_LOG_TAG
+#include "../../lib/espercdp/src/checksum.cpp"
+#undef LOG_TAG
+#define LOG_TAG WAITPROF_LOG_TAG
+#include "../../lib/espercdp/src/wait_profile.cpp"
+#undef LOG_TAG
+#define LOG_TAG RECOVERY_LOG_TAG
+#include "../../lib/espercdp/src/recovery.cpp"
+#undef LOG_TAG
+#define LOG_TAG VCDROM_LOG_TAG
+#include "../../lib/espercdp/src/virtual_drive.cpp"
+#undef LOG_TAG
+#include "../../lib/espercdp/src/atapi.cpp"
+
+using ATAPI::VirtualDrive;
+using ATAPI::VirtualDisc;
+
+static const size_t SECTOR = ATAPI::Device::CDDA_SECTOR_SIZE;
+
+/// @brief The virtual drive's registers, but reached through the expander pins instead of directly
+class VirtualDriveOnPins: public FakeIDEDrive {
+public:
+    VirtualDriveOnPins(VirtualDrive * drive): drive(drive) {}
+    data16 read(uint8_t reg) override { return drive->read(reg); }
+    void write(uint8_t reg, data16 data) override { drive->write(reg, data); }
+    void reset() override { drive->reset(); }
+private:
+    VirtualDrive * drive;
+};
+
+static VirtualDrive * vdrive;
+static VirtualDriveOnPins * pins;
+static FakePCA9555Pair * wire;
+static Core::ThreadSafeI2C * i2c;
+static Platform::IDEBus * bus;
+static ATAPI::Device * cdrom;
+
+static void print_rate(const char * what, size_t bytes, int64_t us, uint32_t transactions) {
+    char msg[128];
+    snprintf(msg, sizeof(msg), "%s: %zu bytes in %lli us = %.0f bytes/s, %u I2C transactions", what, bytes, (long long) us, bytes * 1000000.0 / us, transactions);
+    TEST_MESSAGE(msg);
+}
+
+void setUp() {
+    vdrive = new VirtualDrive();
+    vdrive->insert_disc(0, VirtualDisc::silent(3, 60 * MSF::FRAMES_IN_SECOND));
+    pins = new VirtualDriveOnPins(vdrive);
+    wire = new FakePCA9555Pair(pins);
+    i2c = new Core::ThreadSafeI2C(wire);
+    bus = new Platform::IDEBus(i2c);
+    cdrom = new ATAPI::Device(bus);
+    bus->reset();
+    // let the disc spin up
+    delay(vdrive->latencies.spin_up / 1000 + 100);
+}
+
+void tearDown() {
+    // The device and the virtual drive both outlive the test, the device's task still holds on to them
+}
+
+static void read_out_packet(const ATAPI::Requests::ReadCD& req) {
+    // Straight into the drive, so that only the response goes over the pins
+    vdrive->write(IDE::Register::Command, {{ .low = ATAPI::Command::WRITE_PACKET, .high = 0xFF }});
+    vdrive->write_block(IDE::Register::Data, &req, sizeof(req) / 2);
+}
+
+void test_read_cd_over_pins() {
+    static uint8_t buf[SECTOR];
+    memset(buf, 0xAA, sizeof(buf));
+    TEST_ASSERT_TRUE(cdrom->read_cd(100, 1, buf));
+    // silence, and all of it came through
+    for(size_t i = 0; i < SECTOR; i++) TEST_ASSERT_EQUAL_INT(0, buf[i]);
+    TEST_ASSERT_EQUAL_INT(0, wire->conflicts);
+    TEST_ASSERT_EQUAL_INT(0, wire->floating_writes);
+}
+
+void test_response_throughput() {
+    static uint8_t buf[SECTOR];
+    // no mechanism time in the way, only the bus
+    vdrive->command_latency[ATAPI::OperationCodes::READ_CD] = 0;
+    vdrive->command_latency[ATAPI::OperationCodes::STOP_PLAY_SCAN] = 0;
+    // warm up the shadow registers
+    cdrom->read_cd(100, 1, buf);
+    cdrom->stop();
+
+    // READ CD through `read_response()` and `pio_next_block()`, less a STOP for the packet and the status wait that both have
+    int64_t start = esp_timer_get_time();
+    uint32_t before = wire->transactions;
+    cdrom->stop();
+    const int64_t packet_us = esp_timer_get_time() - start;
+    const uint32_t packet_transactions = wire->transactions - before;
+
+    start = esp_timer_get_time();
+    before = wire->transactions;
+    TEST_ASSERT_TRUE(cdrom->read_cd(200, 1, buf));
+    const int64_t block_us = esp_timer_get_time() - start - packet_us;
+    const uint32_t block_transactions = wire->transactions - before - packet_transactions;
+    print_rate("read_response()", SECTOR, block_us, block_transactions);
+
+    // How `read_response()` used to go about it: a word, a status read, and 10 us of rest after each
+    const ATAPI::Requests::ReadCD req = {
+        .opcode = ATAPI::OperationCodes::READ_CD,
+        .expected_sector_type = ATAPI::Requests::ReadCD::SectorType::SECTOR_CDDA,
+        .lba = htobe32(300),
+        .transfer_length = { 0, 0, 1 },
+        .user_data = true,
+    };
+    read_out_packet(req);
+    start = esp_timer_get_time();
+    before = wire->transactions;
+    size_t i = 0;
+    bool drq;
+    do {
+        data16 val = bus->read(IDE::Register::Data);
+        buf[i++] = val.low;
+        buf[i++] = val.high;
+        delayMicroseconds(10);
+        drq = (bus->read(IDE::Register::Status).low & STS_DRQ) != 0;
+        delayMicroseconds(10);
+    } while(i < SECTOR && drq);
+    const int64_t word_us = esp_timer_get_time() - start;
+    const uint32_t word_transactions = wire->transactions - before;
+    TEST_ASSERT_EQUAL_INT(SECTOR, i);
+    print_rate("Word at a time", SECTOR, word_us, word_transactions);
+
+    TEST_ASSERT_TRUE(block_us * 2 < word_us);
+    TEST_ASSERT_TRUE(block_transactions * 2 < word_transactions);
+}
+
+int main(int argc, char ** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_read_cd_over_pins);
+    RUN_TEST(test_response_throughput);
+    return UNITY_END();
+}
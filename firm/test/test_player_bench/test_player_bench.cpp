@@ -0,0 +1,117 @@
+#include <unity.h>
+#include <host_prefs.h>
+// Every source has its own LOG_TAG, so they need different names once compiled in together
+#define LOG_TAG TSI2C_LOG_TAG
+#include "../../lib/espercore/src/thread_safe_i2c.cpp"
+#undef LOG_TAG
+#define LOG_TAG IDE_LOG_TAG
+#include "../../lib/espercore/src/ide.cpp"
+#undef LOG_TAG
+#include "../../lib/espercdp/src/utils.cpp"
+#define LOG_TAG CKSUM_LOG_TAG
+#include "../../lib/espercdp/src/checksum.cpp"
+#undef LOG_TAG
+#define LOG_TAG WAITPROF_LOG_TAG
+#include "../../lib/espercdp/src/wait_profile.cpp"
+#undef LOG_TAG
+#define LOG_TAG RECOVERY_LOG_TAG
+#include "../../lib/espercdp/src/recovery.cpp"
+#undef LOG_TAG
+#define LOG_TAG VCDROM_LOG_TAG
+#include "../../lib/espercdp/src/virtual_drive.cpp"
+#undef LOG_TAG
+#define LOG_TAG ATAPI_LOG_TAG
+#include "../../lib/espercdp/src/atapi.cpp"
+#undef LOG_TAG
+#define LOG_TAG CDTEXT_LOG_TAG
+#include "../../lib/espercdp/src/metadata/cdtext.cpp"
+#undef LOG_TAG
+#define LOG_TAG EVENTS_LOG_TAG
+#include "../../lib/espercdp/src/player_events.cpp"
+#undef LOG_TAG
+#define LOG_TAG POWER_LOG_TAG
+#include "../../lib/espercdp/src/power_manager.cpp"
+#undef LOG_TAG
+#define LOG_TAG PROGRAM_LOG_TAG
+#include "../../lib/espercdp/src/program.cpp"
+#undef LOG_TAG
+#define LOG_TAG RESUME_LOG_TAG
+#include "../../lib/espercdp/src/resume_store.cpp"
+#undef LOG_TAG
+#define LOG_TAG SHUFFLE_LOG_TAG
+#include "../../lib/espercdp/src/shuffle_planner.cpp"
+#undef LOG_TAG
+#define LOG_TAG TRANSITION_LOG_TAG
+#include "../../lib/espercdp/src/transition_scheduler.cpp"
+#undef LOG_TAG
+#define LOG_TAG IDXSCAN_LOG_TAG
+#define LBA_OFFSET IDXSCAN_LBA_OFFSET
+#include "../../lib/espercdp/src/index_scanner.cpp"
+#undef LBA_OFFSET
+#undef LOG_TAG
+#define LOG_TAG CDP_LOG_TAG
+#include "../../lib/espercdp/src/player.cpp"
+#undef LOG_TAG
+#include "../../lib/espercdp/src/player_bench.cpp"
+
+// The rest of the MusicBrainz provider needs the network, while the program store only wants a file name out of it
+const std::string CD::MusicBrainzMetadataProvider::generate_id(const CD::Album& album) {
+    return "bench";
+}
+
+// The same rounds as the bench used to do on the device, only on the virtual clock now
+static const int LOAD_ROUNDS = 10;
+static const int COMMAND_ROUNDS = 20;
+static const int FUZZ_STEPS = 1000;
+static const uint32_t FUZZ_SEED = 1;
+
+static CD::PlayerBench * bench = nullptr;
+
+static void print_histogram(const char * what, const ATAPI::WaitHistogram& h) {
+    char msg[160];
+    snprintf(msg, sizeof(msg), "%s: %u times, avg %u ms, min %u ms, max %u ms", what, h.count, h.average_us() / 1000, h.min_us / 1000, h.max_us / 1000);
+    TEST_MESSAGE(msg);
+}
+
+void setUp() {
+    // The device behind the bench has a queue task that can't be stopped, so it's the one bench for all of the tests
+    if(bench == nullptr) bench = new CD::PlayerBench(nullptr, 1);
+}
+
+void tearDown() {}
+
+void test_load_time() {
+    bench->measure_load(LOAD_ROUNDS);
+    const ATAPI::WaitHistogram& h = bench->get_load_times();
+    print_histogram("Tray in to track list", h);
+    TEST_ASSERT_EQUAL_INT(LOAD_ROUNDS, h.count);
+    // the virtual drive takes 2 s to spin up, the rest is the player
+    TEST_ASSERT_LESS_THAN(3000000, h.max_us);
+}
+
+void test_command_reactions() {
+    bench->measure_commands(COMMAND_ROUNDS);
+    for(auto& kv: bench->get_reactions()) {
+        print_histogram(kv.first.c_str(), kv.second);
+        // every command got where it should within the bench's timeout
+        if(kv.first != "NEXT_TRACK") TEST_ASSERT_EQUAL_INT(COMMAND_ROUNDS, kv.second.count);
+    }
+    TEST_ASSERT_LESS_THAN(1000000, bench->get_reactions().at("PLAY").max_us);
+    TEST_ASSERT_LESS_THAN(1000000, bench->get_reactions().at("PAUSE").max_us);
+    TEST_ASSERT_LESS_THAN(1000000, bench->get_reactions().at("STOP").max_us);
+}
+
+void test_fuzz_never_stalls() {
+    bench->fuzz(FUZZ_SEED, FUZZ_STEPS);
+    bench->log_report();
+    TEST_ASSERT_EQUAL_INT(0, bench->get_stall_count());
+    TEST_ASSERT_EQUAL_INT(0, bench->get_wedge_count());
+}
+
+int main(int argc, char ** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_load_time);
+    RUN_TEST(test_command_reactions);
+    RUN_TEST(test_fuzz_never_stalls);
+    return UNITY_END();
+}
@@ -0,0 +1,142 @@
+#include <unity.h>
+#include <host_prefs.h>
+// Every source has its own LOG_TAG, so they need different names once compiled in together
+#define LOG_TAG TSI2C_LOG_TAG
+#include "../../lib/espercore/src/thread_safe_i2c.cpp"
+#undef LOG_TAG
+#define LOG_TAG IDE_LOG_TAG
+#include "../../lib/espercore/src/ide.cpp"
+#undef LOG_TAG
+#include "../../lib/espercdp/src/utils.cpp"
+#define LOG_TAG CKSUM_LOG_TAG
+#include "../../lib/espercdp/src/checksum.cpp"
+#undef LOG_TAG
+#define LOG_TAG WAITPROF_LOG_TAG
+#include "../../lib/espercdp/src/wait_profile.cpp"
+#undef LOG_TAG
+#define LOG_TAG RECOVERY_LOG_TAG
+#include "../../lib/espercdp/src/recovery.cpp"
+#undef LOG_TAG
+#define LOG_TAG VCDROM_LOG_TAG
+#include "../../lib/espercdp/src/virtual_drive.cpp"
+#undef LOG_TAG
+#define LOG_TAG ATAPI_LOG_TAG
+#include "../../lib/espercdp/src/atapi.cpp"
+#undef LOG_TAG
+#define LOG_TAG CDTEXT_LOG_TAG
+#include "../../lib/espercdp/src/metadata/cdtext.cpp"
+#undef LOG_TAG
+#define LOG_TAG EVENTS_LOG_TAG
+#include "../../lib/espercdp/src/player_events.cpp"
+#undef LOG_TAG
+#define LOG_TAG POWER_LOG_TAG
+#include "../../lib/espercdp/src/power_manager.cpp"
+#undef LOG_TAG
+#define LOG_TAG PROGRAM_LOG_TAG
+#include "../../lib/espercdp/src/program.cpp"
+#undef LOG_TAG
+#define LOG_TAG RESUME_LOG_TAG
+#include "../../lib/espercdp/src/resume_store.cpp"
+#undef LOG_TAG
+#define LOG_TAG SHUFFLE_LOG_TAG
+#include "../../lib/espercdp/src/shuffle_planner.cpp"
+#undef LOG_TAG
+#define LOG_TAG TRANSITION_LOG_TAG
+#include "../../lib/espercdp/src/transition_scheduler.cpp"
+#undef LOG_TAG
+#define LOG_TAG IDXSCAN_LOG_TAG
+#define LBA_OFFSET IDXSCAN_LBA_OFFSET
+#include "../../lib/espercdp/src/index_scanner.cpp"
+#undef LBA_OFFSET
+#undef LOG_TAG
+#include "../../lib/espercdp/src/player.cpp"
+
+// The rest of the MusicBrainz provider needs the network, while the program store only wants a file name out of it
+const std::string CD::MusicBrainzMetadataProvider::generate_id(const CD::Album& album) {
+    return "transition";
+}
+
+using ATAPI::VirtualDrive;
+using ATAPI::VirtualDisc;
+using CD::Player;
+
+static const int TRACK_COUNT = 8;
+static const int TRACK_FRAMES = 5 * MSF::FRAMES_IN_SECOND;
+/// @brief None of them next to each other on the disc, so that every step is a PLAY AUDIO of its own
+static const std::vector<uint8_t> PROGRAM = { 5, 2, 7, 1, 4, 8 };
+
+static ATAPI::Device * cdrom;
+static VirtualDrive * vdrive;
+static CD::MetadataProvider meta;
+static Player * player;
+
+/// @brief Wait on the virtual clock for the condition to come true
+static bool wait_until(std::function<bool()> condition, uint32_t timeout_ms) {
+    const int64_t deadline = esp_timer_get_time() + (int64_t) timeout_ms * 1000;
+    while(esp_timer_get_time() < deadline) {
+        if(condition()) return true;
+        vTaskDelay(1);
+    }
+    return false;
+}
+
+/// @brief Play the whole program from a stopped player
+static void play_program() {
+    vdrive = new VirtualDrive();
+    vdrive->insert_disc(0, VirtualDisc::silent(TRACK_COUNT, TRACK_FRAMES));
+    cdrom = new ATAPI::Device(vdrive);
+    cdrom->reset();
+    player = new Player(cdrom, &meta);
+    TEST_ASSERT_TRUE(wait_until([]() { return player->get_status() == Player::State::STOP; }, 30000));
+
+    player->set_program(PROGRAM);
+    player->set_play_mode(Player::PlayMode::PLAYMODE_PROGRAM);
+    vdrive->reset_play_gaps();
+    player->do_command(Player::Command::PLAY);
+    TEST_ASSERT_TRUE(wait_until([]() { return player->get_status() == Player::State::PLAY; }, 10000));
+    // The whole program and then some
+    TEST_ASSERT_TRUE(wait_until([]() { return player->get_status() == Player::State::STOP; }, PROGRAM.size() * TRACK_FRAMES * 1000 / MSF::FRAMES_IN_SECOND + 30000));
+}
+
+static void print_gaps(const char * what) {
+    const ATAPI::WaitHistogram& h = vdrive->get_play_gaps();
+    char msg[160];
+    snprintf(msg, sizeof(msg), "%s: %u transitions, gap avg %u ms, min %u ms, max %u ms, %u frames cut off", what, h.count, h.average_us() / 1000, h.min_us / 1000, h.max_us / 1000, vdrive->get_cut_frames());
+    TEST_MESSAGE(msg);
+}
+
+void setUp() {}
+
+void tearDown() {
+    delete player;
+    // The device's queue task has no way to be stopped, so the device and the drive behind it stay around
+}
+
+void test_gap_with_poll_cycle() {
+    // Without its timer the scheduler never arms, which leaves the next PLAY to the poll noticing the drive stopped
+    HostTimers::fail_next_create = 1;
+    play_program();
+    print_gaps("Poll cycle");
+    TEST_ASSERT_EQUAL_INT(PROGRAM.size() - 1, vdrive->get_play_gaps().count);
+    // the poll has to see the drive stopped first, and only then does the seek start
+    TEST_ASSERT_TRUE(vdrive->get_play_gaps().min_us > vdrive->latencies.seek);
+    TEST_ASSERT_EQUAL_INT(0, vdrive->get_cut_frames());
+}
+
+void test_gap_with_scheduler() {
+    play_program();
+    print_gaps("TransitionScheduler");
+    const ATAPI::WaitHistogram& h = vdrive->get_play_gaps();
+    TEST_ASSERT_EQUAL_INT(PROGRAM.size() - 1, h.count);
+    // nothing left of the gap but the seek, give or take a frame
+    TEST_ASSERT_TRUE(h.max_us <= vdrive->latencies.seek + 1000000 / MSF::FRAMES_IN_SECOND);
+    // and no more lost of each range than the lead asks for
+    TEST_ASSERT_TRUE(vdrive->get_cut_frames() <= h.count * TRANSITION_LEAD_FRAMES);
+}
+
+int main(int argc, char ** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_gap_with_poll_cycle);
+    RUN_TEST(test_gap_with_scheduler);
+    return UNITY_END();
+}